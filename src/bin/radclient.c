@@ -1467,6 +1467,7 @@ int main(int argc, char **argv)
 	int		c;
 	char		const *raddb_dir = RADDBDIR;
 	char		const *dict_dir = DICTDIR;
+	fr_dict_gctx_t	*dict_gctx;
 	char		filesecret[256];
 	FILE		*fp;
 	int		do_summary = false;
@@ -1733,11 +1734,17 @@ int main(int argc, char **argv)
 		fr_exit_now(EXIT_FAILURE);
 	}
 
-	if (!fr_dict_global_ctx_init(NULL, true, dict_dir)) {
+	dict_gctx = fr_dict_global_ctx_init(NULL, true, dict_dir);
+	if (!dict_gctx) {
 		fr_perror("radclient");
 		fr_exit_now(EXIT_FAILURE);
 	}
 
+	/*
+	 *	We only use a few vendors, read the rest on demand.
+	 */
+	fr_dict_global_ctx_lazy_vendors(dict_gctx, true);
+
 	if (fr_radius_global_init() < 0) {
 		fr_perror("radclient");
 		fr_exit_now(EXIT_FAILURE);
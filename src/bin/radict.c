@@ -64,6 +64,7 @@ static void usage(void)
 	fprintf(stderr, "  -x               Debugging mode.\n");
 	fprintf(stderr, "  -c               Print out in CSV format.\n");
 	fprintf(stderr, "  -H               Show the headers of each field.\n");
+	fprintf(stderr, "  -v               Show where time was spent loading dictionaries.\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Very simple interface to extract attribute definitions from FreeRADIUS dictionaries\n");
 }
@@ -147,6 +148,85 @@ static int load_dicts(char const *dict_dir, char const *protocol)
 	return 0;
 }
 
+static inline double delta_to_msec(fr_time_delta_t delta)
+{
+	return (double)fr_time_delta_unwrap(delta) / (NSEC / MSEC);
+}
+
+static void load_stats_print_line(char const *name, fr_dict_load_stats_t const *stats)
+{
+	fr_time_delta_t	sum;
+
+	sum = fr_time_delta_add(fr_time_delta_add(stats->read, stats->define),
+				fr_time_delta_add(stats->fixup, stats->init));
+
+	switch (output_format) {
+	case RADICT_OUT_CSV:
+		printf("%s,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+		       name, stats->files, stats->lines,
+		       delta_to_msec(stats->read), delta_to_msec(stats->define), delta_to_msec(stats->fixup), delta_to_msec(stats->init), delta_to_msec(sum));
+		break;
+
+	case RADICT_OUT_FANCY:
+	default:
+		printf("%-16s %6u %6u %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+		       name, stats->files, stats->lines,
+		       delta_to_msec(stats->read), delta_to_msec(stats->define), delta_to_msec(stats->fixup), delta_to_msec(stats->init), delta_to_msec(sum));
+	}
+}
+
+/** Print the load statistics for a single dictionary, and add them to a running total
+ *
+ */
+static void load_stats_print_dict(fr_dict_load_stats_t *total, fr_dict_t const *dict)
+{
+	fr_dict_load_stats_t const *stats = fr_dict_load_stats(dict);
+
+	load_stats_print_line(fr_dict_root(dict)->name, stats);
+
+	total->files += stats->files;
+	total->lines += stats->lines;
+	total->read = fr_time_delta_add(total->read, stats->read);
+	total->define = fr_time_delta_add(total->define, stats->define);
+	total->fixup = fr_time_delta_add(total->fixup, stats->fixup);
+	total->init = fr_time_delta_add(total->init, stats->init);
+}
+
+/** Print a breakdown of where time was spent loading each dictionary
+ *
+ * Includes dictionaries which were only loaded because they were referenced
+ * by another.
+ */
+static void load_stats_print(void)
+{
+	fr_dict_global_ctx_iter_t	iter;
+	fr_dict_t			*dict;
+	fr_dict_load_stats_t		total = { .files = 0 };
+
+	switch (output_format) {
+	case RADICT_OUT_CSV:
+		printf("Dictionary,Files,Lines,Read (ms),Define (ms),Fixup (ms),Init (ms),Total (ms)\n");
+		break;
+
+	case RADICT_OUT_FANCY:
+	default:
+		printf("%-16s %6s %6s %10s %10s %10s %10s %10s\n",
+		       "Dictionary", "Files", "Lines", "Read (ms)", "Define(ms)", "Fixup (ms)", "Init (ms)", "Total (ms)");
+	}
+
+	load_stats_print_dict(&total, fr_dict_internal());
+
+	for (dict = fr_dict_global_ctx_iter_init(&iter);
+	     dict;
+	     dict = fr_dict_global_ctx_iter_next(&iter)) {
+		if (dict == fr_dict_internal()) continue;
+
+		load_stats_print_dict(&total, dict);
+	}
+
+	load_stats_print_line("total", &total);
+}
+
 static void da_print_info_td(fr_dict_t const *dict, fr_dict_attr_t const *da)
 {
 	char 			oid_str[512];
@@ -293,6 +373,7 @@ int main(int argc, char *argv[])
 	bool			found = false;
 	bool			export = false;
 	bool			file_export = false;
+	bool			show_load_stats = false;
 	char const		*protocol = NULL;
 
 	TALLOC_CTX		*autofree;
@@ -315,7 +396,7 @@ int main(int argc, char *argv[])
 
 	fr_debug_lvl = 1;
 
-	while ((c = getopt(argc, argv, "cfED:p:VxhH")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "cfED:p:VvxhH")) != -1) switch (c) {
 		case 'c':
 			output_format = RADICT_OUT_CSV;
 			break;
@@ -344,6 +425,10 @@ int main(int argc, char *argv[])
 			print_values = true;
 			break;
 
+		case 'v':
+			show_load_stats = true;
+			break;
+
 		case 'x':
 			fr_log_fp = stdout;
 			fr_debug_lvl++;
@@ -393,6 +478,11 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
+	if (show_load_stats) {
+		load_stats_print();
+		found = true;
+	}
+
 	if (print_headers) switch(output_format) {
 		case RADICT_OUT_CSV:
 			printf("Dictionary,OID,Attribute,ID,Type,Flags\n");
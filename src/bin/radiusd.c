@@ -135,6 +135,8 @@ static int thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el, UNUSED void
 	if (virtual_servers_thread_instantiate(ctx, el) < 0) return -1;
 
 	if (xlat_thread_instantiate(ctx, el) < 0) return -1;
+
+	if (unlang_offload_thread_instantiate(ctx, el) < 0) return -1;
 #ifdef WITH_TLS
 	if (fr_openssl_thread_init(main_config->openssl_async_pool_init,
 				   main_config->openssl_async_pool_max) < 0) return -1;
@@ -147,6 +149,8 @@ static int thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el, UNUSED void
  */
 static void thread_detach(UNUSED void *uctx)
 {
+	unlang_offload_thread_detach();
+
 	virtual_servers_thread_detach();
 
 	modules_rlm_thread_detach();
@@ -601,6 +605,15 @@ int main(int argc, char *argv[])
 	 */
 	if (main_config_init(config) < 0) EXIT_WITH_FAILURE;
 
+	/*
+	 *  Switch clocks before any threads are started, and
+	 *  before anything has had much of a chance to read it.
+	 */
+	if (fr_time_source_set(config->time_source) < 0) {
+		PERROR("Failed setting time_source");
+		EXIT_WITH_FAILURE;
+	}
+
 	if (!config->suppress_secrets) default_log.suppress_secrets = false;
 
 	/*
@@ -792,6 +805,19 @@ int main(int argc, char *argv[])
 	 */
 	if (unlang_global_init() < 0) EXIT_WITH_FAILURE;
 
+	/*
+	 *	Modules which are marked as safe to do so are
+	 *	instantiated in parallel.  In single threaded
+	 *	mode everything is instantiated serially.
+	 *
+	 *	Checking the configuration follows the same
+	 *	path as starting the server normally.
+	 */
+	if (config->spawn_workers || check_config) {
+		modules_rlm_instantiate_threads_set(config->max_instantiate_threads ?
+						    config->max_instantiate_threads : config->max_workers);
+	}
+
 	if (server_init(config->root_cs) < 0) EXIT_WITH_FAILURE;
 
 	/*
@@ -822,6 +848,11 @@ int main(int argc, char *argv[])
 		EXIT_WITH_FAILURE;
 	}
 
+	/*
+	 *	Allow clients to be added and removed without a HUP.
+	 */
+	if (client_runtime_init(main_loop_event_list()) < 0) EXIT_WITH_FAILURE;
+
 	/*
 	 *	Start the network / worker threads.
 	 */
@@ -839,6 +870,37 @@ int main(int argc, char *argv[])
 #define COPY(_x) schedule->worker._x = config->_x
 		COPY(max_requests);
 		COPY(max_request_time);
+		COPY(talloc_pool_size);
+		COPY(admission_target);
+		COPY(admission_interval);
+		COPY(admission_reject);
+		COPY(work_stealing);
+
+		memcpy(schedule->worker.priority, config->priority, sizeof(schedule->worker.priority));
+		memcpy(schedule->network.priority, config->priority, sizeof(schedule->network.priority));
+
+		schedule->network_cpus = config->affinity_network_cpus;
+		schedule->worker_cpus = config->affinity_worker_cpus;
+		schedule->per_thread = config->affinity_per_thread;
+		schedule->numa = config->affinity_numa;
+
+		if (fr_ring_buffer_huge_pages_set(config->huge_pages) < 0) {
+			PERROR("Failed setting huge_pages");
+			EXIT_WITH_FAILURE;
+		}
+
+		/*
+		 *	Single server mode runs everything in the
+		 *	one thread, including offloaded functions.
+		 */
+		if (unlang_offload_init(&(unlang_offload_config_t){
+				.num_threads = config->spawn_workers ? config->offload_threads : 0,
+				.max_queued = config->offload_max_queued,
+				.full = config->offload_full
+			}) < 0) {
+			PERROR("Failed creating the offload pool");
+			EXIT_WITH_FAILURE;
+		}
 
 		/*
 		 *	Single server mode: use the global event list.
@@ -959,7 +1021,10 @@ int main(int argc, char *argv[])
 	 *	Prevent anything from modifying the dictionaries
 	 *	they're now immutable.
 	 */
-	fr_dict_global_ctx_read_only();
+	if (fr_dict_global_ctx_read_only() < 0) {
+		fr_perror("%s", program);
+		EXIT_WITH_FAILURE;
+	}
 
 	/*
 	 *  Protect global memory - If something attempts
@@ -1105,6 +1170,8 @@ cleanup:
 	 */
 	fr_atexit_thread_trigger_all();
 
+	unlang_offload_free();
+
 	server_free();
 
 #ifdef WITH_TLS
@@ -2331,6 +2331,7 @@ int main(int argc, char *argv[])
 	fr_event_timer_t const	*timeout_ev = NULL;
 	char const		*raddb_dir = RADDBDIR;
 	char const		*dict_dir = DICTDIR;
+	fr_dict_gctx_t		*dict_gctx;
 	TALLOC_CTX		*autofree;
 
 	rs_stats_t		*stats;
@@ -2710,11 +2711,17 @@ int main(int argc, char *argv[])
 							 conf->pcap_filter, conf->pcap_filter);
 	}
 
-	if (!fr_dict_global_ctx_init(NULL, true, dict_dir)) {
+	dict_gctx = fr_dict_global_ctx_init(NULL, true, dict_dir);
+	if (!dict_gctx) {
 		fr_perror("radsniff");
 		fr_exit_now(EXIT_FAILURE);
 	}
 
+	/*
+	 *	Only the vendors seen in captured packets are needed.
+	 */
+	fr_dict_global_ctx_lazy_vendors(dict_gctx, true);
+
 	if (fr_dict_autoload(radsniff_dict) < 0) {
 		fr_perror("radsniff");
 		ret = 64;
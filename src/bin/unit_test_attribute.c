@@ -3636,6 +3636,7 @@ int main(int argc, char *argv[])
 	int			ret = EXIT_SUCCESS;
 	TALLOC_CTX		*autofree;
 	TALLOC_CTX		*thread_ctx;
+	fr_dict_gctx_t		*dict_gctx;
 	bool			exit_now = false;
 
 	command_config_t	config = {
@@ -3777,12 +3778,18 @@ int main(int argc, char *argv[])
 		EXIT_WITH_FAILURE;
 	}
 
-	config.dict_gctx = fr_dict_global_ctx_init(NULL, true, config.dict_dir);
-	if (!config.dict_gctx) {
+	dict_gctx = fr_dict_global_ctx_init(NULL, true, config.dict_dir);
+	if (!dict_gctx) {
 		fr_perror("unit_test_attribute");
 		EXIT_WITH_FAILURE;
 	}
 
+	/*
+	 *	Each test only touches a handful of vendors.
+	 */
+	fr_dict_global_ctx_lazy_vendors(dict_gctx, true);
+	config.dict_gctx = dict_gctx;
+
 	if (fr_dict_internal_afrom_file(&config.dict, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) {
 		fr_perror("unit_test_attribute");
 		EXIT_WITH_FAILURE;
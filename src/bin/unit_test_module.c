@@ -927,6 +927,12 @@ int main(int argc, char *argv[])
 		client_add(NULL, client);
 	}
 
+	/*
+	 *	Modules are only instantiated in parallel if the
+	 *	test configuration explicitly asks for it.
+	 */
+	modules_rlm_instantiate_threads_set(config->max_instantiate_threads);
+
 	if (server_init(config->root_cs) < 0) EXIT_WITH_FAILURE;
 
 	vs = virtual_server_find("default");
@@ -960,6 +966,13 @@ int main(int argc, char *argv[])
 	if (xlat_thread_instantiate(thread_ctx, el) < 0) EXIT_WITH_FAILURE;
 	unlang_thread_instantiate(thread_ctx);
 
+	if (unlang_offload_init(&(unlang_offload_config_t){
+			.num_threads = config->offload_threads,
+			.max_queued = config->offload_max_queued,
+			.full = config->offload_full
+		}) < 0) EXIT_WITH_FAILURE;
+	if (unlang_offload_thread_instantiate(thread_ctx, el) < 0) EXIT_WITH_FAILURE;
+
 	/*
 	 *  Set the panic action (if required)
 	 */
@@ -1205,6 +1218,8 @@ cleanup:
 	 */
 	fr_atexit_thread_trigger_all();
 
+	unlang_offload_free();
+
 	server_free();
 
 	/*
@@ -56,6 +56,66 @@ typedef int (*fr_app_open_t)(void *instance, fr_schedule_t *sc, CONF_SECTION *cs
  */
 typedef int (*fr_app_priority_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
 
+/** Answer a packet in the network thread, without sending it to a worker
+ *
+ * Called after duplicate detection for packets from a known client,
+ * but only if the listener has set #fr_io_instance_t.app_reply, and
+ * the first octet of the packet matches #fr_io_instance_t.app_reply_code.
+ * Other packets never see the cost of calculating the load.
+ *
+ * @param[in] instance	of the #fr_app_t.
+ * @param[in] ctx	to allocate the reply in.
+ * @param[out] reply	the encoded reply.
+ * @param[in] client	which sent the packet.
+ * @param[in] load	of the workers of the network thread which read the packet.
+ * @param[in] buffer	raw packet.
+ * @param[in] buflen	length of the packet.
+ * @return
+ *	- <0 on error, drop the packet.
+ *	- 0 the packet should be sent to a worker as normal.
+ *	- >0 the length of the reply.
+ */
+typedef ssize_t (*fr_app_reply_t)(void const *instance, TALLOC_CTX *ctx, uint8_t **reply,
+				  fr_client_t const *client, fr_io_load_t const *load,
+				  uint8_t *buffer, size_t buflen);
+
+/** Decode a packet in the network thread, instead of in a worker
+ *
+ * The decoded pairs are written after the packet in the same message,
+ * in the internal format, which is flat and doesn't contain pointers.
+ * The worker finds them in request->async->decoded, and the #fr_io_decode_t
+ * callback adopts them instead of decoding the packet again.
+ *
+ * Errors aren't reported here.  The packet is left for the worker to
+ * decode, which will log why it failed.
+ *
+ * @param[in] instance		of the #fr_app_t.
+ * @param[in] packet_ctx	from the #fr_app_io_t read.
+ * @param[out] out		where the pairs should be written.
+ * @param[in] outlen		room available in out.
+ * @param[in] buffer		raw packet.
+ * @param[in] buflen		length of the packet.
+ * @return
+ *	- 0 the packet should be decoded by the worker.
+ *	- >0 the length of the pairs written to out.
+ */
+typedef size_t (*fr_app_predecode_t)(void const *instance, void *packet_ctx, uint8_t *out, size_t outlen,
+				     uint8_t *buffer, size_t buflen);
+
+/** Set the reply for a request which a worker is shedding
+ *
+ * Called instead of running the virtual server, when the worker is
+ * overloaded, and has been configured to reject requests rather than
+ * discard them.
+ *
+ * @param[in] instance	of the #fr_app_t.
+ * @param[in] request	being shed.
+ * @return
+ *	- 0 the reply code has been set, and the reply should be sent.
+ *	- <0 the request can't be rejected, and should be discarded.
+ */
+typedef int (*fr_app_shed_t)(void const *instance, request_t *request);
+
 /** Called by the network thread to pass an event list for the module to use for timer events
  */
 typedef void (*fr_app_event_list_set_t)(fr_listen_t *li, fr_event_list_t *el, void *nr);
@@ -88,6 +148,15 @@ typedef struct {
 							///< to all #fr_app_io_t can be performed by the #fr_app_t.
 
 	fr_app_priority_get_t		priority;	//!< Assign a priority to the packet.
+
+	fr_app_reply_t			reply;		//!< Answer a packet in the network thread.
+							///< May be NULL.
+
+	fr_app_shed_t			shed;		//!< Reject a request the worker is shedding.
+							///< May be NULL.
+
+	fr_app_predecode_t		predecode;	//!< Decode a packet in the network thread.
+							///< May be NULL.
 } fr_app_t;
 
 /** Public structure describing an application (protocol) specialisation
@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <stdint.h>
 #include <stdalign.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include <freeradius-devel/autoconf.h>
 #include <freeradius-devel/io/atomic_queue.h>
@@ -52,32 +53,27 @@ typedef struct CC_HINT(packed, aligned(CACHE_LINE_SIZE)) {
  *
  */
 struct fr_atomic_queue_s {
-	alignas(CACHE_LINE_SIZE) atomic_int64_t		head;		//!< Head, aligned bytes to ensure
-									///< it's in a different cache line to tail
-									///< to reduce memory contention.
-	atomic_int64_t					tail;
-
 	size_t						size;
 
+	bool						spsc;		//!< Only one thread pushes, and only one
+									///< thread pops.  The entries are packed
+									///< into "slot", and have no sequence numbers.
+
+	void						**slot;		//!< Entries for SPSC queues.
+
 	void						*chunk;		//!< To pass to free. The non-aligned address.
 
+	alignas(CACHE_LINE_SIZE) atomic_int64_t		head;		//!< Head, aligned bytes to ensure
+									///< it's in a different cache line to tail
+									///< to reduce memory contention.
+	alignas(CACHE_LINE_SIZE) atomic_int64_t		tail;
+
 	alignas(CACHE_LINE_SIZE) fr_atomic_queue_entry_t entry[];	//!< The entry array, also aligned
 									///< to ensure it's not in the same cache
-									///< line as tail and size.
+									///< line as tail.
 };
 
-/** Create fixed-size atomic queue
- *
- * @note the queue must be freed explicitly by the ctx being freed, or by using
- * the #fr_atomic_queue_free function.
- *
- * @param[in] ctx	The talloc ctx to allocate the queue in.
- * @param[in] size	The number of entries in the queue.
- * @return
- *     - NULL on error.
- *     - fr_atomic_queue_t *, a pointer to the allocated and initialized queue.
- */
-fr_atomic_queue_t *fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size)
+static fr_atomic_queue_t *atomic_queue_alloc(TALLOC_CTX *ctx, size_t size, bool spsc)
 {
 	size_t			i;
 	int64_t			seq;
@@ -94,24 +90,35 @@ fr_atomic_queue_t *fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size)
 	 *	name of the data, too.
 	 */
 	chunk = talloc_aligned_array(ctx, (void **)&aq, CACHE_LINE_SIZE,
-				     sizeof(*aq) + (size) * sizeof(aq->entry[0]));
+				     sizeof(*aq) + (size) * (spsc ? sizeof(aq->slot[0]) : sizeof(aq->entry[0])));
 	if (!chunk) return NULL;
 	aq->chunk = chunk;
 
 	talloc_set_name_const(chunk, "fr_atomic_queue_t");
 
-	/*
-	 *	Initialize the array.  Data is NULL, and indexes are
-	 *	the array entry number.
-	 */
-	for (i = 0; i < size; i++) {
-		seq = i;
+	aq->size = size;
+	aq->spsc = spsc;
 
-		aq->entry[i].data = NULL;
-		store(aq->entry[i].seq, seq);
-	}
+	if (spsc) {
+		/*
+		 *	Only the head and tail are shared, so the
+		 *	entries can be packed together.
+		 */
+		aq->slot = (void **) aq->entry;
+		memset(aq->slot, 0, size * sizeof(aq->slot[0]));
 
-	aq->size = size;
+	} else {
+		/*
+		 *	Initialize the array.  Data is NULL, and
+		 *	indexes are the array entry number.
+		 */
+		for (i = 0; i < size; i++) {
+			seq = i;
+
+			aq->entry[i].data = NULL;
+			store(aq->entry[i].seq, seq);
+		}
+	}
 
 	/*
 	 *	Set the head / tail indexes, and force other CPUs to
@@ -124,6 +131,83 @@ fr_atomic_queue_t *fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size)
 	return aq;
 }
 
+/** Create fixed-size atomic queue
+ *
+ * @note the queue must be freed explicitly by the ctx being freed, or by using
+ * the #fr_atomic_queue_free function.
+ *
+ * @param[in] ctx	The talloc ctx to allocate the queue in.
+ * @param[in] size	The number of entries in the queue.
+ * @return
+ *     - NULL on error.
+ *     - fr_atomic_queue_t *, a pointer to the allocated and initialized queue.
+ */
+fr_atomic_queue_t *fr_atomic_queue_alloc(TALLOC_CTX *ctx, size_t size)
+{
+	return atomic_queue_alloc(ctx, size, false);
+}
+
+/** Create fixed-size atomic queue with one producer and one consumer
+ *
+ * Each entry in a normal queue has its own cache line, so that
+ * producers and consumers working on neighbouring entries don't
+ * contend.  When only one thread pushes, and only one thread pops,
+ * the entries don't need sequence numbers, and are packed together.
+ *
+ * @note Calling push or pop on the queue from more than one thread
+ * at a time will corrupt it.
+ *
+ * @param[in] ctx	The talloc ctx to allocate the queue in.
+ * @param[in] size	The number of entries in the queue.
+ * @return
+ *     - NULL on error.
+ *     - fr_atomic_queue_t *, a pointer to the allocated and initialized queue.
+ */
+fr_atomic_queue_t *fr_atomic_queue_alloc_spsc(TALLOC_CTX *ctx, size_t size)
+{
+	return atomic_queue_alloc(ctx, size, true);
+}
+
+/** Push pointers into an SPSC queue
+ *
+ */
+static inline size_t atomic_queue_spsc_push(fr_atomic_queue_t *aq, void * const *data, size_t num)
+{
+	int64_t	head, tail;
+	size_t	i, room;
+
+	head = load(aq->head);
+	tail = aquire(aq->tail);	/* The consumer has finished with the entries before tail */
+
+	room = aq->size - (head - tail);
+	if (num > room) num = room;
+
+	for (i = 0; i < num; i++) aq->slot[(head + i) % aq->size] = data[i];
+
+	store(aq->head, head + num);
+	return num;
+}
+
+/** Pop pointers from an SPSC queue
+ *
+ */
+static inline size_t atomic_queue_spsc_pop(fr_atomic_queue_t *aq, void **data, size_t num)
+{
+	int64_t	head, tail;
+	size_t	i, used;
+
+	tail = load(aq->tail);
+	head = aquire(aq->head);	/* The producer has written the entries before head */
+
+	used = head - tail;
+	if (num > used) num = used;
+
+	for (i = 0; i < num; i++) data[i] = aq->slot[(tail + i) % aq->size];
+
+	store(aq->tail, tail + num);
+	return num;
+}
+
 /** Free an atomic queue if it's not freed by ctx
  *
  * This function is needed because the atomic queue memory
@@ -152,6 +236,8 @@ bool fr_atomic_queue_push(fr_atomic_queue_t *aq, void *data)
 
 	if (!data) return false;
 
+	if (aq->spsc) return (atomic_queue_spsc_push(aq, &data, 1) == 1);
+
 	head = load(aq->head);
 
 	/*
@@ -219,6 +305,8 @@ bool fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data)
 
 	if (!p_data) return false;
 
+	if (aq->spsc) return (atomic_queue_spsc_pop(aq, p_data, 1) == 1);
+
 	tail = load(aq->tail);
 
 	for (;;) {
@@ -262,6 +350,122 @@ bool fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data)
 	return true;
 }
 
+/** Push several pointers into the atomic queue
+ *
+ * The entries are reserved with one update of the queue head, instead
+ * of one update per entry.  If there isn't room for all of them, as
+ * many as fit are pushed.
+ *
+ * @param[in] aq	The atomic queue to add data to.
+ * @param[in] data	to push.  None of the pointers may be NULL.
+ * @param[in] num	number of pointers in data.
+ * @return the number of pointers pushed, from the start of data.
+ */
+size_t fr_atomic_queue_push_bulk(fr_atomic_queue_t *aq, void * const *data, size_t num)
+{
+	int64_t			head;
+	size_t			i, avail;
+
+	if (!num) return 0;
+
+	if (aq->spsc) return atomic_queue_spsc_push(aq, data, num);
+
+	head = load(aq->head);
+
+	for (;;) {
+		int64_t seq = 0;
+
+		/*
+		 *	Count how many entries after the head are
+		 *	free.  They can only be taken by whoever moves
+		 *	the head past them.
+		 */
+		for (avail = 0; avail < num; avail++) {
+			seq = aquire(aq->entry[(head + avail) % aq->size].seq);
+			if (seq != (int64_t) (head + avail)) break;
+		}
+
+		if (!avail) {
+			/*
+			 *	head is larger than the current entry, the queue is full.
+			 */
+			if ((seq - head) < 0) return 0;
+
+			head = load(aq->head);
+			continue;
+		}
+
+		if (atomic_compare_exchange_strong_explicit(&aq->head, &head, head + avail,
+							    memory_order_release, memory_order_relaxed)) break;
+	}
+
+	for (i = 0; i < avail; i++) {
+		fr_atomic_queue_entry_t *entry = &aq->entry[(head + i) % aq->size];
+
+		entry->data = data[i];
+		store(entry->seq, head + i + 1);
+	}
+
+	return avail;
+}
+
+/** Pop several pointers from the atomic queue
+ *
+ * The entries are claimed with one update of the queue tail, instead
+ * of one update per entry.
+ *
+ * @param[in] aq	the atomic queue to retrieve data from.
+ * @param[out] data	where to write the pointers.
+ * @param[in] num	the maximum number of pointers to pop.
+ * @return the number of pointers popped, which is 0 if the queue is empty.
+ */
+size_t fr_atomic_queue_pop_bulk(fr_atomic_queue_t *aq, void **data, size_t num)
+{
+	int64_t			tail;
+	size_t			i, avail;
+
+	if (!num) return 0;
+
+	if (aq->spsc) return atomic_queue_spsc_pop(aq, data, num);
+
+	tail = load(aq->tail);
+
+	for (;;) {
+		int64_t seq = 0;
+
+		/*
+		 *	Count how many entries after the tail have
+		 *	been written.
+		 */
+		for (avail = 0; avail < num; avail++) {
+			seq = aquire(aq->entry[(tail + avail) % aq->size].seq);
+			if (seq != (int64_t) (tail + avail + 1)) break;
+		}
+
+		if (!avail) {
+			/*
+			 *	The queue is empty.
+			 */
+			if ((seq - (tail + 1)) < 0) return 0;
+
+			tail = load(aq->tail);
+			continue;
+		}
+
+		if (atomic_compare_exchange_strong_explicit(&aq->tail, &tail, tail + avail,
+							    memory_order_release, memory_order_relaxed)) break;
+	}
+
+	for (i = 0; i < avail; i++) {
+		fr_atomic_queue_entry_t *entry = &aq->entry[(tail + i) % aq->size];
+
+		data[i] = entry->data;
+		store(entry->seq, tail + i + aq->size);
+	}
+
+	return avail;
+}
+
 size_t fr_atomic_queue_size(fr_atomic_queue_t *aq)
 {
 	return aq->size;
@@ -304,10 +508,15 @@ void fr_atomic_queue_debug(fr_atomic_queue_t *aq, FILE *fp)
 	int64_t head, tail;
 
 	head = load(aq->head);
-	tail = load(aq->head);
+	tail = load(aq->tail);
 
-	fprintf(fp, "AQ %p size %zu, head %" PRId64 ", tail %" PRId64 "\n",
-		aq, aq->size, head, tail);
+	fprintf(fp, "AQ %p size %zu, head %" PRId64 ", tail %" PRId64 "%s\n",
+		aq, aq->size, head, tail, aq->spsc ? ", spsc" : "");
+
+	if (aq->spsc) {
+		for (i = 0; i < aq->size; i++) fprintf(fp, "\t[%zu] = { %p }\n", i, aq->slot[i]);
+		return;
+	}
 
 	for (i = 0; i < aq->size; i++) {
 		fr_atomic_queue_entry_t *entry;
@@ -45,6 +45,15 @@ typedef struct {
 	uint64_t	dropped;
 } fr_io_stats_t;
 
+/** How busy the workers of a network thread are
+ *
+ */
+typedef struct {
+	uint64_t	outstanding;		//!< Packets sent to workers, which have not been replied to.
+	uint32_t	num_workers;		//!< Number of workers.
+	uint32_t	num_blocked;		//!< Number of workers which are not accepting new packets.
+} fr_io_load_t;
+
 
 typedef struct fr_channel_s fr_channel_t;
 
@@ -355,6 +364,13 @@ typedef void (*fr_io_network_get_t)(int *ipproto, bool *dynamic_clients, fr_trie
 
 typedef char const *(*fr_io_name_t)(fr_listen_t *li);
 
+/** Print statistics kept by the IO path, in addition to the ones kept by the network thread
+ *
+ * @param[in] li		the listener.
+ * @param[in] fp		where the statistics are written.
+ */
+typedef void (*fr_io_stats_print_t)(fr_listen_t const *li, FILE *fp);
+
 
 #ifdef __cplusplus
 }
@@ -79,6 +79,8 @@ size_t channel_direction_len = NUM_ELEMENTS(channel_direction);
  */
 #define ATOMIC_QUEUE_SIZE (1024)
 
+#define RECV_BATCH_SIZE (16)		//!< Maximum number of messages taken from the queue at once.
+
 typedef enum fr_channel_signal_t {
 	FR_CHANNEL_SIGNAL_ERROR			= FR_CHANNEL_ERROR,
 	FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER	= FR_CHANNEL_DATA_READY_RESPONDER,
@@ -169,6 +171,13 @@ fr_table_num_sorted_t const channel_packet_priority[] = {
 };
 size_t channel_packet_priority_len = NUM_ELEMENTS(channel_packet_priority);
 
+char const *channel_priority_class_names[FR_CHANNEL_PRIORITY_CLASS_MAX] = {
+	[FR_CHANNEL_PRIORITY_CLASS_NOW]		= "now",
+	[FR_CHANNEL_PRIORITY_CLASS_HIGH]	= "high",
+	[FR_CHANNEL_PRIORITY_CLASS_NORMAL]	= "normal",
+	[FR_CHANNEL_PRIORITY_CLASS_LOW]		= "low"
+};
+
 
 /** Create a new channel
  *
@@ -197,13 +206,17 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *requestor, fr_con
 	ch->end[TO_RESPONDER].direction = TO_RESPONDER;
 	ch->end[TO_REQUESTOR].direction = TO_REQUESTOR;
 
-	ch->end[TO_RESPONDER].aq = fr_atomic_queue_alloc(ch, ATOMIC_QUEUE_SIZE);
+	/*
+	 *	Each queue is written only by one end, and read only
+	 *	by the other.
+	 */
+	ch->end[TO_RESPONDER].aq = fr_atomic_queue_alloc_spsc(ch, ATOMIC_QUEUE_SIZE);
 	if (!ch->end[TO_RESPONDER].aq) {
 		talloc_free(ch);
 		goto nomem;
 	}
 
-	ch->end[TO_REQUESTOR].aq = fr_atomic_queue_alloc(ch, ATOMIC_QUEUE_SIZE);
+	ch->end[TO_REQUESTOR].aq = fr_atomic_queue_alloc_spsc(ch, ATOMIC_QUEUE_SIZE);
 	if (!ch->end[TO_REQUESTOR].aq) {
 		talloc_free(ch);
 		goto nomem;
@@ -216,7 +229,7 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *requestor, fr_con
 	 *	Create the ring buffer for the requestor to send
 	 *	control-plane messages to the responder, and vice-versa.
 	 */
-	ch->end[TO_RESPONDER].rb = fr_ring_buffer_create(ch, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE);
+	ch->end[TO_RESPONDER].rb = fr_ring_buffer_create(ch, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE, false);
 	if (!ch->end[TO_RESPONDER].rb) {
 	rb_nomem:
 		fr_strerror_const_push("Failed allocating ring buffer");
@@ -224,7 +237,7 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *requestor, fr_con
 		return NULL;
 	}
 
-	ch->end[TO_REQUESTOR].rb = fr_ring_buffer_create(ch, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE);
+	ch->end[TO_REQUESTOR].rb = fr_ring_buffer_create(ch, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE, false);
 	if (!ch->end[TO_REQUESTOR].rb) {
 		talloc_free(ch);
 		goto rb_nomem;
@@ -272,6 +285,7 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *requestor, fr_con
 static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_end_t *end, fr_channel_signal_t which)
 {
 	fr_channel_control_t cc;
+	int ret;
 
 	end->stats.last_sent_signal = when;
 	end->stats.signals++;
@@ -285,7 +299,12 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 	       fr_table_str_by_value(channel_direction, end->direction, "<INVALID>"),
 	       fr_table_str_by_value(channel_signals, which, "<INVALID>"));
 
-	return fr_control_message_send(end->control, end->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
+	ret = fr_control_message_send(end->control, end->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
+	if (ret < 0) return ret;
+
+	if (ret > 0) end->stats.wakeups++;
+
+	return 0;
 }
 
 #define IALPHA (8)
@@ -398,28 +417,12 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 	return 0;
 }
 
-/** Receive a reply message from the channel
+/** Account for one reply, and pass it to the requestor
  *
- * @param[in] ch	the channel to read data from.
- * @return
- *	- true if there was a message received
- *	- false if there are no more messages
  */
-bool fr_channel_recv_reply(fr_channel_t *ch)
+static void channel_recv_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 {
-	fr_channel_data_t *cd;
-	fr_channel_end_t *requestor;
-	fr_atomic_queue_t *aq;
-
-	fr_assert(ch->end[TO_RESPONDER].recv != NULL);
-
-	aq = ch->end[TO_REQUESTOR].aq;
-	requestor = &(ch->end[TO_RESPONDER]);
-
-	/*
-	 *	It's OK for the queue to be empty.
-	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return false;
+	fr_channel_end_t *requestor = &(ch->end[TO_RESPONDER]);
 
 	/*
 	 *	We want an exponential moving average for round trip
@@ -440,6 +443,22 @@ bool fr_channel_recv_reply(fr_channel_t *ch)
 	}
 	ch->cpu_time = cd->reply.cpu_time;
 
+	/*
+	 *	The request was sent on a different channel, and
+	 *	another worker took it.  The reply isn't part of this
+	 *	channel's sequence, so all we do is tell the original
+	 *	channel that it has one fewer request outstanding.
+	 */
+	if (cd->reply.origin) {
+		fr_channel_t *origin = cd->reply.origin;
+
+		fr_assert(origin->end[TO_RESPONDER].stats.outstanding > 0);
+		origin->end[TO_RESPONDER].stats.outstanding--;
+
+		origin->end[TO_RESPONDER].recv(origin->end[TO_RESPONDER].recv_uctx, origin, cd);
+		return;
+	}
+
 	/*
 	 *	Update the outbound channel with the knowledge that
 	 *	we've received one more reply, and with the responders
@@ -457,12 +476,41 @@ bool fr_channel_recv_reply(fr_channel_t *ch)
 	requestor->stats.last_read_other = cd->m.when;
 
 	ch->end[TO_RESPONDER].recv(ch->end[TO_RESPONDER].recv_uctx, ch, cd);
+}
+
+/** Receive reply messages from the channel
+ *
+ * Takes up to #RECV_BATCH_SIZE replies from the queue at once, and
+ * calls the recv_reply callback for each of them.
+ *
+ * @param[in] ch	the channel to read data from.
+ * @return
+ *	- true if there was a message received
+ *	- false if there are no more messages
+ */
+bool fr_channel_recv_reply(fr_channel_t *ch)
+{
+	fr_channel_data_t	*cd[RECV_BATCH_SIZE];
+	size_t			i, num;
+
+	fr_assert(ch->end[TO_RESPONDER].recv != NULL);
+
+	/*
+	 *	It's OK for the queue to be empty.
+	 */
+	num = fr_atomic_queue_pop_bulk(ch->end[TO_REQUESTOR].aq, (void **) cd, NUM_ELEMENTS(cd));
+	if (!num) return false;
+
+	for (i = 0; i < num; i++) channel_recv_reply(ch, cd[i]);
 
 	return true;
 }
 
 
-/** Receive a request message from the channel
+/** Receive request messages from the channel
+ *
+ * Takes up to #RECV_BATCH_SIZE requests from the queue at once, and
+ * calls the recv_request callback for each of them.
  *
  * @param[in] ch the channel
  * @return
@@ -471,29 +519,36 @@ bool fr_channel_recv_reply(fr_channel_t *ch)
  */
 bool fr_channel_recv_request(fr_channel_t *ch)
 {
-	fr_channel_data_t *cd;
-	fr_channel_end_t *responder;
-	fr_atomic_queue_t *aq;
+	fr_channel_data_t	*cd[RECV_BATCH_SIZE];
+	fr_channel_end_t	*responder;
+	size_t			i, num;
 
-	aq = ch->end[TO_RESPONDER].aq;
 	responder = &(ch->end[TO_REQUESTOR]);
 
 	/*
 	 *	It's OK for the queue to be empty.
 	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return false;
+	num = fr_atomic_queue_pop_bulk(ch->end[TO_RESPONDER].aq, (void **) cd, NUM_ELEMENTS(cd));
+	if (!num) return false;
 
-	fr_assert(cd->live.sequence > responder->ack);
-	fr_assert(cd->live.sequence >= responder->sequence); /* must have more requests than replies */
+	/*
+	 *	Account for the whole batch before calling the
+	 *	callback.  It may send a reply, which looks for more
+	 *	requests.
+	 */
+	for (i = 0; i < num; i++) {
+		fr_assert(cd[i]->live.sequence > responder->ack);
+		fr_assert(cd[i]->live.sequence >= responder->sequence); /* must have more requests than replies */
 
-	responder->stats.outstanding++;
-	responder->ack = cd->live.sequence;
-	responder->their_view_of_my_sequence = cd->live.ack;
+		responder->stats.outstanding++;
+		responder->ack = cd[i]->live.sequence;
+		responder->their_view_of_my_sequence = cd[i]->live.ack;
 
-	fr_assert(fr_time_lteq(responder->stats.last_read_other, cd->m.when));
-	responder->stats.last_read_other = cd->m.when;
+		fr_assert(fr_time_lteq(responder->stats.last_read_other, cd[i]->m.when));
+		responder->stats.last_read_other = cd[i]->m.when;
+	}
 
-	ch->end[TO_REQUESTOR].recv(ch->end[TO_REQUESTOR].recv_uctx, ch, cd);
+	for (i = 0; i < num; i++) ch->end[TO_REQUESTOR].recv(ch->end[TO_REQUESTOR].recv_uctx, ch, cd[i]);
 
 	return true;
 }
@@ -529,7 +584,13 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 
 	when = cd->m.when;
 
-	sequence = responder->sequence + 1;
+	/*
+	 *	Replies to requests taken from another worker's
+	 *	channel don't use up a sequence number, as the
+	 *	requestor never sent us the request.
+	 */
+	sequence = responder->sequence;
+	if (!cd->reply.origin) sequence++;
 	cd->live.sequence = sequence;
 	cd->live.ack = responder->ack;
 
@@ -540,8 +601,10 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd)
 		return -1;
 	}
 
-	fr_assert(responder->stats.outstanding > 0);
-	responder->stats.outstanding--;
+	if (!cd->reply.origin) {
+		fr_assert(responder->stats.outstanding > 0);
+		responder->stats.outstanding--;
+	}
 	responder->stats.packets++;
 
 	MPRINT("\tRESPONDER replies %"PRIu64", num_outstanding %"PRIu64"\n", responder->stats.packets, responder->stats.outstanding);
@@ -631,6 +694,54 @@ int fr_channel_null_reply(fr_channel_t *ch)
 	return 0;
 }
 
+/** Stop counting a request as outstanding, as the responder has put it aside
+ *
+ * Requests in a worker's backlog may be taken by another worker, which
+ * replies on its own channel.  So they're only counted against this
+ * channel once the responder starts them, via
+ * fr_channel_responder_resume().
+ *
+ * @param[in] ch	the channel the request arrived on.
+ */
+void fr_channel_responder_defer(fr_channel_t *ch)
+{
+	fr_channel_end_t *responder = &(ch->end[TO_REQUESTOR]);
+
+	if (ch->same_thread) return;
+
+	fr_assert(responder->stats.outstanding > 0);
+	responder->stats.outstanding--;
+}
+
+/** Count a request as outstanding again, as the responder has started it
+ *
+ * @param[in] ch	the channel the request arrived on.
+ */
+void fr_channel_responder_resume(fr_channel_t *ch)
+{
+	if (ch->same_thread) return;
+
+	ch->end[TO_REQUESTOR].stats.outstanding++;
+}
+
+/** Return the number of requests the responder has received, and not replied to
+ *
+ * @param[in] ch	the channel.
+ */
+uint64_t fr_channel_responder_outstanding(fr_channel_t const *ch)
+{
+	return ch->end[TO_REQUESTOR].stats.outstanding;
+}
+
+/** Return the number of requests the requestor has sent, and not had a reply for
+ *
+ * @param[in] ch	the channel.
+ */
+uint64_t fr_channel_requestor_outstanding(fr_channel_t const *ch)
+{
+	return ch->end[TO_RESPONDER].stats.outstanding;
+}
+
 
 
 /** Signal a channel that the responder is sleeping
@@ -647,6 +758,7 @@ int fr_channel_responder_sleeping(fr_channel_t *ch)
 {
 	fr_channel_end_t *responder;
 	fr_channel_control_t cc;
+	int ret;
 
 	responder = &(ch->end[TO_REQUESTOR]);
 
@@ -665,7 +777,12 @@ int fr_channel_responder_sleeping(fr_channel_t *ch)
 
 	MPRINT("\tRESPONDER SLEEPING num_outstanding %"PRIu64", packets in %"PRIu64", packets out %"PRIu64"\n", responder->stats.outstanding,
 	       ch->end[TO_RESPONDER].stats.packets, responder->stats.packets);
-	return fr_control_message_send(responder->control, responder->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
+	ret = fr_control_message_send(responder->control, responder->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
+	if (ret < 0) return ret;
+
+	if (ret > 0) responder->stats.wakeups++;
+
+	return 0;
 }
 
 
@@ -814,6 +931,21 @@ bool fr_channel_active(fr_channel_t *ch)
 	return atomic_load(&ch->end[TO_REQUESTOR].active) && atomic_load(&ch->end[TO_RESPONDER].active);
 }
 
+/** Check whether two channels have the same requestor
+ *
+ * i.e. whether replies sent on either channel go to the same network thread.
+ *
+ * @param[in] a		The first channel.
+ * @param[in] b		The second channel.
+ * @return
+ *	- true if the channels have the same requestor.
+ *	- false if they don't.
+ */
+bool fr_channel_same_requestor(fr_channel_t const *a, fr_channel_t const *b)
+{
+	return (a->end[TO_REQUESTOR].control == b->end[TO_REQUESTOR].control);
+}
+
 /** Signal a responder that the channel is closing
  *
  * @param[in] ch	The channel.
@@ -965,6 +1097,9 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 	fr_log(log, L_INFO, file, line, "requestor\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.signals);
 	fr_log(log, L_INFO, file, line, "\tsignals re-sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.resignals);
+	fr_log(log, L_INFO, file, line, "\twakeups = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.wakeups);
+	fr_log(log, L_INFO, file, line, "\twakeups per packet = %.3f\n",
+	       ch->end[TO_RESPONDER].stats.packets ? (double) ch->end[TO_RESPONDER].stats.wakeups / ch->end[TO_RESPONDER].stats.packets : 0.0);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\toutstanding = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.outstanding);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.packets);
@@ -975,6 +1110,9 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 
 	fr_log(log, L_INFO, file, line, "responder\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64"\n", ch->end[TO_REQUESTOR].stats.signals);
+	fr_log(log, L_INFO, file, line, "\twakeups = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.wakeups);
+	fr_log(log, L_INFO, file, line, "\twakeups per packet = %.3f\n",
+	       ch->end[TO_REQUESTOR].stats.packets ? (double) ch->end[TO_REQUESTOR].stats.wakeups / ch->end[TO_REQUESTOR].stats.packets : 0.0);
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.packets);
 	fr_log(log, L_INFO, file, line, "\tmessage interval (RTT) = %" PRIu64 "\n", fr_time_delta_unwrap(ch->end[TO_REQUESTOR].stats.message_interval));
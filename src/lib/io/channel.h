@@ -82,6 +82,7 @@ typedef struct {
 	uint64_t       		outstanding; 	//!< Number of outstanding requests with no reply.
 	uint64_t		signals;	//!< Number of kevent signals we've sent.
 	uint64_t		resignals;	//!< Number of signals resent.
+	uint64_t		wakeups;	//!< Number of signals which had to wake the other end.
 
 	uint64_t		packets;	//!< Number of actual data packets.
 
@@ -128,12 +129,17 @@ typedef struct {
 	union {
 		struct {
 			fr_time_t		recv_time;	//!< time original request was received (network -> worker)
+			size_t			decoded_len;	//!< Length of the pairs the network thread decoded,
+								///< which follow the packet in the message.
 		} request;
 
 		struct {
 			fr_time_delta_t		cpu_time;		//!< Total CPU time, including predicted work, (only worker -> network).
 			fr_time_delta_t		processing_time; 	//!< Actual processing time for this packet (only worker -> network).
 			fr_time_t		request_time;		//!< Timestamp of the request packet.
+			bool			overloaded;		//!< The worker is shedding load (only worker -> network).
+			fr_channel_t		*origin;		//!< Channel the request was sent on, if another
+									///< worker took it and replied on its own channel.
 	        } reply;
 	};
 
@@ -151,10 +157,46 @@ typedef struct {
 #define PRIORITY_NORMAL (1 << 14)
 #define PRIORITY_LOW    (1 << 13)
 
+/** Classes of packets which are scheduled and limited separately
+ *
+ * Each class covers one of the PRIORITY_* values, and everything
+ * between it and the next one up.
+ */
+typedef enum {
+	FR_CHANNEL_PRIORITY_CLASS_NOW = 0,		//!< PRIORITY_NOW and above.
+	FR_CHANNEL_PRIORITY_CLASS_HIGH,			//!< PRIORITY_HIGH.
+	FR_CHANNEL_PRIORITY_CLASS_NORMAL,		//!< PRIORITY_NORMAL.
+	FR_CHANNEL_PRIORITY_CLASS_LOW,			//!< PRIORITY_LOW, and anything lower.
+	FR_CHANNEL_PRIORITY_CLASS_MAX
+} fr_channel_priority_class_t;
+
+/** How a class of packets is treated
+ *
+ */
+typedef struct {
+	uint32_t	weight;				//!< Share of a worker's time, relative to the
+							///< other classes.
+	uint32_t	max_outstanding;		//!< Maximum number of packets in the workers.
+							///< 0 means no limit.
+} fr_channel_priority_config_t;
+
 extern fr_table_num_sorted_t const channel_signals[];
 extern size_t channel_signals_len;
 extern fr_table_num_sorted_t const channel_packet_priority[];
 extern size_t channel_packet_priority_len;
+extern char const *channel_priority_class_names[FR_CHANNEL_PRIORITY_CLASS_MAX];
+
+/** Map a packet priority to its class
+ *
+ */
+static inline fr_channel_priority_class_t fr_channel_priority_class(uint32_t priority)
+{
+	if (priority >= PRIORITY_NOW) return FR_CHANNEL_PRIORITY_CLASS_NOW;
+	if (priority >= PRIORITY_HIGH) return FR_CHANNEL_PRIORITY_CLASS_HIGH;
+	if (priority >= PRIORITY_NORMAL) return FR_CHANNEL_PRIORITY_CLASS_NORMAL;
+
+	return FR_CHANNEL_PRIORITY_CLASS_LOW;
+}
 
 fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *frontend, fr_control_t *worker, bool same) CC_HINT(nonnull);
 
@@ -164,6 +206,12 @@ bool	fr_channel_recv_request(fr_channel_t *ch) CC_HINT(nonnull);
 int	fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd) CC_HINT(nonnull);
 int	fr_channel_null_reply(fr_channel_t *ch) CC_HINT(nonnull);
 
+void	fr_channel_responder_defer(fr_channel_t *ch) CC_HINT(nonnull);
+void	fr_channel_responder_resume(fr_channel_t *ch) CC_HINT(nonnull);
+
+uint64_t fr_channel_responder_outstanding(fr_channel_t const *ch) CC_HINT(nonnull);
+uint64_t fr_channel_requestor_outstanding(fr_channel_t const *ch) CC_HINT(nonnull);
+
 bool	fr_channel_recv_reply(fr_channel_t *ch) CC_HINT(nonnull);
 
 typedef void (*fr_channel_recv_callback_t)(void *ctx, fr_channel_t *ch, fr_channel_data_t *cd);
@@ -177,6 +225,8 @@ fr_channel_event_t	fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 
 bool	fr_channel_active(fr_channel_t *ch) CC_HINT(nonnull);
 
+bool	fr_channel_same_requestor(fr_channel_t const *a, fr_channel_t const *b) CC_HINT(nonnull);
+
 int	fr_channel_signal_open(fr_channel_t *ch) CC_HINT(nonnull);
 
 int	fr_channel_signal_responder_close(fr_channel_t *ch) CC_HINT(nonnull);
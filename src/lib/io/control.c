@@ -33,10 +33,16 @@ RCSID("$Id$")
 
 #include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/event.h>
 
 #define FR_CONTROL_MAX_TYPES	(32)
 
+#define CONTROL_SPIN_MAX	(50)		//!< Longest we poll for messages before sleeping, in microseconds.
+
+#define IALPHA (8)
+#define RTT(_old, _new) fr_time_delta_wrap((fr_time_delta_unwrap(_new) + (fr_time_delta_unwrap(_old) * (IALPHA - 1))) / IALPHA)
+
 /*
  *	Debugging, mainly for channel_test
  */
@@ -83,30 +89,37 @@ struct fr_control_s {
 
 	int			pipe[2];       		//!< our pipes
 
+	atomic_bool		awake;			//!< The receiver will look at the queue without
+							///< being woken up, so senders don't write to the pipe.
+
+	fr_time_delta_t		spin_max;		//!< Longest we poll for messages before sleeping.
+							///< Zero if we never poll.
+	fr_time_t		last_message;		//!< When we last received a message.
+	fr_time_delta_t		interval;		//!< Average time between messages.
+
 	bool			same_thread;		//!< are the two ends in the same thread
 
 	fr_control_ctx_t 	type[FR_CONTROL_MAX_TYPES];	//!< callbacks
 };
 
-static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+/** Pop all of the messages in the queue, and run their callbacks
+ *
+ * @return the number of messages.
+ */
+static unsigned int control_drain(fr_control_t *c)
 {
-	fr_control_t *c = talloc_get_type_abort(uctx, fr_control_t);
-	ssize_t i, num;
-	fr_time_t now;
-	char read_buffer[256];
-	uint8_t	data[256];
+	unsigned int	count = 0;
+	fr_time_t	now = fr_time();
+	uint8_t		data[256];
 
-	num = read(fd, read_buffer, sizeof(read_buffer));
-	if (num <= 0) return;
-
-	now = fr_time();
-
-	for (i = 0; i < num; i++) {
+	while (true) {
 		uint32_t id = 0;
-		size_t message_size;
+		ssize_t message_size;
 
 		message_size = fr_control_message_pop(c->aq, &id, data, sizeof(data));
-		if (!message_size) return;
+		if (message_size <= 0) break;
+
+		count++;
 
 		if (id >= FR_CONTROL_MAX_TYPES) continue;
 
@@ -114,6 +127,38 @@ static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void
 
 		c->type[id].callback(c->type[id].ctx, data, message_size, now);
 	}
+
+	/*
+	 *	Track how often messages arrive, so that we know
+	 *	whether it's worth waiting for the next one.
+	 */
+	if (count) {
+		c->interval = RTT(c->interval, fr_time_delta_div(fr_time_sub(now, c->last_message),
+								  fr_time_delta_wrap(count)));
+		c->last_message = now;
+	}
+
+	return count;
+}
+
+static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_control_t *c = talloc_get_type_abort(uctx, fr_control_t);
+	ssize_t num;
+	char read_buffer[256];
+
+	num = read(fd, read_buffer, sizeof(read_buffer));
+	if (num <= 0) return;
+
+	/*
+	 *	Senders only write to the pipe when this flag is
+	 *	clear, so there may be many more messages than bytes.
+	 *	Clear the flag before looking at the queue, so that
+	 *	anything pushed after we've finished wakes us again.
+	 */
+	(void) atomic_exchange(&c->awake, false);
+
+	(void) control_drain(c);
 }
 
 /** Free a control structure
@@ -157,6 +202,14 @@ fr_control_t *fr_control_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_atomic_
 	}
 	c->el = el;
 	c->aq = aq;
+	c->last_message = fr_time();
+	c->interval = fr_time_delta_from_sec(1);
+
+	/*
+	 *	Polling only helps if the sender can run at the same
+	 *	time as we poll.
+	 */
+	if (sysconf(_SC_NPROCESSORS_ONLN) > 1) c->spin_max = fr_time_delta_from_usec(CONTROL_SPIN_MAX);
 
 	if (pipe((int *) &c->pipe) < 0) {
 		talloc_free(c);
@@ -338,7 +391,8 @@ int fr_control_message_push(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
  * @param[in] data_size the size of the data to write to the control plane.
  * @return
  *	- <0 on error
- *	- 0 on success
+ *	- 0 on success, where the receiver was already going to look at the queue.
+ *	- 1 on success, where we had to wake the receiver.
  */
 int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id, void *data, size_t data_size)
 {
@@ -353,11 +407,87 @@ int fr_control_message_send(fr_control_t *c, fr_ring_buffer_t *rb, uint32_t id,
 
 	if (fr_control_message_push(c, rb, id, data, data_size) < 0) return -1;
 
+	/*
+	 *	Someone has already woken the receiver, or it's
+	 *	polling the queue.  It will see our message without
+	 *	another system call.
+	 */
+	if (atomic_exchange(&c->awake, true)) return 0;
+
 	while (write(c->pipe[1], ".", 1) == 0) {
 		/* nothing */
 	}
 
-	return 0;
+	return 1;
+}
+
+/** Poll for control-plane messages for a short time, instead of sleeping
+ *
+ *  Waking a thread which is asleep costs a system call for the sender,
+ *  and another for the receiver.  When messages arrive close together,
+ *  it's cheaper for the receiver to poll the queue for a little while
+ *  before it goes to sleep.  Senders don't write to the pipe while
+ *  we're polling.
+ *
+ *  We only poll if messages have recently been arriving more often
+ *  than every #CONTROL_SPIN_MAX microseconds, and then only for about
+ *  twice the average interval between them.
+ *
+ *  This function is called ONLY from the receiving thread, when it's
+ *  about to wait for events.
+ *
+ * @param[in] c the control structure
+ * @return
+ *	- true if we received messages, and the caller has more work to do.
+ *	- false if there was nothing, and the caller should sleep.
+ */
+bool fr_control_poll(fr_control_t *c)
+{
+	fr_time_t	start, now;
+	fr_time_delta_t	limit;
+	bool		received = false;
+
+	if (c->same_thread || !fr_time_delta_ispos(c->spin_max)) return false;
+
+	/*
+	 *	Messages are arriving too slowly for polling to help.
+	 */
+	if (fr_time_delta_gt(c->interval, c->spin_max)) return false;
+
+	limit = fr_time_delta_mul(c->interval, 2);
+	if (fr_time_delta_gt(limit, c->spin_max)) limit = c->spin_max;
+
+	/*
+	 *	Someone has already written to the pipe, so there's no
+	 *	point in polling.  The event loop will return straight
+	 *	away.
+	 */
+	if (atomic_exchange(&c->awake, true)) return false;
+
+	start = fr_time();
+	do {
+		if (control_drain(c) > 0) {
+			received = true;
+			break;
+		}
+
+		now = fr_time();
+	} while (fr_time_delta_lt(fr_time_sub(now, start), limit));
+
+	/*
+	 *	Let senders wake us again, and pick up anything which
+	 *	was pushed before they could see that.
+	 */
+	(void) atomic_exchange(&c->awake, false);
+	if (control_drain(c) > 0) received = true;
+
+	/*
+	 *	Nothing arrived.  Count the time we spent waiting, so
+	 *	that we stop polling if the messages have stopped.
+	 */
+	if (!received) c->interval = RTT(c->interval, fr_time_delta_mul(limit, 2));
+
+	return received;
 }
 
 
@@ -61,6 +61,10 @@ struct fr_async_s {
 
 	fr_time_tracking_t	tracking;
 	fr_channel_t		*channel;
+	fr_channel_t		*origin;	//!< Channel the request was sent on, if it was
+						///< taken from another worker.  Only a tag for
+						///< the network thread, which owns the channel.
+						///< The worker must not dereference it.
 
 	fr_dlist_t		entry;		//!< in the list of requests associated with this channel
 
@@ -70,6 +74,14 @@ struct fr_async_s {
 	uint32_t		priority;	//!< higher == higher priority
 
 	uint32_t		sequence;	//!< higher == higher priority, too
+	uint64_t		tag;		//!< Position in the worker's weighted fair schedule.
+
+	bool			admitted;	//!< Has passed the worker's admission control.
+	bool			rejected;	//!< Was shed, but the application set a reply.
+
+	uint8_t const		*decoded;	//!< Pairs decoded by the network thread, in the internal
+						///< format.  Only set while the packet is being decoded.
+	size_t			decoded_len;	//!< Length of the decoded pairs.
 };
 
 int fr_io_listen_free(fr_listen_t *li);
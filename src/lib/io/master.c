@@ -31,11 +31,22 @@
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/syserror.h>
 
+/** Counters for packets from unknown clients which were discarded
+ *
+ */
+typedef struct {
+	uint64_t			nak;				//!< client is in the negative cache.
+	uint64_t			network_nak;			//!< client's network is in the negative cache.
+	uint64_t			rate_limited;			//!< client's network is defining too many clients.
+} fr_io_client_stats_t;
+
 typedef struct {
 	fr_event_list_t			*el;				//!< event list, for the master socket.
 	fr_network_t			*nr;				//!< network for the master socket
 
 	fr_trie_t			*trie;				//!< trie of clients
+	fr_trie_t			*networks;			//!< trie of per-network dynamic client limits
+	fr_dlist_head_t			network_lru;			//!< network limits, least recently used first
 	fr_heap_t			*pending_clients;		//!< heap of pending clients
 	fr_heap_t			*alive_clients;			//!< heap of active clients
 
@@ -47,8 +58,31 @@ typedef struct {
 	uint32_t			num_connections;		//!< number of dynamic connections
 	uint32_t			num_pending_packets;   		//!< number of pending packets
 	uint64_t			client_id;			//!< Unique client identifier.
+
+	fr_io_client_stats_t		stats;				//!< discarded packets from unknown clients
 } fr_io_thread_t;
 
+/** Limits on dynamic client definitions from one source network
+ *
+ *  The token bucket is stored as the time at which it will be full
+ *  again.  Each definition adds one interval of 1/new_client_rate
+ *  to that time, and a definition is allowed as long as the result
+ *  is no more than new_client_burst intervals in the future.
+ */
+typedef struct {
+	fr_dlist_t			entry;				//!< in the thread's LRU list
+	fr_ipaddr_t			network;			//!< the source network
+	fr_time_t			full;				//!< when the token bucket is full again
+	fr_time_t			nak_expires;			//!< when the NAK count is reset
+	uint32_t			naks;				//!< NAKs within the last nak_lifetime
+} fr_io_network_t;
+
+/*
+ *	Bound the memory used to track garbage sources.  When the
+ *	table is full of live entries, new networks are refused.
+ */
+#define MAX_NETWORK_LIMITS	(16384)
+
 /** A saved packet
  *
  */
@@ -387,11 +421,18 @@ static fr_client_t *radclient_clone(TALLOC_CTX *ctx, fr_client_t const *parent)
 
 	DUP_FIELD(longname);
 	DUP_FIELD(shortname);
-	DUP_FIELD(secret);
 	DUP_FIELD(nas_type);
 	DUP_FIELD(server);
 	DUP_FIELD(nas_type);
 
+	/*
+	 *	"0x..." secrets are binary, and may contain NULs.
+	 */
+	if (parent->secret) {
+		c->secret = talloc_bstrndup(c, parent->secret, talloc_array_length(parent->secret) - 1);
+		if (!c->secret) goto error;
+	}
+
 	COPY_FIELD(require_message_authenticator);
 	COPY_FIELD(limit_proxy_state);
 	COPY_FIELD(received_message_authenticator);
@@ -886,6 +927,147 @@ static void get_inst(fr_listen_t *li, fr_io_instance_t const **inst, fr_io_threa
 }
 
 
+static void network_limit_free(fr_io_thread_t *thread, fr_io_network_t *n)
+{
+	(void) fr_trie_remove_by_key(thread->networks, &n->network.addr, n->network.prefix);
+	fr_dlist_remove(&thread->network_lru, n);
+	talloc_free(n);
+}
+
+/** Find (or create) the dynamic client limits for the network a source address is in
+ *
+ * @param[in] inst		the master IO instance.
+ * @param[in] thread		the master socket.
+ * @param[in] src_ipaddr	of the packet.
+ * @param[in] now		the current time.
+ * @return
+ *	- The limits for the network.
+ *	- NULL if the table of networks is full.
+ */
+static fr_io_network_t *network_limit_find(fr_io_instance_t const *inst, fr_io_thread_t *thread,
+					   fr_ipaddr_t const *src_ipaddr, fr_time_t now)
+{
+	fr_io_network_t	*n;
+	int		i;
+
+	n = fr_trie_lookup_by_key(thread->networks, &src_ipaddr->addr, src_ipaddr->prefix);
+	if (n) {
+		fr_dlist_remove(&thread->network_lru, n);
+		fr_dlist_insert_tail(&thread->network_lru, n);
+		return n;
+	}
+
+	/*
+	 *	Expire a few idle entries each time we add one, so
+	 *	that the table only holds recently active networks.
+	 *	An entry is idle once its bucket is full, and it has
+	 *	no unexpired NAKs.
+	 */
+	for (i = 0; i < 2; i++) {
+		n = fr_dlist_head(&thread->network_lru);
+		if (!n || fr_time_gt(n->full, now) || (n->naks && fr_time_gt(n->nak_expires, now))) break;
+
+		network_limit_free(thread, n);
+	}
+
+	if (fr_dlist_num_elements(&thread->network_lru) >= MAX_NETWORK_LIMITS) return NULL;
+
+	MEM(n = talloc_zero(thread, fr_io_network_t));
+	n->network = *src_ipaddr;
+	fr_ipaddr_mask(&n->network, (n->network.af == AF_INET) ? inst->new_client_ipv4_prefix :
+				    inst->new_client_ipv6_prefix);
+	n->full = now;
+
+	if (fr_trie_insert_by_key(thread->networks, &n->network.addr, n->network.prefix, n)) {
+		talloc_free(n);
+		return NULL;
+	}
+	fr_dlist_insert_tail(&thread->network_lru, n);
+
+	return n;
+}
+
+/** See if a source network may start another dynamic client definition
+ *
+ * This is checked before the pending client is created, so that packets
+ * from a scan, or from a misconfigured NAS, are discarded in the network
+ * thread instead of being queued to a worker.
+ *
+ * @param[in] inst		the master IO instance.
+ * @param[in] thread		the master socket.
+ * @param[in] src_ipaddr	of the packet.
+ * @return
+ *	- true if the dynamic client may be defined.
+ *	- false if the packet should be discarded.
+ */
+static bool network_limit_check(fr_io_instance_t const *inst, fr_io_thread_t *thread, fr_ipaddr_t const *src_ipaddr)
+{
+	fr_io_network_t	*n;
+	fr_time_t	now = fr_time();
+	fr_time_delta_t	interval = fr_time_delta_wrap(NSEC / inst->new_client_rate);
+	fr_time_t	full;
+
+	n = network_limit_find(inst, thread, src_ipaddr, now);
+	if (!n) {
+		DEBUG("proto_%s - ignoring packet from client IP address %pV - "
+		      "too many networks are defining dynamic clients",
+		      inst->app_io->common.name, fr_box_ipaddr(*src_ipaddr));
+		thread->stats.rate_limited++;
+		return false;
+	}
+
+	/*
+	 *	Too many clients in this network have been NAKed
+	 *	recently.  Don't bother asking about any more.
+	 */
+	if (n->naks >= inst->new_client_burst) {
+		if (fr_time_lt(now, n->nak_expires)) {
+			DEBUG2("proto_%s - ignoring packet from client IP address %pV - network %pV is NAKed",
+			       inst->app_io->common.name, fr_box_ipaddr(*src_ipaddr), fr_box_ipaddr(n->network));
+			thread->stats.network_nak++;
+			return false;
+		}
+		n->naks = 0;
+	}
+
+	full = fr_time_gt(n->full, now) ? n->full : now;
+	full = fr_time_add(full, interval);
+	if (fr_time_delta_gt(fr_time_sub(full, now), fr_time_delta_mul(interval, inst->new_client_burst))) {
+		DEBUG2("proto_%s - ignoring packet from client IP address %pV - "
+		       "network %pV is defining too many dynamic clients",
+		       inst->app_io->common.name, fr_box_ipaddr(*src_ipaddr), fr_box_ipaddr(n->network));
+		thread->stats.rate_limited++;
+		return false;
+	}
+	n->full = full;
+
+	return true;
+}
+
+/** Record that a dynamic client was NAKed
+ *
+ * Once new_client_burst clients in the same network have been NAKed
+ * within nak_lifetime, the whole network is NAKed.
+ */
+static void network_limit_nak(fr_io_instance_t const *inst, fr_io_thread_t *thread, fr_ipaddr_t const *src_ipaddr)
+{
+	fr_io_network_t	*n;
+	fr_time_t	now = fr_time();
+
+	n = fr_trie_lookup_by_key(thread->networks, &src_ipaddr->addr, src_ipaddr->prefix);
+	if (!n) return;
+
+	if (fr_time_lteq(n->nak_expires, now)) n->naks = 0;
+
+	n->naks++;
+	n->nak_expires = fr_time_add(now, inst->nak_lifetime);
+
+	if (n->naks == inst->new_client_burst) {
+		DEBUG("proto_%s - NAKing network %pV for %pVs - too many clients in it were NAKed",
+		      inst->app_io->common.name, fr_box_ipaddr(n->network), fr_box_time_delta(inst->nak_lifetime));
+	}
+}
+
 static fr_client_t *radclient_alloc(TALLOC_CTX *ctx, int ipproto, fr_io_address_t *address)
 {
 	fr_client_t	*radclient;
@@ -1505,6 +1687,7 @@ do_read:
 	 *	Negative cache entry.  Drop the packet.
 	 */
 	if (client && client->state == PR_CLIENT_NAK) {
+		if (thread) thread->stats.nak++;
 		if (accept_fd >= 0) close(accept_fd);
 		return 0;
 	}
@@ -1569,6 +1752,17 @@ do_read:
 				goto ignore;
 			}
 
+			/*
+			 *	Limit how quickly any one network can
+			 *	define clients, and how often it can
+			 *	fail to.
+			 */
+			if (inst->new_client_rate &&
+			    !network_limit_check(inst, thread, &address.socket.inet.src_ipaddr)) {
+				if (accept_fd >= 0) close(accept_fd);
+				return 0;
+			}
+
 			/*
 			 *	Allocate our local radclient as a
 			 *	placeholder for the dynamic client.
@@ -1738,6 +1932,42 @@ have_client:
 			client->ready_to_delete = false;
 		}
 
+		/*
+		 *	Let the application answer the packet here,
+		 *	without a round trip through a worker.  The
+		 *	reply is cached in the tracking entry, and
+		 *	written via mod_write() exactly like a
+		 *	duplicate reply.
+		 *
+		 *	Only packets the application has asked for
+		 *	get here, as calculating the load looks at
+		 *	every worker.
+		 */
+		if (inst->app_reply && (buffer[0] == inst->app_reply_code) &&
+		    (client->state != PR_CLIENT_PENDING)) {
+			fr_network_t	*nr = connection ? connection->nr : thread->nr;
+			fr_io_load_t	load;
+			ssize_t		slen;
+
+			fr_network_load(nr, &load);
+
+			slen = inst->app->reply(inst->app_instance, track, &track->reply,
+						client->radclient, &load, buffer, packet_len);
+			if (slen < 0) {
+				DEBUG2("proto_%s - discarding packet from client %s - %s", inst->app_io->common.name,
+				       client->radclient->shortname, fr_strerror());
+				talloc_free(track);
+				return 0;
+			}
+
+			if (slen > 0) {
+				track->reply_len = slen;
+				fr_network_listen_write(nr, li, track->reply, track->reply_len,
+							track, track->timestamp);
+				return 0;
+			}
+		}
+
 		/*
 		 *	Return the packet.
 		 */
@@ -2343,6 +2573,8 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 	 *	tracking table.
 	 */
 	if (buffer_len == 1) {
+		if (!connection && inst->new_client_rate) network_limit_nak(inst, thread, &client->src_ipaddr);
+
 		client->state = PR_CLIENT_NAK;
 		TALLOC_FREE(client->pending);
 		if (client->table) TALLOC_FREE(client->table);
@@ -2457,8 +2689,9 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 
 	DUP_FIELD(longname);
 	DUP_FIELD(shortname);
-	DUP_FIELD(secret);
 	DUP_FIELD(nas_type);
+	if (radclient->secret) client->radclient->secret = talloc_bstrndup(client->radclient, radclient->secret,
+									   talloc_array_length(radclient->secret) - 1);
 
 	COPY_FIELD(ipaddr);
 	COPY_FIELD(src_ipaddr);
@@ -2733,6 +2966,24 @@ static char const *mod_name(fr_listen_t *li)
 	return child->app_io->get_name(child);
 }
 
+static void mod_stats_print(fr_listen_t const *li, FILE *fp)
+{
+	fr_io_instance_t const *inst;
+	fr_io_thread_t const *thread;
+
+	if (li->connected) return;
+
+	inst = li->app_io_instance;
+	thread = li->thread_instance;
+
+	fprintf(fp, "count.client.nak\t%" PRIu64 "\n", thread->stats.nak);
+	fprintf(fp, "count.client.network_nak\t%" PRIu64 "\n", thread->stats.network_nak);
+	fprintf(fp, "count.client.rate_limited\t%" PRIu64 "\n", thread->stats.rate_limited);
+	fprintf(fp, "count.client.networks\t%u\n", fr_dlist_num_elements(&thread->network_lru));
+
+	if (inst->app_io->stats_print) inst->app_io->stats_print(thread->child, fp);
+}
+
 /** Create a trie from arrays of allow / deny IP addresses
  *
  * @param ctx	the talloc ctx
@@ -2984,6 +3235,8 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	 *	Create the trie of clients for this socket.
 	 */
 	MEM(thread->trie = fr_trie_alloc(thread, NULL, NULL));
+	MEM(thread->networks = fr_trie_alloc(thread, NULL, NULL));
+	fr_dlist_talloc_init(&thread->network_lru, fr_io_network_t, entry);
 	MEM(thread->alive_clients = fr_heap_alloc(thread, alive_client_cmp,
 						   fr_io_client_t, alive_id, 0));
 
@@ -3148,4 +3401,5 @@ fr_app_io_t fr_master_app_io = {
 	.close			= mod_close,
 	.event_list_set		= mod_event_list_set,
 	.get_name		= mod_name,
+	.stats_print		= mod_stats_print,
 };
@@ -84,6 +84,13 @@ typedef struct {
 	fr_time_delta_t			nak_lifetime;			//!< lifetime of NAKed clients
 	fr_time_delta_t			check_interval;			//!< polling for closed sockets
 
+	uint32_t			new_client_rate;		//!< dynamic client definitions per second,
+									///< per source network.  0 for no limit.
+	uint32_t			new_client_burst;		//!< how many definitions a network may start at once,
+									///< and how many NAKs before the network is NAKed.
+	uint8_t				new_client_ipv4_prefix;		//!< prefix IPv4 sources are grouped by.
+	uint8_t				new_client_ipv6_prefix;		//!< prefix IPv6 sources are grouped by.
+
 	bool				dynamic_clients;		//!< do we have dynamic clients.
 
 	CONF_SECTION			*server_cs;			//!< server CS for this listener
@@ -93,6 +100,9 @@ typedef struct {
 									///< app_io_* fields below for convenience.
 	fr_app_t			*app;				//!< main protocol handler
 	void				*app_instance;			//!< instance data for main protocol handler
+	bool				app_reply;			//!< call app->reply() in the network thread.
+	uint8_t				app_reply_code;			//!< first octet of packets which app->reply()
+									///< answers.
 
 	fr_app_io_t const		*app_io;			//!< Easy access to the app_io handle.
 	void				*app_io_instance;		//!< Easy access to the app_io instance.
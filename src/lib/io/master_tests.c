@@ -0,0 +1,186 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the rate limits on dynamic client definitions
+ *
+ * @file src/lib/io/master_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "master.c"
+
+static fr_app_io_t test_app_io = {
+	.common = {
+		.name = "master_tests"
+	}
+};
+
+static void test_inst_init(fr_io_instance_t *inst, uint32_t rate, uint32_t burst)
+{
+	*inst = (fr_io_instance_t) {
+		.app_io = &test_app_io,
+		.nak_lifetime = fr_time_delta_from_sec(30),
+		.new_client_rate = rate,
+		.new_client_burst = burst,
+		.new_client_ipv4_prefix = 24,
+		.new_client_ipv6_prefix = 64
+	};
+}
+
+static fr_io_thread_t *test_thread_alloc(TALLOC_CTX *ctx)
+{
+	fr_io_thread_t *thread;
+
+	MEM(thread = talloc_zero(ctx, fr_io_thread_t));
+	MEM(thread->networks = fr_trie_alloc(thread, NULL, NULL));
+	fr_dlist_talloc_init(&thread->network_lru, fr_io_network_t, entry);
+
+	return thread;
+}
+
+static fr_ipaddr_t test_ipaddr(char const *addr)
+{
+	fr_ipaddr_t ipaddr;
+
+	(void) fr_inet_pton(&ipaddr, addr, strlen(addr), AF_UNSPEC, false, true);
+
+	return ipaddr;
+}
+
+static bool test_allowed(fr_io_instance_t const *inst, fr_io_thread_t *thread, char const *addr)
+{
+	fr_ipaddr_t ipaddr = test_ipaddr(addr);
+
+	return network_limit_check(inst, thread, &ipaddr);
+}
+
+static void test_burst(void)
+{
+	fr_io_instance_t	inst;
+	fr_io_thread_t		*thread;
+
+	/*
+	 *	At one definition a second, the bucket doesn't
+	 *	refill while the test runs.
+	 */
+	test_inst_init(&inst, 1, 2);
+	thread = test_thread_alloc(NULL);
+
+	TEST_CASE("A network may start new_client_burst definitions at once");
+	TEST_CHECK(test_allowed(&inst, thread, "192.0.2.1"));
+	TEST_CHECK(test_allowed(&inst, thread, "192.0.2.2"));
+	TEST_CHECK(!test_allowed(&inst, thread, "192.0.2.3"));
+	TEST_CHECK(thread->stats.rate_limited == 1);
+
+	TEST_CASE("Other networks have their own limits");
+	TEST_CHECK(test_allowed(&inst, thread, "198.51.100.1"));
+	TEST_CHECK(test_allowed(&inst, thread, "2001:db8::1"));
+	TEST_CHECK(test_allowed(&inst, thread, "2001:db8::2"));
+	TEST_CHECK(!test_allowed(&inst, thread, "2001:db8::3"));
+	TEST_CHECK(test_allowed(&inst, thread, "2001:db8:0:1::1"));
+	TEST_CHECK(thread->stats.rate_limited == 2);
+
+	talloc_free(thread);
+}
+
+static void test_refill(void)
+{
+	fr_io_instance_t	inst;
+	fr_io_thread_t		*thread;
+
+	test_inst_init(&inst, 1000, 1);
+	thread = test_thread_alloc(NULL);
+
+	TEST_CASE("The bucket refills at new_client_rate");
+	TEST_CHECK(test_allowed(&inst, thread, "192.0.2.1"));
+	usleep(5000);
+	TEST_CHECK(test_allowed(&inst, thread, "192.0.2.2"));
+
+	talloc_free(thread);
+}
+
+static void test_nak(void)
+{
+	fr_io_instance_t	inst;
+	fr_io_thread_t		*thread;
+	fr_ipaddr_t		ipaddr;
+
+	test_inst_init(&inst, 1000, 2);
+	thread = test_thread_alloc(NULL);
+
+	TEST_CASE("A network is NAKed once new_client_burst clients in it are NAKed");
+	TEST_CHECK(test_allowed(&inst, thread, "192.0.2.1"));
+	ipaddr = test_ipaddr("192.0.2.1");
+	network_limit_nak(&inst, thread, &ipaddr);
+	usleep(5000);
+	TEST_CHECK(test_allowed(&inst, thread, "192.0.2.2"));
+	TEST_CHECK(thread->stats.network_nak == 0);
+
+	ipaddr = test_ipaddr("192.0.2.2");
+	network_limit_nak(&inst, thread, &ipaddr);
+	usleep(5000);
+	TEST_CHECK(!test_allowed(&inst, thread, "192.0.2.3"));
+	TEST_CHECK(thread->stats.network_nak == 1);
+	TEST_CHECK(thread->stats.rate_limited == 0);
+
+	TEST_CASE("Other networks are not NAKed");
+	TEST_CHECK(test_allowed(&inst, thread, "198.51.100.1"));
+
+	talloc_free(thread);
+}
+
+static void test_table_full(void)
+{
+	fr_io_instance_t	inst;
+	fr_io_thread_t		*thread;
+	fr_ipaddr_t		ipaddr;
+	uint32_t		i;
+
+	test_inst_init(&inst, 1, 2);
+	thread = test_thread_alloc(NULL);
+
+	TEST_CASE("Networks which are still limited are not expired");
+	ipaddr = test_ipaddr("10.0.0.0");
+	for (i = 0; i < MAX_NETWORK_LIMITS; i++) {
+		uint32_t addr = htonl(0x0a000000 | (i << 8));
+
+		memcpy(&ipaddr.addr.v4.s_addr, &addr, sizeof(addr));
+		if (!network_limit_check(&inst, thread, &ipaddr)) break;
+	}
+	TEST_CHECK(i == MAX_NETWORK_LIMITS);
+	TEST_CHECK(fr_dlist_num_elements(&thread->network_lru) == MAX_NETWORK_LIMITS);
+
+	TEST_CASE("New networks are refused when the table is full");
+	TEST_CHECK(!test_allowed(&inst, thread, "192.0.2.1"));
+	TEST_CHECK(thread->stats.rate_limited == 1);
+
+	TEST_CASE("Networks already in the table are still allowed");
+	TEST_CHECK(test_allowed(&inst, thread, "10.0.0.1"));
+
+	talloc_free(thread);
+}
+
+TEST_LIST = {
+	{ "fr_io_network_limit_burst",		test_burst	},
+	{ "fr_io_network_limit_refill",		test_refill	},
+	{ "fr_io_network_limit_nak",		test_nak	},
+	{ "fr_io_network_limit_table_full",	test_table_full	},
+
+	{ NULL }
+};
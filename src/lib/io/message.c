@@ -157,14 +157,14 @@ fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_
 	CACHE_ALIGN(message_size);
 	ms->message_size = message_size;
 
-	ms->rb_array[0] = fr_ring_buffer_create(ms, ring_buffer_size);
+	ms->rb_array[0] = fr_ring_buffer_create(ms, ring_buffer_size, true);
 	if (!ms->rb_array[0]) {
 		talloc_free(ms);
 		return NULL;
 	}
 	ms->rb_max = 0;
 
-	ms->mr_array[0] = fr_ring_buffer_create(ms, num_messages * message_size);
+	ms->mr_array[0] = fr_ring_buffer_create(ms, num_messages * message_size, true);
 	if (!ms->mr_array[0]) {
 		talloc_free(ms);
 		return NULL;
@@ -752,7 +752,7 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 	 *	Allocate another message ring, double the size
 	 *	of the previous maximum.
 	 */
-	mr = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->mr_array[ms->mr_max]) * 2);
+	mr = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->mr_array[ms->mr_max]) * 2, true);
 	if (!mr) {
 		fr_strerror_const_push("Failed allocating ring buffer");
 		return NULL;
@@ -875,7 +875,7 @@ alloc_rb:
 	 *	Allocate another message ring, double the size
 	 *	of the previous maximum.
 	 */
-	rb = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->rb_array[ms->rb_max]) * 2);
+	rb = fr_ring_buffer_create(ms, fr_ring_buffer_size(ms->rb_array[ms->rb_max]) * 2, true);
 	if (!rb) {
 		fr_strerror_const_push("Failed allocating ring buffer");
 		goto cleanup;
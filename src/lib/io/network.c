@@ -32,6 +32,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/rb.h>
+#include <freeradius-devel/util/rcu.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/talloc.h>
@@ -64,12 +65,25 @@ typedef struct {
 	fr_time_delta_t		predicted;		//!< predicted processing time for one packet
 
 	bool			blocked;		//!< is this worker blocked?
+	int			numa_node;		//!< NUMA node the worker runs on, or -1 if unknown.
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
 	fr_io_stats_t		stats;
+
+	uint64_t		outstanding[FR_CHANNEL_PRIORITY_CLASS_MAX];	//!< requests of each class sent to
+										///< this worker, and not yet replied to.
 } fr_network_worker_t;
 
+/** Requests of one priority class, across all workers
+ *
+ */
+typedef struct {
+	uint64_t		outstanding;		//!< requests sent to workers, and not yet replied to
+	uint64_t		dropped;		//!< requests dropped because of max_outstanding
+	fr_time_elapsed_t	latency;		//!< histogram of time from receiving a request to its reply
+} fr_network_priority_class_t;
+
 typedef struct {
 	fr_rb_node_t		listen_node;		//!< rbtree node for looking up by listener.
 	fr_rb_node_t		num_node;		//!< rbtree node for looking up by number.
@@ -136,6 +150,8 @@ struct fr_network_s {
 
 	int			num_workers;		//!< number of active workers
 	int			num_blocked;		//!< number of blocked workers
+
+	fr_network_priority_class_t priority_class[FR_CHANNEL_PRIORITY_CLASS_MAX];	//!< per-class stats
 	int			num_pending_workers;	//!< number of workers we're waiting to start.
 	int			max_workers;		//!< maximum number of allowed workers
 	int			num_sockets;		//!< actually a counter...
@@ -147,6 +163,10 @@ struct fr_network_s {
 
 	fr_network_config_t	config;			//!< configuration
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
+
+	int			numa_node;		//!< NUMA node we run on, or -1 if unknown.
+	int			num_local_workers;	//!< number of workers on our NUMA node.
+	int			local_workers[MAX_WORKERS];	//!< indexes into workers[] of the local workers.
 };
 
 static void fr_network_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
@@ -154,12 +174,29 @@ static int fr_network_pre_event(fr_time_t now, fr_time_delta_t wake, void *uctx)
 static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s);
 static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int flags, void *ctx);
 
+/** Rebuild the list of workers which are on the same NUMA node as the network
+ *
+ */
+static void network_local_workers_update(fr_network_t *nr)
+{
+	int i;
+
+	nr->num_local_workers = 0;
+	if (nr->numa_node < 0) return;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		if (!nr->workers[i] || (nr->workers[i]->numa_node != nr->numa_node)) continue;
+
+		nr->local_workers[nr->num_local_workers++] = i;
+	}
+}
+
 static int8_t reply_cmp(void const *one, void const *two)
 {
 	fr_channel_data_t const *a = one, *b = two;
 	int ret;
 
-	ret = CMP(a->priority, b->priority);
+	ret = CMP_PREFER_LARGER(a->priority, b->priority);
 	if (ret != 0) return ret;
 
 	return fr_time_cmp(a->m.when, b->m.when);
@@ -170,7 +207,7 @@ static int8_t waiting_cmp(void const *one, void const *two)
 	fr_channel_data_t const *a = one, *b = two;
 	int ret;
 
-	ret = CMP(a->priority, b->priority);
+	ret = CMP_PREFER_LARGER(a->priority, b->priority);
 	if (ret != 0) return ret;
 
 	return fr_time_cmp(a->reply.request_time, b->reply.request_time);
@@ -210,7 +247,7 @@ static inline fr_ring_buffer_t *fr_network_rb_init(void)
 	rb = fr_network_rb;
 	if (rb) return rb;
 
-	rb = fr_ring_buffer_create(NULL, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE);
+	rb = fr_ring_buffer_create(NULL, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE, false);
 	if (!rb) {
 		fr_perror("Failed allocating memory for network ring buffer");
 		return NULL;
@@ -285,6 +322,19 @@ int fr_network_directory_add(fr_network_t *nr, fr_listen_t *li)
 	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_DIRECTORY, &li, sizeof(li));
 }
 
+/** Record which NUMA node the network is running on
+ *
+ * Requests are then preferentially sent to workers on the same node.
+ *
+ * @param nr the network
+ * @param node the NUMA node, or -1 if the network isn't bound to one.
+ */
+void fr_network_numa_node_set(fr_network_t *nr, int node)
+{
+	nr->numa_node = node;
+	network_local_workers_update(nr);
+}
+
 /** Add a worker to a network
  *
  * @param nr the network
@@ -462,6 +512,17 @@ static void fr_network_unsuspend(fr_network_t *nr)
 }
 
 #define IALPHA (8)
+#define OUTSTANDING(_x) ((_x)->stats.in - (_x)->stats.out)
+
+/*
+ *	Requests sent to a worker on another NUMA node pay for
+ *	cross-node memory traffic.  Make those workers look 50% busier,
+ *	so that remote workers are only used when the local ones are
+ *	noticeably more loaded.
+ */
+#define NUMA_COST(_nr, _w) ((((_nr)->numa_node < 0) || ((_w)->numa_node == (_nr)->numa_node)) ? \
+			    OUTSTANDING(_w) : (OUTSTANDING(_w) + (OUTSTANDING(_w) >> 1) + 1))
+
 #define RTT(_old, _new) fr_time_delta_wrap((fr_time_delta_unwrap(_new) + (fr_time_delta_unwrap(_old) * (IALPHA - 1))) / IALPHA)
 
 /** Callback which handles a message being received on the network side.
@@ -474,6 +535,8 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 {
 	fr_network_t *nr = ctx;
 	fr_network_worker_t *worker;
+	fr_channel_priority_class_t pclass = fr_channel_priority_class(cd->priority);
+	fr_network_priority_class_t *pc = &nr->priority_class[pclass];
 
 	cd->channel.ch = ch;
 
@@ -482,6 +545,20 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 	 */
 	worker = fr_channel_requestor_uctx_get(ch);
 	worker->stats.out++;
+
+	if (worker->outstanding[pclass] > 0) {
+		worker->outstanding[pclass]--;
+		pc->outstanding--;
+	}
+	fr_time_elapsed_update(&pc->latency, cd->reply.request_time, fr_time());
+
+	/*
+	 *	Another worker took the request from the one we sent
+	 *	it to.  The timing and load information describe the
+	 *	other worker, so they're no use here.
+	 */
+	if (cd->reply.origin) goto insert;
+
 	worker->cpu_time = cd->reply.cpu_time;
 	if (!fr_time_delta_ispos(worker->predicted)) {
 		worker->predicted = cd->reply.processing_time;
@@ -489,15 +566,38 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 		worker->predicted = RTT(worker->predicted, cd->reply.processing_time);
 	}
 
+	/*
+	 *	The worker is shedding load.  Stop sending it new
+	 *	requests until it says otherwise, and if every worker
+	 *	is in the same state, stop reading from the sockets.
+	 *	The packets then queue in the kernel, and are dropped
+	 *	there, instead of costing us memory and CPU.
+	 *
+	 *	The worker only tells us its state when it replies,
+	 *	so it's not blocked once it has nothing outstanding.
+	 *	Otherwise we'd never hear from it again.
+	 */
+	if (cd->reply.overloaded && (OUTSTANDING(worker) > 0)) {
+		if (!worker->blocked) {
+			worker->blocked = true;
+			nr->num_blocked++;
+
+			RATE_LIMIT_GLOBAL(WARN, "Worker is overloaded - %u/%u workers are blocked",
+					  nr->num_blocked, nr->num_workers);
+
+			if (nr->num_blocked == nr->num_workers) fr_network_suspend(nr);
+		}
+
 	/*
 	 *	Unblock the worker.
 	 */
-	if (worker->blocked) {
+	} else if (worker->blocked) {
 		worker->blocked = false;
 		nr->num_blocked--;
 		fr_network_unsuspend(nr);
 	}
 
+insert:
 	/*
 	 *	Ensure that heap insert works.
 	 */
@@ -508,6 +608,47 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 	}
 }
 
+/** Remove a worker whose channel has closed
+ *
+ * The worker discards any requests it hasn't replied to, so they're
+ * no longer outstanding in their priority class.
+ *
+ * @param[in] nr	the network
+ * @param[in] w		the worker to remove
+ */
+static void network_worker_remove(fr_network_t *nr, fr_network_worker_t *w)
+{
+	int i;
+
+	for (i = 0; i < FR_CHANNEL_PRIORITY_CLASS_MAX; i++) {
+		fr_assert(nr->priority_class[i].outstanding >= w->outstanding[i]);
+		nr->priority_class[i].outstanding -= w->outstanding[i];
+		w->outstanding[i] = 0;
+	}
+
+	/*
+	 *	Remove this worker from the array
+	 */
+	for (i = 0; i < nr->num_workers; i++) {
+		DEBUG3("Worker acked our close request");
+		if (nr->workers[i] == w) {
+			nr->workers[i] = NULL;
+
+			if (i == (nr->num_workers - 1)) break;
+
+			/*
+			 *	Close the hole...
+			 */
+			memmove(&nr->workers[i], &nr->workers[i + 1],
+				((nr->num_workers - i) - 1) * sizeof(nr->workers[0]));
+			nr->workers[nr->num_workers - 1] = NULL;
+			break;
+		}
+	}
+	nr->num_workers--;
+	network_local_workers_update(nr);
+}
+
 /** Handle a network control message callback for a channel
  *
  * This is called from the event loop when we get a notification
@@ -551,36 +692,11 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 		break;
 
 	case FR_CHANNEL_CLOSE:
-	{
-		fr_network_worker_t	*w = talloc_get_type_abort(fr_channel_requestor_uctx_get(ch),
-								   fr_network_worker_t);
-		int			i;
-
-		/*
-		 *	Remove this worker from the array
-		 */
-		for (i = 0; i < nr->num_workers; i++) {
-			DEBUG3("Worker acked our close request");
-			if (nr->workers[i] == w) {
-				nr->workers[i] = NULL;
-
-				if (i == (nr->num_workers - 1)) break;
-
-				/*
-				 *	Close the hole...
-				 */
-				memcpy(&nr->workers[i], &nr->workers[i + 1], ((nr->num_workers - i) - 1));
-				break;
-			}
-		}
-		nr->num_workers--;
-	}
+		network_worker_remove(nr, talloc_get_type_abort(fr_channel_requestor_uctx_get(ch), fr_network_worker_t));
 		break;
 	}
 }
 
-#define OUTSTANDING(_x) ((_x)->stats.in - (_x)->stats.out)
-
 /** Send a message on the "best" channel.
  *
  * @param nr the network
@@ -589,9 +705,23 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 {
 	fr_network_worker_t *worker;
+	fr_channel_priority_class_t pclass = fr_channel_priority_class(cd->priority);
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
+	/*
+	 *	Too many requests of this class are already in the
+	 *	workers.  Drop it, so that the other classes still
+	 *	have room in the channels and message sets.
+	 */
+	if (nr->config.priority[pclass].max_outstanding &&
+	    (nr->priority_class[pclass].outstanding >= nr->config.priority[pclass].max_outstanding)) {
+		RATE_LIMIT_GLOBAL(WARN, "max_outstanding for %s priority packets reached - dropping packet",
+				  channel_priority_class_names[pclass]);
+		nr->priority_class[pclass].dropped++;
+		return -1;
+	}
+
 retry:
 	if (nr->num_workers == 1) {
 		worker = nr->workers[0];
@@ -607,7 +737,17 @@ retry:
 		int64_t cmp;
 		uint32_t one, two;
 
-		one = fr_rand() % nr->num_workers;
+		/*
+		 *	If we know which NUMA node we're on, the first
+		 *	choice is always a worker on the same node.  The
+		 *	second choice is any worker, so that load can
+		 *	still spill over to the other nodes.
+		 */
+		if (nr->num_local_workers > 0) {
+			one = nr->local_workers[fr_rand() % nr->num_local_workers];
+		} else {
+			one = fr_rand() % nr->num_workers;
+		}
 		do {
 			two = fr_rand() % nr->num_workers;
 		} while (two == one);
@@ -620,7 +760,7 @@ retry:
 		 *	outstanding requests, then choose the worker
 		 *	which has used the least total CPU time.
 		 */
-		cmp = (OUTSTANDING(nr->workers[one]) - OUTSTANDING(nr->workers[two]));
+		cmp = (NUMA_COST(nr, nr->workers[one]) - NUMA_COST(nr, nr->workers[two]));
 		if (cmp < 0) {
 			worker = nr->workers[one];
 
@@ -719,6 +859,8 @@ retry:
 	}
 
 	worker->stats.in++;
+	worker->outstanding[pclass]++;
+	nr->priority_class[pclass].outstanding++;
 
 	/*
 	 *	We're projecting that the worker will use more CPU
@@ -766,6 +908,7 @@ int fr_network_listen_send_packet(fr_network_t *nr, fr_listen_t *parent, fr_list
 	cd->priority = PRIORITY_NORMAL;
 	cd->packet_ctx = packet_ctx;
 	cd->request.recv_time = recv_time;
+	cd->request.decoded_len = 0;
 	memcpy(cd->m.data, buffer, buflen);
 	cd->m.when = fr_time();
 
@@ -941,14 +1084,26 @@ next_message:
 	 */
 	cd->m.when = fr_time();
 	cd->listen = s->listen;
+	cd->request.decoded_len = 0;
 
 	/*
 	 *	Nothing in the buffer yet.  Allocate room for one
 	 *	packet.
 	 */
 	if ((cd->m.data_size == 0) && (!s->leftover)) {
+		/*
+		 *	Decode the packet here if the listener wants
+		 *	us to.  The pairs go after the packet, in the
+		 *	room we reserved for it.
+		 */
+		if (s->listen->app->predecode && ((size_t) data_size < cd->m.rb_size)) {
+			cd->request.decoded_len = s->listen->app->predecode(s->listen->app_instance, cd->packet_ctx,
+									   cd->m.data + data_size,
+									   cd->m.rb_size - data_size,
+									   cd->m.data, data_size);
+		}
 
-		(void) fr_message_alloc(s->ms, &cd->m, data_size);
+		(void) fr_message_alloc(s->ms, &cd->m, data_size + cd->request.decoded_len);
 		next = NULL;
 
 	} else {
@@ -1032,6 +1187,7 @@ int fr_network_sendto_worker(fr_network_t *nr, fr_listen_t *li, void *packet_ctx
 	cd->m.when = recv_time;
 	cd->listen = li;
 	cd->packet_ctx = packet_ctx;
+	cd->request.decoded_len = 0;
 
 	memcpy(cd->m.data, data, data_len);
 
@@ -1501,6 +1657,7 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 	MEM(w = talloc_zero(nr, fr_network_worker_t));
 
 	w->worker = worker;
+	w->numa_node = fr_worker_numa_node(worker);
 	w->channel = fr_worker_channel_create(worker, w, nr->control);
 	w->predicted = fr_time_delta_from_msec(10);
 	fr_fatal_assert_msg(w->channel, "Failed creating new channel");
@@ -1523,6 +1680,7 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 		if (nr->workers[i]) continue;
 
 		nr->workers[i] = w;
+		network_local_workers_update(nr);
 		return;
 	}
 
@@ -1780,6 +1938,8 @@ static void _signal_pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int fla
  */
 void fr_network(fr_network_t *nr)
 {
+	if (fr_rcu_thread_register() < 0) PERROR("Failed registering for RCU updates");
+
 	/*
 	 *	Run until we're told to exit AND the number of
 	 *	workers has dropped to zero.
@@ -1803,12 +1963,27 @@ void fr_network(fr_network_t *nr)
 		 */
 		wait_for_event = (fr_heap_num_elements(nr->replies) == 0);
 
+		/*
+		 *	If replies are arriving quickly, look for the
+		 *	next one for a little while before going to
+		 *	sleep.  The workers then don't have to wake us
+		 *	up.
+		 */
+		if (wait_for_event && fr_control_poll(nr->control)) wait_for_event = false;
+
 		/*
 		 *	Check the event list.  If there's an error
 		 *	(e.g. exit), we stop looping and clean up.
 		 */
 		DEBUG4("Gathering events - %s", wait_for_event ? "will wait" : "Will not wait");
+
+		/*
+		 *	Clients found by earlier lookups have been copied,
+		 *	so we hold no references to data published via RCU.
+		 */
+		if (wait_for_event) fr_rcu_thread_offline();
 		num_events = fr_event_corral(nr->el, fr_time(), wait_for_event);
+		fr_rcu_quiescent();
 		DEBUG4("%u event(s) pending%s",
 		       num_events == -1 ? 0 : num_events, num_events == -1 ? " - event loop exiting" : "");
 		if (num_events < 0) break;
@@ -1821,7 +1996,8 @@ void fr_network(fr_network_t *nr)
 			fr_event_service(nr->el);
 		}
 	}
-	return;
+
+	fr_rcu_thread_unregister();
 }
 
 /** Signal a network thread to exit
@@ -1888,6 +2064,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 
 	nr->max_workers = MAX_WORKERS;
 	nr->num_workers = 0;
+	nr->numa_node = -1;
 	nr->signal_pipe[0] = -1;
 	nr->signal_pipe[1] = -1;
 	if (config) nr->config = *config;
@@ -1912,7 +2089,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 	 *	if so, skip the whole control plane / kevent /
 	 *	whatever roundabout thing.
 	 */
-	nr->rb = fr_ring_buffer_create(nr, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE);
+	nr->rb = fr_ring_buffer_create(nr, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE, false);
 	if (!nr->rb) {
 		fr_strerror_const_push("Failed creating ring buffer");
 	fail2:
@@ -2021,9 +2198,33 @@ void fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log)
 	}
 }
 
+/** Get the current load of the workers of a network thread
+ *
+ * This is cheap enough to call for every packet.
+ *
+ * @param[in] nr	the network.
+ * @param[out] load	where the load is written.
+ */
+void fr_network_load(fr_network_t const *nr, fr_io_load_t *load)
+{
+	int i;
+
+	*load = (fr_io_load_t) {
+		.num_workers = nr->num_workers,
+		.num_blocked = nr->num_blocked,
+	};
+
+	for (i = 0; i < nr->max_workers; i++) {
+		if (!nr->workers[i]) continue;
+
+		load->outstanding += OUTSTANDING(nr->workers[i]);
+	}
+}
+
 static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
 {
 	fr_network_t const *nr = ctx;
+	unsigned int i;
 
 	fprintf(fp, "count.in\t%" PRIu64 "\n", nr->stats.in);
 	fprintf(fp, "count.out\t%" PRIu64 "\n", nr->stats.out);
@@ -2031,6 +2232,18 @@ static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cm
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
 	fprintf(fp, "count.sockets\t%u\n", fr_rb_num_elements(nr->sockets));
 
+	for (i = 0; i < FR_CHANNEL_PRIORITY_CLASS_MAX; i++) {
+		char prefix[64];
+
+		fprintf(fp, "count.%s.outstanding\t%" PRIu64 "\n", channel_priority_class_names[i],
+			nr->priority_class[i].outstanding);
+		fprintf(fp, "count.%s.dropped\t%" PRIu64 "\n", channel_priority_class_names[i],
+			nr->priority_class[i].dropped);
+
+		snprintf(prefix, sizeof(prefix), "time.%s", channel_priority_class_names[i]);
+		fr_time_elapsed_fprint(fp, &nr->priority_class[i].latency, prefix, 4);
+	}
+
 	return 0;
 }
 
@@ -2070,6 +2283,8 @@ static int cmd_stats_socket(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t con
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", s->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", s->stats.dropped);
 
+	if (s->listen->app_io->stats_print) s->listen->app_io->stats_print(s->listen, fp);
+
 	return 0;
 }
 
@@ -44,6 +44,8 @@ extern "C" {
 
 typedef struct {
 	uint32_t	max_outstanding;
+
+	fr_channel_priority_config_t priority[FR_CHANNEL_PRIORITY_CLASS_MAX];	//!< Limits for each class of packets.
 } fr_network_config_t;
 
 int		fr_network_listen_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
@@ -54,6 +56,8 @@ int		fr_network_directory_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull
 
 int		fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
 
+void		fr_network_numa_node_set(fr_network_t *nr, int node) CC_HINT(nonnull);
+
 void		fr_network_listen_read(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
 
 void		fr_network_listen_write(fr_network_t *nr, fr_listen_t *li, uint8_t const *packet, size_t packet_len,
@@ -82,6 +86,8 @@ int		fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats) CC_HINT(
 
 void		fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log) CC_HINT(nonnull);
 
+void		fr_network_load(fr_network_t const *nr, fr_io_load_t *load) CC_HINT(nonnull);
+
 extern fr_cmd_table_t cmd_network_table[];
 
 #ifdef __cplusplus
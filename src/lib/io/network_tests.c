@@ -0,0 +1,204 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the network's accounting of priority classes
+ *
+ * @file src/lib/io/network_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "network.c"
+
+typedef struct {
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el;
+	fr_control_t		*responder;	//!< The worker side of the channels.
+	fr_message_set_t	*ms;
+	fr_network_t		*nr;
+} test_network_t;
+
+static void test_network_init(test_network_t *tn, uint32_t low_max_outstanding)
+{
+	fr_network_config_t	config = {};
+	fr_atomic_queue_t	*aq;
+
+	config.priority[FR_CHANNEL_PRIORITY_CLASS_LOW].max_outstanding = low_max_outstanding;
+
+	MEM(tn->ctx = talloc_init_const("network_tests"));
+	MEM(tn->el = fr_event_list_alloc(tn->ctx, NULL, NULL));
+	MEM(aq = fr_atomic_queue_alloc(tn->ctx, 1024));
+	MEM(tn->responder = fr_control_create(tn->ctx, tn->el, aq));
+	MEM(tn->ms = fr_message_set_create(tn->ctx, 1024, sizeof(fr_channel_data_t), 1024 * 64));
+	MEM(tn->nr = fr_network_create(tn->ctx, tn->el, "network_tests", &default_log, L_DBG_LVL_OFF, &config));
+}
+
+/** Add a worker, without starting a worker thread
+ *
+ * Requests sent to it stay in its channel, until the test replies to them.
+ */
+static fr_network_worker_t *test_worker_add(test_network_t *tn)
+{
+	fr_network_t		*nr = tn->nr;
+	fr_network_worker_t	*w;
+
+	MEM(w = talloc_zero(nr, fr_network_worker_t));
+	w->numa_node = -1;
+	w->predicted = fr_time_delta_from_msec(10);
+	MEM(w->channel = fr_channel_create(w, nr->control, tn->responder, false));
+
+	fr_channel_requestor_uctx_add(w->channel, w);
+	fr_channel_set_recv_reply(w->channel, nr, fr_network_recv_reply);
+
+	nr->workers[nr->num_workers++] = w;
+
+	return w;
+}
+
+static fr_channel_data_t *test_cd_alloc(test_network_t *tn, uint32_t priority)
+{
+	fr_channel_data_t *cd;
+
+	cd = (fr_channel_data_t *) fr_message_alloc(tn->ms, NULL, 1);
+	fr_assert(cd != NULL);
+
+	cd->m.when = fr_time();
+	cd->priority = priority;
+	cd->packet_ctx = NULL;
+	cd->listen = NULL;
+	cd->request.recv_time = cd->m.when;
+	cd->request.decoded_len = 0;
+
+	return cd;
+}
+
+static int test_send(test_network_t *tn, uint32_t priority)
+{
+	fr_channel_data_t	*cd = test_cd_alloc(tn, priority);
+	int			ret;
+
+	ret = fr_network_send_request(tn->nr, cd);
+	if (ret < 0) fr_message_done(&cd->m);
+
+	return ret;
+}
+
+/** Pretend that a worker has replied to one request
+ *
+ */
+static void test_reply(test_network_t *tn, fr_network_worker_t *w, uint32_t priority)
+{
+	fr_channel_data_t	*cd = test_cd_alloc(tn, priority);
+	fr_time_t		now = cd->m.when;
+
+	cd->reply.cpu_time = fr_time_delta_wrap(0);
+	cd->reply.processing_time = fr_time_delta_wrap(0);
+	cd->reply.request_time = now;
+	cd->reply.overloaded = false;
+	cd->reply.origin = NULL;
+	fr_network_recv_reply(tn->nr, w->channel, cd);
+
+	while ((cd = fr_heap_pop(&tn->nr->replies)) != NULL) fr_message_done(&cd->m);
+}
+
+#define LOW	FR_CHANNEL_PRIORITY_CLASS_LOW
+#define HIGH	FR_CHANNEL_PRIORITY_CLASS_HIGH
+
+static void test_max_outstanding(void)
+{
+	test_network_t		tn;
+	fr_network_t		*nr;
+	fr_network_worker_t	*w;
+	int			i;
+
+	test_network_init(&tn, 4);
+	nr = tn.nr;
+	w = test_worker_add(&tn);
+
+	TEST_CASE("Requests up to max_outstanding are sent");
+	for (i = 0; i < 4; i++) TEST_CHECK(test_send(&tn, PRIORITY_LOW) == 0);
+	TEST_CHECK_RET(nr->priority_class[LOW].outstanding, 4);
+	TEST_CHECK_RET(w->outstanding[LOW], 4);
+
+	TEST_CASE("Requests over max_outstanding are dropped");
+	TEST_CHECK(test_send(&tn, PRIORITY_LOW) < 0);
+	TEST_CHECK_RET(nr->priority_class[LOW].outstanding, 4);
+	TEST_CHECK_RET(nr->priority_class[LOW].dropped, 1);
+
+	TEST_CASE("Other classes are still sent");
+	TEST_CHECK(test_send(&tn, PRIORITY_HIGH) == 0);
+	TEST_CHECK_RET(nr->priority_class[HIGH].outstanding, 1);
+	TEST_CHECK_RET(nr->priority_class[HIGH].dropped, 0);
+
+	TEST_CASE("A reply makes room for another request");
+	test_reply(&tn, w, PRIORITY_LOW);
+	TEST_CHECK_RET(nr->priority_class[LOW].outstanding, 3);
+	TEST_CHECK(test_send(&tn, PRIORITY_LOW) == 0);
+	TEST_CHECK(test_send(&tn, PRIORITY_LOW) < 0);
+	TEST_CHECK_RET(nr->priority_class[LOW].dropped, 2);
+
+	talloc_free(tn.ctx);
+}
+
+static void test_worker_close(void)
+{
+	test_network_t		tn;
+	fr_network_t		*nr;
+	fr_network_worker_t	*a, *b;
+	int			i;
+
+	test_network_init(&tn, 8);
+	nr = tn.nr;
+	a = test_worker_add(&tn);
+	b = test_worker_add(&tn);
+
+	/*
+	 *	Requests go to whichever worker has fewer outstanding.
+	 */
+	for (i = 0; i < 8; i++) TEST_CHECK(test_send(&tn, PRIORITY_LOW) == 0);
+	for (i = 0; i < 2; i++) TEST_CHECK(test_send(&tn, PRIORITY_HIGH) == 0);
+	TEST_CHECK_RET(nr->priority_class[LOW].outstanding, 8);
+	TEST_CHECK_RET(nr->priority_class[HIGH].outstanding, 2);
+	TEST_CHECK((a->outstanding[LOW] + b->outstanding[LOW]) == 8);
+	TEST_CHECK(a->outstanding[LOW] > 0);
+	TEST_CHECK(b->outstanding[LOW] > 0);
+	TEST_CHECK(test_send(&tn, PRIORITY_LOW) < 0);
+
+	TEST_CASE("Requests a closed worker discarded are no longer outstanding");
+	network_worker_remove(nr, a);
+	TEST_CHECK_RET(nr->num_workers, 1);
+	TEST_CHECK(nr->priority_class[LOW].outstanding == b->outstanding[LOW]);
+	TEST_CHECK(nr->priority_class[HIGH].outstanding == b->outstanding[HIGH]);
+
+	TEST_CASE("Their class can use the room");
+	TEST_CHECK(test_send(&tn, PRIORITY_LOW) == 0);
+	TEST_CHECK(b->outstanding[LOW] == nr->priority_class[LOW].outstanding);
+
+	TEST_CASE("Late replies from the closed worker are ignored");
+	test_reply(&tn, a, PRIORITY_LOW);
+	TEST_CHECK(nr->priority_class[LOW].outstanding == b->outstanding[LOW]);
+
+	talloc_free(tn.ctx);
+}
+
+TEST_LIST = {
+	{ "fr_network_max_outstanding",	test_max_outstanding	},
+	{ "fr_network_worker_close",	test_worker_close	},
+
+	{ NULL }
+};
@@ -0,0 +1,8 @@
+TARGET		:= network_tests$(E)
+SOURCES		:= network_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-io$(L)
+
+TGT_INSTALLDIR	:=
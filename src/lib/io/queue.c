@@ -221,32 +221,34 @@ done:
  */
 int fr_queue_localize_atomic(fr_queue_t *fq, fr_atomic_queue_t *aq)
 {
-	void *data;
-	int i, room;
+	int total = 0;
 
 	(void) talloc_get_type_abort(fq, fr_queue_t);
 
 	/*
-	 *	No room to push anything, return an error.
+	 *	Pop as many entries as we have room for.  The free
+	 *	space may wrap around the end of the array, so we pop
+	 *	at most twice.
 	 */
-	room = fq->size - fq->num;
-	if (!room) return 0;
+	while (fq->num < fq->size) {
+		int room, num;
 
-	/*
-	 *	Pop as many entries as we have room for.
-	 */
-	for (i = 0; i < room; i++) {
-		if (!fr_atomic_queue_pop(aq, &data)) {
-			return i;
-		}
+		room = fq->size - fq->num;
+		if (room > (fq->size - fq->head)) room = fq->size - fq->head;
 
-		fq->entry[fq->head++] = data;
+		num = fr_atomic_queue_pop_bulk(aq, &fq->entry[fq->head], room);
+		if (!num) break;
+
+		fq->head += num;
 		if (fq->head >= fq->size) fq->head = 0;
-		fq->num++;
+		fq->num += num;
 		fr_assert(fq->num <= fq->size);
+
+		total += num;
+		if (num < room) break;
 	}
 
-	return room;
+	return total;
 }
 
 #ifndef NDEBUG
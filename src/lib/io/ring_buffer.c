@@ -28,6 +28,11 @@ RCSID("$Id$")
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/debug.h>
 #include <string.h>
+#include <sys/mman.h>
+
+#if defined(MADV_HUGEPAGE) || defined(MAP_HUGETLB)
+#  define RING_BUFFER_HAVE_HUGE_PAGES 1
+#endif
 
 /*
  *	Ring buffers are allocated in a block.
@@ -35,6 +40,8 @@ RCSID("$Id$")
 struct fr_ring_buffer_s {
 	uint8_t		*buffer;	//!< actual start of the ring buffer
 	size_t		size;		//!< Size of this ring buffer
+	bool		mapped;		//!< buffer is an anonymous mapping, not talloced
+	bool		huge;		//!< buffer is (probably) backed by huge pages
 
 	size_t		data_start;	//!< start of used portion of the buffer
 	size_t		data_end;	//!< end of used portion of the buffer
@@ -45,6 +52,123 @@ struct fr_ring_buffer_s {
 	bool		closed;		//!< whether allocations are closed
 };
 
+/*
+ *	Set once at startup, before any threads are started.
+ */
+static fr_ring_buffer_huge_pages_t	ring_buffer_huge_pages = FR_RING_BUFFER_HUGE_PAGES_NO;
+
+/** Set what kind of pages back ring buffers created from now on
+ *
+ * Ring buffers are read and written sequentially, and at high packet
+ * rates the threads walking them take a TLB miss every 4k.  With
+ * huge pages, each 2M of the ring needs a single TLB entry.
+ *
+ * Only ring buffers created with huge_pages set are affected.  They're
+ * rounded up to #FR_RING_BUFFER_HUGE_PAGE_SIZE when huge pages are
+ * enabled.  If no huge pages are available, the ring buffer is still
+ * created, just without them.
+ *
+ * @param[in] huge_pages	to use.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the platform has no way of asking for huge pages.
+ */
+int fr_ring_buffer_huge_pages_set(fr_ring_buffer_huge_pages_t huge_pages)
+{
+#ifndef RING_BUFFER_HAVE_HUGE_PAGES
+	if (huge_pages != FR_RING_BUFFER_HUGE_PAGES_NO) {
+		fr_strerror_const("Huge pages are not supported on this platform");
+		return -1;
+	}
+#endif
+
+	ring_buffer_huge_pages = huge_pages;
+
+	return 0;
+}
+
+#ifdef RING_BUFFER_HAVE_HUGE_PAGES
+static int _ring_buffer_free(fr_ring_buffer_t *rb)
+{
+	if (rb->mapped) munmap(rb->buffer, rb->size);
+
+	return 0;
+}
+
+#ifdef MADV_HUGEPAGE
+/** Map a 2M aligned range, and ask for it to be backed by transparent huge pages
+ *
+ * @param[out] huge	whether the kernel accepted the advice.
+ * @param[in] size	a multiple of #FR_RING_BUFFER_HUGE_PAGE_SIZE.
+ * @return
+ *	- The mapping on success.
+ *	- NULL on failure.
+ */
+static uint8_t *ring_buffer_map_transparent(bool *huge, size_t size)
+{
+	uint8_t		*p, *aligned;
+	size_t		head;
+
+	/*
+	 *	The kernel can only use a huge page for a 2M aligned
+	 *	range, so over-allocate, and trim either side.
+	 */
+	p = mmap(NULL, size + FR_RING_BUFFER_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) return NULL;
+
+	aligned = (uint8_t *)(((uintptr_t)p + (FR_RING_BUFFER_HUGE_PAGE_SIZE - 1)) &
+			      ~((uintptr_t)FR_RING_BUFFER_HUGE_PAGE_SIZE - 1));
+	head = aligned - p;
+	if (head) munmap(p, head);
+	munmap(aligned + size, FR_RING_BUFFER_HUGE_PAGE_SIZE - head);
+
+	/*
+	 *	Fails if the kernel was built without THP, in
+	 *	which case we've still got perfectly good memory.
+	 */
+	*huge = (madvise(aligned, size, MADV_HUGEPAGE) == 0);
+
+	return aligned;
+}
+#endif
+
+/** Map memory for a ring buffer, preferably backed by huge pages
+ *
+ * @param[in] rb	to allocate the buffer for.
+ * @param[in] size	a multiple of #FR_RING_BUFFER_HUGE_PAGE_SIZE.
+ * @return
+ *	- 0 on success.
+ *	- -1 if no mapping could be created.  The caller should use talloc.
+ */
+static int ring_buffer_map(fr_ring_buffer_t *rb, size_t size)
+{
+	uint8_t		*p = NULL;
+
+#ifdef MAP_HUGETLB
+	if (ring_buffer_huge_pages == FR_RING_BUFFER_HUGE_PAGES_EXPLICIT) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			rb->huge = true;
+		} else {
+			p = NULL;	/* Pool is empty or not configured, try THP */
+		}
+	}
+#endif
+
+#ifdef MADV_HUGEPAGE
+	if (!p) p = ring_buffer_map_transparent(&rb->huge, size);
+#endif
+	if (!p) return -1;
+
+	rb->buffer = p;
+	rb->mapped = true;
+	talloc_set_destructor(rb, _ring_buffer_free);
+
+	return 0;
+}
+#endif
+
 /** Create a ring buffer.
  *
  *  The size provided will be rounded up to the next highest power of
@@ -55,13 +179,17 @@ struct fr_ring_buffer_s {
  *  tracking the start of the reservation, *and* it's write offset
  *  within that reservation.
  *
- * @param[in] ctx	a talloc context
- * @param[in] size	of the raw ring buffer array to allocate.
+ * @param[in] ctx		a talloc context
+ * @param[in] size		of the raw ring buffer array to allocate.
+ * @param[in] huge_pages	back the ring buffer with huge pages, if they've been
+ *				enabled with #fr_ring_buffer_huge_pages_set.  Only worth it
+ *				for large, busy, ring buffers, as they're rounded up to
+ *				#FR_RING_BUFFER_HUGE_PAGE_SIZE.
  * @return
  *	- A new ring buffer on success.
  *	- NULL on failure.
  */
-fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
+fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size, bool huge_pages)
 {
 	fr_ring_buffer_t	*rb;
 
@@ -91,6 +219,17 @@ fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
 	size |= size >> 16;
 	size++;
 
+#ifdef RING_BUFFER_HAVE_HUGE_PAGES
+	if (huge_pages && (ring_buffer_huge_pages != FR_RING_BUFFER_HUGE_PAGES_NO)) {
+		if (size < FR_RING_BUFFER_HUGE_PAGE_SIZE) size = FR_RING_BUFFER_HUGE_PAGE_SIZE;
+
+		if (ring_buffer_map(rb, size) == 0) {
+			rb->size = size;
+			return rb;
+		}
+	}
+#endif
+
 	rb->buffer = talloc_array(rb, uint8_t, size);
 	if (!rb->buffer) {
 		talloc_free(rb);
@@ -452,6 +591,21 @@ size_t fr_ring_buffer_used(fr_ring_buffer_t *rb)
 	return size;
 }
 
+/** Whether the ring buffer was allocated from huge pages
+ *
+ * For transparent huge pages this only means the kernel was asked
+ * to use them.
+ *
+ * @param[in] rb a ring buffer
+ * @return true if the ring buffer is backed by huge pages.
+ */
+bool fr_ring_buffer_is_huge(fr_ring_buffer_t *rb)
+{
+	(void) talloc_get_type_abort(rb, fr_ring_buffer_t);
+
+	return rb->huge;
+}
+
 /** Get a pointer to the data at the start of the ring buffer.
  *
  * @param[in] rb a ring buffer
@@ -484,6 +638,6 @@ int fr_ring_buffer_start(fr_ring_buffer_t *rb, uint8_t **p_start, size_t *p_size
  */
 void fr_ring_buffer_debug(fr_ring_buffer_t *rb, FILE *fp)
 {
-	fprintf(fp, "Buffer %p, write_offset %zu, data_start %zu, data_end %zu\n",
-		rb->buffer, rb->write_offset, rb->data_start, rb->data_end);
+	fprintf(fp, "Buffer %p%s, write_offset %zu, data_start %zu, data_end %zu\n",
+		rb->buffer, rb->huge ? " (huge pages)" : "", rb->write_offset, rb->data_start, rb->data_end);
 }
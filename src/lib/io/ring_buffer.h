@@ -36,7 +36,25 @@ extern "C" {
 
 typedef struct fr_ring_buffer_s fr_ring_buffer_t;
 
-fr_ring_buffer_t	*fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size);
+/** What kind of pages back new ring buffers
+ *
+ */
+typedef enum {
+	FR_RING_BUFFER_HUGE_PAGES_NO = 0,		//!< Allocate from talloc.
+	FR_RING_BUFFER_HUGE_PAGES_TRANSPARENT,		//!< Aligned anonymous mappings, with the kernel
+							///< asked to use transparent huge pages for them.
+	FR_RING_BUFFER_HUGE_PAGES_EXPLICIT		//!< MAP_HUGETLB mappings from the reserved pool,
+							///< falling back to transparent huge pages.
+} fr_ring_buffer_huge_pages_t;
+
+/** The huge page size we align and round ring buffers to
+ *
+ */
+#define FR_RING_BUFFER_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+
+int			fr_ring_buffer_huge_pages_set(fr_ring_buffer_huge_pages_t huge_pages);
+
+fr_ring_buffer_t	*fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size, bool huge_pages);
 
 uint8_t			*fr_ring_buffer_reserve(fr_ring_buffer_t *rb, size_t size) CC_HINT(nonnull);
 
@@ -52,6 +70,8 @@ size_t			fr_ring_buffer_size(fr_ring_buffer_t *rb) CC_HINT(nonnull);
 
 size_t 			fr_ring_buffer_used(fr_ring_buffer_t *rb) CC_HINT(nonnull);
 
+bool			fr_ring_buffer_is_huge(fr_ring_buffer_t *rb) CC_HINT(nonnull);
+
 void			fr_ring_buffer_debug(fr_ring_buffer_t *rb, FILE *fp) CC_HINT(nonnull);
 
 #ifdef __cplusplus
@@ -95,6 +95,10 @@ typedef struct {
 
 	fr_schedule_child_status_t status;	//!< status of the worker
 	fr_worker_t	*worker;		//!< the worker data structure
+
+	bool		bind;			//!< whether the thread is bound to cpus
+	fr_cpuset_t	cpus;			//!< CPUs the thread runs on
+	int		numa_node;		//!< NUMA node the thread runs on, or -1
 } fr_schedule_worker_t;
 
 /** Scheduler specific information for network threads
@@ -116,6 +120,10 @@ typedef struct {
 	fr_network_t	*nr;			//!< the receive data structure
 
 	fr_event_timer_t const *ev;		//!< timer for stats_interval
+
+	bool		bind;			//!< whether the thread is bound to cpus
+	fr_cpuset_t	cpus;			//!< CPUs the thread runs on
+	int		numa_node;		//!< NUMA node the thread runs on, or -1
 } fr_schedule_network_t;
 
 
@@ -144,6 +152,8 @@ struct fr_schedule_s {
 	fr_dlist_head_t	workers;		//!< list of workers
 	fr_dlist_head_t	networks;		//!< list of networks
 
+	fr_worker_group_t *group;		//!< workers which take requests from each other.
+
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
 };
@@ -159,6 +169,107 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+/** Work out which CPUs a thread should be bound to
+ *
+ * If "numa" is set, threads are spread round-robin across the NUMA
+ * nodes which have CPUs in the configured set, and each thread is
+ * bound to the CPUs of its node.  If "per_thread" is set, each thread
+ * is then bound to a single CPU from what's left.
+ *
+ * @param[out] out	CPUs the thread should be bound to.
+ * @param[out] node	NUMA node the thread will run on, or -1 if unknown.
+ * @param[in] config	scheduler configuration.
+ * @param[in] cpus	configured CPU list for this type of thread.  May be NULL.
+ * @param[in] index	of the thread, amongst threads sharing the same CPU list.
+ * @return
+ *	- 1 if the thread should be bound.
+ *	- 0 if the thread should run wherever the kernel puts it.
+ *	- -1 on error.
+ */
+static int schedule_affinity(fr_cpuset_t *out, int *node, fr_schedule_config_t const *config,
+			     char const *cpus, unsigned int index)
+{
+	fr_cpuset_t	set;
+	unsigned int	pos = index;
+
+	*node = -1;
+
+	if (fr_cpuset_from_str(&set, cpus ? cpus : "") < 0) return -1;
+
+	if (!fr_cpuset_count(&set)) {
+		if (!config->per_thread && !config->numa) return 0;
+
+		if (fr_cpuset_thread_get(&set) < 0) return -1;
+	}
+
+	if (config->numa) {
+		unsigned int	i, num_nodes = fr_cpuset_numa_nodes();
+		unsigned int	usable[64];
+		unsigned int	num_usable = 0;
+		fr_cpuset_t	node_set;
+
+		for (i = 0; (i < num_nodes) && (num_usable < NUM_ELEMENTS(usable)); i++) {
+			if (fr_cpuset_numa_node(&node_set, i) < 0) return -1;
+
+			fr_cpuset_and(&node_set, &node_set, &set);
+			if (fr_cpuset_count(&node_set) > 0) usable[num_usable++] = i;
+		}
+
+		if (!num_usable) {
+			fr_strerror_const("None of the CPUs are on a known NUMA node");
+			return -1;
+		}
+
+		*node = usable[index % num_usable];
+		if (fr_cpuset_numa_node(&node_set, *node) < 0) return -1;
+		fr_cpuset_and(&set, &set, &node_set);
+
+		pos = index / num_usable;
+	}
+
+	if (config->per_thread) {
+		memset(out, 0, sizeof(*out));
+		fr_cpuset_add(out, fr_cpuset_nth(&set, pos));
+	} else {
+		*out = set;
+	}
+
+	if (*node < 0) *node = fr_cpuset_numa_node_of(out);
+
+	return 1;
+}
+
+/** Bind the current thread to its CPUs
+ *
+ * This has to be done before the thread allocates any memory.  The
+ * kernel places pages on the NUMA node of the CPU which first touches
+ * them, so the thread's message sets, ring buffers and requests then
+ * end up on its own node.
+ */
+static int schedule_thread_bind(fr_schedule_t *sc, char const *name, bool bind, fr_cpuset_t const *cpus, int node)
+{
+	char buffer[256];
+
+	if (!bind) {
+		INFO("%s - Starting", name);
+		return 0;
+	}
+
+	if (fr_cpuset_thread_set(cpus) < 0) {
+		PERROR("%s - Failed binding to CPUs", name);
+		return -1;
+	}
+
+	fr_cpuset_snprint(buffer, sizeof(buffer), cpus);
+	if (node < 0) {
+		INFO("%s - Starting on CPUs %s", name, buffer);
+	} else {
+		INFO("%s - Starting on CPUs %s (NUMA node %d)", name, buffer, node);
+	}
+
+	return 0;
+}
+
 /** Entry point for worker threads
  *
  * @param[in] arg	the fr_schedule_worker_t
@@ -166,7 +277,7 @@ int fr_schedule_worker_id(void)
  */
 static void *fr_schedule_worker_thread(void *arg)
 {
-	TALLOC_CTX			*ctx;
+	TALLOC_CTX			*ctx = NULL;
 	fr_schedule_worker_t		*sw = talloc_get_type_abort(arg, fr_schedule_worker_t);
 	fr_schedule_t			*sc = sw->sc;
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
@@ -204,14 +315,14 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	snprintf(worker_name, sizeof(worker_name), "Worker %d", sw->id);
 
+	if (schedule_thread_bind(sc, worker_name, sw->bind, &sw->cpus, sw->numa_node) < 0) goto fail;
+
 	sw->ctx = ctx = talloc_init("%s", worker_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", worker_name);
 		goto fail;
 	}
 
-	INFO("%s - Starting", worker_name);
-
 	sw->el = fr_event_list_alloc(ctx, NULL, NULL);
 	if (!sw->el) {
 		PERROR("%s - Failed creating event list", worker_name);
@@ -224,6 +335,12 @@ static void *fr_schedule_worker_thread(void *arg)
 		PERROR("%s - Failed creating worker", worker_name);
 		goto fail;
 	}
+	fr_worker_numa_node_set(sw->worker, sw->numa_node);
+
+	if (sc->group && (fr_worker_group_join(sc->group, sw->worker) < 0)) {
+		PERROR("%s - Failed enabling work stealing", worker_name);
+		goto fail;
+	}
 
 	/*
 	 *	@todo make this a registry
@@ -314,7 +431,7 @@ static void stats_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
  */
 static void *fr_schedule_network_thread(void *arg)
 {
-	TALLOC_CTX			*ctx;
+	TALLOC_CTX			*ctx = NULL;
 	fr_schedule_network_t		*sn = talloc_get_type_abort(arg, fr_schedule_network_t);
 	fr_schedule_t			*sc = sn->sc;
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
@@ -350,7 +467,7 @@ static void *fr_schedule_network_thread(void *arg)
 
 	snprintf(network_name, sizeof(network_name), "Network %d", sn->id);
 
-	INFO("%s - Starting", network_name);
+	if (schedule_thread_bind(sc, network_name, sn->bind, &sn->cpus, sn->numa_node) < 0) goto fail;
 
 	sn->ctx = ctx = talloc_init("%s", network_name);
 	if (!ctx) {
@@ -369,6 +486,7 @@ static void *fr_schedule_network_thread(void *arg)
 		PERROR("%s - Failed creating network", network_name);
 		goto fail;
 	}
+	fr_network_numa_node_set(sn->nr, sn->numa_node);
 
 	sn->status = FR_CHILD_RUNNING;
 
@@ -446,6 +564,60 @@ int fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *a
 	return 0;
 }
 
+/** Print where the network and worker threads are running
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] fp	the file where the debug output is printed.
+ */
+void fr_schedule_debug(fr_schedule_t *sc, FILE *fp)
+{
+	fr_schedule_network_t	*sn;
+	fr_schedule_worker_t	*sw;
+	char			buffer[256];
+
+	if (sc->el) {
+		fprintf(fp, "single-threaded\n");
+		return;
+	}
+
+	for (sn = fr_dlist_head(&sc->networks);
+	     sn != NULL;
+	     sn = fr_dlist_next(&sc->networks, sn)) {
+		if (sn->bind) fr_cpuset_snprint(buffer, sizeof(buffer), &sn->cpus);
+
+		fprintf(fp, "network.%u.cpus = %s\n", sn->id, sn->bind ? buffer : "any");
+		fprintf(fp, "network.%u.numa_node = %d\n", sn->id, sn->numa_node);
+	}
+
+	for (sw = fr_dlist_head(&sc->workers);
+	     sw != NULL;
+	     sw = fr_dlist_next(&sc->workers, sw)) {
+		if (sw->bind) fr_cpuset_snprint(buffer, sizeof(buffer), &sw->cpus);
+
+		fprintf(fp, "worker.%u.cpus = %s\n", sw->id, sw->bind ? buffer : "any");
+		fprintf(fp, "worker.%u.numa_node = %d\n", sw->id, sw->numa_node);
+	}
+}
+
+static int cmd_show_thread(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_schedule_debug(talloc_get_type_abort(ctx, fr_schedule_t), fp);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_schedule_table[] = {
+	{
+		.parent = "show",
+		.name = "thread",
+		.func = cmd_show_thread,
+		.help = "Show which CPUs and NUMA nodes the network and worker threads run on.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
 /** Create a scheduler and spawn the child threads.
  *
  * @param[in] ctx				talloc context.
@@ -466,7 +638,8 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 				  fr_schedule_thread_detach_t worker_thread_detach,
 				  fr_schedule_config_t *config)
 {
-	unsigned int i;
+	unsigned int i, cpu_offset = 0;
+	int ret;
 	fr_schedule_worker_t *sw, *next_sw;
 	fr_schedule_network_t *sn, *next_sn;
 	fr_schedule_t *sc;
@@ -535,6 +708,11 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 			goto st_fail;
 		}
 
+		if (fr_command_register_hook(NULL, NULL, sc, cmd_schedule_table) < 0) {
+			PERROR("Failed adding scheduler commands");
+			goto st_fail;
+		}
+
 		(void) fr_network_worker_add(sc->single_network, sc->single_worker);
 		DEBUG("Scheduler created in single-threaded mode");
 
@@ -608,6 +786,15 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		sn->id = i;
 		sn->sc = sc;
 		sn->status = FR_CHILD_INITIALIZING;
+
+		ret = schedule_affinity(&sn->cpus, &sn->numa_node, sc->config, sc->config->network_cpus, i);
+		if (ret < 0) {
+			PERROR("Network %u - Failed setting CPU affinity", i);
+			talloc_free(sn);
+			break;
+		}
+		sn->bind = (ret > 0);
+
 		fr_dlist_insert_head(&sc->networks, sn);
 
 		if (fr_schedule_pthread_create(&sn->pthread_id, fr_schedule_network_thread, sn) < 0) {
@@ -649,6 +836,30 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
+	/*
+	 *	Idle workers take requests which busy ones haven't
+	 *	started yet.  There's no point with only one worker.
+	 */
+	if (sc->config->worker.work_stealing && (sc->config->max_workers > 1)) {
+		sc->group = fr_worker_group_alloc(sc, sc->config->max_workers);
+		if (!sc->group) {
+			ERROR("Failed allocating worker group");
+			fr_schedule_destroy(&sc);
+			return NULL;
+		}
+	}
+
+	/*
+	 *	If the workers share the network threads' CPU list,
+	 *	then they carry on from where the network threads
+	 *	left off.  Otherwise with "per_thread", network N and
+	 *	worker N are bound to the same CPU.
+	 */
+	if (strcmp(sc->config->network_cpus ? sc->config->network_cpus : "",
+		   sc->config->worker_cpus ? sc->config->worker_cpus : "") == 0) {
+		cpu_offset = sc->config->max_networks;
+	}
+
 	/*
 	 *	Create all of the workers.
 	 */
@@ -667,6 +878,16 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		sw->id = i;
 		sw->sc = sc;
 		sw->status = FR_CHILD_INITIALIZING;
+
+		ret = schedule_affinity(&sw->cpus, &sw->numa_node, sc->config, sc->config->worker_cpus,
+					cpu_offset + i);
+		if (ret < 0) {
+			PERROR("Worker %u - Failed setting CPU affinity", i);
+			talloc_free(sw);
+			break;
+		}
+		sw->bind = (ret > 0);
+
 		fr_dlist_insert_head(&sc->workers, sw);
 
 		if (fr_schedule_pthread_create(&sw->pthread_id, fr_schedule_worker_thread, sw) < 0) {
@@ -737,6 +958,11 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 	}
 
+	if (fr_command_register_hook(NULL, NULL, sc, cmd_schedule_table) < 0) {
+		PERROR("Failed adding scheduler commands");
+		goto st_fail;
+	}
+
 	if (sc) INFO("Scheduler created successfully with %u networks and %u workers",
 		     sc->config->max_networks, (unsigned int)fr_dlist_num_elements(&sc->workers));
 
@@ -38,6 +38,7 @@ typedef struct fr_schedule_s fr_schedule_t;
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/network.h>
 #include <freeradius-devel/io/worker.h>
+#include <freeradius-devel/util/cpuset.h>
 #include <freeradius-devel/util/log.h>
 
 #ifdef __cplusplus
@@ -68,6 +69,11 @@ typedef struct {
 	fr_network_config_t network;		//!< configuration for each network;
 
 	fr_time_delta_t	stats_interval;		//!< print channel statistics
+
+	char const	*network_cpus;		//!< CPUs the network threads may run on, e.g. "0-3".
+	char const	*worker_cpus;		//!< CPUs the worker threads may run on.
+	bool		per_thread;		//!< bind each thread to a single CPU.
+	bool		numa;			//!< spread threads across NUMA nodes, binding each to one node.
 } fr_schedule_config_t;
 
 int			fr_schedule_worker_id(void);
@@ -80,6 +86,8 @@ fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_
 /* schedulers are async, so there's no fr_schedule_run() */
 int			fr_schedule_destroy(fr_schedule_t **sc);
 
+void			fr_schedule_debug(fr_schedule_t *sc, FILE *fp) CC_HINT(nonnull);
+
 fr_network_t		*fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 fr_network_t		*fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 #ifdef __cplusplus
@@ -63,7 +63,9 @@ RCSID("$Id$")
 #include <freeradius-devel/server/time_tracking.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/minmax_heap.h>
+#include <freeradius-devel/util/rcu.h>
 
+#include <sched.h>
 #include <stdalign.h>
 
 #ifdef WITH_VERIFY_PTR
@@ -88,6 +90,82 @@ typedef struct {
 	fr_dlist_head_t		dlist;
 } fr_worker_channel_t;
 
+#define WORKER_POOL_BUCKETS		10	//!< <1k, <2k ... <256k, >=256k
+#define WORKER_POOL_SERVERS_MAX		32	//!< Virtual servers we track pool usage for.
+#define WORKER_POOL_SAMPLE_RATE		8	//!< Measure pool usage of one in N requests.
+#define WORKER_STRIDE			(1 << 20)	//!< Schedule tag increment for a class with weight 1.
+
+#define WORKER_BACKLOG_SIZE		1024	//!< Requests waiting to be started, which other workers may take.
+
+#define WORKER_POOL_RESIZE_SAMPLES	1024	//!< Samples between re-evaluating the pool size.
+#define WORKER_POOL_MIN			4096
+#define WORKER_POOL_MAX			65536
+
+/** Histogram of how much pair memory requests used
+ *
+ * Only the worker writes it, but "stats worker" reads it from another
+ * thread.
+ */
+typedef struct {
+	atomic_uint64_t		samples;	//!< Requests measured.
+	atomic_uint64_t		overflows;	//!< Requests which used more memory than their pool had.
+	atomic_size_t		max;		//!< Largest amount of memory used by a single request.
+	atomic_uint64_t		bucket[WORKER_POOL_BUCKETS];	//!< Power of two buckets, starting at 1k.
+} fr_worker_pool_usage_t;
+
+/** Copy of the thread's request free list statistics, which other threads can read
+ *
+ */
+typedef struct {
+	atomic_uint64_t		alloced;	//!< Requests allocated.
+	atomic_uint64_t		reused;		//!< Requests taken from the free list.
+	atomic_uint64_t		freed;		//!< Requests freed, instead of being kept.
+	atomic_uint		in_use;		//!< Requests currently in use.
+	atomic_uint		free;		//!< Requests in the free list.
+	atomic_uint		high_water_mark;	//!< How many requests the free list may hold.
+} fr_worker_request_alloc_t;
+
+/** Pool usage for a single virtual server
+ *
+ */
+typedef struct {
+	CONF_SECTION const	*server_cs;	//!< The virtual server.
+	fr_worker_pool_usage_t	usage;
+} fr_worker_pool_server_t;
+
+/** CoDel state for admission control
+ *
+ * Requests are shed based on how long they waited to be run, not on
+ * how many are waiting.  A queue which stays full of short lived
+ * requests is fine, a queue where requests wait longer than the
+ * target for a whole interval is not.
+ */
+typedef struct {
+	fr_time_t		first_above;	//!< When the delay will have been above target for an interval.
+	fr_time_t		shed_next;	//!< When the next request is shed.
+	uint32_t		count;		//!< Requests shed since we started shedding.
+	uint32_t		last_count;	//!< Value of count when we last started shedding.
+	bool			shedding;	//!< Whether we're shedding requests.
+} fr_worker_admission_t;
+
+/** A member of a work stealing group
+ *
+ */
+typedef struct {
+	_Atomic(fr_worker_t *)	worker;		//!< The worker, or NULL if it has exited.
+	atomic_uint		refs;		//!< Other workers which are looking at this one.
+} fr_worker_peer_t;
+
+/** Workers which take requests from each other
+ *
+ */
+struct fr_worker_group_s {
+	unsigned int		max_workers;	//!< Number of slots in the group.
+	atomic_uint		num_workers;	//!< Slots which have been handed out.
+	atomic_uint		num_idle;	//!< Workers waiting for something to do.
+	fr_worker_peer_t	*peer;		//!< One slot per worker.
+};
+
 /**
  *  A worker which takes packets from a master, and processes them.
  */
@@ -98,6 +176,7 @@ struct fr_worker_s {
 	unlang_interpret_t 	*intp;		//!< Worker's local interpreter.
 
 	pthread_t		thread_id;	//!< my thread ID
+	int			numa_node;	//!< NUMA node the worker runs on, or -1 if unknown.
 
 	fr_log_t const		*log;		//!< log destination
 	fr_log_lvl_t		lvl;		//!< log level
@@ -119,13 +198,39 @@ struct fr_worker_s {
 	fr_io_stats_t		stats;		//!< input / output stats
 	fr_time_elapsed_t	cpu_time;	//!< histogram of total CPU time per request
 	fr_time_elapsed_t	wall_clock;	//!< histogram of wall clock time per request
+	fr_time_elapsed_t	queue_delay;	//!< histogram of time requests waited before being run
 
 	uint64_t    		num_naks;	//!< number of messages which were nak'd
 	uint64_t    		num_active;	//!< number of active requests
+	uint64_t		num_shed;	//!< number of requests shed by admission control
+	uint64_t		num_rejected;	//!< number of shed requests which were rejected
+	uint64_t		num_stolen;	//!< number of requests taken from other workers
+
+	fr_worker_group_t	*group;		//!< Workers we take requests from, and which take ours.
+	unsigned int		group_id;	//!< Our slot in the group.
+	unsigned int		steal_next;	//!< Slot we next try to take requests from.
+	fr_atomic_queue_t	*backlog;	//!< Requests we've received, but haven't started.
+	atomic_uint		backlog_len;	//!< Number of requests in the backlog.  May over-count.
+	atomic_bool		idle;		//!< Waiting for events, with nothing to run.
+
+	fr_worker_admission_t	admission;	//!< admission control state
+
+	uint64_t		vtime;		//!< Tag of the last request run.
+	uint64_t		pass[FR_CHANNEL_PRIORITY_CLASS_MAX];	//!< Tag of the last request of each class.
 
 	fr_time_delta_t		predicted;	//!< How long we predict a request will take to execute.
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
 
+	fr_worker_request_alloc_t	request_alloc;	//!< snapshot of the request free list statistics
+						///< for this worker's thread.
+
+	atomic_size_t		pool_size;	//!< Current size of the pair arena in new request pools.
+	fr_worker_pool_usage_t	pool_usage;	//!< Pool usage of all requests.
+	uint64_t		pool_recent[WORKER_POOL_BUCKETS];	//!< Decaying histogram used for sizing.
+	uint32_t		pool_recent_samples;	//!< Samples since the pool size was last evaluated.
+	fr_worker_pool_server_t	pool_server[WORKER_POOL_SERVERS_MAX];	//!< Pool usage per virtual server.
+	atomic_uint		num_pool_servers;	//!< Number of entries used in pool_server.
+
 	bool			was_sleeping;	//!< used to suppress multiple sleep signals in a row
 	bool			exiting;	//!< are we exiting?
 
@@ -177,7 +282,7 @@ static inline fr_ring_buffer_t *fr_worker_rb_init(void)
 	rb = fr_worker_rb;
 	if (rb) return rb;
 
-	rb = fr_ring_buffer_create(NULL, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE);
+	rb = fr_ring_buffer_create(NULL, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE, false);
 	if (!rb) {
 		fr_perror("Failed allocating memory for worker ring buffer");
 		return NULL;
@@ -193,10 +298,12 @@ static inline bool is_worker_thread(fr_worker_t const *worker)
 	return (pthread_equal(pthread_self(), worker->thread_id) != 0);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_channel_t *origin, fr_time_t now);
 static void worker_send_reply(fr_worker_t *worker, request_t *request, bool do_not_respond, fr_time_t now);
 static void worker_max_request_time(UNUSED fr_event_list_t *el, UNUSED fr_time_t when, void *uctx);
 static void worker_max_request_timer(fr_worker_t *worker);
+static void worker_backlog_purge(fr_worker_t *worker, fr_channel_t *ch);
+static void worker_group_leave(fr_worker_t *worker);
 
 /** Callback which handles a message being received on the worker side.
  *
@@ -208,10 +315,43 @@ static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *
 {
 	fr_worker_t *worker = ctx;
 
+	cd->channel.ch = ch;
+
+	/*
+	 *	Work stealing is enabled.  Put the request into our
+	 *	backlog, where an idle worker can take it if we're
+	 *	stuck.  We take it back out when we run out of work.
+	 *
+	 *	The length is incremented first, so that it never
+	 *	under-counts.
+	 *
+	 *	Another worker may reply to the request on its own
+	 *	channel, so it isn't outstanding on this channel until
+	 *	we start it.
+	 *
+	 *	The backlog is first in, first out, so requests are
+	 *	only scheduled by class once they're taken out of it.
+	 *	A low priority request which is ahead of a high
+	 *	priority one in the backlog is started first.
+	 *
+	 *	Only we read our channels, so requests which arrive
+	 *	while we're blocked in a request stay in the channel,
+	 *	and can't be taken.  Making the channel queue readable
+	 *	by other workers would mean sharing its sequence / ack
+	 *	state between threads.
+	 */
+	if (worker->backlog) {
+		atomic_fetch_add(&worker->backlog_len, 1);
+		if (fr_atomic_queue_push(worker->backlog, cd)) {
+			fr_channel_responder_defer(ch);
+			return;
+		}
+		atomic_fetch_sub(&worker->backlog_len, 1);
+	}
+
 	worker->stats.in++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
-	cd->channel.ch = ch;
-	worker_request_bootstrap(worker, cd, fr_time());
+	worker_request_bootstrap(worker, cd, NULL, fr_time());
 }
 
 static void worker_requests_cancel(fr_worker_channel_t *ch)
@@ -238,6 +378,42 @@ static void worker_exit(fr_worker_t *worker)
 	(void)fr_event_post_delete(worker->el, fr_worker_post_event, worker);
 }
 
+/** Remove requests for a closing channel from the backlog
+ *
+ * Other workers may be taking requests from the backlog at the same
+ * time, so we just cycle through it once, putting back the requests
+ * which are for other channels.
+ *
+ * A worker which popped a request just before we looked may still be
+ * checking its channel, so we wait for everyone looking at our backlog
+ * to finish.  Once they have, the channel is only used as a tag on
+ * their replies, which the network thread uses for its accounting.
+ * We can then acknowledge the close.
+ *
+ * @param[in] worker	the worker.
+ * @param[in] ch	the channel which is closing, or NULL for all channels.
+ */
+static void worker_backlog_purge(fr_worker_t *worker, fr_channel_t *ch)
+{
+	unsigned int		i, num = atomic_load(&worker->backlog_len);
+	fr_channel_data_t	*cd;
+
+	for (i = 0; i < num; i++) {
+		if (!fr_atomic_queue_pop(worker->backlog, (void **) &cd)) break;
+
+		if (ch && (cd->channel.ch != ch) && fr_atomic_queue_push(worker->backlog, cd)) continue;
+
+		atomic_fetch_sub(&worker->backlog_len, 1);
+		fr_message_done(&cd->m);
+	}
+
+	if (worker->group) {
+		fr_worker_peer_t *peer = &worker->group->peer[worker->group_id];
+
+		while (atomic_load(&peer->refs) > 0) sched_yield();
+	}
+}
+
 /** Handle a control plane message sent to the worker via a channel
  *
  * @param[in] ctx	the worker
@@ -330,6 +506,7 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 			if (worker->channel[i].ch != ch) continue;
 
 			worker_requests_cancel(&worker->channel[i]);
+			if (worker->backlog) worker_backlog_purge(worker, ch);
 
 			ms = fr_channel_responder_uctx_get(ch);
 
@@ -411,7 +588,7 @@ static void worker_listen_cancel_callback(void *ctx, void const *data, NDEBUG_UN
  * @param[in] cd	the message to NAK
  * @param[in] now	when the message is NAKd
  */
-static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_channel_t *origin, fr_time_t now)
 {
 	size_t			size;
 	fr_channel_data_t	*reply;
@@ -456,7 +633,7 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 	 */
 	if (listen->app_io->nak) {
 		size = listen->app_io->nak(listen, cd->packet_ctx, cd->m.data,
-					   cd->m.data_size, reply->m.data, reply->m.rb_size);
+					   cd->m.data_size - cd->request.decoded_len, reply->m.data, reply->m.rb_size);
 	} else {
 		size = 1;	/* rely on them to figure it the heck out */
 	}
@@ -470,6 +647,9 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 	reply->reply.cpu_time = worker->tracking.running_total;
 	reply->reply.processing_time = fr_time_delta_from_sec(10); /* @todo - set to something better? */
 	reply->reply.request_time = cd->request.recv_time;
+	reply->reply.overloaded = worker->admission.shedding;
+	reply->reply.origin = origin;
+	reply->priority = cd->priority;
 
 	reply->listen = cd->listen;
 	reply->packet_ctx = cd->packet_ctx;
@@ -581,6 +761,32 @@ static void worker_max_request_timer(fr_worker_t *worker)
 	}
 }
 
+/** Place a new request in the worker's schedule
+ *
+ * Requests are run in order of their tag.  Each request's tag is
+ * later than the last one of its class by an amount inversely
+ * proportional to the weight of the class, so that when there are
+ * requests of several classes waiting, each class gets its share
+ * of the worker.  A class which has been idle starts again from
+ * the current position in the schedule, and doesn't get to run
+ * everything it missed first.
+ *
+ * Requests keep their tag when they yield, so ones which have
+ * already started running are resumed before new ones.
+ *
+ * With work stealing, requests are only tagged when they're taken
+ * from the backlog, which is first in, first out.
+ */
+static inline CC_HINT(always_inline) void worker_request_tag(fr_worker_t *worker, request_t *request)
+{
+	fr_channel_priority_class_t pclass = fr_channel_priority_class(request->async->priority);
+	uint64_t start = worker->pass[pclass];
+
+	if (start < worker->vtime) start = worker->vtime;
+
+	request->async->tag = worker->pass[pclass] = start + (WORKER_STRIDE / worker->config.priority[pclass].weight);
+}
+
 /** Start time tracking for a request, and mark it as runnable.
  *
  */
@@ -603,6 +809,8 @@ static void worker_request_time_tracking_start(fr_worker_t *worker, request_t *r
 	fr_time_tracking_yield(&request->async->tracking, now);
 	worker->num_active++;
 
+	worker_request_tag(worker, request);
+
 	fr_assert(!fr_heap_entry_inserted(request->runnable_id));
 	(void) fr_heap_insert(&worker->runnable, request);
 
@@ -706,6 +914,9 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, bool send
 	reply->reply.cpu_time = worker->tracking.running_total;
 	reply->reply.processing_time = request->async->tracking.running_total;
 	reply->reply.request_time = request->async->recv_time;
+	reply->reply.overloaded = worker->admission.shedding;
+	reply->reply.origin = request->async->origin;
+	reply->priority = request->async->priority;
 
 	reply->listen = request->async->listen;
 	reply->packet_ctx = request->async->packet_ctx;
@@ -798,12 +1009,13 @@ void worker_request_name_number(request_t *request)
 	request->name = itoa_internal(request, request->number);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_channel_t *origin, fr_time_t now)
 {
 	int			ret = -1;
 	request_t		*request;
 	TALLOC_CTX		*ctx;
 	fr_listen_t const	*listen;
+	size_t			packet_len;
 
 	if (fr_minmax_heap_num_elements(worker->time_order) >= (uint32_t) worker->config.max_requests) goto nak;
 
@@ -830,6 +1042,7 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 	 *	Update the transport-specific fields.
 	 */
 	request->async->channel = cd->channel.ch;
+	request->async->origin = origin;
 
 	request->async->recv_time = cd->request.recv_time;
 
@@ -838,21 +1051,37 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 	request->async->priority = cd->priority;
 	listen = request->async->listen;
 
+	/*
+	 *	The network thread may have already decoded the
+	 *	packet.  If so, the pairs follow the packet.
+	 */
+	packet_len = cd->m.data_size - cd->request.decoded_len;
+	if (cd->request.decoded_len) {
+		request->async->decoded = cd->m.data + packet_len;
+		request->async->decoded_len = cd->request.decoded_len;
+	}
+
 	/*
 	 *	Now that the "request" structure has been initialized, go decode the packet.
 	 *
 	 *	Note that this also sets the "async process" function.
 	 */
 	if (listen->app->decode) {
-		ret = listen->app->decode(listen->app_instance, request, cd->m.data, cd->m.data_size);
+		ret = listen->app->decode(listen->app_instance, request, cd->m.data, packet_len);
 	} else if (listen->app_io->decode) {
-		ret = listen->app_io->decode(listen->app_io_instance, request, cd->m.data, cd->m.data_size);
+		ret = listen->app_io->decode(listen->app_io_instance, request, cd->m.data, packet_len);
 	}
 
+	/*
+	 *	The message is about to be freed.
+	 */
+	request->async->decoded = NULL;
+	request->async->decoded_len = 0;
+
 	if (ret < 0) {
 		talloc_free(ctx);
 nak:
-		worker_nak(worker, cd, now);
+		worker_nak(worker, cd, origin, now);
 		return;
 	}
 
@@ -861,7 +1090,7 @@ nak:
 	 */
 	if (unlang_call_push(request, cd->listen->server_cs, UNLANG_TOP_FRAME) < 0) {
 		RERROR("Protocol failed to set 'process' function");
-		worker_nak(worker, cd, now);
+		worker_nak(worker, cd, origin, now);
 		return;
 	}
 
@@ -895,17 +1124,16 @@ nak:
 		 *
 		 *	If the new packet is a duplicate of the old
 		 *	one, then we can just discard the new one.  We
-		 *	have to tell the channel that we've "eaten"
-		 *	this reply, so the sequence number should
-		 *	increase.
-		 *
-		 *	@todo - fix the channel code to do queue
-		 *	depth, and not sequence / ack.
+		 *	still send an empty reply, so that the network
+		 *	thread knows the packet is done, and stops
+		 *	counting it as outstanding.  If we took the
+		 *	packet from another worker, the reply is tagged
+		 *	with that worker's channel.
 		 */
 		if (fr_time_eq(old->async->recv_time, request->async->recv_time)) {
 			RWARN("Discarding duplicate of request (%"PRIu64")", old->number);
 
-			fr_channel_null_reply(request->async->channel);
+			worker_send_reply(worker, request, false, now);
 			talloc_free(request);
 
 			/*
@@ -957,14 +1185,14 @@ nak:
 
 /**
  *  Track a request_t in the "runnable" heap.
- *  Higher priorities take precedence, followed by lower sequence numbers
+ *  Earlier schedule tags take precedence, followed by lower sequence numbers
  */
 static int8_t worker_runnable_cmp(void const *one, void const *two)
 {
 	request_t const *a = one, *b = two;
 	int ret;
 
-	ret = CMP(b->async->priority, a->async->priority);
+	ret = CMP(a->async->tag, b->async->tag);
 	if (ret != 0) return ret;
 
 	ret = CMP(a->async->sequence, b->async->sequence);
@@ -1016,6 +1244,13 @@ void fr_worker_destroy(fr_worker_t *worker)
 
 //	WORKER_VERIFY;
 
+	/*
+	 *	Stop other workers taking requests from us, and
+	 *	throw away the ones which nobody started.
+	 */
+	if (worker->group) worker_group_leave(worker);
+	if (worker->backlog) worker_backlog_purge(worker, NULL);
+
 	/*
 	 *	Stop any new requests running with this interpreter
 	 */
@@ -1078,6 +1313,135 @@ static void _worker_request_internal_init(request_t *request, void *uctx)
 }
 
 
+/** Map an amount of memory to a histogram bucket
+ *
+ */
+static inline CC_HINT(always_inline) unsigned int worker_pool_bucket(size_t used)
+{
+	unsigned int i;
+
+	for (i = 0; i < (WORKER_POOL_BUCKETS - 1); i++) if (used < ((size_t)1024 << i)) break;
+
+	return i;
+}
+
+/** Increment a counter which only this worker writes
+ *
+ * There's only one writer, so a locked read-modify-write isn't needed.
+ */
+static inline CC_HINT(always_inline) void worker_stat_inc(atomic_uint64_t *stat)
+{
+	atomic_store_explicit(stat, atomic_load_explicit(stat, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static inline CC_HINT(always_inline) void worker_pool_usage_update(fr_worker_pool_usage_t *usage,
+								 unsigned int bucket, size_t used, bool overflow)
+{
+	worker_stat_inc(&usage->samples);
+	if (overflow) worker_stat_inc(&usage->overflows);
+	if (used > atomic_load_explicit(&usage->max, memory_order_relaxed)) {
+		atomic_store_explicit(&usage->max, used, memory_order_relaxed);
+	}
+	worker_stat_inc(&usage->bucket[bucket]);
+}
+
+/** Copy the thread's request free list statistics to where other threads can read them
+ *
+ */
+static void worker_request_alloc_publish(fr_worker_t *worker)
+{
+	request_alloc_stats_t stats;
+
+	request_alloc_stats(&stats);
+
+	atomic_store_explicit(&worker->request_alloc.alloced, stats.alloced, memory_order_relaxed);
+	atomic_store_explicit(&worker->request_alloc.reused, stats.reused, memory_order_relaxed);
+	atomic_store_explicit(&worker->request_alloc.freed, stats.freed, memory_order_relaxed);
+	atomic_store_explicit(&worker->request_alloc.in_use, stats.in_use, memory_order_relaxed);
+	atomic_store_explicit(&worker->request_alloc.free, stats.free, memory_order_relaxed);
+	atomic_store_explicit(&worker->request_alloc.high_water_mark, stats.high_water_mark, memory_order_relaxed);
+}
+
+/** Pick a new pool size from the 95th percentile of recent usage
+ *
+ * The upper bound of the bucket holding the 95th percentile is used, so
+ * there's always some headroom.  Older samples are decayed by halving the
+ * histogram after each evaluation.
+ */
+static void worker_pool_resize(fr_worker_t *worker)
+{
+	uint64_t	total = 0, seen = 0;
+	size_t		size;
+	unsigned int	i;
+
+	for (i = 0; i < WORKER_POOL_BUCKETS; i++) total += worker->pool_recent[i];
+
+	for (i = 0; i < (WORKER_POOL_BUCKETS - 1); i++) {
+		seen += worker->pool_recent[i];
+		if ((seen * 100) >= (total * 95)) break;
+	}
+
+	for (i = 0; i < WORKER_POOL_BUCKETS; i++) worker->pool_recent[i] /= 2;
+	worker->pool_recent_samples = 0;
+
+	/*
+	 *	A busy worker never waits for events, so this is
+	 *	where its statistics are kept up to date.
+	 */
+	worker_request_alloc_publish(worker);
+
+	size = (size_t)1024 << i;
+	if (size < WORKER_POOL_MIN) size = WORKER_POOL_MIN;
+	if (size > WORKER_POOL_MAX) size = WORKER_POOL_MAX;
+
+	if (size == atomic_load_explicit(&worker->pool_size, memory_order_relaxed)) return;
+
+	DEBUG2("Worker - Request pool size changed from %zu to %zu bytes",
+	       atomic_load_explicit(&worker->pool_size, memory_order_relaxed), size);
+	atomic_store_explicit(&worker->pool_size, size, memory_order_relaxed);
+	request_pool_size_set(size);
+}
+
+/** Record how much pair memory a request used, by virtual server
+ *
+ * Only one in #WORKER_POOL_SAMPLE_RATE requests is measured, as walking
+ * the pair tree isn't free.
+ */
+static inline CC_HINT(always_inline) void worker_pool_sample(fr_worker_t *worker, request_t *request)
+{
+	size_t				used;
+	unsigned int			i, bucket, num_pool_servers;
+	bool				overflow;
+	CONF_SECTION const		*server_cs = request->async->listen->server_cs;
+
+	if ((worker->stats.out % WORKER_POOL_SAMPLE_RATE) != 0) return;
+
+	used = talloc_total_size(request->pair_root);
+	bucket = worker_pool_bucket(used);
+	overflow = (used > atomic_load_explicit(&worker->pool_size, memory_order_relaxed));
+
+	worker_pool_usage_update(&worker->pool_usage, bucket, used, overflow);
+
+	num_pool_servers = atomic_load_explicit(&worker->num_pool_servers, memory_order_relaxed);
+	for (i = 0; i < num_pool_servers; i++) {
+		if (worker->pool_server[i].server_cs == server_cs) break;
+	}
+	if (i < WORKER_POOL_SERVERS_MAX) {
+		/*
+		 *	Readers only look at entries below
+		 *	num_pool_servers, so fill it in first.
+		 */
+		if (i == num_pool_servers) {
+			worker->pool_server[i].server_cs = server_cs;
+			atomic_store_explicit(&worker->num_pool_servers, num_pool_servers + 1, memory_order_release);
+		}
+		worker_pool_usage_update(&worker->pool_server[i].usage, bucket, used, overflow);
+	}
+
+	worker->pool_recent[bucket]++;
+	if (++worker->pool_recent_samples >= WORKER_POOL_RESIZE_SAMPLES) worker_pool_resize(worker);
+}
+
 /** External request is now complete
  *
  */
@@ -1143,7 +1507,13 @@ static void _worker_request_done_external(request_t *request, UNUSED rlm_rcode_t
 		return;
 	}
 
-	worker_send_reply(worker, request, request->master_state != REQUEST_STOP_PROCESSING, now);
+	/*
+	 *	Sample before sending the reply, as sending the
+	 *	reply detaches the request from its listener.
+	 */
+	worker_pool_sample(worker, request);
+	worker_send_reply(worker, request,
+			  (request->master_state != REQUEST_STOP_PROCESSING) || request->async->rejected, now);
 	talloc_free(request);
 }
 
@@ -1294,6 +1664,372 @@ static bool _worker_request_scheduled(request_t const *request, UNUSED void *uct
 	return fr_heap_entry_inserted(request->runnable_id);
 }
 
+/** Integer square root, for the CoDel control law
+ *
+ */
+static inline CC_HINT(always_inline) uint32_t worker_isqrt(uint32_t x)
+{
+	uint32_t r = x, y = (x + 1) / 2;
+
+	while (y < r) {
+		r = y;
+		y = (r + (x / r)) / 2;
+	}
+
+	return r;
+}
+
+/** When the next request should be shed
+ *
+ * The rate increases with the square root of the number of requests
+ * shed, so the delay drops roughly linearly.
+ */
+static inline CC_HINT(always_inline) fr_time_t worker_shed_next(fr_worker_t const *worker, fr_time_t from)
+{
+	return fr_time_add(from, fr_time_delta_wrap(fr_time_delta_unwrap(worker->config.admission_interval) /
+						    worker_isqrt(worker->admission.count)));
+}
+
+/** Decide whether a new request should be run, or shed
+ *
+ * This is CoDel (RFC 8289), with the queue being the requests which
+ * the worker has received, but not yet started running.  Once the
+ * queueing delay has been above the target for an entire interval,
+ * requests are shed at an increasing rate until the delay drops
+ * below the target again.
+ *
+ * @param[in] worker	the worker.
+ * @param[in] request	which is about to be run for the first time.
+ * @param[in] now	the current time.
+ * @return
+ *	- true if the request should be run.
+ *	- false if it should be shed.
+ */
+static bool worker_admit(fr_worker_t *worker, request_t *request, fr_time_t now)
+{
+	fr_worker_admission_t	*admission = &worker->admission;
+	fr_time_delta_t		delay = fr_time_sub(now, request->async->recv_time);
+	bool			above = false;
+
+	fr_time_elapsed_update(&worker->queue_delay, request->async->recv_time, now);
+
+	if (!fr_time_delta_ispos(worker->config.admission_target)) return true;
+
+	/*
+	 *	The delay is fine, or it's been above the target for
+	 *	less than an interval.
+	 */
+	if (fr_time_delta_lt(delay, worker->config.admission_target)) {
+		admission->first_above = fr_time_wrap(0);
+
+	} else if (!fr_time_ispos(admission->first_above)) {
+		admission->first_above = fr_time_add(now, worker->config.admission_interval);
+
+	} else if (fr_time_gteq(now, admission->first_above)) {
+		above = true;
+	}
+
+	if (admission->shedding) {
+		if (!above) {
+			admission->shedding = false;
+			return true;
+		}
+
+		if (fr_time_lt(now, admission->shed_next)) return true;
+
+		/*
+		 *	Shed more often, the longer we've been
+		 *	shedding.
+		 */
+		admission->count++;
+		admission->shed_next = worker_shed_next(worker, admission->shed_next);
+		return false;
+	}
+
+	if (!above) return true;
+
+	/*
+	 *	Start shedding.  If we were shedding recently, then
+	 *	pick up where we left off, as the load likely hasn't
+	 *	changed much.
+	 */
+	admission->shedding = true;
+	if (((admission->count - admission->last_count) > 1) &&
+	    fr_time_delta_lt(fr_time_sub(now, admission->shed_next),
+			     fr_time_delta_mul(worker->config.admission_interval, 16))) {
+		admission->count -= admission->last_count;
+	} else {
+		admission->count = 1;
+	}
+	admission->last_count = admission->count;
+	admission->shed_next = worker_shed_next(worker, now);
+
+	RATE_LIMIT_GLOBAL(WARN, "Requests have been queued for more than %pV - shedding load",
+			  fr_box_time_delta(worker->config.admission_target));
+
+	return false;
+}
+
+/** Shed a request which failed admission control
+ *
+ * The request is either discarded, or if configured, the application
+ * is asked to set a reply rejecting it.  Either way, the virtual
+ * server is never run.
+ *
+ * @param[in] worker	the worker.
+ * @param[in] request_p	the request to shed.  Will be set to NULL.
+ */
+static void worker_shed_request(fr_worker_t *worker, request_t **request_p)
+{
+	request_t		*request = *request_p;
+	fr_listen_t const	*listen = request->async->listen;
+
+	worker->num_shed++;
+
+	if (worker->config.admission_reject && listen->app->shed &&
+	    (listen->app->shed(listen->app_instance, request) == 0)) {
+		RDEBUG("Overloaded - rejecting request");
+		request->async->rejected = true;
+		worker->num_rejected++;
+	} else {
+		RDEBUG("Overloaded - discarding request");
+	}
+
+	worker_stop_request(request_p);
+}
+
+/** Mark ourselves as having nothing to do
+ *
+ */
+static inline CC_HINT(always_inline) void worker_idle_set(fr_worker_t *worker)
+{
+	if (!atomic_exchange(&worker->idle, true)) atomic_fetch_add(&worker->group->num_idle, 1);
+}
+
+/** Clear a worker's idle flag
+ *
+ * Called by the worker itself when it finds work, and by other workers
+ * when they wake it up.  Only one caller sees the flag set.
+ *
+ * @return
+ *	- true if the worker was idle.
+ *	- false if it was already busy, or someone else woke it.
+ */
+static inline CC_HINT(always_inline) bool worker_idle_clear(fr_worker_group_t *group, fr_worker_t *worker)
+{
+	if (!atomic_exchange(&worker->idle, false)) return false;
+
+	atomic_fetch_sub(&group->num_idle, 1);
+	return true;
+}
+
+/** Find the channel which goes to the same network thread as another worker's channel
+ *
+ */
+static fr_channel_t *worker_channel_find(fr_worker_t *worker, fr_channel_t *origin)
+{
+	int i;
+
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (!worker->channel[i].ch) continue;
+
+		if (fr_channel_same_requestor(worker->channel[i].ch, origin)) return worker->channel[i].ch;
+	}
+
+	return NULL;
+}
+
+/** Take one request from another worker's backlog
+ *
+ * The request is run here, and the reply is sent back to the same
+ * network thread on our own channel.  The reply is tagged with the
+ * channel the request arrived on, so that the network thread can
+ * finish its accounting.
+ *
+ * We take the oldest request, whatever its priority class.  The
+ * weighted fair schedule only applies to requests we've started.
+ *
+ * @param[in] worker	the worker looking for something to do.
+ * @param[in] now	the current time.
+ * @return
+ *	- true if we took a request.
+ *	- false if there was nothing to take.
+ */
+static bool worker_steal(fr_worker_t *worker, fr_time_t now)
+{
+	fr_worker_group_t	*group = worker->group;
+	unsigned int		i, num = atomic_load(&group->num_workers);
+
+	if (num > group->max_workers) num = group->max_workers;
+
+	for (i = 0; i < num; i++) {
+		unsigned int		id = (worker->steal_next + i) % num;
+		fr_worker_peer_t	*peer = &group->peer[id];
+		fr_worker_t		*victim;
+		fr_channel_data_t	*cd = NULL;
+		fr_channel_t		*ch = NULL;
+
+		if (id == worker->group_id) continue;
+
+		/*
+		 *	The reference stops the victim from freeing its
+		 *	backlog while we're looking at it.
+		 */
+		atomic_fetch_add(&peer->refs, 1);
+		victim = atomic_load(&peer->worker);
+		if (victim && (atomic_load_explicit(&victim->backlog_len, memory_order_relaxed) > 0) &&
+		    fr_atomic_queue_pop(victim->backlog, (void **) &cd)) {
+			atomic_fetch_sub(&victim->backlog_len, 1);
+
+			if (!fr_channel_active(cd->channel.ch)) {
+				fr_message_done(&cd->m);
+				cd = NULL;
+
+			/*
+			 *	We're not connected to the network
+			 *	thread which sent the request.  Put it
+			 *	back for someone else.
+			 */
+			} else if (!(ch = worker_channel_find(worker, cd->channel.ch))) {
+				atomic_fetch_add(&victim->backlog_len, 1);
+				if (!fr_atomic_queue_push(victim->backlog, cd)) {
+					atomic_fetch_sub(&victim->backlog_len, 1);
+					fr_message_done(&cd->m);
+				}
+				cd = NULL;
+			}
+		}
+		atomic_fetch_sub(&peer->refs, 1);
+
+		if (!cd) continue;
+
+		/*
+		 *	Busy workers tend to stay busy, so start with
+		 *	this one next time.
+		 */
+		worker->steal_next = id;
+		worker->num_stolen++;
+		worker->stats.in++;
+
+		DEBUG3("Took request from worker %u", id);
+		{
+			fr_channel_t *origin = cd->channel.ch;
+
+			cd->channel.ch = ch;
+			worker_request_bootstrap(worker, cd, origin, now);
+		}
+		return true;
+	}
+
+	return false;
+}
+
+/** Start a request from our backlog, or from someone else's
+ *
+ */
+static bool worker_backlog_pop(fr_worker_t *worker, fr_time_t now)
+{
+	fr_channel_data_t *cd;
+
+	if (!fr_atomic_queue_pop(worker->backlog, (void **) &cd)) return worker_steal(worker, now);
+
+	atomic_fetch_sub(&worker->backlog_len, 1);
+	fr_channel_responder_resume(cd->channel.ch);
+
+	worker->stats.in++;
+	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
+	worker_request_bootstrap(worker, cd, NULL, now);
+
+	return true;
+}
+
+/** Start requests from the backlog until there's something to run
+ *
+ * If there's nothing to run, we mark ourselves idle, and check one more
+ * time.  Busy workers check for idle workers after queueing requests,
+ * so either they see us idle and wake us, or we see their requests.
+ *
+ * @param[in] worker	the worker.
+ */
+static void worker_backlog_run(fr_worker_t *worker)
+{
+	bool		idle = false;
+
+	(void) worker_idle_clear(worker->group, worker);
+
+	/*
+	 *	Requests may take a while to bootstrap, and the time
+	 *	is used for replies, which must not go backwards.  So
+	 *	get a new time for each one.
+	 */
+	while (fr_heap_num_elements(worker->runnable) == 0) {
+		if (worker_backlog_pop(worker, fr_time())) continue;
+
+		if (idle) return;
+
+		worker_idle_set(worker);
+		idle = true;
+	}
+
+	if (idle) (void) worker_idle_clear(worker->group, worker);
+}
+
+/** Wake one idle worker, so that it takes requests from our backlog
+ *
+ * @param[in] worker	the busy worker.
+ */
+static void worker_group_wake(fr_worker_t *worker)
+{
+	fr_worker_group_t	*group = worker->group;
+	unsigned int		i, num;
+
+	if (atomic_load_explicit(&group->num_idle, memory_order_relaxed) == 0) return;
+
+	num = atomic_load(&group->num_workers);
+	if (num > group->max_workers) num = group->max_workers;
+
+	for (i = 0; i < num; i++) {
+		fr_worker_peer_t	*peer = &group->peer[i];
+		fr_worker_t		*thief;
+		bool			woken = false;
+
+		if (i == worker->group_id) continue;
+
+		atomic_fetch_add(&peer->refs, 1);
+		thief = atomic_load(&peer->worker);
+		if (thief && worker_idle_clear(group, thief)) {
+			fr_ring_buffer_t *rb;
+
+			rb = fr_worker_rb_init();
+			if (rb) (void) fr_control_message_send(thief->control, rb, FR_CONTROL_ID_STEAL,
+							       &worker->group_id, sizeof(worker->group_id));
+			woken = true;
+		}
+		atomic_fetch_sub(&peer->refs, 1);
+
+		if (woken) return;
+	}
+}
+
+/** Stop other workers taking requests from us, and stop waking us
+ *
+ */
+static void worker_group_leave(fr_worker_t *worker)
+{
+	fr_worker_group_t	*group = worker->group;
+	fr_worker_peer_t	*peer = &group->peer[worker->group_id];
+
+	atomic_store(&peer->worker, NULL);
+	(void) worker_idle_clear(group, worker);
+
+	/*
+	 *	Wait for anyone who found us before we left.
+	 */
+	while (atomic_load(&peer->refs) > 0) sched_yield();
+
+	worker->group = NULL;
+}
+
 /** Run a request
  *
  *  Until it either yields, or is done.
@@ -1326,6 +2062,8 @@ static inline CC_HINT(always_inline) void worker_run_request(fr_worker_t *worker
 		REQUEST_VERIFY(request);
 		fr_assert(!fr_heap_entry_inserted(request->runnable_id));
 
+		if (request->async->tag > worker->vtime) worker->vtime = request->async->tag;
+
 		/*
 		 *	For real requests, if the channel is gone,
 		 *	just stop the request and free it.
@@ -1335,6 +2073,29 @@ static inline CC_HINT(always_inline) void worker_run_request(fr_worker_t *worker
 			return;
 		}
 
+		/*
+		 *	New requests have to get past admission
+		 *	control before we spend any time on them.
+		 */
+		if (request_is_external(request) && !request->async->admitted) {
+			request->async->admitted = true;
+
+			if (!worker_admit(worker, request, now)) {
+				worker_shed_request(worker, &request);
+				now = fr_time();
+				continue;
+			}
+		}
+
+		/*
+		 *	We're about to be busy, and there are requests
+		 *	waiting behind this one.  Get an idle worker
+		 *	to take them.
+		 */
+		if (worker->group && (atomic_load_explicit(&worker->backlog_len, memory_order_relaxed) > 0)) {
+			worker_group_wake(worker);
+		}
+
 		(void)unlang_interpret(request);
 
 		now = fr_time();
@@ -1357,6 +2118,7 @@ fr_worker_t *fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *
 			      fr_worker_config_t *config)
 {
 	fr_worker_t *worker;
+	unsigned int i;
 
 	worker = talloc_zero(ctx, fr_worker_t);
 	if (!worker) {
@@ -1366,6 +2128,7 @@ nomem:
 	}
 
 	worker->name = talloc_strdup(worker, name); /* thread locality */
+	worker->numa_node = -1;
 
 	unlang_thread_instantiate(worker);
 
@@ -1384,11 +2147,39 @@ nomem:
 
 	CHECK_CONFIG(max_requests,1024,(1 << 30));
 	CHECK_CONFIG(max_channels, 64, 1024);
-	CHECK_CONFIG(talloc_pool_size, 4096, 65536);
+	CHECK_CONFIG(talloc_pool_size, WORKER_POOL_MIN, WORKER_POOL_MAX);
 	CHECK_CONFIG(message_set_size, 1024, 8192);
 	CHECK_CONFIG(ring_buffer_size, (1 << 17), (1 << 20));
 	CHECK_CONFIG_TIME_DELTA(max_request_time, fr_time_delta_from_sec(5), fr_time_delta_from_sec(120));
 
+	for (i = 0; i < FR_CHANNEL_PRIORITY_CLASS_MAX; i++) {
+		static uint32_t const weight[FR_CHANNEL_PRIORITY_CLASS_MAX] = {
+			[FR_CHANNEL_PRIORITY_CLASS_NOW]		= 64,
+			[FR_CHANNEL_PRIORITY_CLASS_HIGH]	= 16,
+			[FR_CHANNEL_PRIORITY_CLASS_NORMAL]	= 4,
+			[FR_CHANNEL_PRIORITY_CLASS_LOW]		= 1
+		};
+
+		if (!worker->config.priority[i].weight) worker->config.priority[i].weight = weight[i];
+		if (worker->config.priority[i].weight > 1024) worker->config.priority[i].weight = 1024;
+	}
+
+	if (fr_time_delta_ispos(worker->config.admission_target)) {
+		CHECK_CONFIG_TIME_DELTA(admission_target, fr_time_delta_from_msec(1), fr_time_delta_from_sec(5));
+		CHECK_CONFIG_TIME_DELTA(admission_interval, fr_time_delta_from_msec(10), fr_time_delta_from_sec(10));
+	}
+
+	/*
+	 *	Decoded pairs and their values are bump allocated
+	 *	from the request's pool, and released in bulk when
+	 *	the request is returned to the free list.
+	 *
+	 *	The configured size is only the starting point, it's
+	 *	adjusted later from what requests actually use.
+	 */
+	atomic_store_explicit(&worker->pool_size, worker->config.talloc_pool_size, memory_order_relaxed);
+	request_pool_size_set(worker->config.talloc_pool_size);
+
 	worker->channel = talloc_zero_array(worker, fr_worker_channel_t, worker->config.max_channels);
 	if (!worker->channel) {
 		talloc_free(worker);
@@ -1494,12 +2285,21 @@ void fr_worker(fr_worker_t *worker)
 {
 	WORKER_VERIFY;
 
+	if (fr_rcu_thread_register() < 0) PERROR("Failed registering for RCU updates");
+
 	while (true) {
 		bool wait_for_event;
 		int num_events;
 
 		WORKER_VERIFY;
 
+		/*
+		 *	Start requests from the backlog only when we
+		 *	have nothing else to run.  If our backlog is
+		 *	empty, try to take requests from other workers.
+		 */
+		if (worker->group && !worker->exiting) worker_backlog_run(worker);
+
 		/*
 		 *	There are runnable requests.  We still service
 		 *	the event loop, but we don't wait for events.
@@ -1511,12 +2311,31 @@ void fr_worker(fr_worker_t *worker)
 			DEBUG4("Ready to process requests");
 		}
 
+		/*
+		 *	If requests are arriving quickly, look for the
+		 *	next one for a little while before going to
+		 *	sleep.  The network thread then doesn't have to
+		 *	wake us up.
+		 */
+		if (wait_for_event && fr_control_poll(worker->control)) wait_for_event = false;
+
 		/*
 		 *	Check the event list.  If there's an error
 		 *	(e.g. exit), we stop looping and clean up.
 		 */
 		DEBUG4("Gathering events - %s", wait_for_event ? "will wait" : "Will not wait");
+
+		/*
+		 *	Between calls to the interpreter we hold no
+		 *	references to data published via RCU.  If we're
+		 *	about to sleep, don't hold up anyone replacing it.
+		 */
+		if (wait_for_event) {
+			worker_request_alloc_publish(worker);
+			fr_rcu_thread_offline();
+		}
 		num_events = fr_event_corral(worker->el, fr_time(), wait_for_event);
+		fr_rcu_quiescent();
 		if (num_events < 0) {
 			PERROR("Failed retrieving events");
 			break;
@@ -1538,6 +2357,8 @@ void fr_worker(fr_worker_t *worker)
 		 */
 		worker_run_request(worker, fr_time());
 	}
+
+	fr_rcu_thread_unregister();
 }
 
 /** Pre-event handler
@@ -1570,6 +2391,12 @@ void fr_worker_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void
 	fr_worker_t *worker = talloc_get_type_abort(uctx, fr_worker_t);
 
 	worker_run_request(worker, fr_time());	/* Event loop time can be too old, and trigger asserts */
+
+	/*
+	 *	The counters are thread local, so take a copy
+	 *	which can be read from other threads.
+	 */
+	worker_request_alloc_publish(worker);
 }
 
 /** Print debug information about the worker structure
@@ -1591,6 +2418,116 @@ void fr_worker_debug(fr_worker_t *worker, FILE *fp)
 
 	fr_time_tracking_debug(&worker->tracking, fp);
 
+	fprintf(fp, "\trequest.alloced = %" PRIu64 "\n", atomic_load(&worker->request_alloc.alloced));
+	fprintf(fp, "\trequest.reused = %" PRIu64 "\n", atomic_load(&worker->request_alloc.reused));
+	fprintf(fp, "\trequest.freed = %" PRIu64 "\n", atomic_load(&worker->request_alloc.freed));
+	fprintf(fp, "\trequest.in_use = %u\n", atomic_load(&worker->request_alloc.in_use));
+	fprintf(fp, "\trequest.free = %u\n", atomic_load(&worker->request_alloc.free));
+	fprintf(fp, "\trequest.high_water_mark = %u\n", atomic_load(&worker->request_alloc.high_water_mark));
+}
+
+/** Record which NUMA node the worker is running on
+ *
+ * Network threads prefer workers on their own node.
+ *
+ * @param[in] worker	the worker.
+ * @param[in] node	the NUMA node, or -1 if the worker isn't bound to one.
+ */
+void fr_worker_numa_node_set(fr_worker_t *worker, int node)
+{
+	WORKER_VERIFY;
+
+	worker->numa_node = node;
+}
+
+/** Return the NUMA node the worker is running on
+ *
+ * @param[in] worker	the worker.
+ * @return the NUMA node, or -1 if unknown.
+ */
+int fr_worker_numa_node(fr_worker_t const *worker)
+{
+	return worker->numa_node;
+}
+
+/** Allocate a group of workers which take requests from each other
+ *
+ * @param[in] ctx		to allocate the group in.
+ * @param[in] max_workers	which will join the group.
+ * @return
+ *	- The group on success.
+ *	- NULL on failure.
+ */
+fr_worker_group_t *fr_worker_group_alloc(TALLOC_CTX *ctx, unsigned int max_workers)
+{
+	fr_worker_group_t *group;
+
+	group = talloc_zero(ctx, fr_worker_group_t);
+	if (!group) return NULL;
+
+	group->peer = talloc_zero_array(group, fr_worker_peer_t, max_workers);
+	if (!group->peer) {
+		talloc_free(group);
+		return NULL;
+	}
+	group->max_workers = max_workers;
+
+	return group;
+}
+
+/** Wake-up message from a busy worker
+ *
+ * The message itself doesn't matter.  It just gets us out of the event
+ * loop, so that we look at the other workers' backlogs.
+ */
+static void worker_steal_callback(UNUSED void *ctx, UNUSED void const *data, UNUSED size_t data_size, UNUSED fr_time_t now)
+{
+}
+
+/** Join a group of workers which take requests from each other
+ *
+ * Must be called from the worker's thread, before any channels are
+ * opened to it.  After this, new requests are queued in a backlog,
+ * and are only started when the worker has nothing else to do.  Idle
+ * workers in the same group take requests from the backlog.
+ *
+ * @param[in] group	to join.
+ * @param[in] worker	joining the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_worker_group_join(fr_worker_group_t *group, fr_worker_t *worker)
+{
+	unsigned int id;
+
+	WORKER_VERIFY;
+	fr_assert(!worker->group);
+
+	id = atomic_fetch_add(&group->num_workers, 1);
+	if (id >= group->max_workers) {
+		fr_strerror_printf("Too many workers in group, maximum is %u", group->max_workers);
+		return -1;
+	}
+
+	worker->backlog = fr_atomic_queue_alloc(worker, WORKER_BACKLOG_SIZE);
+	if (!worker->backlog) {
+		fr_strerror_const("Failed creating backlog");
+		return -1;
+	}
+
+	if (fr_control_callback_add(worker->control, FR_CONTROL_ID_STEAL, worker, worker_steal_callback) < 0) {
+		fr_strerror_const_push("Failed adding work stealing callback");
+		return -1;
+	}
+
+	worker->group = group;
+	worker->group_id = id;
+	worker->steal_next = id + 1;
+
+	atomic_store(&group->peer[id].worker, worker);
+
+	return 0;
 }
 
 /** Create a channel to the worker
@@ -1695,6 +2632,26 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	return 6;
 }
 
+static void worker_pool_usage_fprint(FILE *fp, fr_worker_pool_usage_t const *usage, char const *prefix)
+{
+	static char const *names[WORKER_POOL_BUCKETS] = {
+		"1k", "2k", "4k", "8k", "16k", "32k", "64k", "128k", "256k", "more"
+	};
+	unsigned int i;
+
+	fprintf(fp, "%s.samples\t%" PRIu64 "\n", prefix, atomic_load(&usage->samples));
+	fprintf(fp, "%s.overflows\t%" PRIu64 "\n", prefix, atomic_load(&usage->overflows));
+	fprintf(fp, "%s.max\t%zu\n", prefix, atomic_load(&usage->max));
+
+	for (i = 0; i < WORKER_POOL_BUCKETS; i++) {
+		uint64_t count = atomic_load(&usage->bucket[i]);
+
+		if (!count) continue;
+
+		fprintf(fp, "%s.%s\t%" PRIu64 "\n", prefix, names[i], count);
+	}
+}
+
 static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
 {
 	fr_worker_t const *worker = ctx;
@@ -1706,6 +2663,10 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.dup\t\t\t%" PRIu64 "\n", worker->stats.dup);
 		fprintf(fp, "count.dropped\t\t\t%" PRIu64 "\n", worker->stats.dropped);
 		fprintf(fp, "count.naks\t\t\t%" PRIu64 "\n", worker->num_naks);
+		fprintf(fp, "count.shed\t\t\t%" PRIu64 "\n", worker->num_shed);
+		fprintf(fp, "count.rejected\t\t\t%" PRIu64 "\n", worker->num_rejected);
+		fprintf(fp, "count.stolen\t\t\t%" PRIu64 "\n", worker->num_stolen);
+		fprintf(fp, "count.backlog\t\t\t%u\n", atomic_load(&worker->backlog_len));
 		fprintf(fp, "count.active\t\t\t%" PRIu64 "\n", worker->num_active);
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
 	}
@@ -1726,6 +2687,23 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 
 		fr_time_elapsed_fprint(fp, &worker->cpu_time, "cpu.requests", 4);
 		fr_time_elapsed_fprint(fp, &worker->wall_clock, "time.requests", 4);
+		fr_time_elapsed_fprint(fp, &worker->queue_delay, "time.queue", 4);
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "memory") == 0)) {
+		unsigned int i, num_pool_servers;
+
+		fprintf(fp, "memory.pool_size		%zu\n", atomic_load(&worker->pool_size));
+		worker_pool_usage_fprint(fp, &worker->pool_usage, "memory.requests");
+
+		num_pool_servers = atomic_load_explicit(&worker->num_pool_servers, memory_order_acquire);
+		for (i = 0; i < num_pool_servers; i++) {
+			char prefix[128];
+
+			snprintf(prefix, sizeof(prefix), "memory.server.%s",
+				 cf_section_name2(worker->pool_server[i].server_cs));
+			worker_pool_usage_fprint(fp, &worker->pool_server[i].usage, prefix);
+		}
 	}
 
 	return 0;
@@ -1743,7 +2721,7 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.parent = "stats worker",
 		.add_name = true,
 		.name = "self",
-		.syntax = "[(count|cpu)]",
+		.syntax = "[(count|cpu|memory)]",
 		.func = cmd_stats_worker,
 		.help = "Show statistics for a specific worker thread.",
 		.read_only = true
@@ -37,6 +37,11 @@ extern "C" {
  */
 typedef struct fr_worker_s fr_worker_t;
 
+/**
+ *  Workers which take requests from each other when they're idle.
+ */
+typedef struct fr_worker_group_s fr_worker_group_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,6 +71,17 @@ typedef struct {
 	fr_time_delta_t	max_request_time;	//!< maximum time a request can be processed
 
 	size_t		talloc_pool_size;	//!< for each request
+
+	fr_time_delta_t	admission_target;	//!< Queueing delay above which requests are shed.
+						///< Zero disables admission control.
+	fr_time_delta_t	admission_interval;	//!< How long the delay must stay above the target
+						///< before requests are shed.
+	bool		admission_reject;	//!< Reject shed requests, instead of discarding them.
+
+	fr_channel_priority_config_t priority[FR_CHANNEL_PRIORITY_CLASS_MAX];	//!< Weights for each class of packets.
+
+	bool		work_stealing;		//!< Idle workers take requests which other workers
+						///< haven't started yet.
 } fr_worker_config_t;
 
 fr_worker_t	*fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *name,
@@ -77,6 +93,14 @@ void		fr_worker(fr_worker_t *worker) CC_HINT(nonnull);
 
 void		fr_worker_debug(fr_worker_t *worker, FILE *fp) CC_HINT(nonnull);
 
+void		fr_worker_numa_node_set(fr_worker_t *worker, int node) CC_HINT(nonnull);
+
+int		fr_worker_numa_node(fr_worker_t const *worker) CC_HINT(nonnull);
+
+fr_worker_group_t *fr_worker_group_alloc(TALLOC_CTX *ctx, unsigned int max_workers);
+
+int		fr_worker_group_join(fr_worker_group_t *group, fr_worker_t *worker) CC_HINT(nonnull);
+
 int		fr_worker_pre_event(fr_time_t now, fr_time_delta_t wake, void *uctx);
 
 void		fr_worker_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
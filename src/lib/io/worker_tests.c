@@ -0,0 +1,576 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the worker's schedule, and workers taking requests from each other
+ *
+ * @file src/lib/io/worker_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "worker.c"
+
+#include <freeradius-devel/io/control.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/dict_test.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#define NUM_REQUESTS	(64)		//!< Sent to the busy worker, after the first one.
+#define GATE		(0)		//!< The first request sent to the busy worker.
+#define WAKE		(NUM_REQUESTS + 1)	//!< The request sent to the idle worker.
+
+typedef struct {
+	char const		*name;
+	pthread_t		pthread_id;
+	fr_worker_t		*worker;
+	fr_channel_t		*ch;		//!< Channel from the test to the worker.
+#ifndef NDEBUG
+	uint64_t		time_reads;	//!< Calls to fr_time() by the worker thread.
+#endif
+} test_worker_t;
+
+typedef struct {
+	fr_channel_t		*ch;		//!< Channel the request was sent on.
+	int			replies;	//!< Number of replies we've had.
+	bool			stolen;		//!< The reply came from a worker we didn't send it to.
+} test_request_t;
+
+static TALLOC_CTX		*autofree;
+static fr_dict_t		*test_dict;
+
+static fr_worker_group_t	*group;
+static pthread_barrier_t	barrier;
+static test_worker_t		busy, idle, single;
+
+static test_request_t		requests[WAKE + 1];
+static int			num_replies, num_stolen, num_closed;
+
+static atomic_bool		all_sent, blocked, release;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("worker_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+
+	if (unlang_global_init() < 0) goto error;
+}
+
+/** Spin until another thread sets a flag
+ *
+ * Gives up after a few seconds, so that a broken worker fails the
+ * test, instead of hanging it.
+ */
+static bool test_wait_for(atomic_bool *flag)
+{
+	fr_time_t end = fr_time_add(fr_time(), fr_time_delta_from_sec(5));
+
+	while (!atomic_load(flag)) {
+		if (fr_time_gt(fr_time(), end)) return false;
+		sched_yield();
+	}
+
+	return true;
+}
+
+/** Decode a request in the worker
+ *
+ * The first request the busy worker starts after the gate blocks it,
+ * until the idle worker has taken everything else from its backlog.
+ * All requests then fail to decode, so that the worker NAKs them,
+ * which is enough to check where the replies go.
+ */
+static int test_decode(UNUSED void const *instance, request_t *request, uint8_t *const data, UNUSED size_t data_len)
+{
+	uint32_t number;
+
+	memcpy(&number, data, sizeof(number));
+
+	if (number == GATE) {
+		(void) test_wait_for(&all_sent);
+
+	} else if (!request->async->origin && (request->async->channel == busy.ch) &&
+		   !atomic_exchange(&blocked, true)) {
+		(void) test_wait_for(&release);
+	}
+
+	return -1;
+}
+
+static size_t test_nak(UNUSED fr_listen_t *li, UNUSED void *packet_ctx, uint8_t *const packet,
+		       UNUSED size_t packet_len, uint8_t *reply, UNUSED size_t reply_len)
+{
+	memcpy(reply, packet, sizeof(uint32_t));
+
+	return sizeof(uint32_t);
+}
+
+static fr_app_t test_app = {
+	.common = {
+		.name = "worker_tests"
+	},
+	.decode = test_decode
+};
+
+static fr_app_io_t test_app_io = {
+	.common = {
+		.name = "worker_tests"
+	},
+	.default_message_size = 64,
+	.nak = test_nak
+};
+
+static fr_listen_t test_listen = {
+	.name = "worker_tests",
+	.app = &test_app,
+	.app_io = &test_app_io
+};
+
+static void *test_worker_thread(void *arg)
+{
+	test_worker_t		*tw = arg;
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el;
+
+	MEM(ctx = talloc_init_const(tw->name));
+	MEM(el = fr_event_list_alloc(ctx, NULL, NULL));
+
+	tw->worker = fr_worker_create(ctx, el, tw->name, &default_log, fr_debug_lvl, NULL);
+	if (!tw->worker || (fr_worker_group_join(group, tw->worker) < 0)) {
+		fr_perror("worker_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Channels can only be opened once we're in the group.
+	 */
+	pthread_barrier_wait(&barrier);
+
+	fr_worker(tw->worker);
+#ifndef NDEBUG
+	tw->time_reads = fr_time_reads;
+#endif
+	fr_worker_destroy(tw->worker);
+
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+static void test_recv_reply(UNUSED void *uctx, fr_channel_t *ch, fr_channel_data_t *cd)
+{
+	uint32_t number;
+
+	memcpy(&number, cd->m.data, sizeof(number));
+	if (TEST_CHECK(number <= WAKE)) {
+		TEST_CHECK(requests[number].ch == ch);
+		TEST_MSG("Reply to request %u arrived on the wrong channel", number);
+
+		requests[number].replies++;
+		if (cd->reply.origin) {
+			TEST_CHECK(cd->reply.origin == ch);
+			requests[number].stolen = true;
+			num_stolen++;
+		}
+	}
+
+	num_replies++;
+	fr_message_done(&cd->m);
+}
+
+static void test_channel_callback(UNUSED void *ctx, void const *data, size_t data_size, fr_time_t now)
+{
+	fr_channel_t		*ch;
+
+	switch (fr_channel_service_message(now, &ch, data, data_size)) {
+	case FR_CHANNEL_DATA_READY_REQUESTOR:
+		while (fr_channel_recv_reply(ch));
+		break;
+
+	case FR_CHANNEL_CLOSE:
+		num_closed++;
+		break;
+
+	default:
+		break;
+	}
+}
+
+/** Service our event loop until we have enough replies, or close signals
+ *
+ */
+static bool test_run(fr_event_list_t *el, int *counter, int wanted)
+{
+	fr_time_t end = fr_time_add(fr_time(), fr_time_delta_from_sec(5));
+
+	while (*counter < wanted) {
+		if (fr_time_gt(fr_time(), end)) return false;
+
+		if (fr_event_corral(el, fr_time(), false) > 0) fr_event_service(el);
+		sched_yield();
+	}
+
+	return true;
+}
+
+static void test_send(fr_message_set_t *ms, test_worker_t *tw, uint32_t number)
+{
+	fr_channel_data_t *cd;
+
+	cd = (fr_channel_data_t *) fr_message_alloc(ms, NULL, sizeof(number));
+	fr_assert(cd != NULL);
+
+	cd->m.when = fr_time();
+	cd->priority = PRIORITY_NORMAL;
+	cd->listen = &test_listen;
+	cd->packet_ctx = NULL;
+	cd->request.recv_time = cd->m.when;
+	cd->request.decoded_len = 0;
+	memcpy(cd->m.data, &number, sizeof(number));
+
+	requests[number].ch = tw->ch;
+	TEST_CHECK(fr_channel_send_request(tw->ch, cd) == 0);
+}
+
+static void test_worker_start(test_worker_t *tw, char const *name)
+{
+	tw->name = name;
+	TEST_CHECK(pthread_create(&tw->pthread_id, NULL, test_worker_thread, tw) == 0);
+}
+
+static void test_steal(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el;
+	fr_atomic_queue_t	*aq;
+	fr_control_t		*control;
+	fr_message_set_t	*ms;
+	uint32_t		i;
+
+	MEM(ctx = talloc_init_const("worker_tests"));
+	MEM(el = fr_event_list_alloc(ctx, NULL, NULL));
+	MEM(aq = fr_atomic_queue_alloc(ctx, 1024));
+	MEM(control = fr_control_create(ctx, el, aq));
+	TEST_CHECK(fr_control_callback_add(control, FR_CONTROL_ID_CHANNEL, NULL, test_channel_callback) == 0);
+	MEM(ms = fr_message_set_create(ctx, 1024, sizeof(fr_channel_data_t), 1024 * 64));
+
+	MEM(group = fr_worker_group_alloc(ctx, 2));
+	pthread_barrier_init(&barrier, NULL, 3);
+
+	test_worker_start(&busy, "busy");
+	test_worker_start(&idle, "idle");
+	pthread_barrier_wait(&barrier);
+
+	MEM(busy.ch = fr_worker_channel_create(busy.worker, ctx, control));
+	fr_channel_set_recv_reply(busy.ch, NULL, test_recv_reply);
+
+	MEM(idle.ch = fr_worker_channel_create(idle.worker, ctx, control));
+	fr_channel_set_recv_reply(idle.ch, NULL, test_recv_reply);
+
+	TEST_CASE("Requests queue up behind a busy worker");
+	test_send(ms, &busy, GATE);
+	for (i = 1; i <= NUM_REQUESTS; i++) test_send(ms, &busy, i);
+	atomic_store(&all_sent, true);
+
+	/*
+	 *	The busy worker blocks in the first request it starts
+	 *	itself.  The idle worker may take all of them before
+	 *	that happens.
+	 */
+	TEST_CASE("An idle worker takes them");
+	test_send(ms, &idle, WAKE);
+	TEST_CHECK(test_run(el, &num_replies, WAKE));
+	TEST_CHECK(num_stolen >= (NUM_REQUESTS - 1));
+	TEST_MSG("Only %d requests were stolen", num_stolen);
+	if (num_stolen < NUM_REQUESTS) TEST_CHECK(atomic_load(&blocked));
+
+	TEST_CASE("The busy worker replies to the one it started");
+	atomic_store(&release, true);
+	TEST_CHECK(test_run(el, &num_replies, WAKE + 1));
+
+	for (i = 0; i <= WAKE; i++) {
+		TEST_CHECK(requests[i].replies == 1);
+		TEST_MSG("Request %u had %d replies", i, requests[i].replies);
+	}
+	TEST_CHECK(!requests[GATE].stolen);
+	TEST_CHECK(!requests[WAKE].stolen);
+
+	TEST_CASE("Nothing is outstanding on either channel");
+	(void) fr_channel_signal_responder_close(busy.ch);
+	(void) fr_channel_signal_responder_close(idle.ch);
+	TEST_CHECK(test_run(el, &num_closed, 2));
+
+	pthread_join(busy.pthread_id, NULL);
+	pthread_join(idle.pthread_id, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	TEST_CHECK_RET(fr_channel_requestor_outstanding(busy.ch), 0);
+	TEST_CHECK_RET(fr_channel_responder_outstanding(busy.ch), 0);
+	TEST_CHECK_RET(fr_channel_requestor_outstanding(idle.ch), 0);
+	TEST_CHECK_RET(fr_channel_responder_outstanding(idle.ch), 0);
+
+	talloc_free(ctx);
+}
+
+#ifndef NDEBUG
+#define TIME_BATCHES		(20)
+#define TIME_BATCH_SIZE		(50)
+#define TIME_READS_MAX		(10)	//!< Per request, including the worker's event loop.
+
+/** Count how often the worker reads the clock for each request
+ *
+ * The requests are NAKed after decoding, so this covers the worker's
+ * own overhead, and not what the virtual server does.
+ */
+static void test_time_reads(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el;
+	fr_atomic_queue_t	*aq;
+	fr_control_t		*control;
+	fr_message_set_t	*ms;
+	int			i, j;
+	uint64_t		per_request;
+
+	MEM(ctx = talloc_init_const("worker_tests"));
+	MEM(el = fr_event_list_alloc(ctx, NULL, NULL));
+	MEM(aq = fr_atomic_queue_alloc(ctx, 1024));
+	MEM(control = fr_control_create(ctx, el, aq));
+	TEST_CHECK(fr_control_callback_add(control, FR_CONTROL_ID_CHANNEL, NULL, test_channel_callback) == 0);
+	MEM(ms = fr_message_set_create(ctx, 1024, sizeof(fr_channel_data_t), 1024 * 64));
+
+	MEM(group = fr_worker_group_alloc(ctx, 1));
+	pthread_barrier_init(&barrier, NULL, 2);
+
+	test_worker_start(&single, "single");
+	pthread_barrier_wait(&barrier);
+
+	MEM(single.ch = fr_worker_channel_create(single.worker, ctx, control));
+	fr_channel_set_recv_reply(single.ch, NULL, test_recv_reply);
+
+	/*
+	 *	Send the requests in batches, so that the worker
+	 *	handles more than one per trip round its event loop.
+	 */
+	for (i = 0; i < TIME_BATCHES; i++) {
+		for (j = 0; j < TIME_BATCH_SIZE; j++) test_send(ms, &single, 1);
+		TEST_CHECK(test_run(el, &num_replies, (i + 1) * TIME_BATCH_SIZE));
+	}
+
+	(void) fr_channel_signal_responder_close(single.ch);
+	TEST_CHECK(test_run(el, &num_closed, 1));
+
+	pthread_join(single.pthread_id, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	per_request = single.time_reads / (TIME_BATCHES * TIME_BATCH_SIZE);
+	TEST_CHECK(per_request <= TIME_READS_MAX);
+	TEST_MSG("The worker read the clock %" PRIu64 " times per request", per_request);
+
+	talloc_free(ctx);
+}
+#endif
+
+/** Add a request to the schedule, as worker_request_time_tracking_start() does
+ *
+ */
+static void test_wfq_push(fr_worker_t *worker, request_t *request, uint32_t priority)
+{
+	request->async->priority = priority;
+	worker_request_tag(worker, request);
+	TEST_CHECK(fr_heap_insert(&worker->runnable, request) == 0);
+}
+
+/** Take the next request from the schedule, as fr_worker_run_request() does
+ *
+ */
+static fr_channel_priority_class_t test_wfq_pop(fr_worker_t *worker)
+{
+	request_t *request = fr_heap_pop(&worker->runnable);
+
+	fr_assert(request != NULL);
+	if (request->async->tag > worker->vtime) worker->vtime = request->async->tag;
+
+	return fr_channel_priority_class(request->async->priority);
+}
+
+#define WFQ_REQUESTS	(40)
+
+static void test_wfq(void)
+{
+	TALLOC_CTX	*ctx;
+	fr_worker_t	*worker;
+	request_t	*pending;
+	fr_async_t	*async;
+	int		i, num[FR_CHANNEL_PRIORITY_CLASS_MAX] = {};
+
+	MEM(ctx = talloc_init_const("worker_tests"));
+	MEM(pending = talloc_zero_array(ctx, request_t, WFQ_REQUESTS * 2));
+	MEM(async = talloc_zero_array(ctx, fr_async_t, WFQ_REQUESTS * 2));
+	for (i = 0; i < (WFQ_REQUESTS * 2); i++) pending[i].async = &async[i];
+
+	MEM(worker = talloc_zero(ctx, fr_worker_t));
+	MEM(worker->runnable = fr_heap_alloc(worker, worker_runnable_cmp, request_t, runnable_id, 0));
+	for (i = 0; i < FR_CHANNEL_PRIORITY_CLASS_MAX; i++) worker->config.priority[i].weight = 1;
+	worker->config.priority[FR_CHANNEL_PRIORITY_CLASS_HIGH].weight = 3;
+
+	TEST_CASE("Each class gets a share of the worker in proportion to its weight");
+	for (i = 0; i < WFQ_REQUESTS; i++) test_wfq_push(worker, &pending[i], PRIORITY_LOW);
+	for (i = 0; i < WFQ_REQUESTS; i++) test_wfq_push(worker, &pending[WFQ_REQUESTS + i], PRIORITY_HIGH);
+
+	TEST_CHECK(test_wfq_pop(worker) == FR_CHANNEL_PRIORITY_CLASS_HIGH);
+	num[FR_CHANNEL_PRIORITY_CLASS_HIGH]++;
+	for (i = 1; i < WFQ_REQUESTS; i++) num[test_wfq_pop(worker)]++;
+
+	TEST_CHECK_RET(num[FR_CHANNEL_PRIORITY_CLASS_HIGH], (WFQ_REQUESTS * 3) / 4);
+	TEST_CHECK_RET(num[FR_CHANNEL_PRIORITY_CLASS_LOW], WFQ_REQUESTS / 4);
+
+	TEST_CASE("A class which was idle doesn't get to run what it missed first");
+	while (fr_heap_num_elements(worker->runnable) > 0) (void) test_wfq_pop(worker);
+	memset(worker->pass, 0, sizeof(worker->pass));
+	worker->vtime = 0;
+
+	for (i = 0; i < WFQ_REQUESTS; i++) test_wfq_push(worker, &pending[i], PRIORITY_HIGH);
+	for (i = 0; i < WFQ_REQUESTS; i++) (void) test_wfq_pop(worker);
+
+	for (i = 0; i < 4; i++) test_wfq_push(worker, &pending[i], PRIORITY_LOW);
+	for (i = 0; i < 4; i++) test_wfq_push(worker, &pending[WFQ_REQUESTS + i], PRIORITY_HIGH);
+
+	for (i = 0; i < 3; i++) TEST_CHECK(test_wfq_pop(worker) == FR_CHANNEL_PRIORITY_CLASS_HIGH);
+	TEST_CHECK(test_wfq_pop(worker) == FR_CHANNEL_PRIORITY_CLASS_LOW);
+
+	talloc_free(ctx);
+}
+
+/** Ask admission control about a request which has waited for a number of milliseconds
+ *
+ */
+static bool test_admit(fr_worker_t *worker, request_t *request, fr_time_t now, int64_t waited)
+{
+	request->async->recv_time = fr_time_sub(now, fr_time_delta_from_msec(waited));
+
+	return worker_admit(worker, request, now);
+}
+
+static void test_admission(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_worker_t		*worker;
+	fr_worker_admission_t	*admission;
+	request_t		*request;
+	fr_time_delta_t		interval = fr_time_delta_from_msec(100);
+	fr_time_t		start = fr_time_wrap(NSEC), now, shed_next;
+	uint32_t		count;
+	int			i;
+
+	MEM(ctx = talloc_init_const("worker_tests"));
+	MEM(request = talloc_zero(ctx, request_t));
+	MEM(request->async = talloc_zero(request, fr_async_t));
+
+	MEM(worker = talloc_zero(ctx, fr_worker_t));
+	worker->name = "test";
+	worker->log = &default_log;
+	worker->config.admission_target = fr_time_delta_from_msec(5);
+	worker->config.admission_interval = interval;
+	admission = &worker->admission;
+
+	TEST_CASE("Requests are run until the delay has been above target for an interval");
+	TEST_CHECK(test_admit(worker, request, start, 10));
+	TEST_CHECK(test_admit(worker, request, fr_time_add(start, fr_time_delta_from_msec(50)), 10));
+	TEST_CHECK(test_admit(worker, request, fr_time_add(start, fr_time_delta_from_msec(99)), 10));
+	TEST_CHECK(!admission->shedding);
+
+	TEST_CASE("Shedding starts after an interval above target");
+	now = fr_time_add(start, interval);
+	TEST_CHECK(!test_admit(worker, request, now, 10));
+	TEST_CHECK(admission->shedding);
+	TEST_CHECK_RET(admission->count, 1);
+	TEST_CHECK(fr_time_eq(admission->shed_next, fr_time_add(now, interval)));
+
+	TEST_CASE("Requests are shed interval / sqrt(count) apart");
+	for (i = 0; i < 8; i++) {
+		shed_next = admission->shed_next;
+		count = admission->count;
+
+		TEST_CHECK(test_admit(worker, request, fr_time_sub(shed_next, fr_time_delta_wrap(1)), 10));
+		TEST_CHECK(!test_admit(worker, request, shed_next, 10));
+		TEST_CHECK(admission->count == (count + 1));
+		TEST_CHECK(fr_time_delta_eq(fr_time_sub(admission->shed_next, shed_next),
+					    fr_time_delta_wrap(fr_time_delta_unwrap(interval) / worker_isqrt(count + 1))));
+		TEST_MSG("Expected a gap of interval / %u", worker_isqrt(count + 1));
+	}
+	TEST_CHECK_RET(admission->count, 9);
+	TEST_CHECK(fr_time_delta_eq(fr_time_sub(admission->shed_next, shed_next),
+				    fr_time_delta_wrap(fr_time_delta_unwrap(interval) / 3)));
+
+	TEST_CASE("Shedding stops when the delay drops below target");
+	now = admission->shed_next;
+	TEST_CHECK(test_admit(worker, request, now, 1));
+	TEST_CHECK(!admission->shedding);
+	TEST_CHECK(!fr_time_ispos(admission->first_above));
+	TEST_CHECK(test_admit(worker, request, fr_time_add(now, fr_time_delta_from_msec(50)), 10));
+	TEST_CHECK(!admission->shedding);
+
+	TEST_CASE("Shedding again soon after resumes at the previous rate");
+	now = fr_time_add(now, fr_time_delta_from_msec(150));
+	TEST_CHECK(!test_admit(worker, request, now, 10));
+	TEST_CHECK(admission->shedding);
+	TEST_CHECK_RET(admission->count, 8);
+	TEST_CHECK_RET(admission->last_count, 8);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "fr_worker_wfq",		test_wfq	},
+	{ "fr_worker_admission",	test_admission	},
+	{ "fr_worker_steal",		test_steal	},
+#ifndef NDEBUG
+	{ "fr_worker_time_reads",	test_time_reads	},
+#endif
+
+	{ NULL }
+};
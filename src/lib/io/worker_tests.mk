@@ -0,0 +1,8 @@
+TARGET		:= worker_tests$(E)
+SOURCES		:= worker_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L) libfreeradius-io$(L)
+
+TGT_INSTALLDIR	:=
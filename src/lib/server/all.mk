@@ -1,5 +1,6 @@
 SUBMAKEFILES := \
 	libfreeradius-server.mk \
+	client_tests.mk \
 	pair_server_tests.mk \
 	tmpl_dcursor_tests.mk \
 	trunk_tests.mk
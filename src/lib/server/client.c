@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/cf_file.h>
 #include <freeradius-devel/server/cf_parse.h>
 #include <freeradius-devel/server/client.h>
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/server/main_config.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/virtual_servers.h>
@@ -38,50 +39,500 @@ RCSID("$Id$")
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/base16.h>
 #include <freeradius-devel/util/misc.h>
-#include <freeradius-devel/util/trie.h>
+#include <freeradius-devel/util/rcu.h>
+#include <freeradius-devel/util/syserror.h>
 
 #include <ctype.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
-//#define WITH_TRIE (1)
+/** A network in a client prefix trie
+ *
+ * The trie is path compressed, so nodes only exist where there are
+ * clients, or where two branches diverge.
+ *
+ * Lookups don't take any locks.  Changes publish fully initialised
+ * nodes, and nodes which have been unlinked are freed via RCU, once
+ * no network or worker thread can still be traversing them.
+ */
+typedef struct client_node_s client_node_t;
+struct client_node_s {
+	_Atomic(client_node_t *)	child[2];	//!< Branches where the next bit is 0 or 1.
+	_Atomic(fr_client_t *)		client[3];	//!< Clients for proto "*", udp and tcp.
+	uint8_t				prefix;		//!< Number of significant bits in the key.
+	uint8_t				key[16];	//!< Network address, with the host bits zeroed.
+};
+
+/** A secret shared by one or more clients
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the tree of secrets.
+	char const		*secret;		//!< talloc'd copy of the secret, which may be binary.
+	size_t			len;			//!< Length of the secret.
+	unsigned int		refs;			//!< How many clients are using the secret.
+} client_secret_t;
 
 /** Group of clients
  *
  */
 struct fr_client_list_s {
-	char const	*name;			//!< Name of the client list.
-#ifdef WITH_TRIE
-	fr_trie_t	*v4_udp;
-	fr_trie_t	*v6_udp;
-	fr_trie_t	*v4_tcp;
-	fr_trie_t	*v6_tcp;
-#else
-	fr_rb_tree_t	*tree[129];
-#endif
+	char const		*name;			//!< Name of the client list.
+
+	client_node_t		*v4;			//!< Root of the IPv4 trie.
+	client_node_t		*v6;			//!< Root of the IPv6 trie.
+	fr_rb_tree_t		*secrets;		//!< Secrets used by clients in the list.
+
+	pthread_mutex_t		mutex;			//!< Serialises changes.  Lookups don't take it.
+	uint64_t		num_clients;		//!< How many clients are in the list.
+	uint64_t		num_nodes;		//!< How many nodes are in the tries.
+
+	_Atomic(uint64_t)	generation;		//!< Changes whenever a client is added or removed.
 };
 
-static fr_client_list_t	*root_clients = NULL;	//!< Global client list.
+static fr_client_list_t	*root_clients = NULL;		//!< Global client list.
+
+static char const	*file_clients_path = NULL;	//!< File or directory of additional global clients.
+static fr_rb_tree_t	*file_clients = NULL;		//!< Clients which were loaded from file_clients_path.
+
+#define CLIENT_KEY_BIT(_key, _bit)	(((_key)[(_bit) >> 3] >> (7 - ((_bit) & 0x07))) & 0x01)
 
-#ifndef WITH_TRIE
-static int8_t client_cmp(void const *one, void const *two)
+/** Map a protocol to a client slot in a #client_node_t
+ *
+ */
+static inline CC_HINT(always_inline) unsigned int client_proto_slot(int proto)
 {
-	int ret;
-	fr_client_t const *a = one;
-	fr_client_t const *b = two;
+	switch (proto) {
+	case IPPROTO_UDP:
+		return 1;
+
+	case IPPROTO_TCP:
+		return 2;
+
+	default:
+		return 0;
+	}
+}
+
+/** Return the client at a node which matches proto
+ *
+ * "proto = *" clients match any protocol, and a proto of IPPROTO_IP
+ * matches a client of any protocol.
+ */
+static inline CC_HINT(always_inline) fr_client_t *client_node_client(client_node_t *node, int proto)
+{
+	fr_client_t *client;
+
+	client = atomic_load_explicit(&node->client[0], memory_order_acquire);
+	if (client) return client;
+
+	switch (proto) {
+	case IPPROTO_UDP:
+		return atomic_load_explicit(&node->client[1], memory_order_acquire);
+
+	case IPPROTO_TCP:
+		return atomic_load_explicit(&node->client[2], memory_order_acquire);
+
+	default:
+		client = atomic_load_explicit(&node->client[1], memory_order_acquire);
+		if (client) return client;
+
+		return atomic_load_explicit(&node->client[2], memory_order_acquire);
+	}
+}
+
+static inline CC_HINT(always_inline) bool client_node_has_clients(client_node_t *node)
+{
+	return (atomic_load_explicit(&node->client[0], memory_order_relaxed) ||
+		atomic_load_explicit(&node->client[1], memory_order_relaxed) ||
+		atomic_load_explicit(&node->client[2], memory_order_relaxed));
+}
+
+/** Return how many branches a node has, and one of them
+ *
+ */
+static inline CC_HINT(always_inline) unsigned int client_node_children(client_node_t **one, client_node_t *node)
+{
+	client_node_t *zero = atomic_load_explicit(&node->child[0], memory_order_relaxed);
+	client_node_t *other = atomic_load_explicit(&node->child[1], memory_order_relaxed);
+
+	*one = zero ? zero : other;
+
+	return (zero != NULL) + (other != NULL);
+}
+
+/** Return the number of leading bits two keys have in common, up to max
+ *
+ */
+static inline CC_HINT(always_inline) uint8_t client_key_common(uint8_t const *a, uint8_t const *b, uint8_t max)
+{
+	unsigned int i;
+
+	for (i = 0; i < max; i += 8) {
+		uint8_t diff = a[i >> 3] ^ b[i >> 3];
+
+		if (!diff) continue;
+
+		while (!(diff & 0x80)) {
+			diff <<= 1;
+			i++;
+		}
+
+		return (i < max) ? i : max;
+	}
+
+	return max;
+}
+
+static inline CC_HINT(always_inline) client_node_t *client_root(fr_client_list_t const *clients,
+								  fr_ipaddr_t const *ipaddr)
+{
+	switch (ipaddr->af) {
+	case AF_INET:
+		return clients->v4;
+
+	case AF_INET6:
+		return clients->v6;
+
+	default:
+		return NULL;
+	}
+}
+
+static inline CC_HINT(always_inline) uint8_t const *client_key(fr_ipaddr_t const *ipaddr)
+{
+	if (ipaddr->af == AF_INET) return (uint8_t const *) &ipaddr->addr.v4.s_addr;
 
-	ret = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
-	if (ret != 0) return ret;
+	return ipaddr->addr.v6.s6_addr;
+}
+
+/** Free a node, client or secret once no thread can still be reading it
+ *
+ */
+static void client_retire(void *ptr)
+{
+	if (fr_rcu_retire(ptr) < 0) PERROR("Failed freeing client data, it will be leaked");
+}
+
+static client_node_t *client_node_alloc(fr_client_list_t *clients, uint8_t const *key, uint8_t prefix)
+{
+	client_node_t	*node;
+	unsigned int	len = (prefix + 7) >> 3;
 
 	/*
-	 *	0 is "wildcard", or "both" protocols
+	 *	Nodes are freed by whichever thread is last to pass
+	 *	through a quiescent state, so they can't be parented
+	 *	by the list.
 	 */
-	if ((a->proto == IPPROTO_IP) || (b->proto == IPPROTO_IP)) return 0;
+	node = talloc_zero(NULL, client_node_t);
+	if (unlikely(!node)) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	node->prefix = prefix;
+	if (len) {
+		memcpy(node->key, key, len);
+		if (prefix & 0x07) node->key[len - 1] &= (uint8_t) (0xff << (8 - (prefix & 0x07)));
+	}
+	clients->num_nodes++;
 
-	return CMP(a->proto, b->proto);
+	return node;
 }
 
-#endif
+static void client_node_free(fr_client_list_t *clients, client_node_t *node)
+{
+	clients->num_nodes--;
+	client_retire(node);
+}
+
+/** Find the most specific client matching a key
+ *
+ */
+static fr_client_t *client_node_find(client_node_t *node, uint8_t const *key, uint8_t prefix, int proto)
+{
+	fr_client_t *found = NULL;
+
+	while (node) {
+		fr_client_t *client;
+
+		if ((node->prefix > prefix) || (client_key_common(node->key, key, node->prefix) < node->prefix)) break;
+
+		client = client_node_client(node, proto);
+		if (client) found = client;
+
+		if (node->prefix == prefix) break;
+
+		node = atomic_load_explicit(&node->child[CLIENT_KEY_BIT(key, node->prefix)], memory_order_acquire);
+	}
+
+	return found;
+}
+
+/** Find the node for exactly this network
+ *
+ * Must be called with the list mutex held.
+ */
+static client_node_t *client_node_exact(client_node_t *node, uint8_t const *key, uint8_t prefix)
+{
+	while (node && (node->prefix < prefix)) {
+		node = atomic_load_explicit(&node->child[CLIENT_KEY_BIT(key, node->prefix)], memory_order_relaxed);
+	}
+
+	if (!node || (node->prefix != prefix) || (client_key_common(node->key, key, prefix) < prefix)) return NULL;
+
+	return node;
+}
+
+/** Link a client into a trie
+ *
+ * Must be called with the list mutex held, and the slot for the client must be free.
+ */
+static int client_node_insert(fr_client_list_t *clients, client_node_t *node, uint8_t const *key, uint8_t prefix,
+			      fr_client_t *client)
+{
+	unsigned int slot = client_proto_slot(client->proto);
+
+	for (;;) {
+		_Atomic(client_node_t *)	*link;
+		client_node_t			*child, *split, *leaf;
+		uint8_t				common;
+
+		if (node->prefix == prefix) {
+			atomic_store_explicit(&node->client[slot], client, memory_order_release);
+			return 0;
+		}
+
+		link = &node->child[CLIENT_KEY_BIT(key, node->prefix)];
+		child = atomic_load_explicit(link, memory_order_relaxed);
+		if (!child) {
+			leaf = client_node_alloc(clients, key, prefix);
+			if (!leaf) return -1;
+
+			atomic_init(&leaf->client[slot], client);
+			atomic_store_explicit(link, leaf, memory_order_release);
+			return 0;
+		}
+
+		common = client_key_common(child->key, key, (child->prefix < prefix) ? child->prefix : prefix);
+		if (common == child->prefix) {
+			node = child;
+			continue;
+		}
+
+		/*
+		 *	The new network contains, or diverges from,
+		 *	the child.  Build a node where they split, with
+		 *	the child below it, and only then make it visible.
+		 */
+		split = client_node_alloc(clients, key, common);
+		if (!split) return -1;
+
+		atomic_init(&split->child[CLIENT_KEY_BIT(child->key, common)], child);
+
+		if (common == prefix) {
+			atomic_init(&split->client[slot], client);
+		} else {
+			leaf = client_node_alloc(clients, key, prefix);
+			if (!leaf) {
+				clients->num_nodes--;
+				talloc_free(split);
+				return -1;
+			}
+
+			atomic_init(&leaf->client[slot], client);
+			atomic_init(&split->child[CLIENT_KEY_BIT(key, common)], leaf);
+		}
+
+		atomic_store_explicit(link, split, memory_order_release);
+		return 0;
+	}
+}
+
+/** Unlink a client from a trie, and remove any nodes which are no longer needed
+ *
+ * Must be called with the list mutex held.
+ */
+static fr_client_t *client_node_remove(fr_client_list_t *clients, client_node_t *root, uint8_t const *key,
+				       uint8_t prefix, int proto)
+{
+	_Atomic(client_node_t *)	*link = NULL, *parent_link = NULL;
+	client_node_t			*node = root, *parent = NULL, *child;
+	fr_client_t			*client;
+
+	while (node->prefix < prefix) {
+		parent_link = link;
+		parent = node;
+		link = &node->child[CLIENT_KEY_BIT(key, node->prefix)];
+		node = atomic_load_explicit(link, memory_order_relaxed);
+		if (!node) return NULL;
+	}
+
+	if ((node->prefix != prefix) || (client_key_common(node->key, key, prefix) < prefix)) return NULL;
+
+	/*
+	 *	UDP and TCP only remove a client for exactly that
+	 *	protocol, and not a "proto = *" client which also
+	 *	matches it.
+	 */
+	if (proto == IPPROTO_IP) {
+		client = client_node_client(node, proto);
+	} else {
+		client = atomic_load_explicit(&node->client[client_proto_slot(proto)], memory_order_relaxed);
+	}
+	if (!client) return NULL;
+
+	atomic_store_explicit(&node->client[client_proto_slot(client->proto)], NULL, memory_order_release);
+
+	/*
+	 *	Nodes without clients are only needed where two
+	 *	branches diverge.  Readers which are already on an
+	 *	unlinked node can still follow its branches.
+	 */
+	if ((node == root) || client_node_has_clients(node)) return client;
+
+	switch (client_node_children(&child, node)) {
+	case 2:
+		return client;
+
+	case 1:
+		atomic_store_explicit(link, child, memory_order_release);
+		client_node_free(clients, node);
+		return client;
+
+	default:
+		atomic_store_explicit(link, NULL, memory_order_release);
+		client_node_free(clients, node);
+		break;
+	}
+
+	/*
+	 *	The parent may now be joining a single branch.
+	 */
+	if ((parent == root) || client_node_has_clients(parent)) return client;
+	if (client_node_children(&child, parent) != 1) return client;
+
+	atomic_store_explicit(parent_link, child, memory_order_release);
+	client_node_free(clients, parent);
+
+	return client;
+}
+
+static void client_node_free_all(client_node_t *node)
+{
+	size_t i;
+
+	if (!node) return;
+
+	client_node_free_all(atomic_load_explicit(&node->child[0], memory_order_relaxed));
+	client_node_free_all(atomic_load_explicit(&node->child[1], memory_order_relaxed));
+
+	for (i = 0; i < NUM_ELEMENTS(node->client); i++) {
+		talloc_free(atomic_load_explicit(&node->client[i], memory_order_relaxed));
+	}
+	talloc_free(node);
+}
+
+static void client_node_stats(fr_client_list_stats_t *stats, client_node_t *node)
+{
+	size_t i;
+
+	if (!node) return;
+
+	stats->nodes++;
+	stats->node_bytes += talloc_total_size(node);
+
+	for (i = 0; i < NUM_ELEMENTS(node->client); i++) {
+		fr_client_t *client = atomic_load_explicit(&node->client[i], memory_order_relaxed);
+
+		if (!client) continue;
+
+		stats->clients++;
+		stats->client_bytes += talloc_total_size(client);
+	}
+
+	client_node_stats(stats, atomic_load_explicit(&node->child[0], memory_order_relaxed));
+	client_node_stats(stats, atomic_load_explicit(&node->child[1], memory_order_relaxed));
+}
+
+static int8_t client_secret_cmp(void const *one, void const *two)
+{
+	client_secret_t const	*a = one;
+	client_secret_t const	*b = two;
+	int			ret;
+
+	CMP_RETURN(a, b, len);
+
+	ret = memcmp(a->secret, b->secret, a->len);
+	return CMP(ret, 0);
+}
+
+/** Return a copy of the secret which is shared by all clients in the list using it
+ *
+ * Must be called with the list mutex held.
+ */
+static char const *client_secret_intern(fr_client_list_t *clients, char const *secret)
+{
+	client_secret_t *found, find = { .secret = secret, .len = talloc_array_length(secret) - 1 };
+
+	found = fr_rb_find(clients->secrets, &find);
+	if (!found) {
+		found = talloc_pooled_object(NULL, client_secret_t, 1, find.len + 1);
+		if (unlikely(!found)) {
+		oom:
+			fr_strerror_const("Out of memory");
+			return NULL;
+		}
+
+		found->secret = talloc_bstrndup(found, secret, find.len);
+		found->len = find.len;
+		found->refs = 0;
+
+		if (unlikely(!found->secret || !fr_rb_insert(clients->secrets, found))) {
+			talloc_free(found);
+			goto oom;
+		}
+	}
+	found->refs++;
+
+	return found->secret;
+}
+
+/** Release a shared secret, freeing it once no client is using it
+ *
+ * Must be called with the list mutex held.
+ */
+static void client_secret_release(fr_client_list_t *clients, char const *secret)
+{
+	client_secret_t *found, find = { .secret = secret };
+
+	if (!secret) return;
+
+	find.len = talloc_array_length(secret) - 1;
+	found = fr_rb_find(clients->secrets, &find);
+	if (!fr_cond_assert(found && (found->secret == secret))) return;
+
+	if (--found->refs > 0) return;
+
+	fr_rb_remove(clients->secrets, found);
+	client_retire(found);
+}
+
+static int _client_list_free(fr_client_list_t *clients)
+{
+	if (clients == root_clients) {
+		TALLOC_FREE(file_clients);
+		root_clients = NULL;
+	}
+
+	client_node_free_all(clients->v4);
+	client_node_free_all(clients->v6);
+	pthread_mutex_destroy(&clients->mutex);
+
+	return 0;
+}
 
 void client_list_free(void)
 {
@@ -113,65 +564,116 @@ fr_client_list_t *client_list_init(CONF_SECTION *cs)
 
 	if (!clients) return NULL;
 
+	pthread_mutex_init(&clients->mutex, NULL);
+	talloc_set_destructor(clients, _client_list_free);
+
 	clients->name = talloc_strdup(clients, cs ? cf_section_name1(cs) : "root");
 
-#ifdef WITH_TRIE
-	clients->v4_udp = fr_trie_alloc(clients, NULL, NULL);
-	if (!clients->v4_udp) {
+	clients->v4 = client_node_alloc(clients, NULL, 0);
+	clients->v6 = client_node_alloc(clients, NULL, 0);
+	clients->secrets = fr_rb_inline_talloc_alloc(clients, client_secret_t, node, client_secret_cmp, NULL);
+	if (!clients->name || !clients->v4 || !clients->v6 || !clients->secrets) {
 		talloc_free(clients);
 		return NULL;
 	}
 
-	clients->v6_udp = fr_trie_alloc(clients, NULL, NULL);
-	if (!clients->v6_udp) {
-		talloc_free(clients);
-		return NULL;
+	return clients;
+}
+
+/** Add a client to a list
+ *
+ * Must be called with the list mutex held.  The secret of the client is
+ * replaced with one shared with other clients in the list.
+ *
+ * @param[in] clients	to add the client to.
+ * @param[in] client	to add.  Is reparented on success, so it can be freed by any thread.
+ * @param[out] old	Set to an existing client for the same network and protocol.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int client_insert(fr_client_list_t *clients, fr_client_t *client, fr_client_t **old)
+{
+	client_node_t	*root, *node;
+	uint8_t const	*key;
+
+	*old = NULL;
+
+	root = client_root(clients, &client->ipaddr);
+	if (!root) {
+		fr_strerror_printf("Invalid address family %u", client->ipaddr.af);
+		return -1;
 	}
+	key = client_key(&client->ipaddr);
 
-	clients->v4_tcp = fr_trie_alloc(clients, NULL, NULL);
-	if (!clients->v4_tcp) {
-		talloc_free(clients);
-		return NULL;
+	node = client_node_exact(root, key, client->ipaddr.prefix);
+	if (node) {
+		*old = client_node_client(node, client->proto);
+		if (*old) {
+			fr_strerror_printf("Client %s already exists", (*old)->shortname);
+			return -1;
+		}
 	}
 
-	clients->v6_tcp = fr_trie_alloc(clients, NULL, NULL);
-	if (!clients->v6_tcp) {
-		talloc_free(clients);
-		return NULL;
+	/*
+	 *	Share the secret with other clients using it.  This
+	 *	has to be done before readers can see the client.
+	 */
+	if (client->secret) {
+		char const *secret;
+
+		secret = client_secret_intern(clients, client->secret);
+		if (!secret) return -1;
+
+		if (talloc_parent(client->secret) == client) talloc_const_free(client->secret);
+		client->secret = secret;
 	}
-#endif	/* WITH_TRIE */
 
-	return clients;
+	(void) talloc_steal(NULL, client);
+
+	if (client_node_insert(clients, root, key, client->ipaddr.prefix, client) < 0) {
+		client_secret_release(clients, client->secret);
+		client->secret = NULL;
+		return -1;
+	}
+	clients->num_clients++;
+	atomic_fetch_add_explicit(&clients->generation, 1, memory_order_release);
+
+	return 0;
 }
 
-#ifdef WITH_TRIE
-/*
- *	@todo - either support client definitions where "proto = *",
- *	or update this code to allow for that.  i.e. we create yet
- *	another set of v4/v6 tries, for "proto = *" clients.  And then
- *	do lookups there, too.  Or, just unify the udp/tcp tries, and
- *	instead do post-processing?  Though those two clients can have
- *	different secrets... and the trie code doesn't allow 2
- *	fr_trie_user_t nodes in a row.  So we would have to instead
- *	handle that ourselves, with a wrapper around the fr_client_t
- *	structure that does udp/tcp/wildcard demultiplexing
+/** Remove a client from a list, freeing it once no thread can still be using it
+ *
+ * Must be called with the list mutex held.
  */
-static fr_trie_t *clients_trie(fr_client_list_t const *clients, fr_ipaddr_t const *ipaddr,
-			       int proto)
+static int client_unlink(fr_client_list_t *clients, fr_ipaddr_t const *ipaddr, int proto)
 {
-	if (ipaddr->af == AF_INET) {
-		if (proto == IPPROTO_TCP) return clients->v4_tcp;
+	client_node_t	*root;
+	fr_client_t	*client;
 
-		return clients->v4_udp;
+	root = client_root(clients, ipaddr);
+	if (!root) {
+		fr_strerror_printf("Invalid address family %u", ipaddr->af);
+		return -1;
 	}
 
-	fr_assert(ipaddr->af == AF_INET6);
+	client = client_node_remove(clients, root, client_key(ipaddr), ipaddr->prefix, proto);
+	if (!client) {
+		fr_strerror_const("No such client");
+		return -1;
+	}
+	clients->num_clients--;
+	atomic_fetch_add_explicit(&clients->generation, 1, memory_order_release);
 
-	if (proto == IPPROTO_TCP) return clients->v6_tcp;
+	if (file_clients && (clients == root_clients) && (fr_rb_find(file_clients, client) == client)) {
+		fr_rb_remove(file_clients, client);
+	}
 
-	return clients->v6_udp;
+	client_secret_release(clients, client->secret);
+	client_retire(client);
+
+	return 0;
 }
-#endif	/* WITH_TRIE */
 
 /** Add a client to a fr_client_list_t
  *
@@ -183,12 +685,10 @@ static fr_trie_t *clients_trie(fr_client_list_t const *clients, fr_ipaddr_t cons
  */
 bool client_add(fr_client_list_t *clients, fr_client_t *client)
 {
-#ifdef WITH_TRIE
-	fr_trie_t *trie;
-#else
-#endif
-	fr_client_t *old;
-	char buffer[FR_IPADDR_PREFIX_STRLEN];
+	fr_client_t	*old;
+	char		buffer[FR_IPADDR_PREFIX_STRLEN];
+	bool		duplicate = false;
+	int		ret;
 
 	if (!client) return false;
 
@@ -272,95 +772,162 @@ bool client_add(fr_client_list_t *clients, fr_client_t *client)
 
 #define namecmp(a) ((!old->a && !client->a) || (old->a && client->a && (strcmp(old->a, client->a) == 0)))
 
-#ifdef WITH_TRIE
-	trie = clients_trie(clients, &client->ipaddr, client->proto);
+	pthread_mutex_lock(&clients->mutex);
+	ret = client_insert(clients, client, &old);
 
 	/*
-	 *	Cannot insert the same client twice.
+	 *	If it's a complete duplicate, then free the new
+	 *	one, and return "OK".
 	 */
-	old = fr_trie_match_by_key(trie, &client->ipaddr.addr, client->ipaddr.prefix);
+	if (old && namecmp(longname) && namecmp(secret) &&
+	    namecmp(shortname) && namecmp(nas_type) &&
+	    namecmp(server) &&
+	    (old->require_message_authenticator == client->require_message_authenticator)) duplicate = true;
+	pthread_mutex_unlock(&clients->mutex);
+#undef namecmp
 
-#else  /* WITH_TRIE */
+	if (ret == 0) return true;
 
-	if (!clients->tree[client->ipaddr.prefix]) {
-		clients->tree[client->ipaddr.prefix] = fr_rb_inline_talloc_alloc(clients, fr_client_t, node, client_cmp,
-										 NULL);
-		if (!clients->tree[client->ipaddr.prefix]) {
-			return false;
-		}
+	if (duplicate) {
+		WARN("Ignoring duplicate client %s", client->longname);
+		client_free(client);
+		return true;
 	}
 
-	old = fr_rb_find(clients->tree[client->ipaddr.prefix], client);
-#endif
 	if (old) {
-		/*
-		 *	If it's a complete duplicate, then free the new
-		 *	one, and return "OK".
-		 */
-		if (namecmp(longname) && namecmp(secret) &&
-		    namecmp(shortname) && namecmp(nas_type) &&
-		    namecmp(server) &&
-		    (old->require_message_authenticator == client->require_message_authenticator)) {
-			WARN("Ignoring duplicate client %s", client->longname);
-			client_free(client);
-			return true;
-		}
-
 		ERROR("Failed to add duplicate client %s", client->shortname);
-		client_free(client);
-		return false;
+	} else {
+		PERROR("Failed to add client %s", client->shortname);
 	}
-#undef namecmp
+	client_free(client);
 
-#ifdef WITH_TRIE
-	/*
-	 *	Other error adding client: likely is fatal.
-	 */
-	if (fr_trie_insert_by_key(trie, &client->ipaddr.addr, client->ipaddr.prefix, client) < 0) {
-		client_free(client);
-		return false;
-	}
-#else
-	if (!fr_rb_insert(clients->tree[client->ipaddr.prefix], client)) {
-		client_free(client);
-		return false;
+	return false;
+}
+
+/** Remove a client from a fr_client_list_t
+ *
+ * Lookups in other threads may continue to use the client until they
+ * next pass through a quiescent state, after which it is freed.
+ *
+ * @param[in] clients	list to remove the client from, may be NULL for the global client list.
+ * @param[in] ipaddr	Network of the client.  Must match the client exactly.
+ * @param[in] proto	of the client.  IPPROTO_UDP and IPPROTO_TCP must match the client's
+ *			protocol exactly.  IPPROTO_IP removes a client with any protocol,
+ *			preferring a "proto = *" client.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there is no such client.
+ */
+int client_remove(fr_client_list_t *clients, fr_ipaddr_t const *ipaddr, int proto)
+{
+	int ret;
+
+	if (!clients) clients = root_clients;
+
+	if (!clients) {
+		fr_strerror_const("No such client");
+		return -1;
 	}
-#endif
 
-	/*
-	 *	@todo - do we want to do this for dynamic clients?
-	 */
-	(void) talloc_steal(clients, client); /* reparent it */
+	pthread_mutex_lock(&clients->mutex);
+	ret = client_unlink(clients, ipaddr, proto);
+	pthread_mutex_unlock(&clients->mutex);
+
+	return ret;
+}
+
+/** Return the number of clients in a list, and the memory they use
+ *
+ * @param[out] stats	Where to write the statistics.
+ * @param[in] clients	to gather statistics for, may be NULL for the global client list.
+ */
+void client_list_stats(fr_client_list_stats_t *stats, fr_client_list_t *clients)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (!clients) clients = root_clients;
+	if (!clients) return;
 
-	return true;
-}
+	pthread_mutex_lock(&clients->mutex);
+	client_node_stats(stats, clients->v4);
+	client_node_stats(stats, clients->v6);
 
+	fr_rb_inorder_foreach(clients->secrets, client_secret_t, secret) {
+		stats->secrets++;
+		stats->secret_bytes += talloc_total_size(secret);
+	}
+	endforeach
+	pthread_mutex_unlock(&clients->mutex);
+}
 
-void client_delete(fr_client_list_t *clients, fr_client_t *client)
+static void client_node_networks(fr_ipaddr_t *networks, size_t *num, client_node_t *node, int af, int proto)
 {
-#ifdef WITH_TRIE
-	fr_trie_t *trie;
-#endif
+	if (!node) return;
 
-	if (!client) return;
+	if (client_node_client(node, proto)) {
+		fr_ipaddr_t *ipaddr = &networks[(*num)++];
+
+		*ipaddr = (fr_ipaddr_t) { .af = af, .prefix = node->prefix };
+		if (af == AF_INET) {
+			memcpy(&ipaddr->addr.v4.s_addr, node->key, sizeof(ipaddr->addr.v4.s_addr));
+		} else {
+			memcpy(ipaddr->addr.v6.s6_addr, node->key, sizeof(ipaddr->addr.v6.s6_addr));
+		}
+	}
+
+	client_node_networks(networks, num, atomic_load_explicit(&node->child[0], memory_order_relaxed), af, proto);
+	client_node_networks(networks, num, atomic_load_explicit(&node->child[1], memory_order_relaxed), af, proto);
+}
+
+/** Return the networks of all the clients in a list
+ *
+ * @param[in] ctx	to allocate the array in.
+ * @param[in] clients	to get the networks of, may be NULL for the global client list.
+ * @param[in] proto	only return networks with a client for this protocol.
+ * @return
+ *	- An array of networks.  Use talloc_array_length() to get the number of entries.
+ *	- NULL on failure.
+ */
+fr_ipaddr_t *client_list_networks(TALLOC_CTX *ctx, fr_client_list_t *clients, int proto)
+{
+	fr_ipaddr_t	*networks;
+	size_t		num = 0;
 
 	if (!clients) clients = root_clients;
+	if (!clients) return talloc_array(ctx, fr_ipaddr_t, 0);
 
-	fr_assert(client->ipaddr.prefix <= 128);
+	pthread_mutex_lock(&clients->mutex);
+	networks = talloc_array(ctx, fr_ipaddr_t, clients->num_clients);
+	if (networks) {
+		client_node_networks(networks, &num, clients->v4, AF_INET, proto);
+		client_node_networks(networks, &num, clients->v6, AF_INET6, proto);
+	}
+	pthread_mutex_unlock(&clients->mutex);
 
-#ifdef WITH_TRIE
-	trie = clients_trie(clients, &client->ipaddr, client->proto);
+	if (!networks) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
 
-	/*
-	 *	Don't free the client.  The caller is responsible for that.
-	 */
-	(void) fr_trie_remove_by_key(trie, &client->ipaddr.addr, client->ipaddr.prefix);
-#else
+	fr_assert(num <= talloc_array_length(networks));
+	if (num && (num < talloc_array_length(networks))) networks = talloc_realloc(ctx, networks, fr_ipaddr_t, num);
 
-	if (!clients->tree[client->ipaddr.prefix]) return;
+	return networks;
+}
 
-	(void) fr_rb_delete(clients->tree[client->ipaddr.prefix], client);
-#endif
+/** Return a value which changes whenever a client is added to, or removed from a list
+ *
+ * Lets users of #client_list_networks cheaply check if they need to
+ * refresh their copy.
+ *
+ * @param[in] clients	to check, may be NULL for the global client list.
+ */
+uint64_t client_list_generation(fr_client_list_t const *clients)
+{
+	if (!clients) clients = root_clients;
+	if (!clients) return 0;
+
+	return atomic_load_explicit(&clients->generation, memory_order_acquire);
 }
 
 fr_client_t *client_findbynumber(UNUSED const fr_client_list_t *clients, UNUSED int number)
@@ -371,48 +938,22 @@ fr_client_t *client_findbynumber(UNUSED const fr_client_list_t *clients, UNUSED
 
 /*
  *	Find a client in the fr_client_tS list.
+ *
+ *	This doesn't take any locks.  The client may be used until the
+ *	calling thread next passes through an RCU quiescent state.
  */
 fr_client_t *client_find(fr_client_list_t const *clients, fr_ipaddr_t const *ipaddr, int proto)
 {
-#ifdef WITH_TRIE
-	fr_trie_t *trie;
-#else
-	int i, max;
-	fr_client_t my_client, *client;
-#endif
+	client_node_t *root;
 
 	if (!clients) clients = root_clients;
 
 	if (!clients || !ipaddr) return NULL;
 
-#ifdef WITH_TRIE
-	trie = clients_trie(clients, ipaddr, proto);
-
-	return fr_trie_lookup_by_key(trie, &ipaddr->addr, ipaddr->prefix);
-#else
-
-	if (proto == AF_INET) {
-		max = 32;
-	} else {
-		max = 128;
-	}
-
-	if (max > ipaddr->prefix) max = ipaddr->prefix;
-
-	my_client.proto = proto;
-	for (i = max; i >= 0; i--) {
-		if (!clients->tree[i]) continue;
-
-		my_client.ipaddr = *ipaddr;
-		fr_ipaddr_mask(&my_client.ipaddr, i);
-		client = fr_rb_find(clients->tree[i], &my_client);
-		if (client) {
-			return client;
-		}
-	}
+	root = client_root(clients, ipaddr);
+	if (!root) return NULL;
 
-	return NULL;
-#endif
+	return client_node_find(root, client_key(ipaddr), ipaddr->prefix, proto);
 }
 
 static fr_ipaddr_t cl_ipaddr;
@@ -1145,3 +1686,508 @@ fr_client_t *client_from_request(request_t *request)
 
 	return client;
 }
+
+/** Allocate a client which isn't defined by a configuration section
+ *
+ * The client accepts packets for any protocol, with the same defaults
+ * as a "client" section.
+ */
+static fr_client_t *client_alloc(fr_ipaddr_t const *ipaddr, char const *secret, size_t secret_len,
+				 char const *shortname, char const *nas_type)
+{
+	fr_client_t	*c;
+	char		buffer[FR_IPADDR_PREFIX_STRLEN];
+	size_t		len;
+
+	if (fr_ipaddr_is_prefix(ipaddr) == 1) {
+		fr_inet_ntop_prefix(buffer, sizeof(buffer), ipaddr);
+	} else {
+		fr_inet_ntop(buffer, sizeof(buffer), ipaddr);
+	}
+
+	len = strlen(buffer) + 1 + secret_len + 1;
+	if (shortname) len += strlen(shortname) + 1;
+	if (nas_type) len += strlen(nas_type) + 1;
+
+	c = talloc_zero_pooled_object(NULL, fr_client_t, 4, len);
+	if (!c) return NULL;
+
+	c->ipaddr = *ipaddr;
+	c->src_ipaddr.af = ipaddr->af;
+	c->proto = IPPROTO_IP;
+	c->require_message_authenticator = FR_RADIUS_REQUIRE_MA_NO;
+	c->limit_proxy_state = FR_RADIUS_LIMIT_PROXY_STATE_AUTO;
+	c->limit.max_connections = 16;
+	c->limit.idle_timeout = fr_time_delta_from_sec(30);
+
+	c->longname = talloc_typed_strdup(c, buffer);
+	c->shortname = shortname ? talloc_typed_strdup(c, shortname) : c->longname;
+	if (nas_type) c->nas_type = talloc_typed_strdup(c, nas_type);
+
+	/*
+	 *	Allocated last, so the space is returned to the
+	 *	pool when the secret is replaced by a shared one.
+	 */
+	c->secret = talloc_bstrndup(c, secret, secret_len);
+
+	if (!c->longname || !c->shortname || (nas_type && !c->nas_type) || !c->secret) {
+		talloc_free(c);
+		return NULL;
+	}
+
+	return c;
+}
+
+static int8_t client_file_cmp(void const *one, void const *two)
+{
+	fr_client_t const *a = one;
+	fr_client_t const *b = two;
+
+	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
+}
+
+/** Whether a client from the clients file is unchanged
+ *
+ */
+static bool client_file_same(fr_client_t const *a, fr_client_t const *b)
+{
+	size_t len = talloc_array_length(a->secret);
+
+	if ((len != talloc_array_length(b->secret)) || (memcmp(a->secret, b->secret, len) != 0)) return false;
+	if (strcmp(a->shortname, b->shortname) != 0) return false;
+	if (!a->nas_type || !b->nas_type) return (a->nas_type == b->nas_type);
+
+	return (strcmp(a->nas_type, b->nas_type) == 0);
+}
+
+/** Read clients from a single file, one per line
+ *
+ * Each line is "<ipaddr>[/<prefix>] <secret> [<shortname> [<nas_type>]]".
+ * Secrets starting with "0x" are hex encoded.  Blank lines, and anything
+ * after a '#' at the start of a field, are ignored.
+ */
+static int client_file_read_one(fr_rb_tree_t *out, char const *filename)
+{
+	FILE	*fp;
+	char	buffer[1024];
+	int	lineno = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		ERROR("Failed opening clients file %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		char		*argv[4], *p = buffer;
+		int		argc = 0;
+		fr_ipaddr_t	ipaddr;
+		char const	*secret;
+		size_t		secret_len;
+		uint8_t		bin[256];
+		fr_client_t	*c;
+
+		lineno++;
+
+		if (!strchr(buffer, '\n') && !feof(fp)) {
+			ERROR("%s[%d]: Line too long", filename, lineno);
+			goto error;
+		}
+
+		for (;;) {
+			fr_skip_whitespace(p);
+			if (!*p || (*p == '#')) break;
+
+			if (argc == NUM_ELEMENTS(argv)) {
+				ERROR("%s[%d]: Too many fields", filename, lineno);
+				goto error;
+			}
+
+			argv[argc++] = p;
+			fr_skip_not_whitespace(p);
+			if (*p) *p++ = '\0';
+		}
+		if (!argc) continue;
+
+		if (argc < 2) {
+			ERROR("%s[%d]: Expected \"<ipaddr> <secret> [<shortname> [<nas_type>]]\"", filename, lineno);
+			goto error;
+		}
+
+		if (fr_inet_pton(&ipaddr, argv[0], strlen(argv[0]), AF_UNSPEC, false, true) < 0) {
+			PERROR("%s[%d]: Invalid client address", filename, lineno);
+			goto error;
+		}
+
+		secret = argv[1];
+		secret_len = strlen(secret);
+		if ((secret[0] == '0') && (secret[1] == 'x')) {
+			fr_slen_t slen;
+
+			slen = fr_base16_decode(NULL, &FR_DBUFF_TMP(bin, sizeof(bin)),
+						&FR_SBUFF_IN(secret + 2, secret_len - 2), false);
+			if ((slen < 0) || ((size_t) slen != ((secret_len - 2) / 2)) || (secret_len & 0x01)) {
+				ERROR("%s[%d]: Invalid hex string in shared secret", filename, lineno);
+				goto error;
+			}
+			secret = (char const *) bin;
+			secret_len = slen;
+		}
+
+		c = client_alloc(&ipaddr, secret, secret_len,
+				 (argc > 2) ? argv[2] : NULL, (argc > 3) ? argv[3] : NULL);
+		if (!c) {
+			ERROR("%s[%d]: Out of memory", filename, lineno);
+			goto error;
+		}
+
+		if (!fr_rb_insert(out, c)) {
+			WARN("%s[%d]: Ignoring duplicate client %s", filename, lineno, c->longname);
+			client_free(c);
+		}
+	}
+
+	fclose(fp);
+	return 0;
+
+error:
+	fclose(fp);
+	return -1;
+}
+
+/** Read clients from a file, or from every file in a directory
+ *
+ */
+static int client_file_read(fr_rb_tree_t *out, char const *filename)
+{
+	struct stat	st;
+	DIR		*dir;
+	struct dirent	*dp;
+	int		ret = 0;
+
+	if (stat(filename, &st) < 0) {
+		ERROR("Failed reading clients from %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (!S_ISDIR(st.st_mode)) return client_file_read_one(out, filename);
+
+	dir = opendir(filename);
+	if (!dir) {
+		ERROR("Failed reading clients from %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Skip hidden files, and editor backups.
+	 */
+	while ((ret == 0) && (dp = readdir(dir))) {
+		char	path[PATH_MAX];
+		size_t	len = strlen(dp->d_name);
+
+		if ((dp->d_name[0] == '.') || (dp->d_name[len - 1] == '~')) continue;
+
+		snprintf(path, sizeof(path), "%s/%s", filename, dp->d_name);
+		if ((stat(path, &st) < 0) || !S_ISREG(st.st_mode)) continue;
+
+		ret = client_file_read_one(out, path);
+	}
+	closedir(dir);
+
+	return ret;
+}
+
+/** Load global clients from a file, or a directory of files
+ *
+ * When called again, clients which have been removed from, or changed in,
+ * the file are removed, and new or changed clients are added.  Clients
+ * which are unchanged are left as they are.  If the file can't be read,
+ * the existing clients are left as they are.
+ *
+ * @param[in] filename	File or directory to read clients from.
+ *			Must remain valid for the lifetime of the server.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int client_file_load(char const *filename)
+{
+	fr_rb_tree_t		*next;
+	fr_rb_iter_inorder_t	iter;
+	fr_client_t		*c, *old;
+	fr_time_t		start = fr_time();
+	unsigned int		added = 0, removed = 0, unchanged = 0;
+
+	next = fr_rb_inline_alloc(NULL, fr_client_t, node, client_file_cmp, NULL);
+	if (!next) return -1;
+
+	if (client_file_read(next, filename) < 0) {
+	error:
+		while ((c = fr_rb_first(next))) {
+			fr_rb_remove(next, c);
+			client_free(c);
+		}
+		talloc_free(next);
+		return -1;
+	}
+
+	if (!root_clients) {
+		root_clients = client_list_init(NULL);
+		if (!root_clients) goto error;
+	}
+
+	if (!file_clients) {
+		file_clients = fr_rb_inline_alloc(NULL, fr_client_t, node, client_file_cmp, NULL);
+		if (!file_clients) goto error;
+	}
+	file_clients_path = filename;
+
+	pthread_mutex_lock(&root_clients->mutex);
+
+	/*
+	 *	Remove clients which have gone away, or changed.
+	 */
+	for (old = fr_rb_iter_init_inorder(&iter, file_clients);
+	     old;
+	     old = fr_rb_iter_next_inorder(&iter)) {
+		c = fr_rb_find(next, old);
+		if (c && client_file_same(old, c)) {
+			fr_rb_remove(next, c);
+			client_free(c);
+			unchanged++;
+			continue;
+		}
+
+		fr_rb_iter_delete_inorder(&iter);
+		if (client_unlink(root_clients, &old->ipaddr, old->proto) == 0) removed++;
+	}
+
+	/*
+	 *	...and add the new ones.
+	 */
+	while ((c = fr_rb_first(next))) {
+		fr_rb_remove(next, c);
+
+		if (client_insert(root_clients, c, &old) < 0) {
+			PERROR("Ignoring client %s from %s", c->longname, filename);
+			client_free(c);
+			continue;
+		}
+
+		fr_rb_insert(file_clients, c);
+		added++;
+	}
+
+	pthread_mutex_unlock(&root_clients->mutex);
+	talloc_free(next);
+
+	DEBUG("Loaded clients from %s in %pVs - %u added, %u removed, %u unchanged",
+	      filename, fr_box_time_delta(fr_time_sub(fr_time(), start)), added, removed, unchanged);
+
+	if (DEBUG_ENABLED2) {
+		fr_client_list_stats_t stats;
+
+		client_list_stats(&stats, root_clients);
+		if (stats.clients) DEBUG2("Global client list uses %zu bytes per client",
+					  (stats.client_bytes + stats.node_bytes + stats.secret_bytes) / stats.clients);
+	}
+
+	return 0;
+}
+
+static int client_file_watch(fr_event_list_t *el);
+
+/** Reload the clients file when it, or the directory, changes
+ *
+ */
+static void _client_file_changed(fr_event_list_t *el, int fd, UNUSED int fflags, UNUSED void *uctx)
+{
+	/*
+	 *	The file may have been replaced rather than modified,
+	 *	so we watch whatever is at the path after reloading.
+	 */
+	if (fr_event_fd_delete(el, fd, FR_EVENT_FILTER_VNODE) < 0) PERROR("Failed removing watch on clients file");
+	close(fd);
+
+	INFO("Clients in %s changed, reloading", file_clients_path);
+	if (client_file_load(file_clients_path) < 0) {
+		ERROR("Failed reloading clients, continuing with the existing clients");
+	}
+
+	if (client_file_watch(el) < 0) ERROR("No longer watching %s for changes", file_clients_path);
+}
+
+static int client_file_watch(fr_event_list_t *el)
+{
+	fr_event_vnode_func_t	funcs = {
+					.delete = _client_file_changed,
+					.write = _client_file_changed,
+					.extend = _client_file_changed,
+					.rename = _client_file_changed
+				};
+	int			fd;
+
+	fd = open(file_clients_path, O_RDONLY);
+	if (fd < 0) {
+		ERROR("Failed opening %s: %s", file_clients_path, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fr_event_filter_insert(NULL, NULL, el, fd, FR_EVENT_FILTER_VNODE, &funcs, NULL, NULL) < 0) {
+		PERROR("Failed watching %s for changes", file_clients_path);
+		close(fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cmd_show_client_table(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_client_list_stats_t stats;
+
+	client_list_stats(&stats, NULL);
+
+	fprintf(fp, "clients\t\t%" PRIu64 "\n", stats.clients);
+	fprintf(fp, "nodes\t\t%" PRIu64 "\n", stats.nodes);
+	fprintf(fp, "secrets\t\t%" PRIu64 "\n", stats.secrets);
+	fprintf(fp, "client_bytes\t%zu\n", stats.client_bytes);
+	fprintf(fp, "node_bytes\t%zu\n", stats.node_bytes);
+	fprintf(fp, "secret_bytes\t%zu\n", stats.secret_bytes);
+	if (stats.clients) {
+		fprintf(fp, "bytes_per_client\t%zu\n",
+			(stats.client_bytes + stats.node_bytes + stats.secret_bytes) / stats.clients);
+	}
+
+	return 0;
+}
+
+static int cmd_set_client_add(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	fr_ipaddr_t	ipaddr;
+	fr_client_t	*client, *old;
+	int		ret;
+
+	if (!root_clients) {
+		fprintf(fp_err, "No global client list\n");
+		return -1;
+	}
+
+	if (fr_inet_pton(&ipaddr, info->argv[0], strlen(info->argv[0]), AF_UNSPEC, false, true) < 0) {
+		fprintf(fp_err, "Invalid address '%s' - %s\n", info->argv[0], fr_strerror());
+		return -1;
+	}
+
+	client = client_alloc(&ipaddr, info->argv[1], strlen(info->argv[1]), (info->argc > 2) ? info->argv[2] : NULL, NULL);
+	if (!client) {
+		fprintf(fp_err, "Out of memory\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&root_clients->mutex);
+	ret = client_insert(root_clients, client, &old);
+	pthread_mutex_unlock(&root_clients->mutex);
+
+	if (ret < 0) {
+		fprintf(fp_err, "Failed adding client - %s\n", fr_strerror());
+		client_free(client);
+		return -1;
+	}
+
+	fprintf(fp, "Added client %s\n", info->argv[0]);
+
+	return 0;
+}
+
+static int cmd_set_client_del(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	fr_ipaddr_t	ipaddr;
+	int		proto = IPPROTO_IP;
+
+	if (fr_inet_pton(&ipaddr, info->argv[0], strlen(info->argv[0]), AF_UNSPEC, false, true) < 0) {
+		fprintf(fp_err, "Invalid address '%s' - %s\n", info->argv[0], fr_strerror());
+		return -1;
+	}
+
+	if (info->argc > 1) {
+		if (strcmp(info->argv[1], "udp") == 0) {
+			proto = IPPROTO_UDP;
+
+		} else if (strcmp(info->argv[1], "tcp") == 0) {
+			proto = IPPROTO_TCP;
+
+		} else if (strcmp(info->argv[1], "*") != 0) {
+			fprintf(fp_err, "Invalid protocol '%s' - must be one of udp, tcp, or *\n", info->argv[1]);
+			return -1;
+		}
+	}
+
+	if (client_remove(NULL, &ipaddr, proto) < 0) {
+		fprintf(fp_err, "Failed removing client %s - %s\n", info->argv[0], fr_strerror());
+		return -1;
+	}
+
+	fprintf(fp, "Removed client %s\n", info->argv[0]);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_client_table[] = {
+	{
+		.parent = "show client",
+		.name = "table",
+		.func = cmd_show_client_table,
+		.help = "Show the number of global clients, and the memory they use.",
+		.read_only = true
+	},
+
+	{
+		.parent = "set",
+		.name = "client",
+		.help = "Change the global clients.",
+		.read_only = false
+	},
+
+	{
+		.parent = "set client",
+		.name = "add",
+		.syntax = "STRING STRING [STRING]",
+		.func = cmd_set_client_add,
+		.help = "Add a client with the given IP address or network, secret, and optional shortname.",
+		.read_only = false
+	},
+
+	{
+		.parent = "set client",
+		.name = "del",
+		.syntax = "STRING [STRING]",
+		.func = cmd_set_client_del,
+		.help = "Remove the client with the given IP address or network, and optional protocol "
+			"(udp, tcp, or * for any).",
+		.read_only = false
+	},
+
+	CMD_TABLE_END
+};
+
+/** Allow the global clients to be changed whilst the server is running
+ *
+ * Registers radmin commands to add and remove clients, and watches
+ * the clients file, if one was loaded, for changes.
+ *
+ * @param[in] el	to watch the clients file in.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int client_runtime_init(fr_event_list_t *el)
+{
+	if (fr_command_register_hook(NULL, NULL, NULL, cmd_client_table) < 0) {
+		PERROR("Failed registering radmin commands for clients");
+		return -1;
+	}
+
+	if (!file_clients_path) return 0;
+
+	return client_file_watch(el);
+}
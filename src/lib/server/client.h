@@ -67,6 +67,7 @@ typedef struct fr_client_list_s fr_client_list_t;
  */
 typedef int (*client_value_cb_t)(char **out, CONF_PAIR const *cp, void *data);
 
+#include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/server/request.h>
 #include <freeradius-devel/server/socket.h>
@@ -78,7 +79,8 @@ typedef int (*client_value_cb_t)(char **out, CONF_PAIR const *cp, void *data);
  *
  */
 struct fr_client_s {
-	fr_rb_node_t		node;			//!< Entry in the client tree.
+	fr_rb_node_t		node;			//!< Entry in a tree of clients, e.g. those loaded
+							///< from the clients file.
 
 	fr_ipaddr_t		ipaddr;			//!< IPv4/IPv6 address of the host.
 	fr_ipaddr_t		src_ipaddr;		//!< IPv4/IPv6 address to send responses
@@ -87,7 +89,9 @@ struct fr_client_s {
 	char const		*longname;		//!< Client identifier.
 	char const		*shortname;		//!< Client nickname.
 
-	char const		*secret;		//!< Secret PSK.
+	char const		*secret;		//!< Secret PSK.  Once the client has been added to
+							///< a list, this is shared with other clients using
+							///< the same secret.
 
 	/** Require RADIUS message authenticator for incoming packets
 	 */
@@ -144,6 +148,18 @@ struct fr_client_s {
 	fr_socket_limit_t	limit;			//!< Connections per client (TCP clients only).
 };
 
+/** Memory used by a client list
+ *
+ */
+typedef struct {
+	uint64_t		clients;		//!< Number of clients in the list.
+	uint64_t		nodes;			//!< Number of nodes in the prefix tries.
+	uint64_t		secrets;		//!< Number of distinct secrets.
+	size_t			client_bytes;		//!< Memory used by the clients, excluding secrets.
+	size_t			node_bytes;		//!< Memory used by the prefix tries.
+	size_t			secret_bytes;		//!< Memory used by the shared secrets.
+} fr_client_list_stats_t;
+
 fr_client_list_t	*client_list_init(CONF_SECTION *cs);
 
 void		client_list_free(void);
@@ -154,7 +170,17 @@ void		client_free(fr_client_t *client);
 
 bool		client_add(fr_client_list_t *clients, fr_client_t *client);
 
-void		client_delete(fr_client_list_t *clients, fr_client_t *client);
+int		client_remove(fr_client_list_t *clients, fr_ipaddr_t const *ipaddr, int proto);
+
+void		client_list_stats(fr_client_list_stats_t *stats, fr_client_list_t *clients);
+
+fr_ipaddr_t	*client_list_networks(TALLOC_CTX *ctx, fr_client_list_t *clients, int proto);
+
+uint64_t	client_list_generation(fr_client_list_t const *clients);
+
+int		client_file_load(char const *filename);
+
+int		client_runtime_init(fr_event_list_t *el);
 
 fr_client_t	*client_afrom_request(TALLOC_CTX *ctx, request_t *request);
 
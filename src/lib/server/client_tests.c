@@ -0,0 +1,253 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for adding, finding and removing clients
+ *
+ * @file src/lib/server/client_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/rand.h>
+
+#include <freeradius-devel/server/client.h>
+
+static fr_client_t *client_test_alloc(char const *addr, int proto, char const *secret)
+{
+	fr_client_t *c;
+
+	c = talloc_zero(NULL, fr_client_t);
+	if (fr_inet_pton(&c->ipaddr, addr, strlen(addr), AF_UNSPEC, false, true) < 0) {
+		talloc_free(c);
+		return NULL;
+	}
+	c->proto = proto;
+	c->longname = c->shortname = talloc_typed_strdup(c, addr);
+	c->secret = talloc_typed_strdup(c, secret);
+
+	return c;
+}
+
+static fr_client_t *client_test_find(fr_client_list_t *clients, char const *addr, int proto)
+{
+	fr_ipaddr_t ipaddr;
+
+	if (fr_inet_pton(&ipaddr, addr, strlen(addr), AF_UNSPEC, false, true) < 0) return NULL;
+
+	return client_find(clients, &ipaddr, proto);
+}
+
+static int client_test_remove(fr_client_list_t *clients, char const *addr, int proto)
+{
+	fr_ipaddr_t ipaddr;
+
+	if (fr_inet_pton(&ipaddr, addr, strlen(addr), AF_UNSPEC, false, true) < 0) return -1;
+
+	return client_remove(clients, &ipaddr, proto);
+}
+
+#define TEST_CHECK_CLIENT(_clients, _addr, _proto, _name) do { \
+	fr_client_t *_found = client_test_find(_clients, _addr, _proto); \
+	TEST_CHECK(_found != NULL); \
+	if (_found) { \
+		TEST_CHECK(strcmp(_found->shortname, _name) == 0); \
+		TEST_MSG("Expected %s, got %s", _name, _found->shortname); \
+	} \
+} while (0)
+
+static void test_longest_prefix(void)
+{
+	fr_client_list_t *clients = client_list_init(NULL);
+
+	TEST_CASE("Add overlapping networks");
+	TEST_CHECK(client_add(clients, client_test_alloc("10.0.0.0/8", IPPROTO_UDP, "a")));
+	TEST_CHECK(client_add(clients, client_test_alloc("10.1.0.0/16", IPPROTO_IP, "b")));
+	TEST_CHECK(client_add(clients, client_test_alloc("10.1.2.3", IPPROTO_TCP, "c")));
+	TEST_CHECK(client_add(clients, client_test_alloc("2001:db8::/32", IPPROTO_UDP, "d")));
+
+	TEST_CASE("The most specific matching network is found");
+	TEST_CHECK_CLIENT(clients, "10.1.2.3", IPPROTO_UDP, "10.1.0.0/16");
+	TEST_CHECK_CLIENT(clients, "10.1.2.3", IPPROTO_TCP, "10.1.2.3");
+	TEST_CHECK_CLIENT(clients, "10.2.0.1", IPPROTO_UDP, "10.0.0.0/8");
+	TEST_CHECK_CLIENT(clients, "2001:db8::1", IPPROTO_UDP, "2001:db8::/32");
+	TEST_CHECK(client_test_find(clients, "10.2.0.1", IPPROTO_TCP) == NULL);
+	TEST_CHECK(client_test_find(clients, "11.0.0.1", IPPROTO_UDP) == NULL);
+	TEST_CHECK(client_test_find(clients, "2001:db9::1", IPPROTO_UDP) == NULL);
+
+	TEST_CASE("Duplicates are rejected, unless the protocol differs");
+	TEST_CHECK(!client_add(clients, client_test_alloc("10.0.0.0/8", IPPROTO_UDP, "other")));
+	TEST_CHECK(!client_add(clients, client_test_alloc("10.1.0.0/16", IPPROTO_TCP, "other")));
+	TEST_CHECK(client_add(clients, client_test_alloc("10.0.0.0/8", IPPROTO_TCP, "e")));
+	TEST_CHECK_CLIENT(clients, "10.2.0.1", IPPROTO_TCP, "10.0.0.0/8");
+
+	TEST_CASE("Removing by protocol does not remove a \"proto = *\" client");
+	TEST_CHECK(client_test_remove(clients, "10.1.0.0/16", IPPROTO_UDP) < 0);
+	TEST_CHECK(client_test_remove(clients, "10.1.0.0/16", IPPROTO_TCP) < 0);
+	TEST_CHECK_CLIENT(clients, "10.1.2.3", IPPROTO_UDP, "10.1.0.0/16");
+
+	TEST_CASE("Removing a network exposes the less specific one");
+	TEST_CHECK(client_test_remove(clients, "10.1.0.0/16", IPPROTO_IP) == 0);
+	TEST_CHECK_CLIENT(clients, "10.1.2.3", IPPROTO_UDP, "10.0.0.0/8");
+	TEST_CHECK(client_test_remove(clients, "10.1.2.3", IPPROTO_TCP) == 0);
+	TEST_CHECK_CLIENT(clients, "10.1.2.3", IPPROTO_TCP, "10.0.0.0/8");
+	TEST_CHECK(client_test_remove(clients, "10.1.2.3", IPPROTO_TCP) < 0);
+
+	talloc_free(clients);
+}
+
+static void test_secrets(void)
+{
+	fr_client_list_t	*clients = client_list_init(NULL);
+	fr_client_list_stats_t	stats;
+	fr_client_t		*a, *b;
+
+	TEST_CHECK(client_add(clients, client_test_alloc("192.0.2.1", IPPROTO_UDP, "testing123")));
+	TEST_CHECK(client_add(clients, client_test_alloc("192.0.2.2", IPPROTO_UDP, "testing123")));
+	TEST_CHECK(client_add(clients, client_test_alloc("192.0.2.3", IPPROTO_UDP, "other")));
+
+	TEST_CASE("Clients with the same secret share it");
+	a = client_test_find(clients, "192.0.2.1", IPPROTO_UDP);
+	b = client_test_find(clients, "192.0.2.2", IPPROTO_UDP);
+	TEST_ASSERT(a && b);
+	TEST_CHECK(a->secret == b->secret);
+	TEST_CHECK(talloc_array_length(a->secret) == sizeof("testing123"));
+
+	client_list_stats(&stats, clients);
+	TEST_CHECK_RET((int)stats.clients, 3);
+	TEST_CHECK_RET((int)stats.secrets, 2);
+
+	TEST_CASE("Secrets are freed when no client uses them");
+	TEST_CHECK(client_test_remove(clients, "192.0.2.3", IPPROTO_IP) == 0);
+	TEST_CHECK(client_test_remove(clients, "192.0.2.1", IPPROTO_IP) == 0);
+	client_list_stats(&stats, clients);
+	TEST_CHECK_RET((int)stats.clients, 1);
+	TEST_CHECK_RET((int)stats.secrets, 1);
+
+	talloc_free(clients);
+}
+
+static void test_networks(void)
+{
+	fr_client_list_t	*clients = client_list_init(NULL);
+	fr_ipaddr_t		*networks;
+	uint64_t		generation;
+	char			buffer[FR_IPADDR_PREFIX_STRLEN];
+
+	TEST_CHECK(client_add(clients, client_test_alloc("10.0.0.0/8", IPPROTO_UDP, "a")));
+	TEST_CHECK(client_add(clients, client_test_alloc("192.0.2.1", IPPROTO_TCP, "b")));
+	TEST_CHECK(client_add(clients, client_test_alloc("2001:db8::/32", IPPROTO_IP, "c")));
+
+	TEST_CASE("Networks are returned for clients matching the protocol");
+	networks = client_list_networks(NULL, clients, IPPROTO_UDP);
+	TEST_ASSERT(networks != NULL);
+	TEST_CHECK_LEN(talloc_array_length(networks), 2);
+	TEST_CHECK_STRCMP(fr_inet_ntop_prefix(buffer, sizeof(buffer), &networks[0]), "10.0.0.0/8");
+	TEST_CHECK_STRCMP(fr_inet_ntop_prefix(buffer, sizeof(buffer), &networks[1]), "2001:db8::/32");
+	talloc_free(networks);
+
+	TEST_CASE("The generation changes when clients are added or removed");
+	generation = client_list_generation(clients);
+	TEST_CHECK(client_test_remove(clients, "192.0.2.1", IPPROTO_TCP) == 0);
+	TEST_CHECK(client_list_generation(clients) != generation);
+
+	generation = client_list_generation(clients);
+	TEST_CHECK(!client_add(clients, client_test_alloc("10.0.0.0/8", IPPROTO_UDP, "other")));
+	TEST_CHECK(client_list_generation(clients) == generation);
+
+	talloc_free(clients);
+}
+
+#define NUM_RANDOM 10000
+
+static void test_random(void)
+{
+	fr_client_list_t	*clients = client_list_init(NULL);
+	fr_client_list_stats_t	stats;
+	static fr_ipaddr_t	addrs[NUM_RANDOM];
+	static bool		present[NUM_RANDOM];
+	size_t			i, j;
+	char			buffer[FR_IPADDR_PREFIX_STRLEN];
+
+	TEST_CASE("Add random networks");
+	for (i = 0; i < NUM_RANDOM; i++) {
+		uint32_t	addr = fr_rand();
+		fr_client_t	*c;
+
+		addrs[i] = (fr_ipaddr_t) { .af = AF_INET, .prefix = 16 + (fr_rand() % 17) };
+		memcpy(&addrs[i].addr.v4.s_addr, &addr, sizeof(addr));
+		fr_ipaddr_mask(&addrs[i], addrs[i].prefix);
+
+		c = client_test_alloc(fr_inet_ntop_prefix(buffer, sizeof(buffer), &addrs[i]), IPPROTO_UDP, "secret");
+		present[i] = client_add(clients, c);
+
+		/*
+		 *	Duplicates are rare, and just ignored.
+		 */
+		for (j = 0; present[i] && (j < i); j++) {
+			if (present[j] && (fr_ipaddr_cmp(&addrs[i], &addrs[j]) == 0)) present[i] = false;
+		}
+	}
+
+	TEST_CASE("Remove half of them");
+	for (i = 0; i < NUM_RANDOM; i += 2) {
+		if (!present[i]) continue;
+		TEST_CHECK(client_remove(clients, &addrs[i], IPPROTO_UDP) == 0);
+		present[i] = false;
+	}
+
+	TEST_CASE("Lookups match a linear search");
+	for (i = 0; i < NUM_RANDOM; i++) {
+		fr_ipaddr_t	host = addrs[i];
+		fr_client_t	*found;
+		int		best = -1;
+
+		host.prefix = 32;
+		found = client_find(clients, &host, IPPROTO_UDP);
+
+		for (j = 0; j < NUM_RANDOM; j++) {
+			fr_ipaddr_t masked = host;
+
+			if (!present[j]) continue;
+
+			fr_ipaddr_mask(&masked, addrs[j].prefix);
+			if (fr_ipaddr_cmp(&masked, &addrs[j]) != 0) continue;
+			if ((best < 0) || (addrs[j].prefix > addrs[best].prefix)) best = j;
+		}
+
+		if (best < 0) {
+			TEST_CHECK(found == NULL);
+			continue;
+		}
+
+		TEST_CHECK(found && (fr_ipaddr_cmp(&found->ipaddr, &addrs[best]) == 0));
+	}
+
+	client_list_stats(&stats, clients);
+	TEST_CHECK(stats.nodes <= (stats.clients * 2) + 2);
+	TEST_MSG("%" PRIu64 " nodes for %" PRIu64 " clients", stats.nodes, stats.clients);
+
+	talloc_free(clients);
+}
+
+TEST_LIST = {
+	{ "client_longest_prefix",	test_longest_prefix	},
+	{ "client_secrets",		test_secrets		},
+	{ "client_networks",		test_networks		},
+	{ "client_random",		test_random		},
+
+	{ NULL }
+};
@@ -34,9 +34,11 @@ RCSID("$Id$")
 #include <freeradius-devel/server/map_proc.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/module.h>
+#include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/server/util.h>
 #include <freeradius-devel/server/virtual_servers.h>
 
+#include <freeradius-devel/unlang/offload.h>
 #include <freeradius-devel/unlang/xlat.h>
 
 #include <freeradius-devel/util/conf.h>
@@ -72,6 +74,19 @@ extern fr_log_t		debug_log;
 
 fr_log_t		debug_log = { .fd = -1, .dst = L_DST_NULL };
 
+static fr_table_num_sorted_t const huge_pages_table[] = {
+	{ L("explicit"),	FR_RING_BUFFER_HUGE_PAGES_EXPLICIT },
+	{ L("no"),		FR_RING_BUFFER_HUGE_PAGES_NO },
+	{ L("transparent"),	FR_RING_BUFFER_HUGE_PAGES_TRANSPARENT }
+};
+static size_t huge_pages_table_len = NUM_ELEMENTS(huge_pages_table);
+
+static fr_table_num_sorted_t const offload_full_table[] = {
+	{ L("fail"),		UNLANG_OFFLOAD_FULL_FAIL },
+	{ L("inline"),		UNLANG_OFFLOAD_FULL_INLINE }
+};
+static size_t offload_full_table_len = NUM_ELEMENTS(offload_full_table);
+
 /**********************************************************************
  *
  *	We need to figure out where the logs go, before doing anything
@@ -168,14 +183,78 @@ static const conf_parser_t resources[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const conf_parser_t admission_config[] = {
+	{ FR_CONF_OFFSET("target", main_config_t, admission_target), .dflt = "0" },
+	{ FR_CONF_OFFSET("interval", main_config_t, admission_interval), .dflt = "0.1" },
+	{ FR_CONF_OFFSET("reject", main_config_t, admission_reject), .dflt = "no" },
+
+	CONF_PARSER_TERMINATOR
+};
+
+static const conf_parser_t priority_class_config[] = {
+	{ FR_CONF_OFFSET("weight", fr_channel_priority_config_t, weight) },
+	{ FR_CONF_OFFSET("max_outstanding", fr_channel_priority_config_t, max_outstanding) },
+
+	CONF_PARSER_TERMINATOR
+};
+
+#define PRIORITY_CLASS(_name, _class) \
+	{ FR_CONF_OFFSET_SUBSECTION(_name, 0, main_config_t, priority[_class], priority_class_config) }
+
+static const conf_parser_t priority_config[] = {
+	PRIORITY_CLASS("now", FR_CHANNEL_PRIORITY_CLASS_NOW),
+	PRIORITY_CLASS("high", FR_CHANNEL_PRIORITY_CLASS_HIGH),
+	PRIORITY_CLASS("normal", FR_CHANNEL_PRIORITY_CLASS_NORMAL),
+	PRIORITY_CLASS("low", FR_CHANNEL_PRIORITY_CLASS_LOW),
+
+	CONF_PARSER_TERMINATOR
+};
+
+static const conf_parser_t affinity_config[] = {
+	{ FR_CONF_OFFSET("network_cpus", main_config_t, affinity_network_cpus), .dflt = "" },
+	{ FR_CONF_OFFSET("worker_cpus", main_config_t, affinity_worker_cpus), .dflt = "" },
+	{ FR_CONF_OFFSET("per_thread", main_config_t, affinity_per_thread), .dflt = "no" },
+	{ FR_CONF_OFFSET("numa", main_config_t, affinity_numa), .dflt = "no" },
+
+	CONF_PARSER_TERMINATOR
+};
+
+static const conf_parser_t offload_config[] = {
+	{ FR_CONF_OFFSET("num_threads", main_config_t, offload_threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_queued", main_config_t, offload_max_queued), .dflt = "1024" },
+	{ FR_CONF_OFFSET("full", main_config_t, offload_full), .dflt = "inline",
+		.func = cf_table_parse_int,
+			.uctx = &(cf_table_parse_ctx_t){
+				.table = offload_full_table,
+				.len = &offload_full_table_len
+			}
+		},
+
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t thread_config[] = {
 	{ FR_CONF_OFFSET("num_networks", main_config_t, max_networks), .dflt = STRINGIFY(1),
 	  .func = num_networks_parse },
 	{ FR_CONF_OFFSET("num_workers", main_config_t, max_workers), .dflt = STRINGIFY(0),
 	  .func = num_workers_parse, .dflt_func = num_workers_dflt },
+	{ FR_CONF_OFFSET("num_instantiate_threads", main_config_t, max_instantiate_threads), .dflt = STRINGIFY(0) },
+	{ FR_CONF_OFFSET("work_stealing", main_config_t, work_stealing), .dflt = "no" },
+	{ FR_CONF_OFFSET("huge_pages", main_config_t, huge_pages), .dflt = "no",
+		.func = cf_table_parse_int,
+			.uctx = &(cf_table_parse_ctx_t){
+				.table = huge_pages_table,
+				.len = &huge_pages_table_len
+			}
+		},
 
 	{ FR_CONF_OFFSET_TYPE_FLAGS("stats_interval", FR_TYPE_TIME_DELTA | CONF_FLAG_HIDDEN, 0, main_config_t, stats_interval), },
 
+	{ FR_CONF_POINTER("admission", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) admission_config },
+	{ FR_CONF_POINTER("priority", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) priority_config },
+	{ FR_CONF_POINTER("affinity", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) affinity_config },
+	{ FR_CONF_POINTER("offload", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) offload_config },
+
 #ifdef WITH_TLS
 	{ FR_CONF_OFFSET_TYPE_FLAGS("openssl_async_pool_init", FR_TYPE_SIZE, 0, main_config_t, openssl_async_pool_init), .dflt = "64" },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("openssl_async_pool_max", FR_TYPE_SIZE, 0, main_config_t, openssl_async_pool_max), .dflt = "1024" },
@@ -223,8 +302,17 @@ static const conf_parser_t server_config[] = {
 	{ FR_CONF_OFFSET("reverse_lookups", main_config_t, reverse_lookups), .dflt = "no", .func = reverse_lookups_parse },
 	{ FR_CONF_OFFSET("hostname_lookups", main_config_t, hostname_lookups), .dflt = "yes", .func = hostname_lookups_parse },
 	{ FR_CONF_OFFSET("max_request_time", main_config_t, max_request_time), .dflt = STRINGIFY(MAX_REQUEST_TIME), .func = max_request_time_parse },
+	{ FR_CONF_OFFSET("time_source", main_config_t, time_source), .dflt = "monotonic_raw",
+		.func = cf_table_parse_int,
+			.uctx = &(cf_table_parse_ctx_t){
+				.table = fr_time_source_table,
+				.len = &fr_time_source_table_len
+			}
+		},
 	{ FR_CONF_OFFSET("pidfile", main_config_t, pid_file), .dflt = "${run_dir}/radiusd.pid"},
 
+	{ FR_CONF_OFFSET("clients_file", main_config_t, clients_file) },
+
 	{ FR_CONF_OFFSET_FLAGS("debug_level", CONF_FLAG_HIDDEN, main_config_t, debug_level), .dflt = "0" },
 	{ FR_CONF_OFFSET("max_requests", main_config_t, max_requests), .dflt = "0" },
 
@@ -1397,6 +1485,7 @@ do {\
 
 	DEBUG2("%s: #### Loading Clients ####", config->name);
 	if (!client_list_parse_section(cs, 0, false)) goto failure;
+	if (config->clients_file && (client_file_load(config->clients_file) < 0)) goto failure;
 
 	/*
 	 *	Register the %config(section.subsection) xlat function.
@@ -1497,7 +1586,13 @@ void main_config_hup(main_config_t *config)
 	}
 	last_hup = when;
 
-	INFO("HUP - NYI in version 4");	/* Not yet implemented in v4 */
+	INFO("HUP - Reloading modules");
+	if (modules_rlm_reload() < 0) WARN("HUP - Some modules failed to reload, they will continue using their existing data");
+
+	if (config->clients_file) {
+		INFO("HUP - Reloading clients from %s", config->clients_file);
+		if (client_file_load(config->clients_file) < 0) WARN("HUP - Failed reloading clients, continuing with the existing clients");
+	}
 }
 
 static fr_table_num_ordered_t config_arg_table[] = {
@@ -38,6 +38,7 @@ typedef struct main_config_s main_config_t;
 
 extern main_config_t const *main_config;		//!< Global configuration singleton.
 
+#include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/server/cf_util.h>
 #include <freeradius-devel/server/tmpl.h>
 
@@ -58,9 +59,14 @@ struct main_config_s {
 	bool		spawn_workers;			//!< Should the server spawn threads.
 	char const      *pid_file;			//!< Path to write out PID file.
 
+	char const	*clients_file;			//!< File or directory of additional clients, which
+							///< is watched for changes.
+
 	fr_time_delta_t	max_request_time;		//!< How long a request can be processed for before
 							//!< timing out.
 
+	int32_t		time_source;			//!< Which clock fr_time() reads, one of #fr_time_source_t.
+
 	bool		drop_requests;			//!< Administratively disable request processing.
 	bool		suppress_secrets;		//!< suppress secrets (or not)
 
@@ -149,7 +155,30 @@ struct main_config_s {
 
 	uint32_t	max_networks;			//!< for the scheduler
 	uint32_t	max_workers;			//!< for the scheduler
+	uint32_t	max_instantiate_threads;	//!< Threads used to instantiate modules.
+							///< 0 means use the same number as max_workers.
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
+	bool		work_stealing;			//!< Idle workers take requests from busy ones.
+
+	fr_time_delta_t	admission_target;		//!< Queueing delay above which workers shed requests.
+	fr_time_delta_t	admission_interval;		//!< How long the delay must stay above the target.
+	bool		admission_reject;		//!< Reject shed requests, instead of discarding them.
+
+	fr_channel_priority_config_t priority[FR_CHANNEL_PRIORITY_CLASS_MAX];	//!< How each class of packets is scheduled.
+
+	char const	*affinity_network_cpus;		//!< CPUs the network threads may run on.
+	char const	*affinity_worker_cpus;		//!< CPUs the worker threads may run on.
+	bool		affinity_per_thread;		//!< Bind each thread to a single CPU.
+	bool		affinity_numa;			//!< Spread threads across NUMA nodes, and bind
+							///< each one to a node.
+
+	int32_t		huge_pages;			//!< What backs ring buffers, one of
+							///< #fr_ring_buffer_huge_pages_t.
+
+	uint32_t	offload_threads;		//!< Threads in the default offload pool.
+	uint32_t	offload_max_queued;		//!< Functions which may wait for an offload thread.
+	int32_t		offload_full;			//!< What to do when the offload queue is full, one of
+							///< #unlang_offload_full_t.
 
 #ifndef NDEBUG
 	uint32_t	ins_max;			//!< max instruction count
@@ -40,6 +40,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/unlang/xlat_func.h>
 
+#include <pthread.h>
 #include <talloc.h>
 #include <sys/mman.h>
 
@@ -62,6 +63,7 @@ static int module_name_tab_expand(UNUSED TALLOC_CTX *talloc_ctx, UNUSED void *uc
 static int cmd_show_module_list(FILE *fp, UNUSED FILE *fp_err, UNUSED void *uctx, UNUSED fr_cmd_info_t const *info);
 static int cmd_show_module_status(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info);
 static int cmd_set_module_status(UNUSED FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t const *info);
+static int cmd_set_module_reload(UNUSED FILE *fp, FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info);
 
 fr_cmd_table_t module_cmd_table[] = {
 	{
@@ -93,6 +95,15 @@ fr_cmd_table_t module_cmd_table[] = {
 		.read_only = false,
 	},
 
+	{
+		.parent = "set module",
+		.add_name = true,
+		.name = "reload",
+		.func = cmd_set_module_reload,
+		.help = "Re-read data the module loaded during instantiation, without interrupting request processing.",
+		.read_only = false,
+	},
+
 	CMD_TABLE_END
 };
 
@@ -210,6 +221,23 @@ static int cmd_set_module_status(UNUSED FILE *fp, FILE *fp_err, void *ctx, fr_cm
 	return 0;
 }
 
+static int cmd_set_module_reload(UNUSED FILE *fp, FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	module_instance_t *mi = ctx;
+
+	if (!mi->exported->reload) {
+		fprintf(fp_err, "Module '%s' does not support reloading\n", mi->name);
+		return -1;
+	}
+
+	if (module_reload(mi) < 0) {
+		fprintf(fp_err, "Failed reloading module '%s' - %s\n", mi->name, fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Chars that are allowed in a module instance name
  *
  */
@@ -1185,18 +1213,19 @@ int modules_thread_instantiate(TALLOC_CTX *ctx, module_list_t const *ml, fr_even
 	return 0;
 }
 
-/** Manually complete module setup by calling its instantiate function
+/** Prepare a module instance for instantiation
  *
- * @param[in] instance	of module to complete instantiation for.
+ * Performs the parts of instantiation which touch global state, and so
+ * must always be run serially.
+ *
+ * @param[in] mi	to prepare.
  * @return
+ *	- 1 if the module instance should not be instantiated.
  *	- 0 on success.
  *	- -1 on failure.
  */
-int module_instantiate(module_instance_t *instance)
+static int module_instantiate_prepare(module_instance_t *mi)
 {
-	module_instance_t *mi = talloc_get_type_abort(instance, module_instance_t);
-	CONF_SECTION *cs = mi->conf;
-
 	/*
 	 *	If we're instantiating, then nothing should be able to
 	 *	modify the boot data for this module.
@@ -1219,7 +1248,7 @@ int module_instantiate(module_instance_t *instance)
 	/*
 	 *	We only instantiate modules in the bootstrapped state
 	 */
-	if (module_instance_skip_instantiate(mi)) return 0;
+	if (module_instance_skip_instantiate(mi)) return 1;
 
 	if (mi->module->type == DL_MODULE_TYPE_MODULE) {
 		if (fr_command_register_hook(NULL, mi->name, mi, module_cmd_table) < 0) {
@@ -1235,10 +1264,29 @@ int module_instantiate(module_instance_t *instance)
 	if (mi->exported->config && (cf_section_parse_pass2(mi->data,
 							    mi->conf) < 0)) return -1;
 
+	return 0;
+}
+
+/** Call a module's instantiate method, and protect its instance data
+ *
+ * This may be called from an instantiation thread if the module is marked
+ * with #MODULE_TYPE_INSTANTIATE_PARALLEL.
+ *
+ * @param[in] mi	to instantiate.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int module_instantiate_call(module_instance_t *mi)
+{
+	CONF_SECTION *cs = mi->conf;
+
 	/*
 	 *	Call the instantiate method, if any.
 	 */
 	if (mi->exported->instantiate) {
+		fr_time_t start;
+
 		cf_log_debug(cs, "Instantiating %s_%s \"%s\"",
 			     module_instance_root_prefix_str(mi),
 			     mi->module->exported->name,
@@ -1247,11 +1295,18 @@ int module_instantiate(module_instance_t *instance)
 		/*
 		 *	Call the module's instantiation routine.
 		 */
+		start = fr_time();
 		if (mi->exported->instantiate(MODULE_INST_CTX(mi)) < 0) {
 			cf_log_err(mi->conf, "Instantiation failed for module \"%s\"", mi->name);
 
 			return -1;
 		}
+
+		cf_log_debug(cs, "Instantiated %s_%s \"%s\" in %pVs",
+			     module_instance_root_prefix_str(mi),
+			     mi->module->exported->name,
+			     mi->name,
+			     fr_box_time_delta(fr_time_sub(fr_time(), start)));
 	}
 
 	/*
@@ -1268,11 +1323,360 @@ int module_instantiate(module_instance_t *instance)
 	return 0;
 }
 
+/** Manually complete module setup by calling its instantiate function
+ *
+ * @param[in] instance	of module to complete instantiation for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int module_instantiate(module_instance_t *instance)
+{
+	module_instance_t *mi = talloc_get_type_abort(instance, module_instance_t);
+	int ret;
+
+	ret = module_instantiate_prepare(mi);
+	if (ret != 0) return (ret < 0) ? -1 : 0;
+
+	return module_instantiate_call(mi);
+}
+
+/** A module instance waiting to be instantiated by #modules_instantiate
+ *
+ */
+typedef struct {
+	module_instance_t	*mi;			//!< To instantiate.
+	fr_log_capture_t	*log;			//!< Messages logged by an instantiation thread.
+	unsigned int		*deps;			//!< Indexes of the jobs which must complete first.
+	unsigned int		num_deps;		//!< Number of entries in deps.
+	bool			parallel;		//!< May be run by an instantiation thread.
+	bool			running;		//!< Being run by an instantiation thread.
+	bool			done;			//!< Instantiation complete (or skipped).
+	int			ret;			//!< Return code from #module_instantiate_call.
+} module_instantiate_job_t;
+
+/** Shared state for the instantiation threads
+ *
+ */
+typedef struct {
+	pthread_mutex_t			mutex;		//!< Protects the fields below, and the jobs.
+	pthread_cond_t			cond;		//!< Signalled when a job completes.
+
+	module_instantiate_job_t	*jobs;		//!< Array of jobs, in module name order.
+	unsigned int			num_jobs;	//!< Number of entries in jobs.
+	unsigned int			running;	//!< How many jobs are currently being run.
+	bool				stop;		//!< No more jobs should be started.
+} module_instantiate_pool_t;
+
+/** Find the job for a given module instance
+ *
+ */
+static module_instantiate_job_t *module_instantiate_job_find(module_instantiate_pool_t *pool, module_instance_t const *mi)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->num_jobs; i++) if (pool->jobs[i].mi == mi) return &pool->jobs[i];
+
+	return NULL;
+}
+
+/** Record that a job depends on any other module instance named in its configuration
+ *
+ * References to other modules are made by name, e.g. `sql_module_instance = sql`,
+ * so any pair whose value matches the name of another instance in the same list
+ * is treated as a dependency.  False positives only reduce parallelism.
+ */
+static void module_instantiate_deps_find(module_instantiate_pool_t *pool, module_instantiate_job_t *job,
+					 CONF_SECTION const *cs)
+{
+	CONF_ITEM const *ci = NULL;
+
+	while ((ci = cf_item_next(cs, ci))) {
+		module_instance_t		*dep_mi;
+		module_instantiate_job_t	*dep;
+		char const			*value;
+		unsigned int			i;
+
+		if (cf_item_is_section(ci)) {
+			module_instantiate_deps_find(pool, job, cf_item_to_section(ci));
+			continue;
+		}
+
+		if (!cf_item_is_pair(ci)) continue;
+
+		value = cf_pair_value(cf_item_to_pair(ci));
+		if (!value || !*value) continue;
+
+		dep_mi = module_instance_by_name(job->mi->ml, NULL, value);
+		if (!dep_mi || (dep_mi == job->mi)) continue;
+
+		dep = module_instantiate_job_find(pool, dep_mi);
+		if (!dep) continue;
+
+		for (i = 0; i < job->num_deps; i++) if (job->deps[i] == (unsigned int)(dep - pool->jobs)) break;
+		if (i < job->num_deps) continue;
+
+		MEM(job->deps = talloc_realloc(pool->jobs, job->deps, unsigned int, job->num_deps + 1));
+		job->deps[job->num_deps++] = dep - pool->jobs;
+	}
+}
+
+/** Whether all the jobs a job depends on have completed
+ *
+ */
+static bool module_instantiate_job_ready(module_instantiate_pool_t *pool, module_instantiate_job_t *job)
+{
+	unsigned int i;
+
+	for (i = 0; i < job->num_deps; i++) if (!pool->jobs[job->deps[i]].done) return false;
+
+	return true;
+}
+
+/** Find the next job an instantiation thread can run
+ *
+ * Jobs are returned in name order, so with a single thread instantiation
+ * order is the same as when modules are instantiated serially.
+ *
+ * @note Must be called with the pool mutex held.
+ */
+static module_instantiate_job_t *module_instantiate_job_next(module_instantiate_pool_t *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->num_jobs; i++) {
+		module_instantiate_job_t *job = &pool->jobs[i];
+
+		if (!job->parallel || job->done || job->running) continue;
+		if (module_instantiate_job_ready(pool, job)) return job;
+	}
+
+	return NULL;
+}
+
+/** Instantiation thread entry point
+ *
+ * Runs jobs until there are none left which can be run in parallel.
+ * Anything logged by a module is captured, and replayed in name order
+ * once all threads have exited.
+ */
+static void *module_instantiate_thread(void *uctx)
+{
+	module_instantiate_pool_t	*pool = uctx;
+	module_instantiate_job_t	*job;
+	int				ret;
+
+	pthread_mutex_lock(&pool->mutex);
+	while (!pool->stop) {
+		job = module_instantiate_job_next(pool);
+		if (!job) {
+			/*
+			 *	Nothing is runnable, and nothing is
+			 *	running which could make another job
+			 *	runnable.  Any jobs left over are
+			 *	part of a dependency loop, and are
+			 *	instantiated serially.
+			 */
+			if (pool->running == 0) {
+				pool->stop = true;
+				pthread_cond_broadcast(&pool->cond);
+				break;
+			}
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+			continue;
+		}
+
+		job->running = true;
+		pool->running++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		fr_log_capture_start(job->log);
+		ret = module_instantiate_call(job->mi);
+		fr_log_capture_stop();
+
+		pthread_mutex_lock(&pool->mutex);
+		job->ret = ret;
+		job->running = false;
+		job->done = true;
+		pool->running--;
+		if (ret < 0) pool->stop = true;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Instantiate modules using a pool of threads
+ *
+ * - Global registrations and pass2 config parsing are performed serially in name order.
+ * - Modules marked with #MODULE_TYPE_INSTANTIATE_PARALLEL, which only depend on other
+ *   such modules, are then instantiated by a pool of threads.  A module is only
+ *   instantiated once all the modules it references have been instantiated.
+ * - Log messages produced by the threads are replayed in name order.
+ * - All remaining modules are instantiated serially, with dependencies first.
+ *
+ * @param[in] ml	containing modules to instantiate.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int modules_instantiate_parallel(module_list_t const *ml)
+{
+	TALLOC_CTX			*ctx;
+	module_instantiate_pool_t	pool = {};
+	pthread_t			*threads;
+	unsigned int			i, num_parallel = 0, num_threads = 0;
+	fr_rb_iter_inorder_t		iter;
+	void				*inst;
+	bool				changed;
+	int				ret = -1;
+
+	MEM(ctx = talloc_new(NULL));
+	pool.num_jobs = fr_rb_num_elements(ml->name_tree);
+	MEM(pool.jobs = talloc_zero_array(ctx, module_instantiate_job_t, pool.num_jobs));
+
+	for (inst = fr_rb_iter_init_inorder(&iter, ml->name_tree), i = 0;
+	     inst;
+	     inst = fr_rb_iter_next_inorder(&iter), i++) {
+		module_instantiate_job_t *job = &pool.jobs[i];
+
+		job->mi = talloc_get_type_abort(inst, module_instance_t);
+		job->parallel = (job->mi->exported->flags & MODULE_TYPE_INSTANTIATE_PARALLEL) &&
+				job->mi->exported->instantiate && !job->mi->parent;
+	}
+
+	for (i = 0; i < pool.num_jobs; i++) {
+		module_instantiate_job_t	*job = &pool.jobs[i];
+		module_instantiate_job_t	*parent;
+
+		module_instantiate_deps_find(&pool, job, job->mi->conf);
+
+		/*
+		 *	Parents may instantiate their submodules
+		 *	themselves, which must not happen in a
+		 *	different thread.
+		 */
+		if (job->mi->parent && (parent = module_instantiate_job_find(&pool, job->mi->parent))) {
+			parent->parallel = false;
+		}
+	}
+
+	/*
+	 *	A module can only be instantiated in parallel
+	 *	if everything it depends on is too.
+	 */
+	do {
+		changed = false;
+
+		for (i = 0; i < pool.num_jobs; i++) {
+			module_instantiate_job_t	*job = &pool.jobs[i];
+			unsigned int			j;
+
+			if (!job->parallel) continue;
+
+			for (j = 0; j < job->num_deps; j++) {
+				if (pool.jobs[job->deps[j]].parallel) continue;
+
+				job->parallel = false;
+				changed = true;
+				break;
+			}
+		}
+	} while (changed);
+
+	for (i = 0; i < pool.num_jobs; i++) {
+		module_instantiate_job_t *job = &pool.jobs[i];
+
+		switch (module_instantiate_prepare(job->mi)) {
+		case 0:
+			break;
+
+		case 1:
+			job->done = true;
+			job->parallel = false;
+			break;
+
+		default:
+			goto finish;
+		}
+
+		if (!job->parallel) continue;
+
+		MEM(job->log = fr_log_capture_alloc(ctx));
+		num_parallel++;
+	}
+
+	if (num_parallel > 1) {
+		MEM(threads = talloc_array(ctx, pthread_t,
+					   (ml->instantiate_threads < num_parallel) ? ml->instantiate_threads : num_parallel));
+
+		pthread_mutex_init(&pool.mutex, NULL);
+		pthread_cond_init(&pool.cond, NULL);
+
+		for (i = 0; i < talloc_array_length(threads); i++) {
+			if (pthread_create(&threads[i], NULL, module_instantiate_thread, &pool) != 0) break;
+			num_threads++;
+		}
+
+		DEBUG3("Instantiating %u of %u %s modules using %u threads",
+		       num_parallel, pool.num_jobs, ml->name, num_threads);
+
+		for (i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+
+		pthread_cond_destroy(&pool.cond);
+		pthread_mutex_destroy(&pool.mutex);
+
+		/*
+		 *	Replay log messages in the same order
+		 *	as a serial instantiation would.
+		 */
+		for (i = 0; i < pool.num_jobs; i++) {
+			module_instantiate_job_t *job = &pool.jobs[i];
+
+			if (job->log) fr_log_capture_flush(job->log);
+			if (job->done && (job->ret < 0)) goto finish;
+		}
+	}
+
+	/*
+	 *	Everything else is instantiated in this thread,
+	 *	in name order, but with dependencies first.
+	 *	Dependency loops fall back to name order.
+	 */
+	for (;;) {
+		module_instantiate_job_t *job = NULL;
+
+		for (i = 0; i < pool.num_jobs; i++) {
+			if (pool.jobs[i].done) continue;
+			if (module_instantiate_job_ready(&pool, &pool.jobs[i])) {
+				job = &pool.jobs[i];
+				break;
+			}
+			if (!job) job = &pool.jobs[i];
+		}
+		if (!job) break;
+
+		if (module_instantiate_call(job->mi) < 0) goto finish;
+		job->done = true;
+	}
+
+	ret = 0;
+
+finish:
+	talloc_free(ctx);
+
+	return ret;
+}
+
 /** Completes instantiation of modules
  *
  * Allows the module to initialise connection pools, and complete any registrations that depend on
  * attributes created during the bootstrap phase.
  *
+ * If the list allows more than one instantiation thread, modules marked with
+ * #MODULE_TYPE_INSTANTIATE_PARALLEL may be instantiated concurrently.
+ *
  * @param[in] ml containing modules to instantiate.
  * @return
  *	- 0 on success.
@@ -1285,6 +1689,8 @@ int modules_instantiate(module_list_t const *ml)
 
 	DEBUG2("#### Instantiating %s modules ####", ml->name);
 
+	if (ml->instantiate_threads > 1) return modules_instantiate_parallel(ml);
+
 	for (inst = fr_rb_iter_init_inorder(&iter, ml->name_tree);
 	     inst;
 	     inst = fr_rb_iter_next_inorder(&iter)) {
@@ -1295,6 +1701,72 @@ int modules_instantiate(module_list_t const *ml)
 	return 0;
 }
 
+/** Re-read any data a module loaded during instantiation
+ *
+ * The module publishes the new data via #fr_rcu_ptr_t, so workers continue
+ * using the old data until they finish with the request they're processing.
+ *
+ * If reloading fails, the module continues using the old data.
+ *
+ * @param[in] mi	Module instance to reload.
+ * @return
+ *	- 0 on success (or if the module doesn't support reloading).
+ *	- -1 on failure.
+ */
+int module_reload(module_instance_t *mi)
+{
+	static pthread_mutex_t	reload_mutex = PTHREAD_MUTEX_INITIALIZER;
+	int			ret;
+
+	if (!mi->exported->reload || !(mi->state & MODULE_INSTANCE_INSTANTIATED)) return 0;
+
+	cf_log_debug(mi->conf, "Reloading %s_%s \"%s\"",
+		     module_instance_root_prefix_str(mi),
+		     mi->module->exported->name,
+		     mi->name);
+
+	/*
+	 *	HUP is processed by the main thread, radmin
+	 *	commands by the network thread.  Don't let
+	 *	them race each other.
+	 */
+	pthread_mutex_lock(&reload_mutex);
+	ret = mi->exported->reload(MODULE_INST_CTX(mi));
+	pthread_mutex_unlock(&reload_mutex);
+	if (ret < 0) {
+		cf_log_perr(mi->conf, "Reload failed for module \"%s\", continuing with existing data", mi->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Re-read any data loaded during instantiation, for all modules in a list
+ *
+ * Failure to reload one module doesn't prevent the others from being reloaded.
+ *
+ * @param[in] ml	containing modules to reload.
+ * @return
+ *	- 0 on success.
+ *	- -1 if any module failed to reload.
+ */
+int modules_reload(module_list_t const *ml)
+{
+	void			*inst;
+	fr_rb_iter_inorder_t	iter;
+	int			ret = 0;
+
+	for (inst = fr_rb_iter_init_inorder(&iter, ml->name_tree);
+	     inst;
+	     inst = fr_rb_iter_next_inorder(&iter)) {
+		module_instance_t *mi = talloc_get_type_abort(inst, module_instance_t);
+
+		if (module_reload(mi) < 0) ret = -1;
+	}
+
+	return ret;
+}
+
 /** Manually complete module bootstrap by calling its instantiate function
  *
  * - Parse the module configuration.
@@ -1837,6 +2309,17 @@ void module_list_mask_set(module_list_t *ml, module_instance_state_t mask)
 	ml->mask = mask;
 }
 
+/** Set the maximum number of threads used to instantiate modules in a list
+ *
+ * @param[in] ml		To set the number of threads for.
+ * @param[in] num		Maximum number of threads.  0 or 1 instantiates
+ *				all modules serially.
+ */
+void module_list_instantiate_threads_set(module_list_t *ml, unsigned int num)
+{
+	ml->instantiate_threads = num;
+}
+
 /** Allocate a new module list
  *
  * This is used to instantiate and destroy modules in distinct phases
@@ -49,8 +49,12 @@ typedef enum CC_HINT(flag_enum) {
 							//!< Server will protect calls with mutex.
 	MODULE_TYPE_RETRY		= (1 << 2), 	//!< can handle retries
 
-	MODULE_TYPE_DYNAMIC_UNSAFE	= (1 << 3)	//!< Instances of this module cannot be
+	MODULE_TYPE_DYNAMIC_UNSAFE	= (1 << 3),	//!< Instances of this module cannot be
 							///< created at runtime.
+
+	MODULE_TYPE_INSTANTIATE_PARALLEL = (1 << 4)	//!< The instantiate callback only modifies its
+							///< own instance data, and may run concurrently
+							///< with the instantiate callbacks of other modules.
 } module_flags_t;
 DIAG_ON(attributes)
 
@@ -220,6 +224,14 @@ struct module_s {
 								///< After instantiate completes the module instance data
 								///< is mprotected to prevent modification.
 
+	module_instantiate_t		reload;			//!< Callback to re-read any data the module loaded from
+								///< external sources (files, etc.) during instantiation.
+								///< Called on HUP, or by radmin, from a thread which
+								///< isn't a worker, whilst the workers continue processing
+								///< requests.  Instance data is still protected, so the
+								///< new data must be published via a #fr_rcu_ptr_t
+								///< allocated during instantiation.
+
 	module_detach_t			detach;			//!< Clean up module resources from the instantiation pahses.
 
 	module_detach_t			unstrap;		//!< Clean up module resources from both the bootstrap phase.
@@ -396,6 +408,10 @@ struct module_list_s
 								///< bootstrapping and instantiation is complete,
 								///< to prevent accidental modification.
 
+	unsigned int			instantiate_threads;	//!< Maximum number of threads to use when
+								///< instantiating modules.  0 or 1 means
+								///< all modules are instantiated serially.
+
 	/** @name Callbacks to manage thread-specific data
 	 *
 	 * In "child" lists, which are only operating in a single thread, we don't need
@@ -506,6 +522,10 @@ int			module_bootstrap(module_instance_t *mi) CC_HINT(nonnull) CC_HINT(warn_unus
 
 int			modules_bootstrap(module_list_t const *ml) CC_HINT(nonnull) CC_HINT(warn_unused_result);
 
+int			module_reload(module_instance_t *mi) CC_HINT(nonnull);
+
+int			modules_reload(module_list_t const *ml) CC_HINT(nonnull);
+
 extern bool const module_instance_allowed_chars[UINT8_MAX + 1];
 
 fr_slen_t		module_instance_name_valid(char const *inst_name) CC_HINT(nonnull);
@@ -549,6 +569,8 @@ bool			module_instance_skip_thread_instantiate(module_instance_t *mi);
 void			module_list_mask_set(module_list_t *ml, module_instance_state_t mask);
 /** @} */
 
+void			module_list_instantiate_threads_set(module_list_t *ml, unsigned int num);
+
 module_list_t 		*module_list_alloc(TALLOC_CTX *ctx, module_list_type_t const *type,
 					   char const *name, bool write_protect)
 					   CC_HINT(nonnull(2,3)) CC_HINT(warn_unused_result);
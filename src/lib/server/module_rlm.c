@@ -978,6 +978,16 @@ int modules_rlm_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el)
 	return modules_thread_instantiate(ctx, rlm_modules_static, el);
 }
 
+/** Set the maximum number of threads used to instantiate backend modules
+ *
+ * @param[in] num	Maximum number of threads.  0 or 1 instantiates
+ *			all modules serially.
+ */
+void modules_rlm_instantiate_threads_set(unsigned int num)
+{
+	module_list_instantiate_threads_set(rlm_modules_static, num);
+}
+
 /** Performs the instantiation phase for all backend modules
  *
  * @return
@@ -989,6 +999,17 @@ int modules_rlm_instantiate(void)
 	return modules_instantiate(rlm_modules_static);
 }
 
+/** Re-read data loaded during instantiation for all backend modules that support it
+ *
+ * @return
+ *	- 0 if all modules were reloaded successfully.
+ *	- -1 if a module failed to reload.
+ */
+int modules_rlm_reload(void)
+{
+	return modules_reload(rlm_modules_static);
+}
+
 /** Compare the section names of two module_method_binding_t structures
  */
 static int8_t binding_name_cmp(void const *one, void const *two)
@@ -146,8 +146,12 @@ void			modules_rlm_thread_detach(void);
 
 int			modules_rlm_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el) CC_HINT(nonnull(2));
 
+void			modules_rlm_instantiate_threads_set(unsigned int num);
+
 int			modules_rlm_instantiate(void);
 
+int			modules_rlm_reload(void);
+
 int			modules_rlm_bootstrap(CONF_SECTION *root) CC_HINT(nonnull);
 /** @} */
 
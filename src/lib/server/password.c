@@ -253,7 +253,7 @@ static password_info_t password_info[] = {
 						.no_normify = true
 					},
 	[FR_CRYPT]			= {
-						.type = PASSWORD_HASH,
+						.type = PASSWORD_HASH_VARIABLE,
 						.da = &attr_crypt
 					},
 	[FR_LM]				= {
@@ -65,6 +65,36 @@ fr_dict_attr_autoload_t request_dict_attr[] = {
  */
 static _Thread_local fr_dlist_head_t *request_free_list; /* macro */
 
+/** Additional pool memory to reserve for the pairs and value buffers of each request
+ *
+ * Pairs decoded into the request lists are parented (directly or indirectly) by
+ * the request, so if there's space left in the request's pool they're bump
+ * allocated from it, and released in one go when the request is returned to the
+ * free list.  Anything which needs to outlive the request (session-state, persistent
+ * request data, subrequests) is already allocated outside of the request's pool.
+ */
+static _Thread_local size_t request_pool_size;
+
+/** Allocation statistics for this thread's requests
+ *
+ */
+static _Thread_local request_alloc_stats_t request_stats;
+
+/** Never shrink the free list below this many requests
+ *
+ */
+#define REQUEST_FREE_LIST_MIN		32
+
+/** How many requests are returned to the free list before the high water mark is re-evaluated
+ *
+ */
+#define REQUEST_FREE_LIST_WINDOW	1024
+
+/** Rough size of a value buffer, used to estimate the number of chunk headers the pool needs
+ *
+ */
+#define REQUEST_POOL_VALUE_LEN	32
+
 #ifndef NDEBUG
 static int _state_ctx_free(fr_pair_t *state)
 {
@@ -273,7 +303,8 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
 			.detachable = args->detachable
 		},
 		.alloc_file = file,
-		.alloc_line = line
+		.alloc_line = line,
+		.pool_size = request->pool_size
 	};
 
 
@@ -352,6 +383,36 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
 	return 0;
 }
 
+/** Decide whether a request being freed should be kept in the free list
+ *
+ * The free list holds enough requests to cover the peak number of requests
+ * this thread has had in flight recently.  The peak is tracked over windows
+ * of #REQUEST_FREE_LIST_WINDOW frees, and decays by half the difference when
+ * a window's peak is lower, so that surplus requests are released gradually
+ * after a burst.
+ *
+ * @return
+ *	- true if the request should be added to the free list.
+ *	- false if the request should be freed.
+ */
+static inline CC_HINT(always_inline) bool request_free_list_keep(void)
+{
+	static _Thread_local uint32_t	window_peak;
+	static _Thread_local uint32_t	window_count;
+	uint32_t			in_flight = request_stats.in_use + 1;	/* Including the one being freed */
+
+	if (in_flight > window_peak) window_peak = in_flight;
+
+	if (++window_count >= REQUEST_FREE_LIST_WINDOW) {
+		if (window_peak < request_stats.high_water_mark) {
+			request_stats.high_water_mark -= (request_stats.high_water_mark - window_peak) / 2;
+		}
+		window_peak = window_count = 0;
+	}
+
+	return fr_dlist_num_elements(request_free_list) < request_stats.high_water_mark;
+}
+
 /** Callback for freeing a request struct
  *
  * @param[in] request		to free or return to the free list.
@@ -382,15 +443,19 @@ static int _request_free(request_t *request)
 	 */
 	if (unlikely(fr_dlist_entry_in_list(&request->free_entry))) {
 		fr_dlist_entry_unlink(&request->free_entry);	/* Don't trust the list head to be available */
+		request_stats.free--;
 		goto really_free;
 	}
 
+	if (request_stats.in_use) request_stats.in_use--;
+
 	/*
 	 *	We keep a buffer of <active> + N requests per
 	 *	thread, to avoid spurious allocations.
 	 */
-	if (fr_dlist_num_elements(request_free_list) <= 256) {
+	if (request_free_list_keep()) {
 		fr_dlist_head_t		*free_list;
+		size_t			pool_size;
 
 		if (request->session_state_ctx) {
 			fr_assert(talloc_parent(request->session_state_ctx) != request);	/* Should never be directly parented */
@@ -403,8 +468,10 @@ static int _request_free(request_t *request)
 		 */
 		talloc_free_children(request);
 
+		pool_size = request->pool_size;
 		memset(request, 0, sizeof(*request));
 		request->component = "free_list";
+		request->pool_size = pool_size;
 #ifndef NDEBUG
 		/*
 		 *	So we don't trip heap asserts
@@ -420,11 +487,14 @@ static int _request_free(request_t *request)
 		 */
 		fr_dlist_insert_head(free_list, request);
 		request_free_list = free_list;
+		request_stats.free++;
 
 		return -1;	/* Prevent free */
  	}
 
 
+	request_stats.freed++;
+
 	/*
 	 *	Ensure anything that might reference the request is
 	 *	freed before it is.
@@ -461,7 +531,8 @@ static int _request_free_list_free_on_exit(void *arg)
 
 static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *ctx)
 {
-	request_t *request;
+	request_t	*request;
+	size_t		pairs = request_pool_size / (sizeof(fr_pair_t) + REQUEST_POOL_VALUE_LEN);
 
 	/*
 	 *	Only allocate requests in the NULL
@@ -476,17 +547,64 @@ static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *c
 					   1 + 					/* Stack pool */
 					   UNLANG_STACK_MAX + 			/* Stack Frames */
 					   2 + 					/* packets */
+					   (pairs * 2) +			/* pairs and their value buffers */
 					   10,					/* extra */
 					   (UNLANG_FRAME_PRE_ALLOC * UNLANG_STACK_MAX) +	/* Stack memory */
 					   (sizeof(fr_pair_t) * 5) +		/* pair lists and root*/
 					   (sizeof(fr_packet_t) * 2) +	/* packets */
+					   request_pool_size +			/* pairs and their value buffers */
 					   128					/* extra */
 					   ));
 	fr_assert(ctx != request);
+	request->pool_size = request_pool_size;
 
 	return request;
 }
 
+/** Set how much pool memory is reserved for the pairs of requests allocated by this thread
+ *
+ * Requests in the thread's free list with a smaller pool than the new size
+ * are released, as their pairs would no longer fit.  Larger ones are kept,
+ * and are released as the free list shrinks after a burst.
+ *
+ * @param[in] size	of the pair arena.  0 reserves space only for the
+ *			request's own structures.
+ */
+void request_pool_size_set(size_t size)
+{
+	request_t *request, *next;
+
+	if (size == request_pool_size) return;
+
+	request_pool_size = size;
+
+	if (!request_free_list) return;
+
+	for (request = fr_dlist_head(request_free_list); request; request = next) {
+		next = fr_dlist_next(request_free_list, request);
+
+		if (request->pool_size >= size) continue;
+
+		/*
+		 *	The destructor would only unlink it, leaving
+		 *	the list's count wrong.
+		 */
+		fr_dlist_remove(request_free_list, request);
+		request_stats.free--;
+		talloc_set_destructor(request, NULL);
+		talloc_free(request);
+	}
+}
+
+/** Return allocation statistics for requests allocated by this thread
+ *
+ * @param[out] stats	Where to write a copy of the statistics.
+ */
+void request_alloc_stats(request_alloc_stats_t *stats)
+{
+	*stats = request_stats;
+}
+
 /** Create a new request_t data structure
  *
  * @param[in] file	where the request was allocated.
@@ -526,12 +644,22 @@ request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx,
 		 */
 		request = request_alloc_pool(NULL);
 		talloc_set_destructor(request, _request_free);
+		request_stats.alloced++;
 	} else {
 		/*
 		 *	Remove from the free list, as we're
 		 *	about to use it!
 		 */
 		fr_dlist_remove(free_list, request);
+		request_stats.reused++;
+		request_stats.free--;
+	}
+
+	if (++request_stats.in_use > request_stats.high_water_mark) {
+		request_stats.high_water_mark = request_stats.in_use;
+	}
+	if (request_stats.high_water_mark < REQUEST_FREE_LIST_MIN) {
+		request_stats.high_water_mark = REQUEST_FREE_LIST_MIN;
 	}
 
 	if (request_init(file, line, request, type, args) < 0) {
@@ -246,6 +246,8 @@ struct request_s {
 
 	fr_dlist_t		listen_entry;	//!< request's entry in the list for this listener / socket
 	fr_dlist_t		free_entry;	//!< Request's entry in the free list.
+
+	size_t			pool_size;	//!< Size of the pair arena the request was allocated with.
 };				/* request_t typedef */
 
 /** Optional arguments for initialising requests
@@ -265,6 +267,19 @@ typedef struct {
 						///< if its parent exits.
 } request_init_args_t;
 
+/** Statistics for the per-thread request free list
+ *
+ */
+typedef struct {
+	uint64_t		alloced;	//!< Requests allocated from the heap.
+	uint64_t		reused;		//!< Requests recycled from the free list.
+	uint64_t		freed;		//!< Requests released because the free list was full.
+	uint32_t		in_use;		//!< Requests currently allocated.
+	uint32_t		high_water_mark; //!< Smoothed peak of in_use.  The free list is
+						///< sized from this.
+	uint32_t		free;		//!< Requests currently in the free list.
+} request_alloc_stats_t;
+
 #ifdef WITH_VERIFY_PTR
 #  define REQUEST_VERIFY(_x) request_verify(__FILE__, __LINE__, _x)
 #else
@@ -331,6 +346,10 @@ fr_pair_t	*request_state_replace(request_t *request, fr_pair_t *state) CC_HINT(n
 
 int		request_detach(request_t *child);
 
+void		request_pool_size_set(size_t size);
+
+void		request_alloc_stats(request_alloc_stats_t *stats) CC_HINT(nonnull);
+
 int		request_global_init(void);
 void		request_global_free(void);
 
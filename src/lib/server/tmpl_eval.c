@@ -825,6 +825,9 @@ int tmpl_copy_pairs(TALLOC_CTX *ctx, fr_pair_list_t *out, request_t *request, tm
 
 
 /** Copy children of pairs matching a #tmpl_t in the current #request_t
+ *
+ * Value buffers are shared with the original pairs, and only copied
+ * if either pair is modified.
  *
  * @param ctx to allocate new #fr_pair_t in.
  * @param out Where to write the copied #fr_pair_t (s).
@@ -856,7 +859,7 @@ int tmpl_copy_pair_children(TALLOC_CTX *ctx, fr_pair_list_t *out, request_t *req
 	     vp = fr_dcursor_next(&from)) {
 		switch (vp->vp_type) {
 	     	case FR_TYPE_STRUCTURAL:
-	     		if (fr_pair_list_copy(ctx, out, &vp->vp_group) < 0) {
+	     		if (fr_pair_list_copy_shared(ctx, out, &vp->vp_group) < 0) {
 	     			err = -4;
 	     			goto done;
 	     		}
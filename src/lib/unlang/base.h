@@ -28,6 +28,7 @@
 #include <freeradius-devel/unlang/function.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/unlang/module.h>
+#include <freeradius-devel/unlang/offload.h>
 #include <freeradius-devel/unlang/subrequest.h>
 
 #ifdef __cplusplus
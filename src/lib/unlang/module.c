@@ -516,6 +516,38 @@ unlang_action_t unlang_module_yield_to_tmpl(TALLOC_CTX *ctx, fr_value_box_list_t
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+/** Run a function on the default offload pool, and resume the module when it's done
+ *
+ * The function runs on a pool thread, without the request, so that
+ * CPU heavy or blocking work doesn't stall the other requests in the
+ * worker.  See #unlang_offload_func_t for what it may touch.
+ *
+ * @param[in] request		The current request.
+ * @param[in] func		to run on a pool thread.  Is passed rctx.
+ * @param[in] resume		function to call when func has run.
+ * @param[in] signal		function to call if a signal is received.
+ * @param[in] sigmask		Signals to block.
+ * @param[in] rctx		to pass to func, and the resume() and signal() callbacks.
+ *				Must be a talloc chunk.
+ * @return
+ *	- UNLANG_ACTION_PUSHED_CHILD on success.
+ *	- UNLANG_ACTION_FAIL if the pool is full.
+ */
+unlang_action_t unlang_module_yield_to_offload(request_t *request, unlang_offload_func_t func,
+					       module_method_t resume,
+					       unlang_module_signal_t signal, fr_signal_t sigmask, void *rctx)
+{
+	/*
+	 *	Push the resumption point BEFORE pushing the offload
+	 *	frame onto the parents stack.
+	 */
+	(void) unlang_module_yield(request, resume, signal, sigmask, rctx);
+
+	if (unlang_offload_push(request, NULL, func, rctx) < 0) return UNLANG_ACTION_FAIL;
+
+	return UNLANG_ACTION_PUSHED_CHILD;
+}
+
 unlang_action_t unlang_module_yield_to_section(rlm_rcode_t *p_result,
 					       request_t *request, CONF_SECTION *subcs,
 					       rlm_rcode_t default_rcode,
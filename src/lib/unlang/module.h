@@ -33,6 +33,7 @@ extern "C" {
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/server/rcode.h>
+#include <freeradius-devel/unlang/offload.h>
 #include <freeradius-devel/unlang/subrequest.h>
 #include <freeradius-devel/unlang/tmpl.h>
 
@@ -115,6 +116,10 @@ unlang_action_t	unlang_module_yield_to_tmpl(TALLOC_CTX *ctx, fr_value_box_list_t
 					    module_method_t resume,
 					    unlang_module_signal_t signal, fr_signal_t sigmask, void *rctx);
 
+unlang_action_t	unlang_module_yield_to_offload(request_t *request, unlang_offload_func_t func,
+					       module_method_t resume,
+					       unlang_module_signal_t signal, fr_signal_t sigmask, void *rctx);
+
 unlang_action_t	unlang_module_yield(request_t *request,
 				    module_method_t resume,
 				    unlang_module_signal_t signal, fr_signal_t sigmask, void *rctx);
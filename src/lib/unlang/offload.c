@@ -0,0 +1,619 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/offload.c
+ * @brief Run CPU heavy or blocking functions on a pool of threads.
+ *
+ * A worker which calls crypt(), or an interpreter, or a blocking library,
+ * stalls every other request it owns until the call returns.  An offload
+ * pool runs those calls on its own threads instead.  The request yields
+ * while the function runs, and the worker is woken through a user event
+ * when the function is done.
+ *
+ * Only the worker thread allocates or frees jobs.  Pool threads only run
+ * the function, and move the job between lists under a mutex.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+
+#include "function.h"
+#include "interpret.h"
+#include "offload.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+typedef struct unlang_offload_thread_s unlang_offload_thread_t;
+
+typedef enum {
+	OFFLOAD_JOB_INLINE = 0,					//!< Run by the worker, when the frame is evaluated.
+	OFFLOAD_JOB_QUEUED,					//!< Waiting for a pool thread.
+	OFFLOAD_JOB_RUNNING,					//!< Being run by a pool thread.
+	OFFLOAD_JOB_DONE					//!< Finished, and on its way back to the worker.
+} offload_job_state_t;
+
+/** A function which is being run for a request
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;				//!< In the pool's queue, or the thread's done list.
+	fr_dlist_t		thread_entry;			//!< In the list of the thread's outstanding jobs.
+
+	offload_job_state_t	state;				//!< Protected by the pool's mutex.
+	bool			delivered;			//!< The worker has taken the job off its
+								///< done list.  Only touched by the worker.
+
+	unlang_offload_pool_t	*pool;				//!< Running the function.
+	unlang_offload_thread_t	*thread;			//!< Which pushed the job.  NULL if the
+								///< calling thread has no offload support.
+	request_t		*request;			//!< NULL if the request was cancelled.
+
+	unlang_offload_func_t	func;				//!< To run.
+	char const		*func_name;			//!< Debug name for the function.
+	void			*uctx;				//!< To pass to the function.
+
+	fr_time_t		queued;				//!< When the job was queued.
+} unlang_offload_job_t;
+
+struct unlang_offload_pool_s {
+	char const		*name;				//!< For debug messages.
+	unlang_offload_config_t	config;
+
+	pthread_mutex_t		mutex;				//!< Protects everything below.
+	pthread_cond_t		cond;				//!< Signalled when a job is queued, or
+								///< the pool is stopping.
+	fr_dlist_head_t		queue;				//!< Jobs waiting for a thread.
+	bool			stop;				//!< Tell the pool threads to exit.
+
+	unlang_offload_stats_t	stats;
+
+	pthread_t		*threads;
+	uint32_t		num_threads;			//!< Which were started.
+};
+
+/** Offload state for a worker thread
+ *
+ */
+struct unlang_offload_thread_s {
+	fr_event_list_t		*el;				//!< The worker's event list.
+	fr_event_user_t		*ev;				//!< Triggered when jobs are done.
+
+	pthread_mutex_t		mutex;				//!< Protects the done list.
+	pthread_cond_t		cond;				//!< Signalled when a job is done.
+	fr_dlist_head_t		done;				//!< Jobs which the pool threads have finished.
+
+	fr_dlist_head_t		jobs;				//!< Jobs which haven't come back yet.
+								///< Only touched by the worker.
+};
+
+static unlang_offload_pool_t *offload_pool_default;
+static _Thread_local unlang_offload_thread_t *offload_thread;
+
+/** Pass a finished job back to the thread which pushed it
+ *
+ * The user event is only triggered if the done list was empty, so
+ * that a burst of jobs finishing costs the worker one wakeup.  It's
+ * triggered with the mutex held, as the worker may free its offload
+ * state as soon as it sees the last job come back.
+ */
+static void offload_job_return(unlang_offload_job_t *job)
+{
+	unlang_offload_thread_t	*t = job->thread;
+
+	pthread_mutex_lock(&t->mutex);
+	if (fr_dlist_num_elements(&t->done) == 0) (void) fr_event_user_trigger(t->el, t->ev);
+	fr_dlist_insert_tail(&t->done, job);
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+}
+
+/** Run jobs until the pool is stopped
+ *
+ */
+static void *offload_pool_thread(void *arg)
+{
+	unlang_offload_pool_t	*pool = talloc_get_type_abort(arg, unlang_offload_pool_t);
+	unlang_offload_job_t	*job;
+	fr_time_t		start;
+	sigset_t		sigset;
+
+	/*
+	 *	Signals are handled by the main thread.
+	 */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->stop && (fr_dlist_num_elements(&pool->queue) == 0)) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+		if (pool->stop) break;
+
+		job = fr_dlist_pop_head(&pool->queue);
+		job->state = OFFLOAD_JOB_RUNNING;
+
+		start = fr_time();
+		pool->stats.wait = fr_time_delta_add(pool->stats.wait, fr_time_sub(start, job->queued));
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->func(job->uctx);
+
+		pthread_mutex_lock(&pool->mutex);
+		job->state = OFFLOAD_JOB_DONE;
+		pool->stats.completed++;
+		pool->stats.run = fr_time_delta_add(pool->stats.run, fr_time_sub(fr_time(), start));
+		pthread_mutex_unlock(&pool->mutex);
+
+		offload_job_return(job);
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Take a job back from the pool, because its request is going away
+ *
+ * Queued jobs are removed from the queue and freed.  Running jobs
+ * can't be stopped, so they take ownership of uctx, and are freed
+ * when they come back to the worker.  Jobs which have already come
+ * back are just freed, as the function has finished.
+ */
+static void offload_job_cancel(unlang_offload_job_t *job)
+{
+	unlang_offload_pool_t *pool = job->pool;
+
+	job->request = NULL;
+
+	if ((job->state == OFFLOAD_JOB_INLINE) || job->delivered) {
+		talloc_free(job);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stats.cancelled++;
+	if (job->state == OFFLOAD_JOB_QUEUED) {
+		fr_dlist_remove(&pool->queue, job);
+		pthread_mutex_unlock(&pool->mutex);
+
+		fr_dlist_remove(&job->thread->jobs, job);
+		talloc_free(job);
+		return;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	talloc_steal(job, job->uctx);
+}
+
+/** Deliver jobs which the pool threads have finished
+ *
+ */
+static void offload_thread_done(UNUSED fr_event_list_t *el, void *uctx)
+{
+	unlang_offload_thread_t	*t = talloc_get_type_abort(uctx, unlang_offload_thread_t);
+	fr_dlist_head_t		done;
+	unlang_offload_job_t	*job;
+
+	fr_dlist_init(&done, unlang_offload_job_t, entry);
+
+	pthread_mutex_lock(&t->mutex);
+	fr_dlist_move(&done, &t->done);
+	pthread_mutex_unlock(&t->mutex);
+
+	while ((job = fr_dlist_pop_head(&done))) {
+		fr_dlist_remove(&t->jobs, job);
+
+		if (!job->request) {
+			talloc_free(job);
+			continue;
+		}
+
+		job->delivered = true;
+		unlang_interpret_mark_runnable(job->request);
+	}
+}
+
+/** Run the function inline, or wait for the pool thread to run it
+ *
+ */
+static unlang_action_t offload_process(rlm_rcode_t *p_result, UNUSED int *priority, request_t *request, void *uctx)
+{
+	unlang_offload_job_t *job = talloc_get_type_abort(uctx, unlang_offload_job_t);
+
+	if (job->state != OFFLOAD_JOB_INLINE) {
+		RDEBUG3("Waiting for offload pool \"%s\" to run %s", job->pool->name, job->func_name);
+		return UNLANG_ACTION_YIELD;
+	}
+
+	RDEBUG3("Running %s in the worker", job->func_name);
+	job->func(job->uctx);
+
+	RETURN_MODULE_OK;
+}
+
+/** Free the job once the function has run
+ *
+ */
+static unlang_action_t offload_resume(rlm_rcode_t *p_result, UNUSED int *priority, UNUSED request_t *request, void *uctx)
+{
+	unlang_offload_job_t *job = talloc_get_type_abort(uctx, unlang_offload_job_t);
+
+	talloc_free(job);
+
+	RETURN_MODULE_OK;
+}
+
+static void offload_signal(request_t *request, fr_signal_t action, void *uctx)
+{
+	unlang_offload_job_t *job = talloc_get_type_abort(uctx, unlang_offload_job_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	RDEBUG3("Cancelling %s", job->func_name);
+
+	offload_job_cancel(job);
+
+	/*
+	 *	The job may be gone, so the frame mustn't
+	 *	reference it again.
+	 */
+	IGNORE(unlang_function_clear(request), int);
+}
+
+/** Run a function on a pool thread, and push a frame which waits for it
+ *
+ * @private
+ *
+ * If the pool has no threads, or the calling thread can't be woken
+ * by the pool, the function is run in the worker when the frame is
+ * evaluated.
+ *
+ * @param[in] request		The current request.
+ * @param[in] pool		to run the function on.  NULL means the default pool.
+ * @param[in] func		to run.
+ * @param[in] func_name		Name of the function (for debugging).
+ * @param[in] uctx		to pass to the function.  Must be a talloc chunk.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the pool is full, or the frame couldn't be pushed.
+ */
+int _unlang_offload_push(request_t *request, unlang_offload_pool_t *pool,
+			 unlang_offload_func_t func, char const *func_name, void *uctx)
+{
+	unlang_offload_thread_t	*t = offload_thread;
+	unlang_offload_job_t	*job;
+
+	if (!pool) pool = offload_pool_default;
+
+	MEM(job = talloc(t ? (TALLOC_CTX *) t : (TALLOC_CTX *) request, unlang_offload_job_t));
+	*job = (unlang_offload_job_t) {
+		.state = OFFLOAD_JOB_INLINE,
+		.pool = pool,
+		.thread = t,
+		.request = request,
+		.func = func,
+		.func_name = func_name,
+		.uctx = uctx
+	};
+
+	if (pool && t && pool->num_threads) {
+		uint32_t queue_len;
+
+		pthread_mutex_lock(&pool->mutex);
+		queue_len = fr_dlist_num_elements(&pool->queue);
+		if (queue_len < pool->config.max_queued) {
+			job->state = OFFLOAD_JOB_QUEUED;
+			job->queued = fr_time();
+			fr_dlist_insert_tail(&pool->queue, job);
+			pool->stats.queued++;
+			if (queue_len >= pool->stats.queue_len_max) pool->stats.queue_len_max = queue_len + 1;
+			pthread_cond_signal(&pool->cond);
+
+		} else if (pool->config.full == UNLANG_OFFLOAD_FULL_FAIL) {
+			pool->stats.rejected++;
+			pthread_mutex_unlock(&pool->mutex);
+
+			RWARN("Offload pool \"%s\" is full", pool->name);
+			talloc_free(job);
+			return -1;
+
+		} else {
+			pool->stats.ran_inline++;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (job->state == OFFLOAD_JOB_QUEUED) fr_dlist_insert_tail(&t->jobs, job);
+
+	} else if (pool) {
+		pthread_mutex_lock(&pool->mutex);
+		pool->stats.ran_inline++;
+		pthread_mutex_unlock(&pool->mutex);
+	}
+
+	if (_unlang_function_push(request,
+				  offload_process, func_name,
+				  offload_resume, "offload_resume",
+				  offload_signal, ~FR_SIGNAL_CANCEL, "offload_signal",
+				  UNLANG_SUB_FRAME, job) != UNLANG_ACTION_PUSHED_CHILD) {
+		offload_job_cancel(job);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Return the counters for a pool
+ *
+ * @param[out] stats	Where to write the counters.
+ * @param[in] pool	to read.
+ */
+void unlang_offload_pool_stats(unlang_offload_stats_t *stats, unlang_offload_pool_t *pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	*stats = pool->stats;
+	stats->queue_len = fr_dlist_num_elements(&pool->queue);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static int cmd_stats_offload(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	unlang_offload_stats_t stats;
+
+	if (!offload_pool_default) return 0;
+
+	unlang_offload_pool_stats(&stats, offload_pool_default);
+
+	fprintf(fp, "count.threads\t\t\t%u\n", offload_pool_default->num_threads);
+	fprintf(fp, "count.queued\t\t\t%" PRIu64 "\n", stats.queued);
+	fprintf(fp, "count.completed\t\t\t%" PRIu64 "\n", stats.completed);
+	fprintf(fp, "count.inline\t\t\t%" PRIu64 "\n", stats.ran_inline);
+	fprintf(fp, "count.rejected\t\t\t%" PRIu64 "\n", stats.rejected);
+	fprintf(fp, "count.cancelled\t\t\t%" PRIu64 "\n", stats.cancelled);
+	fprintf(fp, "count.queue_len\t\t\t%u\n", stats.queue_len);
+	fprintf(fp, "count.queue_len_max\t\t%u\n", stats.queue_len_max);
+	fprintf(fp, "time.wait\t\t\t%.6f\n", fr_time_delta_unwrap(stats.wait) / (double)NSEC);
+	fprintf(fp, "time.run\t\t\t%.6f\n", fr_time_delta_unwrap(stats.run) / (double)NSEC);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_offload_table[] = {
+	{
+		.parent = "stats",
+		.name = "offload",
+		.func = cmd_stats_offload,
+		.help = "Show statistics for the default offload pool.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Return the pool used when no pool is passed to #unlang_offload_push
+ *
+ * @return
+ *	- The default pool.
+ *	- NULL if #unlang_offload_init hasn't been called.
+ */
+unlang_offload_pool_t *unlang_offload_pool_default(void)
+{
+	return offload_pool_default;
+}
+
+/** Whether functions pushed from this thread would run on pool threads
+ *
+ * Callers can use this to skip copying their inputs when the function
+ * would be run in the worker anyway.
+ *
+ * @param[in] pool	to check.  NULL means the default pool.
+ * @return
+ *	- true if the pool has threads, and they can wake this thread.
+ *	- false if functions would be run in the worker.
+ */
+bool unlang_offload_available(unlang_offload_pool_t const *pool)
+{
+	if (!pool) pool = offload_pool_default;
+
+	return pool && pool->num_threads && offload_thread;
+}
+
+static int _offload_pool_free(unlang_offload_pool_t *pool)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+
+	DEBUG2("Offload pool \"%s\" ran %" PRIu64 " functions on its threads, and %" PRIu64 " in workers.  "
+	       "%" PRIu64 " were rejected, %" PRIu64 " cancelled.  At most %u waited for a thread",
+	       pool->name, pool->stats.completed, pool->stats.ran_inline,
+	       pool->stats.rejected, pool->stats.cancelled, pool->stats.queue_len_max);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	return 0;
+}
+
+/** Allocate an offload pool, and start its threads
+ *
+ * @param[in] ctx	to allocate the pool in.  Freeing the pool stops its threads.
+ * @param[in] name	of the pool, for debug messages.
+ * @param[in] config	for the pool.
+ * @return
+ *	- A new pool.
+ *	- NULL on error.
+ */
+unlang_offload_pool_t *unlang_offload_pool_alloc(TALLOC_CTX *ctx, char const *name,
+						 unlang_offload_config_t const *config)
+{
+	unlang_offload_pool_t	*pool;
+	uint32_t		i;
+
+	MEM(pool = talloc_zero(ctx, unlang_offload_pool_t));
+	pool->name = talloc_strdup(pool, name);
+	pool->config = *config;
+	if (!pool->config.max_queued) pool->config.max_queued = 1;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	fr_dlist_init(&pool->queue, unlang_offload_job_t, entry);
+	talloc_set_destructor(pool, _offload_pool_free);
+
+	if (!config->num_threads) return pool;
+
+	MEM(pool->threads = talloc_array(pool, pthread_t, config->num_threads));
+	for (i = 0; i < config->num_threads; i++) {
+		int ret;
+
+		ret = pthread_create(&pool->threads[i], NULL, offload_pool_thread, pool);
+		if (ret != 0) {
+			fr_strerror_printf("Failed creating offload thread: %s", fr_syserror(ret));
+			talloc_free(pool);
+			return NULL;
+		}
+		pool->num_threads++;
+	}
+
+	return pool;
+}
+
+/** Wait for the thread's jobs to come back, and free them
+ *
+ */
+static int _offload_thread_free(unlang_offload_thread_t *t)
+{
+	unlang_offload_job_t *job, *next;
+
+	/*
+	 *	The requests should all have been cancelled, but
+	 *	don't leave jobs for the pool threads to find.
+	 */
+	for (job = fr_dlist_head(&t->jobs); job; job = next) {
+		next = fr_dlist_next(&t->jobs, job);
+		if (job->request) offload_job_cancel(job);
+	}
+
+	pthread_mutex_lock(&t->mutex);
+	while (fr_dlist_num_elements(&t->jobs) > 0) {
+		while ((job = fr_dlist_pop_head(&t->done))) {
+			fr_dlist_remove(&t->jobs, job);
+			talloc_free(job);
+		}
+		if (fr_dlist_num_elements(&t->jobs) == 0) break;
+
+		pthread_cond_wait(&t->cond, &t->mutex);
+	}
+	pthread_mutex_unlock(&t->mutex);
+
+	pthread_cond_destroy(&t->cond);
+	pthread_mutex_destroy(&t->mutex);
+
+	if (offload_thread == t) offload_thread = NULL;
+
+	return 0;
+}
+
+/** Allow requests in this thread to wait for offload pools
+ *
+ * @param[in] ctx	to allocate the thread's offload state in.
+ * @param[in] el	the thread's event list.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int unlang_offload_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el)
+{
+	unlang_offload_thread_t *t;
+
+	MEM(t = talloc_zero(ctx, unlang_offload_thread_t));
+	t->el = el;
+	pthread_mutex_init(&t->mutex, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	fr_dlist_init(&t->done, unlang_offload_job_t, entry);
+	fr_dlist_init(&t->jobs, unlang_offload_job_t, thread_entry);
+	talloc_set_destructor(t, _offload_thread_free);
+
+	if (fr_event_user_insert(t, el, &t->ev, false, offload_thread_done, t) < 0) {
+		talloc_free(t);
+		return -1;
+	}
+
+	offload_thread = t;
+
+	return 0;
+}
+
+/** Free this thread's offload state
+ *
+ * Waits for functions which are still running on pool threads.
+ */
+void unlang_offload_thread_detach(void)
+{
+	TALLOC_FREE(offload_thread);
+}
+
+/** Create the default offload pool
+ *
+ * @param[in] config	for the default pool.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int unlang_offload_init(unlang_offload_config_t const *config)
+{
+	static bool	cmd_registered = false;
+
+	if (offload_pool_default) return 0;
+
+	offload_pool_default = unlang_offload_pool_alloc(NULL, "default", config);
+	if (!offload_pool_default) return -1;
+
+	/*
+	 *	Commands can't be removed, so the command reads
+	 *	whichever pool is the default when it's run.
+	 */
+	if (!cmd_registered) {
+		if (fr_command_register_hook(NULL, NULL, NULL, cmd_offload_table) < 0) {
+			TALLOC_FREE(offload_pool_default);
+			return -1;
+		}
+		cmd_registered = true;
+	}
+
+	return 0;
+}
+
+/** Stop the default offload pool's threads
+ *
+ */
+void unlang_offload_free(void)
+{
+	TALLOC_FREE(offload_pool_default);
+}
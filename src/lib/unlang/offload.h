@@ -0,0 +1,130 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file unlang/offload.h
+ * @brief Run CPU heavy or blocking functions on a pool of threads, and resume
+ *	  the request in its worker when they're done.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/time.h>
+
+typedef struct unlang_offload_pool_s unlang_offload_pool_t;
+
+/** What to do when a pool's queue is full
+ *
+ */
+typedef enum {
+	UNLANG_OFFLOAD_FULL_INLINE = 0,		//!< Run the function in the worker, as if
+						///< there was no pool.
+	UNLANG_OFFLOAD_FULL_FAIL		//!< Fail the push.
+} unlang_offload_full_t;
+
+/** Configuration for an offload pool
+ *
+ */
+typedef struct {
+	uint32_t		num_threads;		//!< Threads in the pool.  0 means functions
+						///< are run in the worker.
+	uint32_t		max_queued;		//!< How many functions may wait for a thread.
+	unlang_offload_full_t	full;			//!< What to do when max_queued is reached.
+} unlang_offload_config_t;
+
+/** Counters for an offload pool
+ *
+ */
+typedef struct {
+	uint64_t		queued;			//!< Functions passed to a pool thread.
+	uint64_t		completed;		//!< Functions which a pool thread finished.
+	uint64_t		ran_inline;		//!< Functions run in the worker, because the pool
+						///< had no threads, or was full.
+	uint64_t		rejected;		//!< Pushes which failed because the pool was full.
+	uint64_t		cancelled;		//!< Functions whose request was cancelled.
+	uint32_t		queue_len;		//!< Functions waiting for a thread now.
+	uint32_t		queue_len_max;		//!< Most functions which have waited at once.
+	fr_time_delta_t		wait;			//!< Total time functions spent waiting for a thread.
+	fr_time_delta_t		run;			//!< Total time pool threads spent running functions.
+} unlang_offload_stats_t;
+
+/** A function to run on a pool thread
+ *
+ * The function runs without the request.  It must not log to it,
+ * or touch its pairs.
+ *
+ * talloc isn't thread safe, and uctx is usually allocated from the
+ * request, which the worker may be using at the same time.  So the
+ * function must not allocate or free anything under uctx, or under
+ * any other talloc ctx which belongs to the worker.  It should only
+ * read its input from uctx, and write its output into buffers which
+ * were allocated before the function was pushed.
+ *
+ * If the request is cancelled while the function is running, uctx
+ * is reparented to the offload job, and freed when the function
+ * returns.
+ *
+ * @param[in] uctx	passed to #unlang_offload_push.
+ */
+typedef void (*unlang_offload_func_t)(void *uctx);
+
+unlang_offload_pool_t	*unlang_offload_pool_alloc(TALLOC_CTX *ctx, char const *name,
+						   unlang_offload_config_t const *config) CC_HINT(nonnull(2,3));
+
+void			unlang_offload_pool_stats(unlang_offload_stats_t *stats, unlang_offload_pool_t *pool) CC_HINT(nonnull);
+
+unlang_offload_pool_t	*unlang_offload_pool_default(void);
+
+bool			unlang_offload_available(unlang_offload_pool_t const *pool);
+
+/** Run a function on a pool thread, and push a frame which waits for it
+ *
+ * The caller should establish its own resumption point first, usually
+ * with #unlang_module_yield, then return #UNLANG_ACTION_PUSHED_CHILD.
+ *
+ * @param[in] _request	The current request.
+ * @param[in] _pool	to run the function on.  NULL means the default pool.
+ * @param[in] _func	to run.
+ * @param[in] _uctx	to pass to the function.  Must be a talloc chunk.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the pool is full, or the frame couldn't be pushed.
+ */
+#define			unlang_offload_push(_request, _pool, _func, _uctx) \
+			_unlang_offload_push(_request, _pool, _func, STRINGIFY(_func), _uctx)
+int			_unlang_offload_push(request_t *request, unlang_offload_pool_t *pool,
+					     unlang_offload_func_t func, char const *func_name, void *uctx)
+			CC_HINT(nonnull(1,3,4)) CC_HINT(warn_unused_result);
+
+int			unlang_offload_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el) CC_HINT(nonnull);
+
+void			unlang_offload_thread_detach(void);
+
+int			unlang_offload_init(unlang_offload_config_t const *config) CC_HINT(nonnull);
+
+void			unlang_offload_free(void);
+
+#ifdef __cplusplus
+}
+#endif
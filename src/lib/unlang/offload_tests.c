@@ -0,0 +1,404 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for offload pools
+ *
+ * @file src/lib/unlang/offload_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/unlang/function.h>
+#include <freeradius-devel/unlang/offload.h>
+#include <freeradius-devel/util/dict_test.h>
+
+#include <sched.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** What a function did, kept outside the request so it can be checked after the request is freed
+ *
+ */
+typedef struct {
+	atomic_bool		started;
+	atomic_bool		ran;
+} test_result_t;
+
+/** uctx for the function
+ *
+ */
+typedef struct {
+	test_result_t		*result;
+	atomic_bool		*gate;		//!< If set, the function waits until it's true.
+} test_job_t;
+
+static TALLOC_CTX		*autofree;
+static fr_dict_t		*test_dict;
+
+static TALLOC_CTX		*thread_ctx;	//!< Holds the thread's offload state, and so its jobs.
+static fr_event_list_t		*el;
+static fr_heap_t		*runnable;
+static unlang_offload_pool_t	*pool;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("offload_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+
+	if (unlang_global_init() < 0) goto error;
+}
+
+/** Spin until another thread sets a flag
+ *
+ * Gives up after a few seconds, so that a broken pool fails the
+ * test, instead of hanging it.
+ */
+static bool test_wait_for(atomic_bool *flag)
+{
+	fr_time_t end = fr_time_add(fr_time(), fr_time_delta_from_sec(5));
+
+	while (!atomic_load(flag)) {
+		if (fr_time_gt(fr_time(), end)) return false;
+		sched_yield();
+	}
+
+	return true;
+}
+
+static void test_func(void *uctx)
+{
+	test_job_t *job = talloc_get_type_abort(uctx, test_job_t);
+
+	atomic_store(&job->result->started, true);
+	if (job->gate) (void) test_wait_for(job->gate);
+	atomic_store(&job->result->ran, true);
+}
+
+static void _request_noop(UNUSED request_t *request, UNUSED void *uctx)
+{
+}
+
+static void _request_done(UNUSED request_t *request, UNUSED rlm_rcode_t rcode, UNUSED void *uctx)
+{
+}
+
+static void _request_stop(request_t *request, UNUSED void *uctx)
+{
+	if (fr_heap_entry_inserted(request->runnable_id)) fr_heap_extract(&runnable, request);
+}
+
+static void _request_runnable(request_t *request, UNUSED void *uctx)
+{
+	fr_heap_insert(&runnable, request);
+}
+
+static bool _request_scheduled(request_t const *request, UNUSED void *uctx)
+{
+	return fr_heap_entry_inserted(request->runnable_id);
+}
+
+/** Set up this thread as a worker, with an offload pool
+ *
+ */
+static void test_setup(uint32_t num_threads)
+{
+	unlang_interpret_t *intp;
+
+	MEM(thread_ctx = talloc_init_const("offload_tests"));
+	MEM(el = fr_event_list_alloc(thread_ctx, NULL, NULL));
+	MEM(runnable = fr_heap_talloc_alloc(thread_ctx, fr_pointer_cmp, request_t, runnable_id, 0));
+	MEM(intp = unlang_interpret_init(thread_ctx, el,
+					 &(unlang_request_func_t){
+						.init_internal = _request_noop,
+
+						.done_external = _request_done,
+						.done_internal = _request_done,
+						.done_detached = _request_done,
+
+						.detach = _request_noop,
+						.stop = _request_stop,
+						.yield = _request_noop,
+						.resume = _request_noop,
+						.mark_runnable = _request_runnable,
+						.scheduled = _request_scheduled
+					 }, NULL));
+	unlang_interpret_set_thread_default(intp);
+
+	MEM(pool = unlang_offload_pool_alloc(thread_ctx, "test", &(unlang_offload_config_t){
+						.num_threads = num_threads,
+						.max_queued = 16,
+						.full = UNLANG_OFFLOAD_FULL_FAIL
+					     }));
+
+	TEST_CHECK(unlang_offload_thread_instantiate(thread_ctx, el) == 0);
+}
+
+/** Free the thread's offload state, which waits for its jobs, then the pool
+ *
+ */
+static void test_teardown(void)
+{
+	unlang_offload_thread_detach();
+	unlang_interpret_set_thread_default(NULL);
+	TALLOC_FREE(thread_ctx);
+}
+
+static unlang_action_t test_push_offload(rlm_rcode_t *p_result, UNUSED int *priority, request_t *request, void *uctx)
+{
+	if (unlang_offload_push(request, pool, test_func, uctx) < 0) RETURN_MODULE_FAIL;
+
+	return UNLANG_ACTION_PUSHED_CHILD;
+}
+
+/** Allocate a request, and start it running a function on the pool
+ *
+ */
+static request_t *test_request_start(test_result_t *result, atomic_bool *gate)
+{
+	request_t	*request;
+	test_job_t	*job;
+
+	MEM(request = request_local_alloc_external(thread_ctx, NULL));
+	unlang_interpret_set(request, unlang_interpret_get_thread_default());
+
+	MEM(job = talloc_zero(request, test_job_t));
+	job->result = result;
+	job->gate = gate;
+
+	TEST_CHECK(unlang_function_push(request, test_push_offload, NULL, NULL, 0, UNLANG_TOP_FRAME, job) ==
+		   UNLANG_ACTION_PUSHED_CHILD);
+
+	(void) unlang_interpret(request);
+	TEST_CHECK(unlang_interpret_is_resumable(request));
+	TEST_MSG("The request should be waiting for the pool");
+
+	return request;
+}
+
+/** Service the event list until the function has come back to the worker
+ *
+ */
+static bool test_wait_runnable(request_t *request)
+{
+	fr_time_t end = fr_time_add(fr_time(), fr_time_delta_from_sec(5));
+
+	while (!fr_heap_entry_inserted(request->runnable_id)) {
+		if (fr_time_gt(fr_time(), end)) return false;
+
+		if (fr_event_corral(el, fr_time(), false) > 0) fr_event_service(el);
+		sched_yield();
+	}
+
+	return true;
+}
+
+/** Service the event list until the thread has no jobs left
+ *
+ */
+static bool test_wait_blocks(size_t blocks)
+{
+	fr_time_t end = fr_time_add(fr_time(), fr_time_delta_from_sec(5));
+
+	while (talloc_total_blocks(thread_ctx) != blocks) {
+		if (fr_time_gt(fr_time(), end)) return false;
+
+		if (fr_event_corral(el, fr_time(), false) > 0) fr_event_service(el);
+		sched_yield();
+	}
+
+	return true;
+}
+
+static void test_request_resume(request_t *request)
+{
+	request_t *next;
+
+	next = fr_heap_pop(&runnable);
+	TEST_CHECK(next == request);
+
+	TEST_CHECK(unlang_interpret(request) == RLM_MODULE_OK);
+	TEST_CHECK(!unlang_interpret_is_resumable(request));
+}
+
+static void test_submit(void)
+{
+	test_result_t		result = {};
+	unlang_offload_stats_t	stats;
+	request_t		*request;
+	size_t			blocks;
+
+	test_setup(2);
+	blocks = talloc_total_blocks(thread_ctx);
+
+	TEST_CASE("The function runs on a pool thread");
+	request = test_request_start(&result, NULL);
+	TEST_CHECK(test_wait_runnable(request));
+	TEST_CHECK(atomic_load(&result.ran));
+
+	TEST_CASE("The request resumes when it's done");
+	test_request_resume(request);
+
+	unlang_offload_pool_stats(&stats, pool);
+	TEST_CHECK_RET(stats.queued, 1);
+	TEST_CHECK_RET(stats.completed, 1);
+	TEST_CHECK_RET(stats.ran_inline, 0);
+	TEST_CHECK_RET(stats.cancelled, 0);
+	TEST_CHECK_RET(stats.queue_len, 0);
+
+	talloc_free(request);
+	TEST_CHECK(talloc_total_blocks(thread_ctx) == blocks);
+	TEST_MSG("%zu blocks leaked", talloc_total_blocks(thread_ctx) - blocks);
+
+	test_teardown();
+}
+
+static void test_cancel_queued(void)
+{
+	test_result_t		running = {}, queued = {};
+	unlang_offload_stats_t	stats;
+	request_t		*first, *second;
+	atomic_bool		gate = false;
+	size_t			blocks;
+
+	test_setup(1);
+	blocks = talloc_total_blocks(thread_ctx);
+
+	TEST_CASE("A function waits while the only thread is busy");
+	first = test_request_start(&running, &gate);
+	TEST_CHECK(test_wait_for(&running.started));
+
+	second = test_request_start(&queued, NULL);
+	unlang_offload_pool_stats(&stats, pool);
+	TEST_CHECK_RET(stats.queue_len, 1);
+
+	TEST_CASE("Cancelling its request takes it off the queue");
+	unlang_interpret_signal(second, FR_SIGNAL_CANCEL);
+	talloc_free(second);
+
+	unlang_offload_pool_stats(&stats, pool);
+	TEST_CHECK_RET(stats.queue_len, 0);
+	TEST_CHECK_RET(stats.cancelled, 1);
+
+	TEST_CASE("The function never runs");
+	atomic_store(&gate, true);
+	TEST_CHECK(test_wait_runnable(first));
+	test_request_resume(first);
+	talloc_free(first);
+
+	TEST_CHECK(!atomic_load(&queued.started));
+
+	unlang_offload_pool_stats(&stats, pool);
+	TEST_CHECK_RET(stats.queued, 2);
+	TEST_CHECK_RET(stats.completed, 1);
+	TEST_CHECK(talloc_total_blocks(thread_ctx) == blocks);
+	TEST_MSG("%zu blocks leaked", talloc_total_blocks(thread_ctx) - blocks);
+
+	test_teardown();
+}
+
+static void test_cancel_running(void)
+{
+	test_result_t		result = {};
+	unlang_offload_stats_t	stats;
+	request_t		*request;
+	atomic_bool		gate = false;
+	size_t			blocks;
+
+	test_setup(1);
+	blocks = talloc_total_blocks(thread_ctx);
+
+	request = test_request_start(&result, &gate);
+	TEST_CHECK(test_wait_for(&result.started));
+
+	TEST_CASE("Cancelling a running function lets its request be freed");
+	unlang_interpret_signal(request, FR_SIGNAL_CANCEL);
+	talloc_free(request);
+
+	unlang_offload_pool_stats(&stats, pool);
+	TEST_CHECK_RET(stats.cancelled, 1);
+
+	TEST_CASE("The job is freed when the function returns");
+	atomic_store(&gate, true);
+	TEST_CHECK(test_wait_blocks(blocks));
+	TEST_CHECK(atomic_load(&result.ran));
+	TEST_CHECK(fr_heap_num_elements(runnable) == 0);
+
+	test_teardown();
+}
+
+static void test_cancel_done(void)
+{
+	test_result_t		result = {};
+	unlang_offload_stats_t	stats;
+	request_t		*request;
+	size_t			blocks;
+
+	test_setup(1);
+	blocks = talloc_total_blocks(thread_ctx);
+
+	request = test_request_start(&result, NULL);
+	TEST_CHECK(test_wait_runnable(request));
+
+	TEST_CASE("Cancelling after the function has come back frees the job");
+	unlang_interpret_signal(request, FR_SIGNAL_CANCEL);
+	TEST_CHECK(fr_heap_num_elements(runnable) == 0);
+	talloc_free(request);
+
+	TEST_CHECK(talloc_total_blocks(thread_ctx) == blocks);
+	TEST_MSG("%zu blocks leaked", talloc_total_blocks(thread_ctx) - blocks);
+
+	unlang_offload_pool_stats(&stats, pool);
+	TEST_CHECK_RET(stats.completed, 1);
+	TEST_CHECK_RET(stats.cancelled, 0);
+
+	test_teardown();
+}
+
+TEST_LIST = {
+	{ "offload_submit",		test_submit		},
+	{ "offload_cancel_queued",	test_cancel_queued	},
+	{ "offload_cancel_running",	test_cancel_running	},
+	{ "offload_cancel_done",	test_cancel_done	},
+
+	{ NULL }
+};
@@ -289,15 +289,15 @@ static unlang_action_t unlang_parallel_process(rlm_rcode_t *p_result, request_t
 			 *	contains state information for
 			 *	the parent.
 			 */
-			if ((fr_pair_list_copy(child->request_ctx,
-					       &child->request_pairs,
-					       &request->request_pairs) < 0) ||
-			    (fr_pair_list_copy(child->reply_ctx,
-					       &child->reply_pairs,
-					       &request->reply_pairs) < 0) ||
-			    (fr_pair_list_copy(child->control_ctx,
-					       &child->control_pairs,
-					       &request->control_pairs) < 0)) {
+			if ((fr_pair_list_copy_shared(child->request_ctx,
+						      &child->request_pairs,
+						      &request->request_pairs) < 0) ||
+			    (fr_pair_list_copy_shared(child->reply_ctx,
+						      &child->reply_pairs,
+						      &request->reply_pairs) < 0) ||
+			    (fr_pair_list_copy_shared(child->control_ctx,
+						      &child->control_pairs,
+						      &request->control_pairs) < 0)) {
 				REDEBUG("failed copying lists to clone");
 			error:
 				/*
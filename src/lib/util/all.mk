@@ -1,5 +1,6 @@
 SUBMAKEFILES := \
 	base_16_32_64_tests.mk \
+	cpuset_tests.mk \
 	dbuff_tests.mk \
 	dcursor_tests.mk \
 	dcursor_typed_tests.mk \
@@ -15,9 +16,11 @@ SUBMAKEFILES := \
 	pair_nested_tests.mk \
 	pair_tests.mk \
 	rb_tests.mk \
+	rcu_tests.mk \
 	sbuff_tests.mk \
 	size_tests.mk \
 	slab_tests.mk \
+	socket_filter_tests.mk \
 	strerror_tests.mk \
 	time_tests.mk
 
@@ -0,0 +1,401 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Sets of CPUs, thread affinity, and NUMA topology
+ *
+ * The NUMA topology is read from sysfs, so there's no dependency on
+ * libnuma.  Memory isn't bound explicitly.  The kernel allocates pages
+ * on the node of the CPU which first touches them, so a thread which
+ * is bound to a node before it allocates anything gets local memory.
+ *
+ * @file src/lib/util/cpuset.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/cpuset.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#  include <sched.h>
+#  include <unistd.h>
+#endif
+
+/** Count the CPUs in a set
+ *
+ */
+unsigned int fr_cpuset_count(fr_cpuset_t const *set)
+{
+	unsigned int	i, count = 0;
+
+	for (i = 0; i < NUM_ELEMENTS(set->bits); i++) count += __builtin_popcountll(set->bits[i]);
+
+	return count;
+}
+
+/** Intersect two sets
+ *
+ * @param[out] out	Where to write the intersection.  May be the same as a or b.
+ * @param[in] a		First set.
+ * @param[in] b		Second set.
+ */
+void fr_cpuset_and(fr_cpuset_t *out, fr_cpuset_t const *a, fr_cpuset_t const *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_ELEMENTS(out->bits); i++) out->bits[i] = a->bits[i] & b->bits[i];
+}
+
+/** Return the nth CPU in a set, wrapping around if there are fewer than n
+ *
+ * Used to hand out CPUs from a set to threads one at a time.
+ *
+ * @param[in] set	to take the CPU from.
+ * @param[in] n		index of the CPU.
+ * @return
+ *	- The CPU number.
+ *	- -1 if the set is empty.
+ */
+int fr_cpuset_nth(fr_cpuset_t const *set, unsigned int n)
+{
+	unsigned int	count = fr_cpuset_count(set);
+	unsigned int	cpu;
+
+	if (!count) return -1;
+
+	n %= count;
+	for (cpu = 0; cpu < FR_CPUSET_MAX; cpu++) {
+		if (!fr_cpuset_isset(set, cpu)) continue;
+		if (n-- == 0) return cpu;
+	}
+
+	return -1;
+}
+
+/** Parse one CPU number
+ *
+ */
+static int cpuset_cpu_parse(unsigned int *out, char const **p)
+{
+	char		*end;
+	unsigned long	cpu;
+
+	while (isspace((uint8_t) **p)) (*p)++;
+
+	if (!isdigit((uint8_t) **p)) {
+		fr_strerror_printf("Expected CPU number, got '%s'", *p);
+		return -1;
+	}
+
+	cpu = strtoul(*p, &end, 10);
+	if (cpu >= FR_CPUSET_MAX) {
+		fr_strerror_printf("CPU number %lu is too large, it must be less than %u", cpu, FR_CPUSET_MAX);
+		return -1;
+	}
+
+	*p = end;
+	while (isspace((uint8_t) **p)) (*p)++;
+
+	*out = cpu;
+	return 0;
+}
+
+/** Parse a list of CPUs
+ *
+ * @param[out] out	Where to write the set.
+ * @param[in] str	e.g. "0-3,8,10-11".  An empty string is an empty set.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_cpuset_from_str(fr_cpuset_t *out, char const *str)
+{
+	char const *p = str;
+
+	memset(out, 0, sizeof(*out));
+
+	while (isspace((uint8_t) *p)) p++;
+	if (!*p) return 0;
+
+	for (;;) {
+		unsigned int first, last, cpu;
+
+		if (cpuset_cpu_parse(&first, &p) < 0) return -1;
+
+		last = first;
+		if (*p == '-') {
+			p++;
+			if (cpuset_cpu_parse(&last, &p) < 0) return -1;
+
+			if (last < first) {
+				fr_strerror_printf("Invalid CPU range %u-%u", first, last);
+				return -1;
+			}
+		}
+
+		for (cpu = first; cpu <= last; cpu++) fr_cpuset_add(out, cpu);
+
+		if (!*p) break;
+
+		if (*p != ',') {
+			fr_strerror_printf("Unexpected text '%s' in CPU list", p);
+			return -1;
+		}
+		p++;
+	}
+
+	return 0;
+}
+
+/** Print a set in the same format as fr_cpuset_from_str() accepts
+ *
+ * @param[out] out	Where to write the string.  Always '\\0' terminated.
+ * @param[in] outlen	Length of the output buffer.
+ * @param[in] set	to print.
+ * @return the length of the string, which is truncated if it didn't fit.
+ */
+size_t fr_cpuset_snprint(char *out, size_t outlen, fr_cpuset_t const *set)
+{
+	unsigned int	cpu = 0;
+	size_t		len = 0;
+
+	if (!outlen) return 0;
+	*out = '\0';
+
+	while (cpu < FR_CPUSET_MAX) {
+		unsigned int	last;
+		int		ret;
+
+		if (!fr_cpuset_isset(set, cpu)) {
+			cpu++;
+			continue;
+		}
+
+		for (last = cpu; (last + 1 < FR_CPUSET_MAX) && fr_cpuset_isset(set, last + 1); last++);
+
+		if (last == cpu) {
+			ret = snprintf(out + len, outlen - len, "%s%u", len ? "," : "", cpu);
+		} else {
+			ret = snprintf(out + len, outlen - len, "%s%u-%u", len ? "," : "", cpu, last);
+		}
+		if ((ret < 0) || ((size_t) ret >= (outlen - len))) {
+			out[outlen - 1] = '\0';
+			return outlen - 1;
+		}
+		len += ret;
+
+		cpu = last + 1;
+	}
+
+	return len;
+}
+
+#ifdef __linux__
+/** Get the CPUs the current thread may run on
+ *
+ * @param[out] out	Where to write the set.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_cpuset_thread_get(fr_cpuset_t *out)
+{
+	cpu_set_t	cs;
+	unsigned int	cpu;
+
+	CPU_ZERO(&cs);
+	if (sched_getaffinity(0, sizeof(cs), &cs) < 0) {
+		fr_strerror_printf("Failed getting CPU affinity: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	memset(out, 0, sizeof(*out));
+	for (cpu = 0; (cpu < CPU_SETSIZE) && (cpu < FR_CPUSET_MAX); cpu++) {
+		if (CPU_ISSET(cpu, &cs)) fr_cpuset_add(out, cpu);
+	}
+
+	return 0;
+}
+
+/** Restrict the current thread to a set of CPUs
+ *
+ * @param[in] set	of CPUs the thread may run on.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_cpuset_thread_set(fr_cpuset_t const *set)
+{
+	cpu_set_t	cs;
+	unsigned int	cpu;
+
+	CPU_ZERO(&cs);
+	for (cpu = 0; (cpu < CPU_SETSIZE) && (cpu < FR_CPUSET_MAX); cpu++) {
+		if (fr_cpuset_isset(set, cpu)) CPU_SET(cpu, &cs);
+	}
+
+	if (sched_setaffinity(0, sizeof(cs), &cs) < 0) {
+		fr_strerror_printf("Failed setting CPU affinity: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Read a CPU list from a sysfs file
+ *
+ */
+static int cpuset_from_file(fr_cpuset_t *out, char const *path)
+{
+	FILE	*fp;
+	char	buffer[4096];
+	char	*p;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fr_strerror_printf("Failed opening %s: %s", path, fr_syserror(errno));
+		return -1;
+	}
+
+	if (!fgets(buffer, sizeof(buffer), fp)) {
+		fr_strerror_printf("Failed reading %s", path);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	p = strchr(buffer, '\n');
+	if (p) *p = '\0';
+
+	return fr_cpuset_from_str(out, buffer);
+}
+
+/** Return the number of NUMA node numbers
+ *
+ * Node numbers can have gaps, e.g. if a node was taken offline.  The
+ * result is the highest online node plus one, and nodes in the gaps
+ * have no CPUs.
+ *
+ * @return the number of nodes, which is 1 if the system isn't NUMA.
+ */
+unsigned int fr_cpuset_numa_nodes(void)
+{
+	fr_cpuset_t	nodes;
+	unsigned int	count;
+
+	/*
+	 *	The list of nodes is in the same format as a list
+	 *	of CPUs.
+	 */
+	if (cpuset_from_file(&nodes, "/sys/devices/system/node/online") < 0) return 1;
+
+	count = fr_cpuset_count(&nodes);
+	if (!count) return 1;
+
+	return fr_cpuset_nth(&nodes, count - 1) + 1;
+}
+
+/** Get the CPUs which belong to a NUMA node
+ *
+ * @param[out] out	Where to write the set.
+ * @param[in] node	to get the CPUs of.  If there is no such node,
+ *			the set is empty.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_cpuset_numa_node(fr_cpuset_t *out, unsigned int node)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+
+	/*
+	 *	Not a NUMA system, or no NUMA support in the
+	 *	kernel.  Everything is on node 0.
+	 */
+	if ((node == 0) && (access(path, F_OK) < 0)) {
+		if (cpuset_from_file(out, "/sys/devices/system/cpu/online") == 0) return 0;
+
+		return fr_cpuset_thread_get(out);
+	}
+
+	if (access(path, F_OK) < 0) {
+		memset(out, 0, sizeof(*out));
+		return 0;
+	}
+
+	return cpuset_from_file(out, path);
+}
+#else
+int fr_cpuset_thread_get(UNUSED fr_cpuset_t *out)
+{
+	fr_strerror_const("CPU affinity is not supported on this platform");
+	return -1;
+}
+
+int fr_cpuset_thread_set(UNUSED fr_cpuset_t const *set)
+{
+	fr_strerror_const("CPU affinity is not supported on this platform");
+	return -1;
+}
+
+unsigned int fr_cpuset_numa_nodes(void)
+{
+	return 1;
+}
+
+int fr_cpuset_numa_node(UNUSED fr_cpuset_t *out, UNUSED unsigned int node)
+{
+	fr_strerror_const("NUMA topology is not available on this platform");
+	return -1;
+}
+#endif
+
+/** Find the NUMA node which all of the CPUs in a set belong to
+ *
+ * @param[in] set	of CPUs.
+ * @return
+ *	- The node number.
+ *	- -1 if the set is empty, spans nodes, or the topology is unknown.
+ */
+int fr_cpuset_numa_node_of(fr_cpuset_t const *set)
+{
+	unsigned int	node, num_nodes = fr_cpuset_numa_nodes();
+	unsigned int	count = fr_cpuset_count(set);
+
+	if (!count) return -1;
+
+	for (node = 0; node < num_nodes; node++) {
+		fr_cpuset_t node_set;
+
+		if (fr_cpuset_numa_node(&node_set, node) < 0) return -1;
+
+		fr_cpuset_and(&node_set, &node_set, set);
+		if (fr_cpuset_count(&node_set) == count) return node;
+	}
+
+	return -1;
+}
@@ -0,0 +1,88 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Sets of CPUs, thread affinity, and NUMA topology
+ *
+ * CPU sets are written the same way as the kernel writes them, e.g.
+ * "0-3,8,10-11".
+ *
+ * @file src/lib/util/cpuset.h
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+RCSIDH(cpuset_h, "$Id$")
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FR_CPUSET_MAX	(1024)		//!< Highest CPU number which can be represented, plus one.
+
+/** A set of CPUs
+ *
+ */
+typedef struct {
+	uint64_t	bits[FR_CPUSET_MAX / 64];
+} fr_cpuset_t;
+
+/** Add a CPU to a set
+ *
+ */
+static inline void fr_cpuset_add(fr_cpuset_t *set, unsigned int cpu)
+{
+	if (cpu >= FR_CPUSET_MAX) return;
+
+	set->bits[cpu / 64] |= ((uint64_t) 1) << (cpu % 64);
+}
+
+/** Check whether a CPU is in a set
+ *
+ */
+static inline bool fr_cpuset_isset(fr_cpuset_t const *set, unsigned int cpu)
+{
+	if (cpu >= FR_CPUSET_MAX) return false;
+
+	return ((set->bits[cpu / 64] & (((uint64_t) 1) << (cpu % 64))) != 0);
+}
+
+unsigned int	fr_cpuset_count(fr_cpuset_t const *set) CC_HINT(nonnull);
+
+void		fr_cpuset_and(fr_cpuset_t *out, fr_cpuset_t const *a, fr_cpuset_t const *b) CC_HINT(nonnull);
+
+int		fr_cpuset_nth(fr_cpuset_t const *set, unsigned int n) CC_HINT(nonnull);
+
+int		fr_cpuset_from_str(fr_cpuset_t *out, char const *str) CC_HINT(nonnull);
+
+size_t		fr_cpuset_snprint(char *out, size_t outlen, fr_cpuset_t const *set) CC_HINT(nonnull);
+
+int		fr_cpuset_thread_get(fr_cpuset_t *out) CC_HINT(nonnull);
+
+int		fr_cpuset_thread_set(fr_cpuset_t const *set) CC_HINT(nonnull);
+
+unsigned int	fr_cpuset_numa_nodes(void);
+
+int		fr_cpuset_numa_node(fr_cpuset_t *out, unsigned int node) CC_HINT(nonnull);
+
+int		fr_cpuset_numa_node_of(fr_cpuset_t const *set) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
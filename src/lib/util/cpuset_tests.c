@@ -0,0 +1,119 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for CPU sets
+ *
+ * @file src/lib/util/cpuset_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "cpuset.h"
+
+static void test_parse(void)
+{
+	fr_cpuset_t	set;
+	char		buffer[64];
+
+	TEST_CASE("Single CPUs and ranges");
+	TEST_CHECK(fr_cpuset_from_str(&set, "0-3,8, 10 - 11") == 0);
+	TEST_CHECK(fr_cpuset_count(&set) == 7);
+	TEST_CHECK(fr_cpuset_isset(&set, 3));
+	TEST_CHECK(!fr_cpuset_isset(&set, 4));
+	TEST_CHECK(fr_cpuset_isset(&set, 11));
+
+	TEST_CASE("Printing merges adjacent CPUs");
+	TEST_CHECK(fr_cpuset_snprint(buffer, sizeof(buffer), &set) == strlen("0-3,8,10-11"));
+	TEST_CHECK(strcmp(buffer, "0-3,8,10-11") == 0);
+	TEST_MSG("Got '%s'", buffer);
+
+	TEST_CASE("Empty string is an empty set");
+	TEST_CHECK(fr_cpuset_from_str(&set, "") == 0);
+	TEST_CHECK(fr_cpuset_count(&set) == 0);
+	TEST_CHECK(fr_cpuset_nth(&set, 0) == -1);
+	TEST_CHECK(fr_cpuset_snprint(buffer, sizeof(buffer), &set) == 0);
+
+	TEST_CASE("Invalid lists are rejected");
+	TEST_CHECK(fr_cpuset_from_str(&set, "3-1") < 0);
+	TEST_CHECK(fr_cpuset_from_str(&set, "1,") < 0);
+	TEST_CHECK(fr_cpuset_from_str(&set, "1;2") < 0);
+	TEST_CHECK(fr_cpuset_from_str(&set, "-1") < 0);
+	TEST_CHECK(fr_cpuset_from_str(&set, "100000") < 0);
+
+	TEST_CASE("Truncated output is terminated");
+	TEST_CHECK(fr_cpuset_from_str(&set, "0,2,4,6,8") == 0);
+	TEST_CHECK(fr_cpuset_snprint(buffer, 5, &set) == 4);
+	TEST_CHECK(strlen(buffer) == 4);
+}
+
+static void test_ops(void)
+{
+	fr_cpuset_t a, b;
+
+	TEST_CHECK(fr_cpuset_from_str(&a, "0-7") == 0);
+	TEST_CHECK(fr_cpuset_from_str(&b, "4-11") == 0);
+
+	TEST_CASE("Intersection");
+	fr_cpuset_and(&a, &a, &b);
+	TEST_CHECK(fr_cpuset_count(&a) == 4);
+
+	TEST_CASE("nth wraps around");
+	TEST_CHECK(fr_cpuset_nth(&a, 0) == 4);
+	TEST_CHECK(fr_cpuset_nth(&a, 3) == 7);
+	TEST_CHECK(fr_cpuset_nth(&a, 5) == 5);
+}
+
+static void test_thread(void)
+{
+	fr_cpuset_t	set, check;
+	int		cpu;
+
+	if (fr_cpuset_thread_get(&set) < 0) {
+		TEST_MSG("No CPU affinity support, skipping");
+		return;
+	}
+	TEST_CHECK(fr_cpuset_count(&set) > 0);
+
+	TEST_CASE("Binding to one CPU");
+	cpu = fr_cpuset_nth(&set, 0);
+	TEST_CHECK(fr_cpuset_from_str(&check, "") == 0);
+	fr_cpuset_add(&check, cpu);
+	TEST_CHECK(fr_cpuset_thread_set(&check) == 0);
+	TEST_CHECK(fr_cpuset_thread_get(&check) == 0);
+	TEST_CHECK(fr_cpuset_count(&check) == 1);
+	TEST_CHECK(fr_cpuset_isset(&check, cpu));
+
+	TEST_CASE("Every CPU is on a NUMA node");
+	TEST_CHECK(fr_cpuset_numa_nodes() >= 1);
+	TEST_CHECK(fr_cpuset_numa_node_of(&check) >= 0);
+
+	TEST_CASE("Nodes which don't exist have no CPUs");
+	TEST_CHECK(fr_cpuset_numa_node(&check, FR_CPUSET_MAX - 1) == 0);
+	TEST_CHECK(fr_cpuset_count(&check) == 0);
+
+	TEST_CHECK(fr_cpuset_thread_set(&set) == 0);
+}
+
+TEST_LIST = {
+	{ "cpuset_parse",	test_parse	},
+	{ "cpuset_ops",		test_ops	},
+	{ "cpuset_thread",	test_thread	},
+
+	{ NULL }
+};
@@ -35,6 +35,7 @@ extern "C" {
 #include <freeradius-devel/util/sbuff.h>
 #include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/types.h>
 
 #include <stdbool.h>
@@ -353,6 +354,22 @@ typedef struct {
 	fr_dict_attr_encode_func_t encode;			//!< for encoding attributes
 } fr_dict_protocol_t;
 
+/** Where time was spent loading a dictionary
+ *
+ * Time is attributed exclusively.  If loading one dictionary causes another
+ * to be loaded (via a ref=, or $INCLUDE), the time spent in the other dictionary
+ * is recorded against that dictionary, and not the one which referenced it.
+ */
+typedef struct {
+	unsigned int		files;				//!< Dictionary files read.
+	unsigned int		lines;				//!< Definitions processed.
+
+	fr_time_delta_t		read;				//!< Opening, reading and tokenizing files.
+	fr_time_delta_t		define;				//!< Creating attributes, values, vendors etc...
+	fr_time_delta_t		fixup;				//!< Resolving forward references, clones and enums.
+	fr_time_delta_t		init;				//!< Initialising the protocol library.
+} fr_dict_load_stats_t;
+
 typedef struct fr_dict_gctx_s fr_dict_gctx_t;
 
 /*
@@ -658,6 +675,8 @@ int			fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name, char
 fr_dict_t		*fr_dict_protocol_alloc(fr_dict_t const *parent);
 
 int			fr_dict_read(fr_dict_t *dict, char const *dict_dir, char const *filename);
+
+fr_dict_load_stats_t const *fr_dict_load_stats(fr_dict_t const *dict) CC_HINT(nonnull);
 /** @} */
 
 /** @name Autoloader interface
@@ -707,13 +726,15 @@ fr_dict_gctx_t		*fr_dict_global_ctx_init(TALLOC_CTX *ctx, bool free_at_exit, cha
 
 void			fr_dict_global_ctx_perm_check(fr_dict_gctx_t *gctx, bool enable);
 
+void			fr_dict_global_ctx_lazy_vendors(fr_dict_gctx_t *gctx, bool enable);
+
 void			fr_dict_global_ctx_set(fr_dict_gctx_t const *gctx);
 
 int			fr_dict_global_ctx_free(fr_dict_gctx_t const *gctx);
 
 int			fr_dict_global_ctx_dir_set(char const *dict_dir);
 
-void			fr_dict_global_ctx_read_only(void);
+int			fr_dict_global_ctx_read_only(void);
 
 void			fr_dict_global_ctx_debug(fr_dict_gctx_t const *gctx);
 
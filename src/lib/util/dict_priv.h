@@ -114,6 +114,10 @@ struct fr_dict {
 	fr_dict_attr_t		**fixups;		//!< Attributes that need fixing up.
 
 	fr_rb_tree_t		*dependents;		//!< Which files are using this dictionary.
+
+	fr_dict_load_stats_t	load_stats;		//!< Where time was spent loading this dictionary.
+
+	fr_hash_table_t		*deferred_vendors;	//!< Vendors whose definitions haven't been read yet.
 };
 
 struct fr_dict_gctx_s {
@@ -124,6 +128,9 @@ struct fr_dict_gctx_s {
 
 	bool			read_only;
 
+	bool			lazy_vendors;		//!< Defer reading BEGIN-VENDOR blocks until the
+							///< vendor's attributes are first looked up.
+
 	char			*dict_dir_default;	//!< The default location for loading dictionaries if one
 							///< wasn't provided.
 
@@ -157,6 +164,20 @@ int			dict_dependent_remove(fr_dict_t *dict, char const *dependent);
 
 fr_dict_t		*dict_alloc(TALLOC_CTX *ctx);
 
+int			dict_vendor_deferred_load(fr_dict_attr_t const *vendor_da);
+
+int			dict_vendor_deferred_load_all(fr_dict_t *dict);
+
+/** Whether a vendor may have definitions which haven't been read yet
+ *
+ * Cheap enough to call whenever a lookup below a vendor fails.
+ */
+static inline bool dict_vendor_is_deferred(fr_dict_attr_t const *da)
+{
+	return (da->type == FR_TYPE_VENDOR) && da->dict && da->dict->deferred_vendors &&
+	       (fr_hash_table_num_elements(da->dict->deferred_vendors) > 0);
+}
+
 int			dict_dlopen(fr_dict_t *dict, char const *name);
 
 fr_dict_attr_t 		*dict_attr_alloc_null(TALLOC_CTX *ctx);
@@ -69,10 +69,74 @@ typedef struct {
 	fr_dict_attr_t const   	*relative_attr;		//!< for ".82" instead of "1.2.3.82".
 							///< only for parents of type "tlv"
 	dict_fixup_ctx_t	fixup;
+
+	struct {
+		fr_dict_attr_t const	*vendor_da;	//!< Vendor whose deferred block we're reading.
+		long			offset;		//!< Where the block starts in the file.
+		int			line;		//!< Line number of the BEGIN-VENDOR statement.
+	} resume;					//!< Set when reading a deferred BEGIN-VENDOR block.
 } dict_tokenize_ctx_t;
 
+/** A BEGIN-VENDOR block which hasn't been read yet
+ *
+ */
+typedef struct dict_deferred_block_s dict_deferred_block_t;
+struct dict_deferred_block_s {
+	char const		*filename;		//!< File containing the block.
+	long			offset;			//!< Offset of the line after BEGIN-VENDOR.
+	int			line;			//!< Line number of BEGIN-VENDOR.
+	dict_deferred_block_t	*next;			//!< Next block for the same vendor.
+};
+
+/** A vendor whose definitions will be read on first reference
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*vendor_da;		//!< Vendor the blocks define attributes for.
+	dict_deferred_block_t	*head;			//!< Blocks in the order they appeared.
+	dict_deferred_block_t	**tail;			//!< Where to append the next block.
+} dict_deferred_vendor_t;
+
 #define CURRENT_FRAME(_dctx)	(&(_dctx)->stack[(_dctx)->stack_depth])
 
+/*
+ *	Loads nest (a ref= can pull in another protocol part way
+ *	through a file), so rather than timing each phase with a
+ *	start/stop pair, we keep a single checkpoint, and charge
+ *	the time since the last checkpoint to whichever dictionary
+ *	and phase is current.
+ *
+ *	Deferred vendor blocks are read by whichever thread first
+ *	looks up one of the vendor's attributes, so the checkpoint
+ *	is per thread.  One thread's load can then never be charged
+ *	with time spent by another.
+ */
+static _Thread_local unsigned int	dict_load_depth;	//!< How many loads are in progress.
+static _Thread_local fr_time_t		dict_load_checkpoint;	//!< When time was last charged to a phase.
+
+static inline void dict_load_enter(void)
+{
+	if (dict_load_depth++ == 0) dict_load_checkpoint = fr_time();
+}
+
+static inline void dict_load_exit(void)
+{
+	fr_assert(dict_load_depth > 0);
+	dict_load_depth--;
+}
+
+/** Charge the time elapsed since the last checkpoint to a load phase
+ *
+ * @param[in] phase	to add the elapsed time to.
+ */
+static inline void dict_load_charge(fr_time_delta_t *phase)
+{
+	fr_time_t now = fr_time();
+
+	*phase = fr_time_delta_add(*phase, fr_time_sub(now, dict_load_checkpoint));
+	dict_load_checkpoint = now;
+}
+
 /*
  *	String split routine.  Splits an input string IN PLACE
  *	into pieces, based on spaces.
@@ -1994,9 +2058,241 @@ static int dict_read_process_vendor(fr_dict_t *dict, char **argv, int argc)
 	return 0;
 }
 
+static uint32_t dict_deferred_vendor_hash(void const *data)
+{
+	dict_deferred_vendor_t const *dv = data;
+
+	return fr_hash(&dv->vendor_da, sizeof(dv->vendor_da));
+}
+
+static int8_t dict_deferred_vendor_cmp(void const *one, void const *two)
+{
+	dict_deferred_vendor_t const *a = one, *b = two;
+
+	return CMP(a->vendor_da, b->vendor_da);
+}
+
+/** Check whether a BEGIN-VENDOR block can be read later, and skip over it if it can
+ *
+ * A block can only be deferred if everything in it is local to the vendor.
+ * Statements which change the dictionary outside of the vendor, or the state
+ * of the parser (new vendors, protocols, includes, flags) mean the block must
+ * be processed now.
+ *
+ * @param[in] ctx	Current parser state.
+ * @param[in] fp	Positioned at the line after BEGIN-VENDOR.  On return it's either
+ *			after the matching END-VENDOR (block deferred), or where it was
+ *			when we were called.
+ * @param[in] fn	Name of the file being read.
+ * @param[in,out] line	Line number of the BEGIN-VENDOR statement.  Updated to the
+ *			line of the END-VENDOR if the block was deferred.
+ * @param[in] vendor_da	The block defines attributes for.
+ * @return
+ *	- 1 if the block was deferred.
+ *	- 0 if the block should be processed now.
+ *	- -1 on error.
+ */
+static int dict_vendor_defer(dict_tokenize_ctx_t *ctx, FILE *fp, char const *fn, int *line,
+			     fr_dict_attr_t const *vendor_da)
+{
+	long			offset;
+	int			end_line = *line;
+	char			buf[256];
+	char			*argv[MAX_ARGV];
+	int			argc;
+	char			*p;
+	dict_deferred_vendor_t	*dv;
+	dict_deferred_block_t	*block;
+
+	offset = ftell(fp);
+	if (offset < 0) return 0;
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		end_line++;
+
+		p = strchr(buf, '#');
+		if (p) *p = '\0';
+
+		argc = fr_dict_str_to_argv(buf, argv, MAX_ARGV);
+		if (argc == 0) continue;
+
+		if (strcasecmp(argv[0], "END-VENDOR") == 0) {
+			if ((argc != 2) || (strcasecmp(argv[1], vendor_da->name) != 0)) break;
+			goto defer;
+		}
+
+		if ((strcasecmp(argv[0], "ATTRIBUTE") != 0) &&
+		    (strcasecmp(argv[0], "VALUE") != 0) &&
+		    (strcasecmp(argv[0], "MEMBER") != 0) &&
+		    (strcasecmp(argv[0], "STRUCT") != 0) &&
+		    (strcasecmp(argv[0], "DEFINE") != 0) &&
+		    (strcasecmp(argv[0], "BEGIN-TLV") != 0) &&
+		    (strcasecmp(argv[0], "END-TLV") != 0)) break;
+	}
+
+	/*
+	 *	Not self-contained, or not terminated.  Let the
+	 *	normal parser deal with it, and produce any errors.
+	 */
+	if (fseek(fp, offset, SEEK_SET) < 0) {
+		fr_strerror_printf("Failed rewinding dictionary \"%s\": %s", fn, fr_syserror(errno));
+		return -1;
+	}
+	return 0;
+
+defer:
+	if (!ctx->dict->deferred_vendors) {
+		ctx->dict->deferred_vendors = fr_hash_table_talloc_alloc(ctx->dict, dict_deferred_vendor_t,
+									 dict_deferred_vendor_hash,
+									 dict_deferred_vendor_cmp, NULL);
+		if (!ctx->dict->deferred_vendors) {
+		oom:
+			fr_strerror_const("Out of memory");
+			return -1;
+		}
+	}
+
+	dv = fr_hash_table_find(ctx->dict->deferred_vendors, &(dict_deferred_vendor_t){ .vendor_da = vendor_da });
+	if (!dv) {
+		dv = talloc_zero(ctx->dict->deferred_vendors, dict_deferred_vendor_t);
+		if (!dv) goto oom;
+
+		dv->vendor_da = vendor_da;
+		dv->tail = &dv->head;
+
+		if (!fr_hash_table_insert(ctx->dict->deferred_vendors, dv)) {
+			talloc_free(dv);
+			fr_strerror_const("Failed recording deferred vendor");
+			return -1;
+		}
+	}
+
+	block = talloc_zero(dv, dict_deferred_block_t);
+	if (!block) goto oom;
+
+	block->filename = talloc_strdup(block, fn);
+	if (!block->filename) goto oom;
+	block->offset = offset;
+	block->line = *line;
+
+	*dv->tail = block;
+	dv->tail = &block->next;
+
+	*line = end_line;
+
+	return 1;
+}
+
+static int dict_finalise(dict_tokenize_ctx_t *ctx);
+
+/** Read one deferred BEGIN-VENDOR block
+ *
+ */
+static int dict_vendor_deferred_block_read(fr_dict_t *dict, fr_dict_attr_t const *vendor_da,
+					   dict_deferred_block_t const *block)
+{
+	dict_tokenize_ctx_t	ctx;
+	int			ret;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.dict = dict;
+	dict_fixup_init(NULL, &ctx.fixup);
+	ctx.stack[0].dict = dict;
+	ctx.stack[0].da = dict->root;
+	ctx.stack[0].nest = NEST_ROOT;
+	ctx.stack[1].dict = dict;
+	ctx.stack[1].da = vendor_da;
+	ctx.stack[1].nest = NEST_VENDOR;
+	ctx.stack_depth = 1;
+
+	ctx.resume.vendor_da = vendor_da;
+	ctx.resume.offset = block->offset;
+	ctx.resume.line = block->line;
+
+	dict_load_enter();
+	ret = _dict_from_file(&ctx, ".", block->filename, NULL, 0);
+	if (ret < 0) {
+		talloc_free(ctx.fixup.pool);
+		dict_load_exit();
+		return ret;
+	}
+
+	ret = dict_finalise(&ctx);
+	dict_load_exit();
+
+	return ret;
+}
+
+/** Read the deferred definitions for a vendor
+ *
+ * @param[in] vendor_da	to read definitions for.
+ * @return
+ *	- 1 if definitions were read.
+ *	- 0 if there was nothing to read.
+ *	- -1 on error.
+ */
+int dict_vendor_deferred_load(fr_dict_attr_t const *vendor_da)
+{
+	fr_dict_t		*dict = fr_dict_unconst(vendor_da->dict);
+	dict_deferred_vendor_t	*dv;
+	dict_deferred_block_t	*block;
+
+	if (!dict->deferred_vendors || dict->read_only) return 0;
+
+	dv = fr_hash_table_find(dict->deferred_vendors, &(dict_deferred_vendor_t){ .vendor_da = vendor_da });
+	if (!dv) return 0;
+
+	/*
+	 *	Remove it first.  Reading the blocks looks up
+	 *	attributes below the vendor, which mustn't cause
+	 *	the same blocks to be read again.
+	 */
+	(void) fr_hash_table_remove(dict->deferred_vendors, dv);
+
+	for (block = dv->head; block; block = block->next) {
+		if (dict_vendor_deferred_block_read(dict, vendor_da, block) < 0) {
+			fr_strerror_printf_push("Failed reading definitions for vendor %s", vendor_da->name);
+			talloc_free(dv);
+			return -1;
+		}
+	}
+	talloc_free(dv);
+
+	return 1;
+}
+
+/** Read the deferred definitions for every vendor in a dictionary
+ *
+ * @param[in] dict	to read definitions for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int dict_vendor_deferred_load_all(fr_dict_t *dict)
+{
+	fr_hash_iter_t		iter;
+	dict_deferred_vendor_t	*dv;
+
+	if (!dict->deferred_vendors) return 0;
+
+	/*
+	 *	Loading removes the entry, so always restart
+	 *	from the beginning of the table.
+	 */
+	while ((dv = fr_hash_table_iter_init(dict->deferred_vendors, &iter))) {
+		if (dict_vendor_deferred_load(dv->vendor_da) < 0) return -1;
+	}
+
+	TALLOC_FREE(dict->deferred_vendors);
+
+	return 0;
+}
+
 static int dict_finalise(dict_tokenize_ctx_t *ctx)
 {
+	dict_load_charge(&ctx->dict->load_stats.define);
 	if (dict_fixup_apply(&ctx->fixup) < 0) return -1;
+	dict_load_charge(&ctx->dict->load_stats.fixup);
 
 	ctx->value_attr = NULL;
 	ctx->relative_attr = NULL;
@@ -2130,9 +2426,32 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 
 	memset(&base_flags, 0, sizeof(base_flags));
 
-	while (fgets(buf, sizeof(buf), fp) != NULL) {
+	/*
+	 *	Reading a deferred BEGIN-VENDOR block, start
+	 *	from the line after the BEGIN-VENDOR.
+	 */
+	if (ctx->resume.offset) {
+		if (fseek(fp, ctx->resume.offset, SEEK_SET) < 0) {
+			fr_strerror_printf_push("Failed seeking in dictionary \"%s\" - %s", fn, fr_syserror(errno));
+			goto perm_error;
+		}
+		line = ctx->resume.line;
+		ctx->resume.offset = 0;
+	}
+
+	ctx->dict->load_stats.files++;
+
+	for (;;) {
 		dict_tokenize_frame_t const *frame;
 
+		/*
+		 *	Anything since the last checkpoint was
+		 *	spent acting on the previous line.
+		 */
+		dict_load_charge(&ctx->dict->load_stats.define);
+
+		if (!fgets(buf, sizeof(buf), fp)) break;
+
 		ctx->stack[ctx->stack_depth].line = ++line;
 
 		switch (buf[0]) {
@@ -2151,8 +2470,11 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 		if (p) *p = '\0';
 
 		argc = fr_dict_str_to_argv(buf, argv, MAX_ARGV);
+		dict_load_charge(&ctx->dict->load_stats.read);
 		if (argc == 0) continue;
 
+		ctx->dict->load_stats.lines++;
+
 		if (argc == 1) {
 			fr_strerror_const("Invalid entry");
 
@@ -2643,6 +2965,25 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 				fr_assert(vendor_da->type == FR_TYPE_VENDOR);
 			}
 
+			/*
+			 *	Index the block and skip over it.  The
+			 *	attributes are created when something
+			 *	first looks below the vendor.
+			 */
+			if (dict_gctx->lazy_vendors && !ctx->dict->read_only && !base_flags.internal) {
+				switch (dict_vendor_defer(ctx, fp, fn, &line, vendor_da)) {
+				case 1:
+					ctx->relative_attr = NULL;
+					continue;
+
+				case 0:
+					break;
+
+				default:
+					goto error;
+				}
+			}
+
 			if (dict_gctx_push(ctx, vendor_da) < 0) goto error;
 			ctx->stack[ctx->stack_depth].nest = NEST_VENDOR;
 			continue;
@@ -2687,6 +3028,11 @@ static int _dict_from_file(dict_tokenize_ctx_t *ctx,
 			}
 
 			ctx->stack_depth--;
+
+			/*
+			 *	We were only asked to read this block.
+			 */
+			if (ctx->resume.vendor_da && (ctx->stack_depth == 0)) break;
 			continue;
 		} /* END-VENDOR */
 
@@ -2722,9 +3068,11 @@ static int dict_from_file(fr_dict_t *dict,
 	ctx.stack[0].da = dict->root;
 	ctx.stack[0].nest = NEST_ROOT;
 
+	dict_load_enter();
 	ret = _dict_from_file(&ctx, dir_name, filename, src_file, src_line);
 	if (ret < 0) {
 		talloc_free(ctx.fixup.pool);
+		dict_load_exit();
 		return ret;
 	}
 
@@ -2735,7 +3083,10 @@ static int dict_from_file(fr_dict_t *dict,
 	 *	Fixups should have been applied already to any protocol
 	 *	dictionaries.
 	 */
-	return dict_finalise(&ctx);
+	ret = dict_finalise(&ctx);
+	dict_load_exit();
+
+	return ret;
 }
 
 /** (Re-)Initialize the special internal dictionary
@@ -2976,7 +3327,15 @@ int fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name, char co
 	 */
 	dict->loaded = true;
 	if (dict->proto && dict->proto->init) {
-		if (dict->proto->init() < 0) goto error;
+		int ret;
+
+		dict_load_enter();
+		dict_load_charge(&dict->load_stats.define);
+		ret = dict->proto->init();
+		dict_load_charge(&dict->load_stats.init);
+		dict_load_exit();
+
+		if (ret < 0) goto error;
 	}
 	dict->loading = false;
 
@@ -3051,6 +3410,16 @@ int fr_dict_read(fr_dict_t *dict, char const *dir, char const *filename)
 	return dict_from_file(dict, dir, filename, NULL, 0);
 }
 
+/** Return where time was spent loading a dictionary
+ *
+ * @param[in] dict	to return load statistics for.
+ * @return load statistics for the dictionary.
+ */
+fr_dict_load_stats_t const *fr_dict_load_stats(fr_dict_t const *dict)
+{
+	return &dict->load_stats;
+}
+
 /*
  *	External API for testing
  */
@@ -3076,11 +3445,14 @@ int fr_dict_parse_str(fr_dict_t *dict, char *buf, fr_dict_attr_t const *parent)
 
 	if (dict_fixup_init(NULL, &ctx.fixup) < 0) return -1;
 
+	dict_load_enter();
+
 	if (strcasecmp(argv[0], "VALUE") == 0) {
 		if (argc < 4) {
 			fr_strerror_printf("VALUE needs at least 4 arguments, got %i", argc);
 		error:
 			TALLOC_FREE(ctx.fixup.pool);
+			dict_load_exit();
 			return -1;
 		}
 
@@ -3108,5 +3480,8 @@ int fr_dict_parse_str(fr_dict_t *dict, char *buf, fr_dict_attr_t const *parent)
 		goto error;
 	}
 
-	return dict_finalise(&ctx);
+	ret = dict_finalise(&ctx);
+	dict_load_exit();
+
+	return ret;
 }
@@ -2784,6 +2784,21 @@ redo:
 
 	da = fr_hash_table_find(namespace, &(fr_dict_attr_t){ .name = buffer });
 	if (!da) {
+		if (dict_vendor_is_deferred(parent)) {
+			switch (dict_vendor_deferred_load(parent)) {
+			case 1:
+				goto redo;
+
+			case 0:
+				break;
+
+			default:
+				if (err) *err = FR_DICT_ATTR_INTERNAL_ERROR;
+				fr_sbuff_set_to_start(&our_name);
+				FR_SBUFF_ERROR_RETURN(&our_name);
+			}
+		}
+
 		if (parent->flags.is_root) {
 			fr_dict_t const *dict = fr_dict_by_da(parent);
 
@@ -2828,6 +2843,20 @@ redo:
 
 	da = fr_hash_table_find(namespace, &(fr_dict_attr_t) { .name = name });
 	if (!da) {
+		if (dict_vendor_is_deferred(parent)) {
+			switch (dict_vendor_deferred_load(parent)) {
+			case 1:
+				goto redo;
+
+			case 0:
+				break;
+
+			default:
+				if (err) *err = FR_DICT_ATTR_INTERNAL_ERROR;
+				return NULL;
+			}
+		}
+
 		if (parent->flags.is_root) {
 			fr_dict_t const *dict = fr_dict_by_da(parent);
 
@@ -2889,18 +2918,28 @@ fr_dict_attr_t *dict_attr_child_by_num(fr_dict_attr_t const *parent, unsigned in
 	ref = fr_dict_attr_ref(parent);
 	if (ref) parent = ref;
 
+redo:
 	children = dict_attr_children(parent);
-	if (!children) return NULL;
+	if (!children) goto not_found;
 
 	/*
 	 *	Child arrays may be trimmed back to save memory.
 	 *	Check that so we don't SEGV.
 	 */
-	if ((attr & 0xff) > talloc_array_length(children)) return NULL;
+	if ((attr & 0xff) > talloc_array_length(children)) goto not_found;
 
 	bin = children[attr & 0xff];
 	for (;;) {
-		if (!bin) return NULL;
+		if (!bin) {
+		not_found:
+			/*
+			 *	The vendor's definitions may not have
+			 *	been read yet.  If they're read now,
+			 *	the child arrays will have changed.
+			 */
+			if (dict_vendor_is_deferred(parent) && (dict_vendor_deferred_load(parent) == 1)) goto redo;
+			return NULL;
+		}
 		if (bin->attr == attr) {
 			fr_dict_attr_t *out;
 
@@ -4040,6 +4079,26 @@ void fr_dict_global_ctx_perm_check(fr_dict_gctx_t *gctx, bool enable)
 	gctx->perm_check = enable;
 }
 
+/** Set whether vendor definitions are read on first reference
+ *
+ * When enabled, self-contained BEGIN-VENDOR blocks are indexed as dictionaries
+ * are loaded, but the attributes they define are only created when something
+ * looks up an attribute below that vendor.  Processes which only ever use a
+ * handful of vendors (radclient, radsniff, test programs) save the memory and
+ * time needed to build all the others.
+ *
+ * Any vendor definitions still outstanding are read when the dictionaries are
+ * marked read only with #fr_dict_global_ctx_read_only, so lookups from multiple
+ * threads after that point never modify the dictionaries.
+ *
+ * @param[in] gctx	to alter.
+ * @param[in] enable	Whether vendor blocks should be read lazily.
+ */
+void fr_dict_global_ctx_lazy_vendors(fr_dict_gctx_t *gctx, bool enable)
+{
+	gctx->lazy_vendors = enable;
+}
+
 /** Set a new, active, global dictionary context
  *
  * @param[in] gctx	To set.
@@ -4093,13 +4152,26 @@ char const *fr_dict_global_ctx_dir(void)
 /** Mark all dictionaries and the global dictionary ctx as read only
  *
  * Any attempts to add new attributes will now fail.
+ *
+ * Any vendor definitions which were deferred are read first, as lookups
+ * are no longer allowed to modify the dictionaries.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if deferred vendor definitions could not be read.
  */
-void fr_dict_global_ctx_read_only(void)
+int fr_dict_global_ctx_read_only(void)
 {
 	fr_hash_iter_t	iter;
 	fr_dict_t	*dict;
 
-	if (!dict_gctx) return;
+	if (!dict_gctx) return 0;
+
+	for (dict = fr_hash_table_iter_init(dict_gctx->protocol_by_num, &iter);
+	     dict;
+	     dict = fr_hash_table_iter_next(dict_gctx->protocol_by_num, &iter)) {
+		if (dict_vendor_deferred_load_all(dict) < 0) return -1;
+	}
 
 	/*
 	 *	Set everything to read only
@@ -4115,6 +4187,8 @@ void fr_dict_global_ctx_read_only(void)
 	dict_hash_tables_finalise(dict);
 	dict->read_only = true;
 	dict_gctx->read_only = true;
+
+	return 0;
 }
 
 /** Dump information about currently loaded dictionaries
@@ -4299,6 +4373,12 @@ fr_dict_attr_t const *fr_dict_attr_iterate_children(fr_dict_attr_t const *parent
 	ref = fr_dict_attr_ref(parent);
 	if (ref) parent = ref;
 
+	/*
+	 *	Iterating over a vendor's children is a good indication
+	 *	its definitions are needed.
+	 */
+	if (!*prev && dict_vendor_is_deferred(parent) && (dict_vendor_deferred_load(parent) < 0)) return NULL;
+
 	children = dict_attr_children(parent);
 	if (!children) return NULL;
 
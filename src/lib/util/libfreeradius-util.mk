@@ -18,6 +18,7 @@ SOURCES		:= \
 		   calc.c \
 		   cap.c \
 		   chap.c \
+		   cpuset.c \
 		   dbuff.c \
 		   debug.c \
 		   decode.c \
@@ -71,6 +72,7 @@ SOURCES		:= \
 		   proto.c \
 		   rand.c \
 		   rb.c \
+		   rcu.c \
 		   regex.c \
 		   retry.c \
 		   sbuff.c \
@@ -79,6 +81,7 @@ SOURCES		:= \
 		   size.c \
 		   snprintf.c \
 		   socket.c \
+		   socket_filter.c \
 		   stats.c \
 		   strerror.c \
 		   strlcat.c \
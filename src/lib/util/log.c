@@ -23,6 +23,7 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/log.h>
 #include <freeradius-devel/util/print.h>
 #include <freeradius-devel/util/sbuff.h>
@@ -62,6 +63,25 @@ bool fr_log_rate_limit = true;			//!< Whether repeated log entries should be rat
 static _Thread_local fr_log_type_t log_msg_type;//!< The type of the last message logged.
 						///< Mainly uses for syslog.
 
+/** A log message held back until its capture is flushed
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the list of captured messages.
+	fr_log_t const		*log;		//!< Destination the message was sent to.
+	fr_log_type_t		type;		//!< Type of log message.
+	char const		*file;		//!< src file the message was generated in.
+	int			line;		//!< src line the message was generated on.
+	char			*msg;		//!< Expanded message.
+} fr_log_captured_t;
+
+struct fr_log_capture_s {
+	fr_dlist_head_t		msgs;		//!< Captured messages, in the order they were logged.
+};
+
+static _Thread_local fr_log_capture_t *log_capture;	//!< Where messages logged by this thread go
+							///< instead of their destination.
+
 /** Canonicalize error strings, removing tabs, and generate spaces for error marker
  *
  * @note talloc_free must be called on the buffer returned in spaces and text
@@ -331,6 +351,64 @@ TALLOC_CTX *fr_log_pool_init(void)
 	return pool;
 }
 
+/** Allocate a buffer for capturing log messages
+ *
+ * @param[in] ctx	to allocate the capture in.
+ * @return
+ *	- A new log capture.
+ *	- NULL on failure.
+ */
+fr_log_capture_t *fr_log_capture_alloc(TALLOC_CTX *ctx)
+{
+	fr_log_capture_t *lc;
+
+	lc = talloc_zero(ctx, fr_log_capture_t);
+	if (unlikely(!lc)) return NULL;
+	fr_dlist_talloc_init(&lc->msgs, fr_log_captured_t, entry);
+
+	return lc;
+}
+
+/** Redirect all messages logged by the current thread into a capture
+ *
+ * This is used when work which would normally be done serially is spread
+ * over multiple threads, so that the log output can be replayed in a
+ * deterministic order once the work is complete.
+ *
+ * @param[in] lc	to add messages to.
+ */
+void fr_log_capture_start(fr_log_capture_t *lc)
+{
+	log_capture = lc;
+}
+
+/** Stop capturing messages logged by the current thread
+ *
+ */
+void fr_log_capture_stop(void)
+{
+	log_capture = NULL;
+}
+
+/** Send all captured messages to their original destinations
+ *
+ * Messages are logged in the order they were captured, and removed from
+ * the capture.
+ *
+ * @param[in] lc	to flush.
+ */
+void fr_log_capture_flush(fr_log_capture_t *lc)
+{
+	fr_log_captured_t *msg;
+
+	fr_assert(log_capture != lc);
+
+	while ((msg = fr_dlist_head(&lc->msgs))) {
+		fr_log(msg->log, msg->type, msg->file, msg->line, "%s", msg->msg);
+		fr_dlist_talloc_free_item(&lc->msgs, msg);
+	}
+}
+
 /** Send a server log message to its destination
  *
  * @param[in] log	destination.
@@ -362,6 +440,26 @@ void fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line
 	 */
 	if (log->dst == L_DST_NULL) return;
 
+	/*
+	 *	Hold the message back until the
+	 *	capture is flushed.
+	 */
+	if (unlikely(log_capture != NULL)) {
+		fr_log_captured_t *msg;
+
+		msg = talloc(log_capture, fr_log_captured_t);
+		if (unlikely(!msg)) return;
+		*msg = (fr_log_captured_t){
+			.log = log,
+			.type = type,
+			.file = file,
+			.line = line,
+			.msg = fr_vasprintf(msg, fmt, ap)
+		};
+		fr_dlist_insert_tail(&log_capture->msgs, msg);
+		return;
+	}
+
 	thread_log_pool = fr_log_pool_init();
 	pool = talloc_new(thread_log_pool);	/* Track our local allocations */
 
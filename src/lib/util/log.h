@@ -139,6 +139,11 @@ typedef struct {
 	char const	*prefix;	//!< To add to log messages.
 } fr_log_fd_event_ctx_t;
 
+/** Log messages held back so they can be replayed later
+ *
+ */
+typedef struct fr_log_capture_s fr_log_capture_t;
+
 extern fr_log_t default_log;
 extern bool fr_log_rate_limit;
 
@@ -199,6 +204,14 @@ int	fr_log_close(fr_log_t *log) CC_HINT(nonnull);
 
 TALLOC_CTX *fr_log_pool_init(void);
 
+fr_log_capture_t *fr_log_capture_alloc(TALLOC_CTX *ctx);
+
+void	fr_log_capture_start(fr_log_capture_t *lc);
+
+void	fr_log_capture_stop(void);
+
+void	fr_log_capture_flush(fr_log_capture_t *lc) CC_HINT(nonnull);
+
 int	fr_log_global_init(fr_event_list_t *el, bool daemonize)	CC_HINT(nonnull);
 
 void	fr_log_global_free(void);
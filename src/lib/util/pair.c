@@ -57,6 +57,7 @@ void fr_pair_list_init(fr_pair_list_t *list)
 	list->verified = true;
 #endif
 	list->is_child = false;
+	list->index = NULL;
 }
 
 /** Free a fr_pair_t
@@ -92,7 +93,7 @@ static int _fr_pair_free(fr_pair_t *vp)
 
 	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
-		if (vp->data.secret) memset_explicit(vp->vp_ptr, 0, vp->vp_length);
+		if (vp->data.secret && !fr_value_box_is_shared(&vp->data)) memset_explicit(vp->vp_ptr, 0, vp->vp_length);
 		break;
 
 	default:
@@ -126,6 +127,303 @@ fr_pair_list_t *fr_pair_list_alloc(TALLOC_CTX *ctx)
 	return pl;
 }
 
+/** A single slot in a pair list index
+ *
+ */
+typedef struct {
+	fr_dict_attr_t const	*da;			//!< Key.  NULL if the slot is empty.
+	fr_pair_t		*vp;			//!< First pair in the list with this da.
+} fr_pair_list_index_slot_t;
+
+/** Open addressed hash table mapping #fr_dict_attr_t to the first matching pair in a list
+ *
+ * Slots are probed linearly, and removals shift subsequent entries back, so there
+ * are no tombstones to clean up.
+ */
+struct fr_pair_list_index_s {
+	fr_pair_list_t const		*list;		//!< The list this index was built for.  Guards against
+							///< fr_pair_list_t structures being copied by value.
+	unsigned int			num_elements;	//!< Number of pairs in the list when the index was
+							///< last updated.  If this doesn't match the list,
+							///< the list was modified behind our back.
+	unsigned int			used;		//!< Number of occupied slots.
+	unsigned int			mask;		//!< Number of slots - 1.
+	fr_pair_list_index_slot_t	*slots;		//!< Slot array, always a power of 2 in size.
+};
+
+static inline CC_HINT(always_inline) uint32_t pair_list_index_hash(fr_dict_attr_t const *da)
+{
+	uint64_t key = (uint64_t)(uintptr_t)da;
+
+	/*
+	 *	Attributes are talloced, so the low bits
+	 *	carry no information.  Fibonacci hash
+	 *	the rest.
+	 */
+	return (uint32_t)(((key >> 4) * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
+}
+
+/** Find the slot for a da, or the empty slot where it should be inserted
+ *
+ */
+static inline CC_HINT(always_inline) fr_pair_list_index_slot_t *pair_list_index_slot(fr_pair_list_index_t const *index,
+										      fr_dict_attr_t const *da)
+{
+	uint32_t i = pair_list_index_hash(da) & index->mask;
+
+	while (index->slots[i].da && (index->slots[i].da != da)) i = (i + 1) & index->mask;
+
+	return &index->slots[i];
+}
+
+/** Double the number of slots in the index
+ *
+ */
+static int pair_list_index_grow(fr_pair_list_index_t *index)
+{
+	fr_pair_list_index_slot_t	*old = index->slots;
+	unsigned int			i, old_size = index->mask + 1;
+
+	index->slots = talloc_zero_array(index, fr_pair_list_index_slot_t, old_size * 2);
+	if (unlikely(!index->slots)) {
+		index->slots = old;
+		return -1;
+	}
+	index->mask = (old_size * 2) - 1;
+
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].da) continue;
+
+		*pair_list_index_slot(index, old[i].da) = old[i];
+	}
+	talloc_free(old);
+
+	return 0;
+}
+
+/** Record vp as the first pair for its da, if there isn't one already
+ *
+ */
+static inline int pair_list_index_add(fr_pair_list_index_t *index, fr_pair_t *vp)
+{
+	fr_pair_list_index_slot_t *slot;
+
+	slot = pair_list_index_slot(index, vp->da);
+	if (slot->da) return 0;
+
+	/*
+	 *	Keep the load factor below 0.5 so probe
+	 *	sequences stay short.
+	 */
+	if (((index->used + 1) * 2) > (index->mask + 1)) {
+		if (pair_list_index_grow(index) < 0) return -1;
+		slot = pair_list_index_slot(index, vp->da);
+	}
+
+	slot->da = vp->da;
+	slot->vp = vp;
+	index->used++;
+
+	return 0;
+}
+
+/** Remove a slot, shifting back any entries which probed past it
+ *
+ */
+static void pair_list_index_slot_delete(fr_pair_list_index_t *index, fr_pair_list_index_slot_t *slot)
+{
+	uint32_t i = slot - index->slots, j = i, k;
+
+	for (;;) {
+		j = (j + 1) & index->mask;
+		if (!index->slots[j].da) break;
+
+		/*
+		 *	Leave the entry where it is if its home
+		 *	slot lies cyclically in (i, j].
+		 */
+		k = pair_list_index_hash(index->slots[j].da) & index->mask;
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) continue;
+
+		index->slots[i] = index->slots[j];
+		i = j;
+	}
+
+	index->slots[i] = (fr_pair_list_index_slot_t){ .da = NULL };
+	index->used--;
+}
+
+/** Discard the index of a pair list
+ *
+ * Must be called by anything that modifies the order list directly,
+ * other than via the fr_pair_append() and fr_pair_remove() family of
+ * functions.  The index will be rebuilt on the next search if the list
+ * is still large enough.
+ *
+ * @param[in] list	to discard the index for.
+ */
+void fr_pair_list_index_invalidate(fr_pair_list_t *list)
+{
+	/*
+	 *	A copy of another list's header, the
+	 *	index isn't ours to free.
+	 */
+	if (list->index && (list->index->list == list)) talloc_free(list->index);
+	list->index = NULL;
+}
+
+/** Return the index for a list, building it if the list is large enough
+ *
+ * @param[in] list	to return the index for.
+ * @return
+ *	- The index.
+ *	- NULL if the list should be searched linearly.
+ */
+static fr_pair_list_index_t *pair_list_index(fr_pair_list_t const *list)
+{
+	fr_pair_list_t		*our_list = UNCONST(fr_pair_list_t *, list);
+	fr_pair_list_index_t	*index = list->index;
+	unsigned int		num = fr_pair_order_list_num_elements(&list->order);
+	unsigned int		size;
+	fr_pair_t		*vp = NULL;
+
+	if (index) {
+		if (likely((index->list == list) && (index->num_elements == num))) return index;
+
+		fr_pair_list_index_invalidate(our_list);
+	}
+
+	/*
+	 *	The index is parented by the pair that owns
+	 *	the list, so it's freed along with it.  Lists
+	 *	which aren't children of a pair don't get one.
+	 */
+	if ((num < FR_PAIR_LIST_INDEX_THRESHOLD) || !list->is_child) return NULL;
+
+	index = talloc(fr_pair_list_parent(list), fr_pair_list_index_t);
+	if (unlikely(!index)) return NULL;
+
+	for (size = 16; size < (num * 2); size <<= 1);
+
+	*index = (fr_pair_list_index_t){
+		.list = list,
+		.num_elements = num,
+		.mask = size - 1,
+		.slots = talloc_zero_array(index, fr_pair_list_index_slot_t, size)
+	};
+	if (unlikely(!index->slots)) {
+	error:
+		talloc_free(index);
+		return NULL;
+	}
+
+	while ((vp = fr_pair_list_next(list, vp))) if (unlikely(pair_list_index_add(index, vp) < 0)) goto error;
+
+	our_list->index = index;
+
+	return index;
+}
+
+/** Returns the index if it's still in sync with the list
+ *
+ * Frees the index if the list has been modified outside of the
+ * functions which maintain it.
+ *
+ * @param[in] list	to return the index for.
+ * @param[in] num	number of elements the index should have recorded.
+ */
+static inline fr_pair_list_index_t *pair_list_index_synced(fr_pair_list_t *list, unsigned int num)
+{
+	fr_pair_list_index_t *index = list->index;
+
+	if (likely((index->list == list) && (index->num_elements == num))) return index;
+
+	fr_pair_list_index_invalidate(list);
+	return NULL;
+}
+
+/** Update the index after a pair has been appended to a list
+ *
+ * @param[in] list	the pair was appended to.
+ * @param[in] vp	that was appended.
+ */
+static inline void pair_list_index_append(fr_pair_list_t *list, fr_pair_t *vp)
+{
+	fr_pair_list_index_t *index;
+
+	index = pair_list_index_synced(list, fr_pair_order_list_num_elements(&list->order) - 1);
+	if (!index) return;
+
+	if (unlikely(pair_list_index_add(index, vp) < 0)) {
+		fr_pair_list_index_invalidate(list);
+		return;
+	}
+	index->num_elements++;
+}
+
+/** Update the index after a pair has been prepended to a list
+ *
+ * @param[in] list	the pair was prepended to.
+ * @param[in] vp	that was prepended.
+ */
+static inline void pair_list_index_prepend(fr_pair_list_t *list, fr_pair_t *vp)
+{
+	fr_pair_list_index_t		*index;
+	fr_pair_list_index_slot_t	*slot;
+
+	index = pair_list_index_synced(list, fr_pair_order_list_num_elements(&list->order) - 1);
+	if (!index) return;
+
+	slot = pair_list_index_slot(index, vp->da);
+	if (slot->da) {
+		slot->vp = vp;
+	} else if (unlikely(pair_list_index_add(index, vp) < 0)) {
+		fr_pair_list_index_invalidate(list);
+		return;
+	}
+	index->num_elements++;
+}
+
+/** Update the index before a pair is removed from a list
+ *
+ * @param[in] list	the pair is being removed from.
+ * @param[in] vp	being removed.
+ */
+void fr_pair_list_index_remove(fr_pair_list_t *list, fr_pair_t const *vp)
+{
+	fr_pair_list_index_t		*index;
+	fr_pair_list_index_slot_t	*slot;
+	fr_pair_t			*next;
+
+	index = pair_list_index_synced(list, fr_pair_order_list_num_elements(&list->order));
+	if (!index) return;
+
+	if (unlikely(fr_pair_order_list_parent(vp) != &list->order)) {
+	invalidate:
+		fr_pair_list_index_invalidate(list);
+		return;
+	}
+
+	slot = pair_list_index_slot(index, vp->da);
+	if (unlikely(!slot->da)) goto invalidate;
+
+	/*
+	 *	Removing the first instance, the next
+	 *	one (if any) becomes the first.
+	 */
+	if (slot->vp == vp) {
+		next = UNCONST(fr_pair_t *, vp);
+		while ((next = fr_pair_list_next(list, next)) && (next->da != vp->da));
+
+		if (next) {
+			slot->vp = next;
+		} else {
+			pair_list_index_slot_delete(index, slot);
+		}
+	}
+	index->num_elements--;
+}
+
 /** Initialise fields in an fr_pair_t without assigning a da
  *
  * @note Internal use by the allocation functions only.
@@ -325,6 +623,11 @@ int fr_pair_reinit_from_da(fr_pair_list_t *list, fr_pair_t *vp, fr_dict_attr_t c
 		fr_value_box_init(&vp->data, da->type, da, false);
 	}
 
+	/*
+	 *	The pair will be filed under a different da.
+	 */
+	if (list && list->index) fr_pair_list_index_invalidate(list);
+
 	to_free = vp->da;
 	vp->da = da;
 
@@ -508,6 +811,61 @@ fr_pair_t *fr_pair_copy(TALLOC_CTX *ctx, fr_pair_t const *vp)
 	return n;
 }
 
+/** Copy a single valuepair, sharing its value buffer with the original
+ *
+ * Like #fr_pair_copy, but string and octets buffers are referenced rather
+ * than duplicated.  The buffer is freed when the last pair using it is freed,
+ * and whichever pair modifies the value first gets its own copy.
+ *
+ * This is much cheaper than #fr_pair_copy for large values which are usually
+ * only read, e.g. the parent's lists in subrequests and inner tunnels.
+ *
+ * @param[in] ctx for talloc
+ * @param[in] vp to copy.
+ * @return
+ *	- A copy of the input VP.
+ *	- NULL on error.
+ */
+fr_pair_t *fr_pair_copy_shared(TALLOC_CTX *ctx, fr_pair_t const *vp)
+{
+	fr_pair_t *n;
+
+	PAIR_VERIFY(vp);
+
+	n = fr_pair_afrom_da(ctx, vp->da);
+	if (!n) return NULL;
+
+	n->op = vp->op;
+
+	switch (vp->vp_type) {
+	case FR_TYPE_STRUCTURAL:
+		if (fr_pair_list_copy_shared(n, &n->vp_group, &vp->vp_group) < 0) {
+		error:
+			talloc_free(n);
+			return NULL;
+		}
+		break;
+
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		if (!vp->vp_ptr || vp->data.borrowed) goto copy;
+
+		fr_value_box_copy_shallow(n, &n->data, &vp->data);
+		if (unlikely(!n->vp_ptr)) {
+			fr_strerror_const("Failed referencing value buffer");
+			goto error;
+		}
+		break;
+
+	default:
+	copy:
+		if (unlikely(fr_value_box_copy(n, &n->data, &vp->data) < 0)) goto error;
+		break;
+	}
+
+	return n;
+}
+
 /** Steal one VP
  *
  * @param[in] ctx to move fr_pair_t into
@@ -693,6 +1051,25 @@ fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_pair_t const *prev,
 
 	PAIR_LIST_VERIFY(list);
 
+	if (!prev) {
+		fr_pair_list_index_t *index = pair_list_index(list);
+
+		if (index) {
+			fr_pair_list_index_slot_t *slot = pair_list_index_slot(index, da);
+
+			if (!slot->da) return NULL;
+
+			vp = slot->vp;
+			if (likely((vp->da == da) && (fr_pair_order_list_parent(vp) == &list->order))) return vp;
+
+			/*
+			 *	Stale entry, fall back to a linear search.
+			 */
+			fr_pair_list_index_invalidate(UNCONST(fr_pair_list_t *, list));
+			vp = NULL;
+		}
+	}
+
 	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) return vp;
 
 	return NULL;
@@ -741,6 +1118,13 @@ fr_pair_t *fr_pair_find_by_da_idx(fr_pair_list_t const *list, fr_dict_attr_t con
 
 	PAIR_LIST_VERIFY(list);
 
+	/*
+	 *	Skip straight to the first instance.
+	 */
+	vp = fr_pair_find_by_da(list, NULL, da);
+	if (!vp || (idx == 0)) return vp;
+	idx--;
+
 	while ((vp = fr_pair_list_next(list, vp))) {
 		if (da != vp->da) continue;
 
@@ -972,6 +1356,12 @@ static int _pair_list_dcursor_insert(fr_dlist_head_t *list, void *to_insert, UNU
 
 	tlist = fr_tlist_head_from_dlist(list);
 
+	/*
+	 *	We don't know where the cursor is going
+	 *	to put the pair, so the index has to go.
+	 */
+	if (fr_pair_list_from_dlist(list)->index) fr_pair_list_index_invalidate(fr_pair_list_from_dlist(list));
+
 	/*
 	 *	Mark the pair as inserted into the list.
 	 */
@@ -1009,6 +1399,12 @@ static int _pair_list_dcursor_remove(NDEBUG_UNUSED fr_dlist_head_t *list, void *
 	parent = fr_pair_parent_list(vp);
 #endif
 
+	/*
+	 *	Must be done while the pair is still
+	 *	marked as being in the list.
+	 */
+	if (parent->index) fr_pair_list_index_remove(parent, vp);
+
 	/*
 	 *	Mark the pair as removed from the list.
 	 */
@@ -1321,6 +1717,7 @@ int fr_pair_prepend(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_pair_order_list_insert_head(&list->order, to_add);
+	if (list->index) pair_list_index_prepend(list, to_add);
 
 	return 0;
 }
@@ -1352,6 +1749,7 @@ int fr_pair_append(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_pair_order_list_insert_tail(&list->order, to_add);
+	if (list->index) pair_list_index_append(list, to_add);
 
 	return 0;
 }
@@ -1384,6 +1782,8 @@ int fr_pair_insert_after(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_add
 		return -1;
 	}
 
+	if (list->index) fr_pair_list_index_invalidate(list);
+
 	fr_pair_order_list_insert_after(&list->order, pos, to_add);
 
 	return 0;
@@ -1418,6 +1818,8 @@ int fr_pair_insert_before(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_ad
 		return -1;
 	}
 
+	if (list->index) fr_pair_list_index_invalidate(list);
+
 	fr_pair_order_list_insert_before(&list->order, pos, to_add);
 
 	return 0;
@@ -2324,6 +2726,7 @@ int fr_pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const
 
 		new_vp = fr_pair_copy(ctx, vp);
 		if (!new_vp) {
+			if (to->index) fr_pair_list_index_invalidate(to);
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
 			return -1;
 		}
@@ -2336,6 +2739,41 @@ int fr_pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const
 }
 
 
+/** Duplicate a list of pairs, sharing value buffers with the originals
+ *
+ * See #fr_pair_copy_shared for details.
+ *
+ * @param[in] ctx	for new #fr_pair_t (s) to be allocated in.
+ * @param[in] to	where to copy attributes to.
+ * @param[in] from	whence to copy #fr_pair_t (s).
+ * @return
+ *	- >0 the number of attributes copied.
+ *	- 0 if no attributes copied.
+ *	- -1 on error.
+ */
+int fr_pair_list_copy_shared(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const *from)
+{
+	fr_pair_t	*new_vp, *first_added = NULL;
+	int		cnt = 0;
+
+	fr_pair_list_foreach(from, vp) {
+		cnt++;
+		PAIR_VERIFY_WITH_LIST(from, vp);
+
+		new_vp = fr_pair_copy_shared(ctx, vp);
+		if (!new_vp) {
+			if (to->index) fr_pair_list_index_invalidate(to);
+			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
+			return -1;
+		}
+
+		if (!first_added) first_added = new_vp;
+		fr_pair_append(to, new_vp);
+	}
+
+	return cnt;
+}
+
 /** Copy the contents of a pair list to a set of value-boxes
  *
  * This function should be removed when the xlats use dcursors
@@ -2423,6 +2861,7 @@ int fr_pair_list_copy_by_da(TALLOC_CTX *ctx, fr_pair_list_t *to,
 		cnt++;
 		new_vp = fr_pair_copy(ctx, vp);
 		if (!new_vp) {
+			if (to->index) fr_pair_list_index_invalidate(to);
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
 			return -1;
 		}
@@ -2539,6 +2978,8 @@ void fr_pair_value_clear(fr_pair_t *vp)
 	case FR_TYPE_STRUCTURAL:
 		if (!fr_pair_list_empty(&vp->vp_group)) return;
 
+		if (vp->vp_group.index) fr_pair_list_index_invalidate(&vp->vp_group);
+
 		while ((child = fr_pair_order_list_pop_tail(&vp->vp_group.order))) {
 			fr_pair_value_clear(child);
 			talloc_free(child);
@@ -3236,7 +3677,7 @@ void fr_pair_verify(char const *file, int line, fr_pair_list_t const *list, fr_p
 		}
 
 		parent = talloc_parent(vp->vp_ptr);
-		if (parent != vp) {
+		if ((parent != vp) && !fr_value_box_is_shared(&vp->data)) {	/* Shared buffers have one parent */
 			fr_fatal_assert_fail("CONSISTENCY CHECK FAILED %s[%u]: fr_pair_t \"%s\" char buffer is not "
 					     "parented by fr_pair_t %p, instead parented by %p (%s)",
 					     file, line, vp->da->name,
@@ -3269,7 +3710,7 @@ void fr_pair_verify(char const *file, int line, fr_pair_list_t const *list, fr_p
 		}
 
 		parent = talloc_parent(vp->vp_ptr);
-		if (parent != vp) {
+		if ((parent != vp) && !fr_value_box_is_shared(&vp->data)) {	/* Shared buffers have one parent */
 			fr_fatal_assert_fail("CONSISTENCY CHECK FAILED %s[%u]: fr_pair_t \"%s\" char buffer is not "
 					     "parented by fr_pair_t %p, instead parented by %p (%s)",
 					     file, line, vp->da->name,
@@ -49,9 +49,26 @@ typedef struct value_pair_s fr_pair_t;
 
 FR_TLIST_TYPES(fr_pair_order_list)
 
+typedef struct fr_pair_list_index_s fr_pair_list_index_t;
+
+/** Lists shorter than this are always searched linearly
+ *
+ * Above this size, the first search of a list which is the child of a pair builds
+ * an index of #fr_dict_attr_t to the first matching pair.  The index is then
+ * maintained on append and remove, and discarded on any other modification.
+ */
+#ifndef FR_PAIR_LIST_INDEX_THRESHOLD
+#  define FR_PAIR_LIST_INDEX_THRESHOLD	24
+#endif
+
 typedef struct pair_list_s {
         FR_TLIST_HEAD(fr_pair_order_list)	order;			//!< Maintains the relative order of pairs in a list.
 
+	fr_pair_list_index_t		*index;			//!< Lazily built da -> first pair lookup table.
+								///< Only ever allocated for lists which are
+								///< children of a pair, as the index is parented
+								///< by that pair.
+
 	bool				 _CONST is_child;		//!< is a child of a VP
 
 #ifdef WITH_VERIFY_PTR
@@ -458,6 +475,8 @@ fr_pair_t	*fr_pair_afrom_da_depth_nested(TALLOC_CTX *ctx, fr_pair_list_t *list,
 
 fr_pair_t	*fr_pair_copy(TALLOC_CTX *ctx, fr_pair_t const *vp) CC_HINT(nonnull(2)) CC_HINT(warn_unused_result);
 
+fr_pair_t	*fr_pair_copy_shared(TALLOC_CTX *ctx, fr_pair_t const *vp) CC_HINT(nonnull(2)) CC_HINT(warn_unused_result);
+
 int		fr_pair_steal(TALLOC_CTX *ctx, fr_pair_t *vp) CC_HINT(nonnull);
 
 int		fr_pair_steal_append(TALLOC_CTX *nctx, fr_pair_list_t *list, fr_pair_t *vp) CC_HINT(nonnull);
@@ -693,6 +712,8 @@ void fr_pair_set_immutable(fr_pair_t *vp)
 /* Lists */
 int		fr_pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const *from);
 
+int		fr_pair_list_copy_shared(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const *from);
+
 void		fr_pair_list_steal(TALLOC_CTX *ctx, fr_pair_list_t *list);
 
 int		fr_pair_list_copy_to_box(fr_value_box_t *dst, fr_pair_list_t *from);
@@ -708,6 +729,17 @@ int		fr_pair_sublist_copy(TALLOC_CTX *ctx, fr_pair_list_t *to,
 				     fr_pair_list_t const *from,
 				     fr_pair_t const *start, unsigned int count) CC_HINT(nonnull(2,3));
 
+/** @name Pair list index maintenance
+ *
+ * Only needed by code which modifies the underlying order list directly.
+ *
+ * @{
+ */
+void		fr_pair_list_index_invalidate(fr_pair_list_t *list) CC_HINT(nonnull);
+
+void		fr_pair_list_index_remove(fr_pair_list_t *list, fr_pair_t const *vp) CC_HINT(nonnull);
+/** @} */
+
 #ifndef _PAIR_INLINE
 /** @hidecallergraph */
 void		fr_pair_list_free(fr_pair_list_t *list) CC_HINT(nonnull);
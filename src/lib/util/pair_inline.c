@@ -103,6 +103,8 @@ _INLINE fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
 	list->verified = false;
 #endif
 
+	if (list->index) fr_pair_list_index_remove(list, vp);
+
 	return fr_pair_order_list_remove(&list->order, vp);
 }
 
@@ -112,6 +114,8 @@ _INLINE fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
  */
 _INLINE void fr_pair_list_free(fr_pair_list_t *list)
 {
+	if (list->index) fr_pair_list_index_invalidate(list);
+
 	fr_pair_order_list_talloc_free(&list->order);
 }
 
@@ -139,6 +143,8 @@ _INLINE bool fr_pair_list_empty(fr_pair_list_t const *list)
  */
 _INLINE void fr_pair_list_sort(fr_pair_list_t *list, fr_cmp_t cmp)
 {
+	if (list->index) fr_pair_list_index_invalidate(list);
+
 	fr_pair_order_list_sort(&list->order, cmp);
 }
 
@@ -171,7 +177,7 @@ _INLINE fr_dlist_head_t *fr_pair_list_to_dlist(fr_pair_list_t const *list)
  */
 _INLINE fr_pair_list_t *fr_pair_list_from_dlist(fr_dlist_head_t const *list)
 {
-	return (fr_pair_list_t *)((uintptr_t)list - offsetof(fr_pair_list_t, order));
+	return (fr_pair_list_t *)((uintptr_t)list - offsetof(fr_pair_list_t, order.head.dlist_head));
 }
 
 /** Appends a list of fr_pair_t from a temporary list to a destination list
@@ -184,6 +190,9 @@ _INLINE void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
 #ifdef WITH_VERIFY_POINTER
 	dst->verified = false;
 #endif
+	if (dst->index) fr_pair_list_index_invalidate(dst);
+	if (src->index) fr_pair_list_index_invalidate(src);
+
 	fr_pair_order_list_move(&dst->order, &src->order);
 }
 
@@ -194,5 +203,8 @@ _INLINE void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
  */
 _INLINE void fr_pair_list_prepend(fr_pair_list_t *dst, fr_pair_list_t *src)
 {
+	if (dst->index) fr_pair_list_index_invalidate(dst);
+	if (src->index) fr_pair_list_index_invalidate(src);
+
 	fr_pair_order_list_move_head(&dst->order, &src->order);
 }
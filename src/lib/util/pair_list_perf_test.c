@@ -483,6 +483,95 @@ static void do_test_fr_pair_list_free(unsigned int len, unsigned int perc, unsig
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
 }
 
+/** Lookup heavy workload, comparing linear searches with the pair list index
+ *
+ * Lists which are the children of a pair get an index once they grow past
+ * #FR_PAIR_LIST_INDEX_THRESHOLD, so we build the same list either as a
+ * standalone list (always searched linearly), or as the children of a group.
+ *
+ * One in four lookups is for an attribute which isn't in the list, as that's
+ * the worst case for a linear search, and common for policies that check for
+ * optional attributes.
+ */
+static void do_test_lookup(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[],
+			   bool indexed)
+{
+	fr_pair_list_t		plain, *test_vps;
+	fr_pair_t		*group = NULL;
+	unsigned int		i, j;
+	fr_pair_t		*new_vp;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	fr_dict_attr_t const	*da;
+	size_t			input_count = talloc_array_length(source_vps);
+	fr_fast_rand_t		rand_ctx;
+
+	if (indexed) {
+		group = fr_pair_afrom_da(autofree, fr_dict_attr_test_group);
+		TEST_ASSERT(group != NULL);
+		test_vps = &group->vp_group;
+	} else {
+		fr_pair_list_init(&plain);
+		test_vps = &plain;
+	}
+
+	if (input_count > len) input_count = len;
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	for (i = 0; i < len; i++) {
+		int idx = fr_fast_rand(&rand_ctx) % input_count;
+		new_vp = fr_pair_copy(autofree, source_vps[idx]);
+		fr_pair_append(test_vps, new_vp);
+	}
+
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < len; j++) {
+			uint32_t r = fr_fast_rand(&rand_ctx);
+
+			da = ((r & 0x03) == 0) ? fr_dict_attr_test_uint32 : source_vps[(r >> 2) % input_count]->da;
+			start = fr_time();
+			new_vp = fr_pair_find_by_da(test_vps, NULL, da);
+			end = fr_time();
+			used = fr_time_delta_add(used, fr_time_sub(end, start));
+
+			/*
+			 *	Both variants must agree
+			 */
+			if (new_vp) TEST_CHECK(new_vp->da == da);
+		}
+
+		/*
+		 *	Mix in some churn so the incremental
+		 *	index maintenance is exercised.
+		 */
+		new_vp = fr_pair_list_head(test_vps);
+		fr_pair_remove(test_vps, new_vp);
+		fr_pair_append(test_vps, new_vp);
+	}
+	TEST_CHECK(fr_pair_list_num_elements(test_vps) == len);
+
+	fr_pair_list_free(test_vps);
+	talloc_free(group);
+
+	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("perc_rep=%d", perc);
+	TEST_MSG_ALWAYS("list_length=%d", len);
+	TEST_MSG_ALWAYS("indexed=%s", indexed ? "yes" : "no");
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+static void do_test_find_linear(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	do_test_lookup(len, perc, reps, source_vps, false);
+}
+
+static void do_test_find_indexed(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	do_test_lookup(len, perc, reps, source_vps, true);
+}
+
 #define test_func(_func, _count, _perc, _source_vps) \
 static void test_ ## _func ## _ ## _count ## _ ## _perc(void)\
 {\
@@ -508,6 +597,22 @@ all_test_funcs(fr_pair_find_by_da_idx)
 all_test_funcs(find_nth)
 all_test_funcs(fr_pair_list_free)
 
+/*
+ *	Lookup tests span FR_PAIR_LIST_INDEX_THRESHOLD to show the crossover
+ *	point between linear searches and the index.
+ */
+#define lookup_test_funcs(_func, _perc) \
+	test_func(_func, 10, _perc, source_vps_ ## _perc) \
+	test_func(_func, 25, _perc, source_vps_ ## _perc) \
+	test_func(_func, 50, _perc, source_vps_ ## _perc) \
+	test_func(_func, 100, _perc, source_vps_ ## _perc) \
+	test_func(_func, 150, _perc, source_vps_ ## _perc)
+
+lookup_test_funcs(find_linear, 0)
+lookup_test_funcs(find_linear, 50)
+lookup_test_funcs(find_indexed, 0)
+lookup_test_funcs(find_indexed, 50)
+
 #define repetition_tests(_func, _perc) \
 	{ #_func "_20_" #_perc, test_ ## _func ## _20_ ## _perc},\
 	{ #_func "_40_" #_perc, test_ ## _func ## _40_ ## _perc},\
@@ -522,11 +627,23 @@ all_test_funcs(fr_pair_list_free)
 	repetition_tests(_func, 75) \
 	repetition_tests(_func, 100)
 
+#define lookup_tests(_func, _perc) \
+	{ #_func "_10_" #_perc, test_ ## _func ## _10_ ## _perc},\
+	{ #_func "_25_" #_perc, test_ ## _func ## _25_ ## _perc},\
+	{ #_func "_50_" #_perc, test_ ## _func ## _50_ ## _perc},\
+	{ #_func "_100_" #_perc, test_ ## _func ## _100_ ## _perc},\
+	{ #_func "_150_" #_perc, test_ ## _func ## _150_ ## _perc},\
+
 TEST_LIST = {
 	all_repetition_tests(fr_pair_append)
 	all_repetition_tests(fr_pair_find_by_da_idx)
 	all_repetition_tests(find_nth)
 	all_repetition_tests(fr_pair_list_free)
 
+	lookup_tests(find_linear, 0)
+	lookup_tests(find_linear, 50)
+	lookup_tests(find_indexed, 0)
+	lookup_tests(find_indexed, 50)
+
 	{ NULL }
 };
@@ -371,6 +371,78 @@ static void test_fr_pair_find_by_da_idx(void)
 	TEST_CHECK(vp && vp->da == fr_dict_attr_test_string);
 }
 
+/** Linear search, to check the pair list index against
+ */
+static fr_pair_t *pair_find_linear(fr_pair_list_t const *list, fr_dict_attr_t const *da)
+{
+	fr_pair_list_foreach(list, vp) if (vp->da == da) return vp;
+
+	return NULL;
+}
+
+static void pair_check_index(fr_pair_list_t const *list, fr_dict_attr_t const **das, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		TEST_CHECK(fr_pair_find_by_da(list, NULL, das[i]) == pair_find_linear(list, das[i]));
+		TEST_MSG("Index and list disagree for %s", das[i]->name);
+	}
+}
+
+static void test_fr_pair_find_by_da_indexed(void)
+{
+	fr_dict_attr_t const	*das[] = { fr_dict_attr_test_string, fr_dict_attr_test_octets,
+					   fr_dict_attr_test_uint8, fr_dict_attr_test_uint16,
+					   fr_dict_attr_test_uint32, fr_dict_attr_test_uint64,
+					   fr_dict_attr_test_int32 };
+	fr_pair_t		*group, *vp;
+	fr_dcursor_t		cursor;
+	unsigned int		i;
+
+	TEST_CASE("Build a list of children large enough to be indexed");
+	TEST_CHECK((group = fr_pair_afrom_da(autofree, fr_dict_attr_test_group)) != NULL);
+	for (i = 0; i < (FR_PAIR_LIST_INDEX_THRESHOLD * 2); i++) {
+		/* Skip int32 so we can check lookups for attributes that aren't present */
+		TEST_CHECK(fr_pair_append_by_da(group, &vp, &group->vp_group, das[i % (NUM_ELEMENTS(das) - 1)]) == 0);
+	}
+	pair_check_index(&group->vp_group, das, NUM_ELEMENTS(das));
+
+	TEST_CASE("Index is maintained on append");
+	TEST_CHECK(fr_pair_append_by_da(group, &vp, &group->vp_group, fr_dict_attr_test_int32) == 0);
+	TEST_CHECK(fr_pair_find_by_da(&group->vp_group, NULL, fr_dict_attr_test_int32) == vp);
+	pair_check_index(&group->vp_group, das, NUM_ELEMENTS(das));
+
+	TEST_CASE("Index is maintained on prepend");
+	TEST_CHECK(fr_pair_prepend_by_da(group, &vp, &group->vp_group, fr_dict_attr_test_uint32) == 0);
+	TEST_CHECK(fr_pair_find_by_da(&group->vp_group, NULL, fr_dict_attr_test_uint32) == vp);
+	pair_check_index(&group->vp_group, das, NUM_ELEMENTS(das));
+
+	TEST_CASE("Index is maintained when removing the first instance of an attribute");
+	for (i = 0; i < NUM_ELEMENTS(das); i++) {
+		vp = fr_pair_find_by_da(&group->vp_group, NULL, das[i]);
+		if (!vp) continue;
+		fr_pair_delete(&group->vp_group, vp);
+		pair_check_index(&group->vp_group, das, NUM_ELEMENTS(das));
+	}
+
+	TEST_CASE("Index is maintained when removing pairs with a cursor");
+	for (vp = fr_pair_dcursor_by_da_init(&cursor, &group->vp_group, fr_dict_attr_test_uint8);
+	     vp;
+	     vp = fr_dcursor_current(&cursor)) talloc_free(fr_dcursor_remove(&cursor));
+	pair_check_index(&group->vp_group, das, NUM_ELEMENTS(das));
+
+	TEST_CASE("Index is rebuilt after the list is sorted");
+	fr_pair_list_sort(&group->vp_group, fr_pair_cmp_by_da);
+	pair_check_index(&group->vp_group, das, NUM_ELEMENTS(das));
+
+	TEST_CASE("Index is empty after the list is freed");
+	fr_pair_list_free(&group->vp_group);
+	pair_check_index(&group->vp_group, das, NUM_ELEMENTS(das));
+
+	talloc_free(group);
+}
+
 static void test_fr_pair_find_by_child_num_idx(void)
 {
 	fr_pair_t *vp;
@@ -706,6 +778,60 @@ static void test_fr_pair_list_copy(void)
 	fr_pair_list_free(&local_pairs);
 }
 
+static void test_fr_pair_list_copy_shared(void)
+{
+	fr_pair_list_t	original, local_pairs;
+	fr_pair_t	*vp, *copy;
+	uint8_t		*buff;
+	char const	*str;
+
+	fr_pair_list_init(&original);
+	fr_pair_list_init(&local_pairs);
+
+	TEST_CHECK(fr_pair_list_copy(autofree, &original, &test_pairs) > 0);
+	TEST_CHECK((vp = fr_pair_find_by_da(&original, NULL, fr_dict_attr_test_octets)) != NULL);
+	TEST_CHECK(fr_pair_value_memdup(vp, (uint8_t const *)"\x01\x02\x03\x04", 4, false) == 0);
+
+	TEST_CASE("Copy 'original' into 'local_pairs' using fr_pair_list_copy_shared()");
+	TEST_CHECK(fr_pair_list_copy_shared(autofree, &local_pairs, &original) > 0);
+
+	TEST_CASE("Check if 'local_pairs' == 'original' using fr_pair_list_cmp()");
+	TEST_CHECK(fr_pair_list_cmp(&local_pairs, &original) == 0);
+
+	TEST_CASE("String buffers should be shared");
+	TEST_CHECK((vp = fr_pair_find_by_da(&original, NULL, fr_dict_attr_test_string)) != NULL);
+	TEST_CHECK((copy = fr_pair_find_by_da(&local_pairs, NULL, fr_dict_attr_test_string)) != NULL);
+	TEST_CHECK(vp->vp_strvalue == copy->vp_strvalue);
+	TEST_CHECK(fr_value_box_is_shared(&copy->data));
+	str = vp->vp_strvalue;
+
+	TEST_CASE("Modifying the copy should not modify the original");
+	TEST_CHECK(fr_pair_value_bstrn_append(copy, "bar", 3, false) == 0);
+	TEST_CHECK(copy->vp_strvalue != str);
+	TEST_CHECK(vp->vp_strvalue == str);
+	TEST_CHECK(strcmp(copy->vp_strvalue, vp->vp_strvalue) != 0);
+	TEST_CHECK(!fr_value_box_is_shared(&vp->data));
+
+	TEST_CASE("Modifying the original should not modify the copy");
+	TEST_CHECK((vp = fr_pair_find_by_da(&original, NULL, fr_dict_attr_test_octets)) != NULL);
+	TEST_CHECK((copy = fr_pair_find_by_da(&local_pairs, NULL, fr_dict_attr_test_octets)) != NULL);
+	TEST_CHECK(vp->vp_octets == copy->vp_octets);
+	TEST_CHECK(fr_pair_value_mem_realloc(vp, &buff, vp->vp_length) == 0);
+	TEST_CHECK(buff != copy->vp_octets);
+	buff[0] = ~buff[0];
+	TEST_CHECK(memcmp(vp->vp_octets, copy->vp_octets, vp->vp_length) != 0);
+
+	TEST_CASE("Freeing the original should leave the copy intact");
+	fr_pair_list_free(&original);
+	fr_pair_list_free(&local_pairs);
+	TEST_CHECK(fr_pair_list_copy(autofree, &original, &test_pairs) > 0);
+	TEST_CHECK(fr_pair_list_copy_shared(autofree, &local_pairs, &original) > 0);
+	fr_pair_list_free(&original);
+	TEST_CHECK(fr_pair_list_cmp(&local_pairs, &test_pairs) == 0);
+
+	fr_pair_list_free(&local_pairs);
+}
+
 static void test_fr_pair_list_copy_by_da(void)
 {
 	fr_dcursor_t   cursor;
@@ -1430,6 +1556,7 @@ TEST_LIST = {
 	{ "fr_pair_dcursor_value_init",           test_fr_pair_dcursor_value_init },
 	{ "fr_pair_raw_afrom_pair",                test_fr_pair_raw_afrom_pair },
 	{ "fr_pair_find_by_da_idx",                   test_fr_pair_find_by_da_idx },
+	{ "fr_pair_find_by_da_indexed",               test_fr_pair_find_by_da_indexed },
 	{ "fr_pair_find_by_child_num_idx",            test_fr_pair_find_by_child_num_idx },
 	{ "fr_pair_find_by_da_nested",            test_fr_pair_find_by_da_nested },
 	{ "fr_pair_append",                       test_fr_pair_append },
@@ -1447,6 +1574,7 @@ TEST_LIST = {
 
 	/* Lists */
 	{ "fr_pair_list_copy",                    test_fr_pair_list_copy },
+	{ "fr_pair_list_copy_shared",             test_fr_pair_list_copy_shared },
 	{ "fr_pair_list_copy_by_da",              test_fr_pair_list_copy_by_da },
 	{ "fr_pair_list_copy_by_ancestor",        test_fr_pair_list_copy_by_ancestor },
 	{ "fr_pair_list_sort",                    test_fr_pair_list_sort },
@@ -0,0 +1,336 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Quiescent state based reclamation of data shared between threads
+ *
+ * Each reader thread publishes the global epoch it last observed whilst
+ * holding no references to shared data.  Replacing a pointer advances the
+ * global epoch, and tags the old data with the new value.  The old data
+ * can be freed once every online reader has published an epoch at least
+ * as recent.
+ *
+ * @file src/lib/util/rcu.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/rcu.h>
+#include <freeradius-devel/util/strerror.h>
+
+#include <pthread.h>
+
+/** Per-thread reader state
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the list of readers.
+	_Atomic(uint64_t)	epoch;		//!< Last epoch observed in a quiescent state.
+						///< 0 if the thread is offline.
+} fr_rcu_reader_t;
+
+/** Data waiting for readers to move past it
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the list of retired data.
+	uint64_t		epoch;		//!< Epoch readers must reach before ptr is freed.
+	void			*ptr;		//!< talloc'd data to free.
+} fr_rcu_retired_t;
+
+static _Atomic(uint64_t)		rcu_epoch = 1;		//!< Advanced each time data is retired.
+static _Atomic(unsigned int)		rcu_pending;		//!< How many items are waiting to be freed.
+
+static pthread_mutex_t			rcu_mutex = PTHREAD_MUTEX_INITIALIZER;	//!< Protects the lists below.
+static fr_dlist_head_t			rcu_readers;		//!< Registered reader threads.
+static fr_dlist_head_t			rcu_retired;		//!< Data waiting to be freed, oldest first.
+
+static _Thread_local fr_rcu_reader_t	*rcu_reader;		//!< This thread's reader state.
+
+static int _rcu_global_init(UNUSED void *uctx)
+{
+	fr_dlist_init(&rcu_readers, fr_rcu_reader_t, entry);
+	fr_dlist_talloc_init(&rcu_retired, fr_rcu_retired_t, entry);
+
+	return 0;
+}
+
+static int _rcu_global_free(UNUSED void *uctx)
+{
+	fr_rcu_retired_t *retired;
+
+	/*
+	 *	All the threads are gone, so
+	 *	nothing can still be reading.
+	 */
+	pthread_mutex_lock(&rcu_mutex);
+	while ((retired = fr_dlist_head(&rcu_retired))) {
+		talloc_free(retired->ptr);
+		fr_dlist_talloc_free_item(&rcu_retired, retired);
+	}
+	pthread_mutex_unlock(&rcu_mutex);
+
+	return 0;
+}
+
+static inline CC_HINT(always_inline) void rcu_global_init(void)
+{
+	fr_atexit_global_once(_rcu_global_init, _rcu_global_free, NULL);
+}
+
+/** Free the version of the data a pointer references when the pointer is freed
+ *
+ */
+static int _rcu_ptr_free(fr_rcu_ptr_t *rp)
+{
+	talloc_free(atomic_load_explicit(&rp->ptr, memory_order_relaxed));
+
+	return 0;
+}
+
+/** Allocate a pointer to data which may be replaced whilst other threads are reading it
+ *
+ * The pointer must not be allocated in memory which may be write protected.
+ * Module instance data is protected once the module has been instantiated,
+ * so modules should allocate the pointer in their #module_instance_t, and
+ * only store the address of it in their instance data.
+ *
+ * @param[in] ctx	to allocate the pointer in.  When the pointer is freed
+ *			the current version of the data is also freed.
+ * @param[in] ptr	Initial version of the data.  Must be a talloc chunk.
+ * @return
+ *	- A new #fr_rcu_ptr_t.
+ *	- NULL on failure.
+ */
+fr_rcu_ptr_t *fr_rcu_ptr_alloc(TALLOC_CTX *ctx, void *ptr)
+{
+	fr_rcu_ptr_t *rp;
+
+	rcu_global_init();
+
+	rp = talloc(ctx, fr_rcu_ptr_t);
+	if (unlikely(!rp)) return NULL;
+
+	atomic_init(&rp->ptr, ptr);
+	talloc_set_destructor(rp, _rcu_ptr_free);
+
+	return rp;
+}
+
+/** Add an entry to the retired list
+ *
+ */
+static inline CC_HINT(always_inline) void rcu_retire(fr_rcu_retired_t *retired, void *ptr)
+{
+	pthread_mutex_lock(&rcu_mutex);
+	retired->ptr = ptr;
+	retired->epoch = atomic_fetch_add_explicit(&rcu_epoch, 1, memory_order_seq_cst) + 1;
+	fr_dlist_insert_tail(&rcu_retired, retired);
+	atomic_store_explicit(&rcu_pending, fr_dlist_num_elements(&rcu_retired), memory_order_relaxed);
+	pthread_mutex_unlock(&rcu_mutex);
+
+	(void)fr_rcu_reclaim();
+}
+
+/** Publish a new version of the data, retiring the old one
+ *
+ * Readers which loaded the old version may continue to use it until
+ * they pass through a quiescent state.
+ *
+ * @param[in] rp	to update.
+ * @param[in] ptr	New version of the data.  Must be a talloc chunk.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The old version of the data remains current.
+ */
+int fr_rcu_ptr_replace(fr_rcu_ptr_t *rp, void *ptr)
+{
+	fr_rcu_retired_t *retired;
+
+	rcu_global_init();
+
+	/*
+	 *	Allocate first so we can't fail after
+	 *	the new version has been published.
+	 */
+	retired = talloc(NULL, fr_rcu_retired_t);
+	if (unlikely(!retired)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	rcu_retire(retired, atomic_exchange_explicit(&rp->ptr, ptr, memory_order_seq_cst));
+
+	return 0;
+}
+
+/** Free data once no reader thread can still be using it
+ *
+ * @param[in] ptr	talloc chunk to free.  May be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The data is not freed.
+ */
+int fr_rcu_retire(void *ptr)
+{
+	fr_rcu_retired_t *retired;
+
+	if (!ptr) return 0;
+
+	rcu_global_init();
+
+	retired = talloc(NULL, fr_rcu_retired_t);
+	if (unlikely(!retired)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	rcu_retire(retired, ptr);
+
+	return 0;
+}
+
+/** Free any retired data no reader thread can still be using
+ *
+ * Called automatically when data is retired, and by readers passing
+ * through a quiescent state whilst data is waiting to be freed, so
+ * the last reader to move past the old data frees it.
+ *
+ * @return The number of items still waiting to be freed.
+ */
+unsigned int fr_rcu_reclaim(void)
+{
+	fr_rcu_retired_t	*retired;
+	uint64_t		oldest = UINT64_MAX;
+	unsigned int		pending;
+
+	rcu_global_init();
+
+	pthread_mutex_lock(&rcu_mutex);
+	fr_dlist_foreach(&rcu_readers, fr_rcu_reader_t, reader) {
+		uint64_t epoch = atomic_load_explicit(&reader->epoch, memory_order_acquire);
+
+		if (epoch && (epoch < oldest)) oldest = epoch;
+	}
+
+	while ((retired = fr_dlist_head(&rcu_retired)) && (retired->epoch <= oldest)) {
+		talloc_free(retired->ptr);
+		fr_dlist_talloc_free_item(&rcu_retired, retired);
+	}
+	pending = fr_dlist_num_elements(&rcu_retired);
+	atomic_store_explicit(&rcu_pending, pending, memory_order_relaxed);
+	pthread_mutex_unlock(&rcu_mutex);
+
+	return pending;
+}
+
+static int _rcu_thread_unregister(void *uctx)
+{
+	fr_rcu_reader_t *reader = uctx;
+
+	pthread_mutex_lock(&rcu_mutex);
+	fr_dlist_remove(&rcu_readers, reader);
+	pthread_mutex_unlock(&rcu_mutex);
+
+	talloc_free(reader);
+	rcu_reader = NULL;
+
+	return 0;
+}
+
+/** Register the current thread as one which reads #fr_rcu_ptr_t
+ *
+ * Registered threads must call #fr_rcu_quiescent regularly, or
+ * #fr_rcu_thread_offline before blocking, otherwise retired data
+ * will never be freed.
+ *
+ * The registration is removed automatically when the thread exits.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_rcu_thread_register(void)
+{
+	fr_rcu_reader_t *reader;
+
+	if (rcu_reader) return 0;
+
+	rcu_global_init();
+
+	reader = talloc_zero(NULL, fr_rcu_reader_t);
+	if (unlikely(!reader)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	atomic_init(&reader->epoch, atomic_load_explicit(&rcu_epoch, memory_order_seq_cst));
+
+	pthread_mutex_lock(&rcu_mutex);
+	fr_dlist_insert_tail(&rcu_readers, reader);
+	pthread_mutex_unlock(&rcu_mutex);
+
+	fr_atexit_thread_local(rcu_reader, _rcu_thread_unregister, reader);
+
+	return 0;
+}
+
+/** Remove the current thread's registration
+ *
+ */
+void fr_rcu_thread_unregister(void)
+{
+	if (!rcu_reader) return;
+
+	fr_atexit_thread_local_disarm(true, _rcu_thread_unregister, rcu_reader);
+	_rcu_thread_unregister(rcu_reader);
+}
+
+/** Signal that the current thread holds no references to shared data
+ *
+ * Also brings a thread back online after #fr_rcu_thread_offline.
+ */
+void fr_rcu_quiescent(void)
+{
+	if (!rcu_reader) return;
+
+	atomic_store_explicit(&rcu_reader->epoch, atomic_load_explicit(&rcu_epoch, memory_order_seq_cst),
+			      memory_order_seq_cst);
+
+	/*
+	 *	Coming back online, the store above must be visible
+	 *	before we load any pointers, otherwise a reclaimer
+	 *	could see us as offline, and free what we load.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load_explicit(&rcu_pending, memory_order_relaxed)) (void)fr_rcu_reclaim();
+}
+
+/** Signal that the current thread will not read shared data until it next calls #fr_rcu_quiescent
+ *
+ * Should be called before a reader blocks for an extended period.
+ */
+void fr_rcu_thread_offline(void)
+{
+	if (!rcu_reader) return;
+
+	atomic_store_explicit(&rcu_reader->epoch, 0, memory_order_seq_cst);
+
+	if (atomic_load_explicit(&rcu_pending, memory_order_relaxed)) (void)fr_rcu_reclaim();
+}
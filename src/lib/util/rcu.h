@@ -0,0 +1,84 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Quiescent state based reclamation of data shared between threads
+ *
+ * Data which is read by many threads, and occasionally replaced by one,
+ * is published through an #fr_rcu_ptr_t.  Readers load the pointer and
+ * use it without taking any locks, for as long as they don't pass through
+ * a quiescent state (for workers, the gap between processing requests).
+ *
+ * When the pointer is replaced, the old data is retired, and only freed
+ * once every registered reader thread has passed through a quiescent state,
+ * or gone offline.
+ *
+ * @file src/lib/util/rcu.h
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+RCSIDH(rcu_h, "$Id$")
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+#include <freeradius-devel/util/talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A pointer to data which may be replaced whilst other threads are reading it
+ *
+ */
+typedef struct {
+	_Atomic(void *)		ptr;		//!< Current version of the data.
+} fr_rcu_ptr_t;
+
+/** Return the current version of the data
+ *
+ * The data remains valid until the calling thread next passes through
+ * a quiescent state.
+ *
+ * @param[in] rp	to read.
+ * @return The current version of the data.
+ */
+static inline void *fr_rcu_ptr_read(fr_rcu_ptr_t *rp)
+{
+	return atomic_load_explicit(&rp->ptr, memory_order_acquire);
+}
+
+fr_rcu_ptr_t	*fr_rcu_ptr_alloc(TALLOC_CTX *ctx, void *ptr);
+
+int		fr_rcu_ptr_replace(fr_rcu_ptr_t *rp, void *ptr) CC_HINT(nonnull);
+
+int		fr_rcu_retire(void *ptr);
+
+unsigned int	fr_rcu_reclaim(void);
+
+int		fr_rcu_thread_register(void);
+
+void		fr_rcu_thread_unregister(void);
+
+void		fr_rcu_quiescent(void);
+
+void		fr_rcu_thread_offline(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,197 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the quiescent state based reclamation API
+ *
+ * @file src/lib/util/rcu_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include "rcu.h"
+
+static _Atomic(int) freed;
+
+typedef struct {
+	int		value;
+} rcu_test_data_t;
+
+static int _rcu_test_data_free(UNUSED rcu_test_data_t *data)
+{
+	freed++;
+	return 0;
+}
+
+static rcu_test_data_t *rcu_test_data_alloc(int value)
+{
+	rcu_test_data_t *data;
+
+	data = talloc(NULL, rcu_test_data_t);
+	data->value = value;
+	talloc_set_destructor(data, _rcu_test_data_free);
+
+	return data;
+}
+
+static void test_rcu_no_readers(void)
+{
+	fr_rcu_ptr_t	*rp;
+
+	freed = 0;
+
+	TEST_CASE("Replaced data is freed immediately if there are no readers");
+	rp = fr_rcu_ptr_alloc(NULL, rcu_test_data_alloc(1));
+	TEST_ASSERT(rp != NULL);
+
+	fr_rcu_ptr_replace(rp, rcu_test_data_alloc(2));
+	TEST_CHECK_RET(freed, 1);
+	TEST_CHECK_RET(((rcu_test_data_t *)fr_rcu_ptr_read(rp))->value, 2);
+
+	TEST_CASE("Freeing the pointer frees the current data");
+	talloc_free(rp);
+	TEST_CHECK_RET(freed, 2);
+}
+
+static void test_rcu_quiescent(void)
+{
+	fr_rcu_ptr_t	*rp;
+	rcu_test_data_t	*old;
+
+	freed = 0;
+
+	TEST_ASSERT(fr_rcu_thread_register() == 0);
+
+	rp = fr_rcu_ptr_alloc(NULL, rcu_test_data_alloc(1));
+	old = fr_rcu_ptr_read(rp);
+
+	TEST_CASE("Replaced data is kept whilst a reader may be using it");
+	fr_rcu_ptr_replace(rp, rcu_test_data_alloc(2));
+	TEST_CHECK_RET(freed, 0);
+	TEST_CHECK_RET(old->value, 1);
+	TEST_CHECK_RET((int)fr_rcu_reclaim(), 1);
+
+	TEST_CASE("Replaced data is freed once the reader is quiescent");
+	fr_rcu_quiescent();
+	TEST_CHECK_RET(freed, 1);
+	TEST_CHECK_RET((int)fr_rcu_reclaim(), 0);
+
+	TEST_CASE("Offline readers do not hold back reclamation");
+	fr_rcu_thread_offline();
+	fr_rcu_ptr_replace(rp, rcu_test_data_alloc(3));
+	TEST_CHECK_RET(freed, 2);
+	fr_rcu_quiescent();
+
+	TEST_CASE("Unregistered readers do not hold back reclamation");
+	fr_rcu_thread_unregister();
+	fr_rcu_ptr_replace(rp, rcu_test_data_alloc(4));
+	TEST_CHECK_RET(freed, 3);
+
+	talloc_free(rp);
+	TEST_CHECK_RET(freed, 4);
+}
+
+typedef struct {
+	fr_rcu_ptr_t		*rp;
+	_Atomic(bool)		stop;
+	_Atomic(uint64_t)	reads;
+	_Atomic(bool)		bad;
+} rcu_test_ctx_t;
+
+static void *rcu_test_reader(void *uctx)
+{
+	rcu_test_ctx_t	*ctx = uctx;
+
+	fr_rcu_thread_register();
+
+	while (!atomic_load(&ctx->stop)) {
+		rcu_test_data_t	*data = fr_rcu_ptr_read(ctx->rp);
+		int		value = data->value;
+
+		/*
+		 *	Values only ever increase, and the data must
+		 *	not have been freed (and poisoned) under us.
+		 */
+		if ((value <= 0) || (data->value != value)) atomic_store(&ctx->bad, true);
+
+		atomic_fetch_add(&ctx->reads, 1);
+		fr_rcu_quiescent();
+	}
+
+	return NULL;
+}
+
+static int _rcu_test_data_poison(rcu_test_data_t *data)
+{
+	data->value = -1;
+	freed++;
+	return 0;
+}
+
+static void test_rcu_threads(void)
+{
+	rcu_test_ctx_t	ctx = { .stop = false };
+	pthread_t	readers[4];
+	size_t		i;
+	int		j;
+
+	freed = 0;
+
+	ctx.rp = fr_rcu_ptr_alloc(NULL, rcu_test_data_alloc(1));
+
+	for (i = 0; i < NUM_ELEMENTS(readers); i++) pthread_create(&readers[i], NULL, rcu_test_reader, &ctx);
+
+	while (atomic_load(&ctx.reads) == 0) sched_yield();
+
+	TEST_CASE("Readers never see freed data");
+	for (j = 2; j < 10000; j++) {
+		rcu_test_data_t *data = rcu_test_data_alloc(j);
+
+		talloc_set_destructor(data, _rcu_test_data_poison);
+		fr_rcu_ptr_replace(ctx.rp, data);
+	}
+
+	atomic_store(&ctx.stop, true);
+	for (i = 0; i < NUM_ELEMENTS(readers); i++) pthread_join(readers[i], NULL);
+
+	TEST_CHECK(!atomic_load(&ctx.bad));
+	TEST_CHECK(atomic_load(&ctx.reads) > 0);
+
+	TEST_CASE("Everything is reclaimed once the readers exit");
+	TEST_CHECK_RET((int)fr_rcu_reclaim(), 0);
+	TEST_CHECK_RET(freed, 9998);
+
+	talloc_free(ctx.rp);
+}
+
+TEST_LIST = {
+	{ "fr_rcu_no_readers",		test_rcu_no_readers	},
+	{ "fr_rcu_quiescent",		test_rcu_quiescent	},
+	{ "fr_rcu_threads",		test_rcu_threads	},
+
+	{ NULL }
+};
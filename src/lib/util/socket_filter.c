@@ -0,0 +1,431 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Kernel side filtering of packets by source address
+ *
+ * The program loads the IP version from the network header, and then
+ * tests the source address against the rules for that version, most
+ * specific first.  Each rule ends in its own return instruction, as
+ * classic BPF conditional jumps can only skip 255 instructions.
+ *
+ * @file src/lib/util/socket_filter.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/socket_filter.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <sys/socket.h>
+
+#ifdef __linux__
+#  include <linux/filter.h>
+#  include <linux/sock_diag.h>
+#endif
+
+#ifdef SO_ATTACH_FILTER
+/*
+ *	The kernel charges filters against net.core.optmem_max, which
+ *	can be as small as 20K.  Start well under that, and make the
+ *	program smaller if the kernel still refuses it.
+ */
+#define FILTER_MAX_INSNS	(1024)
+#define FILTER_MIN_INSNS	(64)
+
+/*
+ *	Load the IP version, and jump to the rules for it.
+ */
+#define FILTER_HEADER_INSNS	(7)
+
+/** Sort rules by family, and then most specific first
+ *
+ */
+static int filter_rule_specific_cmp(void const *one, void const *two)
+{
+	fr_socket_filter_rule_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->network.af, b->network.af);
+	if (ret != 0) return ret;
+
+	return CMP(b->network.prefix, a->network.prefix);
+}
+
+/** Sort rules by family and address, with networks before the networks they contain
+ *
+ */
+static int filter_rule_network_cmp(void const *one, void const *two)
+{
+	fr_socket_filter_rule_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->network.af, b->network.af);
+	if (ret != 0) return ret;
+
+	if (a->network.af == AF_INET) {
+		ret = memcmp(&a->network.addr.v4.s_addr, &b->network.addr.v4.s_addr, sizeof(a->network.addr.v4.s_addr));
+	} else {
+		ret = memcmp(a->network.addr.v6.s6_addr, b->network.addr.v6.s6_addr, sizeof(a->network.addr.v6.s6_addr));
+	}
+	if (ret != 0) return ret;
+
+	return CMP(a->network.prefix, b->network.prefix);
+}
+
+/** Return true if network a contains network b
+ *
+ */
+static bool filter_network_contains(fr_ipaddr_t const *a, fr_ipaddr_t const *b)
+{
+	fr_ipaddr_t masked;
+
+	if ((a->af != b->af) || (a->prefix > b->prefix)) return false;
+
+	masked = *b;
+	fr_ipaddr_mask(&masked, a->prefix);
+
+	return (fr_ipaddr_cmp(&masked, a) == 0);
+}
+
+static size_t filter_rule_insns(fr_socket_filter_rule_t const *rule)
+{
+	uint8_t prefix = rule->network.prefix;
+
+	if (!prefix) return 1;
+
+	/*
+	 *	txa, and (unless it's a host), jeq, ret
+	 */
+	if (rule->network.af == AF_INET) return 3 + (prefix < 32);
+
+	/*
+	 *	ld, and (for a partial word), jeq for each word, then ret
+	 */
+	return (((prefix + 31) / 32) * 2) + ((prefix & 0x1f) != 0) + 1;
+}
+
+static size_t filter_insns(fr_socket_filter_rule_t const *rules, size_t num_rules)
+{
+	size_t i, insns;
+
+	/*
+	 *	Header, then "ld, tax, ... ret" for IPv4, and "... ret" for IPv6
+	 */
+	insns = FILTER_HEADER_INSNS + 2 + 1 + 1;
+
+	for (i = 0; i < num_rules; i++) insns += filter_rule_insns(&rules[i]);
+
+	return insns;
+}
+
+/** Remove rules which are contained in another rule
+ *
+ * Only valid when all the rules allow packets.
+ */
+static size_t filter_rules_prune(fr_socket_filter_rule_t *rules, size_t num_rules)
+{
+	size_t i, num = 0;
+
+	if (!num_rules) return 0;
+
+	qsort(rules, num_rules, sizeof(rules[0]), filter_rule_network_cmp);
+
+	for (i = 1; i < num_rules; i++) {
+		if (filter_network_contains(&rules[num].network, &rules[i].network)) continue;
+
+		rules[++num] = rules[i];
+	}
+
+	return num + 1;
+}
+
+/** Reduce a set of rules until the program fits in max_insns
+ *
+ * Dropping deny rules, and shortening the prefixes of allow rules, can
+ * only make the filter accept more packets, so the caller will still
+ * see every packet it wants.
+ */
+static fr_socket_filter_rule_t *filter_rules_reduce(TALLOC_CTX *ctx, size_t *out,
+						    fr_socket_filter_rule_t const *in, size_t num_in, size_t max_insns)
+{
+	static uint8_t const	v4_prefix[] = { 32, 24, 16, 8, 0 };
+	static uint8_t const	v6_prefix[] = { 128, 64, 48, 32, 0 };
+	fr_socket_filter_rule_t	*rules;
+	size_t			i, j, num_rules = 0;
+	bool			deny = false;
+
+	rules = talloc_array(ctx, fr_socket_filter_rule_t, num_in);
+	if (unlikely(!rules)) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	for (i = 0; i < num_in; i++) {
+		if ((in[i].network.af != AF_INET) && (in[i].network.af != AF_INET6)) continue;
+
+		rules[num_rules] = in[i];
+		fr_ipaddr_mask(&rules[num_rules].network, in[i].network.prefix);
+		if (!in[i].allow) deny = true;
+		num_rules++;
+	}
+
+	if (!deny) num_rules = filter_rules_prune(rules, num_rules);
+
+	if (filter_insns(rules, num_rules) <= max_insns) goto done;
+
+	for (i = 0, j = 0; i < num_rules; i++) {
+		if (rules[i].allow) rules[j++] = rules[i];
+	}
+	num_rules = j;
+
+	for (i = 0; i < NUM_ELEMENTS(v4_prefix); i++) {
+		for (j = 0; j < num_rules; j++) {
+			uint8_t prefix = (rules[j].network.af == AF_INET) ? v4_prefix[i] : v6_prefix[i];
+
+			if (rules[j].network.prefix > prefix) fr_ipaddr_mask(&rules[j].network, prefix);
+		}
+
+		num_rules = filter_rules_prune(rules, num_rules);
+		if (filter_insns(rules, num_rules) <= max_insns) break;
+	}
+
+done:
+	qsort(rules, num_rules, sizeof(rules[0]), filter_rule_specific_cmp);
+	*out = num_rules;
+
+	return rules;
+}
+
+static void filter_compile_rule(struct sock_filter *prog, size_t *pc, fr_socket_filter_rule_t const *rule)
+{
+	uint32_t	verdict = rule->allow ? UINT32_MAX : 0;
+	uint8_t		prefix = rule->network.prefix;
+	size_t		jeq[4];
+	size_t		i, words;
+
+	if (!prefix) {
+		prog[(*pc)++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, verdict);
+		return;
+	}
+
+	if (rule->network.af == AF_INET) {
+		prog[(*pc)++] = (struct sock_filter) BPF_STMT(BPF_MISC | BPF_TXA, 0);
+		if (prefix < 32) {
+			prog[(*pc)++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_AND | BPF_K,
+								      ~(UINT32_MAX >> prefix));
+		}
+		prog[(*pc)++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+							      ntohl(rule->network.addr.v4.s_addr), 0, 1);
+		prog[(*pc)++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, verdict);
+		return;
+	}
+
+	/*
+	 *	Compare the address a word at a time.  Any mismatch
+	 *	skips to the next rule.
+	 */
+	words = (prefix + 31) / 32;
+	for (i = 0; i < words; i++) {
+		uint32_t word;
+		uint8_t	 bits = (prefix >= ((i + 1) * 32)) ? 32 : prefix & 0x1f;
+
+		memcpy(&word, &rule->network.addr.v6.s6_addr[i * 4], sizeof(word));
+
+		prog[(*pc)++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+							      (uint32_t) SKF_NET_OFF + 8 + (i * 4));
+		if (bits < 32) {
+			prog[(*pc)++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_AND | BPF_K,
+								      ~(UINT32_MAX >> bits));
+		}
+		jeq[i] = (*pc)++;
+		prog[jeq[i]] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(word), 0, 0);
+	}
+
+	for (i = 0; i < words; i++) prog[jeq[i]].jf = *pc - jeq[i];
+
+	prog[(*pc)++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, verdict);
+}
+
+/** Compile rules into a classic BPF program of no more than max_insns instructions
+ *
+ */
+static struct sock_filter *filter_compile(TALLOC_CTX *ctx, size_t *len,
+					  fr_socket_filter_rule_t const *in, size_t num_in, size_t max_insns)
+{
+	fr_socket_filter_rule_t	*rules;
+	struct sock_filter	*prog;
+	size_t			i, num_rules, pc = FILTER_HEADER_INSNS;
+
+	rules = filter_rules_reduce(ctx, &num_rules, in, num_in, max_insns);
+	if (!rules) return NULL;
+
+	prog = talloc_array(ctx, struct sock_filter, filter_insns(rules, num_rules));
+	if (unlikely(!prog)) {
+		talloc_free(rules);
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	/*
+	 *	IPv4 - keep the source address in X, as every rule needs it
+	 */
+	prog[pc++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t) SKF_NET_OFF + 12);
+	prog[pc++] = (struct sock_filter) BPF_STMT(BPF_MISC | BPF_TAX, 0);
+	for (i = 0; (i < num_rules) && (rules[i].network.af == AF_INET); i++) filter_compile_rule(prog, &pc, &rules[i]);
+	prog[pc++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+	/*
+	 *	The header jumps are relative to the instruction after them.
+	 */
+	prog[0] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, (uint32_t) SKF_NET_OFF);
+	prog[1] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4);
+	prog[2] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 1);
+	prog[3] = (struct sock_filter) BPF_STMT(BPF_JMP | BPF_JA, FILTER_HEADER_INSNS - 4);
+	prog[4] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 1);
+	prog[5] = (struct sock_filter) BPF_STMT(BPF_JMP | BPF_JA, pc - 6);
+	prog[6] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+	/*
+	 *	IPv6
+	 */
+	for (; i < num_rules; i++) filter_compile_rule(prog, &pc, &rules[i]);
+	prog[pc++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+	fr_assert(pc == talloc_array_length(prog));
+	talloc_free(rules);
+	*len = pc;
+
+	return prog;
+}
+
+/** Attach a filter to a socket, so the kernel discards packets from unwanted sources
+ *
+ * Replaces any filter already attached to the socket.
+ *
+ * @param[in] sockfd		to filter.
+ * @param[in] rules		Source networks to accept or reject.  The most
+ *				specific match wins, and packets matching no rule
+ *				are rejected.
+ * @param[in] num_rules		How many rules there are.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  Any existing filter is left in place.
+ */
+int fr_socket_filter_attach(int sockfd, fr_socket_filter_rule_t const *rules, size_t num_rules)
+{
+	size_t	max_insns;
+	int	err = 0;
+
+	for (max_insns = FILTER_MAX_INSNS; max_insns >= FILTER_MIN_INSNS; max_insns /= 2) {
+		struct sock_fprog	fprog;
+		struct sock_filter	*prog;
+		size_t			len;
+		int			ret;
+
+		prog = filter_compile(NULL, &len, rules, num_rules, max_insns);
+		if (!prog) return -1;
+
+		fprog = (struct sock_fprog) {
+			.len = len,
+			.filter = prog
+		};
+		ret = setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+		err = errno;
+		talloc_free(prog);
+
+		if (ret == 0) return 0;
+
+		/*
+		 *	Too big for optmem_max, try again with
+		 *	less specific rules.
+		 */
+		if (err != ENOMEM) break;
+	}
+
+	fr_strerror_printf("Failed attaching socket filter: %s", fr_syserror(err));
+	return -1;
+}
+
+/** Remove any filter attached to a socket
+ *
+ * @param[in] sockfd	to remove the filter from.
+ * @return
+ *	- 0 on success, or if no filter was attached.
+ *	- -1 on failure.
+ */
+int fr_socket_filter_detach(int sockfd)
+{
+	int dummy = 0;
+
+	if ((setsockopt(sockfd, SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy)) < 0) && (errno != ENOENT)) {
+		fr_strerror_printf("Failed detaching socket filter: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#else
+int fr_socket_filter_attach(UNUSED int sockfd, UNUSED fr_socket_filter_rule_t const *rules, UNUSED size_t num_rules)
+{
+	fr_strerror_const("Socket filters are not supported on this platform");
+	return -1;
+}
+
+int fr_socket_filter_detach(UNUSED int sockfd)
+{
+	return 0;
+}
+#endif
+
+/** Return how many packets the kernel has discarded for a socket
+ *
+ * This includes packets rejected by the filter, and packets which
+ * arrived when the socket's receive buffer was full.
+ *
+ * @param[out] out	Where to write the count.
+ * @param[in] sockfd	to get the count for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_socket_filter_dropped(uint64_t *out, int sockfd)
+{
+#if defined(__linux__) && defined(SO_MEMINFO)
+	uint32_t	meminfo[SK_MEMINFO_VARS];
+	socklen_t	len = sizeof(meminfo);
+
+	if (getsockopt(sockfd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0) {
+		fr_strerror_printf("Failed getting socket statistics: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (len <= (SK_MEMINFO_DROPS * sizeof(meminfo[0]))) {
+		fr_strerror_const("Kernel did not return the count of dropped packets");
+		return -1;
+	}
+
+	*out = meminfo[SK_MEMINFO_DROPS];
+	return 0;
+#else
+	*out = 0;
+	fr_strerror_const("Counting dropped packets is not supported on this platform");
+	return -1;
+#endif
+}
@@ -0,0 +1,60 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Kernel side filtering of packets by source address
+ *
+ * A list of allowed and denied source networks is compiled into a
+ * classic BPF program, and attached to a socket.  Packets which the
+ * program rejects are discarded by the kernel, and never wake up the
+ * thread reading the socket.
+ *
+ * The filter is only ever an optimisation.  If the rules don't fit in
+ * a program the kernel will accept, they are made less specific until
+ * they do, so the filter may accept packets the caller would not.  It
+ * will never reject a packet the rules accept.
+ *
+ * @file src/lib/util/socket_filter.h
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+RCSIDH(socket_filter_h, "$Id$")
+
+#include <freeradius-devel/util/inet.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** One source network to accept or reject
+ *
+ * The most specific rule matching a packet's source address decides
+ * its fate.  Packets matching no rule are rejected.
+ */
+typedef struct {
+	fr_ipaddr_t		network;	//!< Source network.  Host bits must be zero.
+	bool			allow;		//!< Whether packets from the network are accepted.
+} fr_socket_filter_rule_t;
+
+int	fr_socket_filter_attach(int sockfd, fr_socket_filter_rule_t const *rules, size_t num_rules);
+
+int	fr_socket_filter_detach(int sockfd);
+
+int	fr_socket_filter_dropped(uint64_t *out, int sockfd) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
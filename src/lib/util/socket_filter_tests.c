@@ -0,0 +1,253 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for kernel side filtering of packets by source address
+ *
+ * @file src/lib/util/socket_filter_tests.c
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/strerror.h>
+
+#include <sys/socket.h>
+
+#include "socket_filter.h"
+
+/** Open a UDP socket bound to an address, with an ephemeral port
+ *
+ */
+static int test_socket(char const *addr, fr_ipaddr_t *ipaddr, uint16_t *port)
+{
+	struct sockaddr_storage	ss;
+	socklen_t		salen;
+	int			sockfd;
+
+	if (fr_inet_pton(ipaddr, addr, strlen(addr), AF_UNSPEC, false, true) < 0) return -1;
+	if (fr_ipaddr_to_sockaddr(&ss, &salen, ipaddr, 0) < 0) return -1;
+
+	sockfd = socket(ipaddr->af, SOCK_DGRAM, 0);
+	if (sockfd < 0) return -1;
+
+	if (bind(sockfd, (struct sockaddr *) &ss, salen) < 0) {
+		close(sockfd);
+		return -1;
+	}
+
+	if (port) {
+		salen = sizeof(ss);
+		(void) getsockname(sockfd, (struct sockaddr *) &ss, &salen);
+		(void) fr_ipaddr_from_sockaddr(ipaddr, port, &ss, salen);
+	}
+
+	return sockfd;
+}
+
+#ifdef SO_ATTACH_FILTER
+/** Send a packet from an address, and see if the filtered socket receives it
+ *
+ */
+static bool test_received(int sockfd, fr_ipaddr_t const *ipaddr, uint16_t port, char const *from)
+{
+	struct sockaddr_storage	ss;
+	socklen_t		salen;
+	fr_ipaddr_t		src;
+	uint8_t			buffer[16];
+	int			fd;
+	ssize_t			ret;
+
+	fd = test_socket(from, &src, NULL);
+	TEST_ASSERT(fd >= 0);
+	TEST_MSG("Failed binding to %s", from);
+
+	(void) fr_ipaddr_to_sockaddr(&ss, &salen, ipaddr, port);
+	TEST_CHECK(sendto(fd, "test", 4, 0, (struct sockaddr *) &ss, salen) == 4);
+	close(fd);
+
+	/*
+	 *	Loopback delivers (or drops) the packet before
+	 *	sendto() returns, so there's no need to wait.
+	 */
+	ret = recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+	return (ret == 4);
+}
+
+#define TEST_RULE(_addr, _allow) (fr_socket_filter_rule_t){ .network = test_network(_addr), .allow = _allow }
+
+static fr_ipaddr_t test_network(char const *addr)
+{
+	fr_ipaddr_t ipaddr;
+
+	(void) fr_inet_pton(&ipaddr, addr, strlen(addr), AF_UNSPEC, false, true);
+
+	return ipaddr;
+}
+
+static void test_ipv4(void)
+{
+	fr_ipaddr_t		ipaddr;
+	uint16_t		port;
+	int			sockfd;
+#ifdef SO_MEMINFO
+	uint64_t		dropped;
+#endif
+	fr_socket_filter_rule_t	rules[2];
+
+	sockfd = test_socket("127.0.0.1", &ipaddr, &port);
+	TEST_ASSERT(sockfd >= 0);
+
+	/*
+	 *	Only 127.0.0.1 is guaranteed to exist, so the rules
+	 *	change, and the source address stays the same.
+	 */
+	TEST_CASE("Only allowed sources are received");
+	rules[0] = TEST_RULE("127.0.0.1/32", true);
+	TEST_ASSERT(fr_socket_filter_attach(sockfd, rules, 1) == 0);
+	TEST_CHECK(test_received(sockfd, &ipaddr, port, "127.0.0.1"));
+
+	rules[0] = TEST_RULE("192.0.2.0/24", true);
+	TEST_ASSERT(fr_socket_filter_attach(sockfd, rules, 1) == 0);
+	TEST_CHECK(!test_received(sockfd, &ipaddr, port, "127.0.0.1"));
+
+#ifdef SO_MEMINFO
+	TEST_CASE("Rejected packets are counted");
+	TEST_CHECK(fr_socket_filter_dropped(&dropped, sockfd) == 0);
+	TEST_CHECK(dropped >= 1);
+#endif
+
+	TEST_CASE("More specific rules win");
+	rules[0] = TEST_RULE("127.0.0.0/8", true);
+	rules[1] = TEST_RULE("127.0.0.1/32", false);
+	TEST_ASSERT(fr_socket_filter_attach(sockfd, rules, 2) == 0);
+	TEST_CHECK(!test_received(sockfd, &ipaddr, port, "127.0.0.1"));
+
+	rules[0] = TEST_RULE("127.0.0.0/8", false);
+	rules[1] = TEST_RULE("127.0.0.1/32", true);
+	TEST_ASSERT(fr_socket_filter_attach(sockfd, rules, 2) == 0);
+	TEST_CHECK(test_received(sockfd, &ipaddr, port, "127.0.0.1"));
+
+	TEST_CASE("Detaching the filter allows everything");
+	rules[0] = TEST_RULE("127.0.0.1/32", false);
+	TEST_ASSERT(fr_socket_filter_attach(sockfd, rules, 1) == 0);
+	TEST_CHECK(!test_received(sockfd, &ipaddr, port, "127.0.0.1"));
+	TEST_CHECK(fr_socket_filter_detach(sockfd) == 0);
+	TEST_CHECK(test_received(sockfd, &ipaddr, port, "127.0.0.1"));
+
+	close(sockfd);
+}
+
+static void test_ipv6(void)
+{
+	fr_ipaddr_t		ipaddr;
+	uint16_t		port;
+	int			sockfd;
+	fr_socket_filter_rule_t	rules[2];
+
+	sockfd = test_socket("::1", &ipaddr, &port);
+	if (sockfd < 0) {
+		TEST_MSG("No IPv6 loopback, skipping");
+		return;
+	}
+
+	TEST_CASE("IPv6 sources are matched");
+	rules[0] = TEST_RULE("::1/128", true);
+	TEST_ASSERT(fr_socket_filter_attach(sockfd, rules, 1) == 0);
+	TEST_CHECK(test_received(sockfd, &ipaddr, port, "::1"));
+
+	rules[0] = TEST_RULE("::/0", true);
+	rules[1] = TEST_RULE("::1/128", false);
+	TEST_ASSERT(fr_socket_filter_attach(sockfd, rules, 2) == 0);
+	TEST_CHECK(!test_received(sockfd, &ipaddr, port, "::1"));
+
+	rules[0] = TEST_RULE("fe80::/10", true);
+	TEST_ASSERT(fr_socket_filter_attach(sockfd, rules, 1) == 0);
+	TEST_CHECK(!test_received(sockfd, &ipaddr, port, "::1"));
+
+	close(sockfd);
+}
+
+#define NUM_RULES 5000
+
+static void test_large(void)
+{
+	fr_ipaddr_t		ipaddr;
+	uint16_t		port;
+	int			sockfd;
+	fr_socket_filter_rule_t	*rules;
+	size_t			i;
+
+	sockfd = test_socket("127.0.0.1", &ipaddr, &port);
+	TEST_ASSERT(sockfd >= 0);
+
+	rules = talloc_array(NULL, fr_socket_filter_rule_t, NUM_RULES + 2);
+	for (i = 0; i < NUM_RULES; i++) {
+		uint32_t addr = htonl(0x0a000000 | (fr_rand() & 0x00ffffff));
+
+		rules[i] = (fr_socket_filter_rule_t) {
+			.network = { .af = AF_INET, .prefix = 32 },
+			.allow = true
+		};
+		memcpy(&rules[i].network.addr.v4.s_addr, &addr, sizeof(addr));
+	}
+	rules[i++] = TEST_RULE("127.0.0.1/32", true);
+	rules[i++] = TEST_RULE("192.0.2.0/24", false);
+
+	TEST_CASE("Too many rules are made less specific, without rejecting allowed sources");
+	TEST_ASSERT(fr_socket_filter_attach(sockfd, rules, NUM_RULES + 2) == 0);
+	TEST_CHECK(test_received(sockfd, &ipaddr, port, "127.0.0.1"));
+
+	talloc_free(rules);
+	close(sockfd);
+}
+#else
+static void test_not_supported(void)
+{
+	fr_ipaddr_t		ipaddr;
+	uint16_t		port;
+	int			sockfd;
+	fr_socket_filter_rule_t	rules[1];
+
+	sockfd = test_socket("127.0.0.1", &ipaddr, &port);
+	TEST_ASSERT(sockfd >= 0);
+
+	TEST_CASE("Attaching a filter fails");
+	rules[0] = (fr_socket_filter_rule_t){ .network = ipaddr, .allow = true };
+	TEST_CHECK(fr_socket_filter_attach(sockfd, rules, 1) < 0);
+	TEST_CHECK(strcmp(fr_strerror(), "Socket filters are not supported on this platform") == 0);
+	TEST_MSG("Got error \"%s\"", fr_strerror());
+
+	TEST_CASE("Detaching is a no-op");
+	TEST_CHECK(fr_socket_filter_detach(sockfd) == 0);
+
+	close(sockfd);
+}
+#endif
+
+TEST_LIST = {
+#ifdef SO_ATTACH_FILTER
+	{ "socket_filter_ipv4",		test_ipv4	},
+	{ "socket_filter_ipv6",		test_ipv6	},
+	{ "socket_filter_large",	test_large	},
+#else
+	{ "socket_filter_not_supported",	test_not_supported	},
+#endif
+
+	{ NULL }
+};
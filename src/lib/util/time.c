@@ -28,6 +28,12 @@ RCSID("$Id$")
 #include <freeradius-devel/autoconf.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef FR_TIME_HAVE_TSC
+#  include <cpuid.h>
+#endif
 
 int64_t const fr_time_multiplier_by_res[] = {
 	[FR_TIME_RES_NSEC]	= 1,
@@ -83,14 +89,185 @@ fr_table_num_ordered_t const fr_time_precision_table[] = {
 };
 size_t fr_time_precision_table_len = NUM_ELEMENTS(fr_time_precision_table);
 
+fr_table_num_sorted_t const fr_time_source_table[] = {
+	{ L("monotonic"),	FR_TIME_SOURCE_MONOTONIC },
+	{ L("monotonic_raw"),	FR_TIME_SOURCE_MONOTONIC_RAW },
+	{ L("tsc"),		FR_TIME_SOURCE_TSC }
+};
+size_t fr_time_source_table_len = NUM_ELEMENTS(fr_time_source_table);
+
 int64_t				fr_time_epoch;					//!< monotonic clock at boot, i.e. our epoch
 _Atomic int64_t			fr_time_monotonic_to_realtime;			//!< difference between the two clocks
+fr_time_source_t		fr_time_source = FR_TIME_SOURCE_MONOTONIC_RAW;	//!< what fr_time() reads
+
+#ifndef NDEBUG
+_Thread_local uint64_t		fr_time_reads;					//!< calls to fr_time() by this thread
+#endif
+
+#ifdef FR_TIME_HAVE_TSC
+fr_time_tsc_t			fr_time_tsc;					//!< current TSC conversion
+
+static uint64_t			tsc_calibrated_tsc;				//!< TSC when calibration started
+static int64_t			tsc_calibrated_ns;				//!< CLOCK_MONOTONIC_RAW when calibration started
+static uint64_t			tsc_mult;					//!< best estimate of ns per tick
+#endif
 
 static char const		*tz_names[2] = { NULL, NULL };	//!< normal, DST, from localtime_r(), tm_zone
 static long			gmtoff[2] = {0, 0};	       	//!< from localtime_r(), tm_gmtoff
 static bool			isdst = false;			//!< from localtime_r(), tm_is_dst
 
 
+#ifdef FR_TIME_HAVE_TSC
+/** Read the TSC and CLOCK_MONOTONIC_RAW as close together as we can
+ *
+ * Takes the pair with the smallest number of ticks between the two TSC
+ * reads either side of clock_gettime(), so that a preemption or an SMI
+ * doesn't skew the result.
+ */
+static int time_tsc_pair(uint64_t *tsc, int64_t *ns)
+{
+	int		i;
+	uint64_t	best = UINT64_MAX;
+
+	for (i = 0; i < 5; i++) {
+		struct timespec	ts;
+		uint64_t	before, after;
+
+		before = __rdtsc();
+		if (clock_gettime(CLOCK_MONOTONIC_RAW, &ts) < 0) return -1;
+		after = __rdtsc();
+
+		if ((after - before) >= best) continue;
+
+		best = after - before;
+		*tsc = before + (best / 2);
+		*ns = fr_time_delta_unwrap(fr_time_delta_from_timespec(&ts));
+	}
+
+	return 0;
+}
+
+/** Calculate nanoseconds per tick, shifted left by #FR_TIME_TSC_SHIFT
+ *
+ */
+static inline uint64_t time_tsc_mult(uint64_t ticks, int64_t ns)
+{
+	return (uint64_t)(((unsigned __int128)ns << FR_TIME_TSC_SHIFT) / ticks);
+}
+
+/** Check the CPU has a TSC which ticks at a constant rate, and in all C-states
+ *
+ */
+static bool time_tsc_invariant(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || (eax < 0x80000007)) return false;
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+
+	return (edx & (1 << 8)) != 0;
+}
+
+/** Update the TSC conversion used by fr_time()
+ *
+ * Only one thread may call this.
+ */
+static void time_tsc_publish(uint64_t tsc, int64_t ns, uint64_t mult)
+{
+	uint64_t seq = atomic_load_explicit(&fr_time_tsc.seq, memory_order_relaxed);
+
+	atomic_store_explicit(&fr_time_tsc.seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	atomic_store_explicit(&fr_time_tsc.tsc, tsc, memory_order_relaxed);
+	atomic_store_explicit(&fr_time_tsc.ns, ns, memory_order_relaxed);
+	atomic_store_explicit(&fr_time_tsc.mult, mult, memory_order_relaxed);
+
+	atomic_store_explicit(&fr_time_tsc.seq, seq + 2, memory_order_release);
+}
+
+/** Measure the TSC frequency against CLOCK_MONOTONIC_RAW
+ *
+ * This is only a first estimate.  time_tsc_resync() refines it
+ * using the whole period since calibration.
+ *
+ * @param[in] epoch	CLOCK_MONOTONIC_RAW value which fr_time() should
+ *			count from.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int time_tsc_calibrate(int64_t epoch)
+{
+	uint64_t	tsc;
+	int64_t		ns;
+
+	if (time_tsc_pair(&tsc_calibrated_tsc, &tsc_calibrated_ns) < 0) return -1;
+
+	/*
+	 *	10ms is enough to get within a few ppm, and
+	 *	this is done once at startup.
+	 */
+	do {
+		if (time_tsc_pair(&tsc, &ns) < 0) return -1;
+	} while ((ns - tsc_calibrated_ns) < (NSEC / 100));
+
+	if (tsc <= tsc_calibrated_tsc) {
+		fr_strerror_const("TSC did not advance during calibration");
+		return -1;
+	}
+
+	tsc_mult = time_tsc_mult(tsc - tsc_calibrated_tsc, ns - tsc_calibrated_ns);
+
+	time_tsc_publish(tsc, ns - epoch, tsc_mult);
+
+	return 0;
+}
+
+/** Correct the TSC conversion for drift against CLOCK_MONOTONIC_RAW
+ *
+ * The TSC derived time is never stepped, as other threads may
+ * already have seen it.  Instead the rate is adjusted so that any
+ * error is slewed out by the next resync, which is assumed to be
+ * about as far away as the last one.
+ *
+ * Only one thread may call this.
+ */
+static int time_tsc_resync(void)
+{
+	uint64_t		cur_tsc = atomic_load_explicit(&fr_time_tsc.tsc, memory_order_relaxed);
+	int64_t			cur_ns = atomic_load_explicit(&fr_time_tsc.ns, memory_order_relaxed);
+	uint64_t		cur_mult = atomic_load_explicit(&fr_time_tsc.mult, memory_order_relaxed);
+	uint64_t		tsc, ticks;
+	int64_t			ns, now, error, slew, limit;
+
+	if (time_tsc_pair(&tsc, &ns) < 0) return -1;
+	if (tsc <= cur_tsc) return 0;
+
+	/*
+	 *	The longer the baseline, the better the estimate.
+	 */
+	tsc_mult = time_tsc_mult(tsc - tsc_calibrated_tsc, ns - tsc_calibrated_ns);
+
+	ticks = tsc - cur_tsc;
+	now = cur_ns + (int64_t)(((unsigned __int128)ticks * cur_mult) >> FR_TIME_TSC_SHIFT);
+	error = (ns - fr_time_epoch) - now;
+
+	/*
+	 *	Don't slew by more than half the rate in either
+	 *	direction, so the clock always moves forwards.
+	 */
+	limit = (int64_t)(tsc_mult / 2);
+	slew = (int64_t)(((__int128)error * ((__int128)1 << FR_TIME_TSC_SHIFT)) / (__int128)ticks);
+	if (slew > limit) slew = limit;
+	if (slew < -limit) slew = -limit;
+
+	time_tsc_publish(tsc, now, (uint64_t)((int64_t)tsc_mult + slew));
+
+	return 0;
+}
+#endif
+
 /** Get a new fr_time_monotonic_to_realtime value
  *
  * Should be done regularly to adjust for changes in system time.
@@ -110,17 +287,22 @@ int fr_time_sync(void)
 	 *	So to convert a realtime timeval to fr_time we just subtract fr_time_monotonic_to_realtime from the timeval,
 	 *	which leaves the number of nanoseconds elapsed since our epoch.
 	 */
-	struct timespec ts_realtime, ts_monotime;
+	struct timespec ts_realtime;
+	fr_time_t now_monotime;
+
+#ifdef FR_TIME_HAVE_TSC
+	if ((fr_time_source == FR_TIME_SOURCE_TSC) && (time_tsc_resync() < 0)) return -1;
+#endif
 
 	/*
 	 *	Call these consecutively to minimise drift...
 	 */
 	if (clock_gettime(CLOCK_REALTIME, &ts_realtime) < 0) return -1;
-	if (clock_gettime(CLOCK_MONOTONIC_RAW, &ts_monotime) < 0) return -1;
+	now_monotime = fr_time();
 
 	atomic_store_explicit(&fr_time_monotonic_to_realtime,
 			      fr_time_delta_unwrap(fr_time_delta_from_timespec(&ts_realtime)) -
-			      (fr_time_delta_unwrap(fr_time_delta_from_timespec(&ts_monotime)) - fr_time_epoch),
+			      fr_time_unwrap(now_monotime),
 			      memory_order_release);
 
 	now = ts_realtime.tv_sec;
@@ -159,6 +341,70 @@ int fr_time_start(void)
 	return fr_time_sync();
 }
 
+/** Change the clock fr_time() reads
+ *
+ * fr_time() carries on from where it was, so times taken with the
+ * previous source remain comparable.
+ *
+ * MUST be called before any other threads are started, as fr_time()
+ * doesn't synchronise with the change.
+ *
+ * @param[in] source	to switch to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The source is left unchanged.
+ */
+int fr_time_source_set(fr_time_source_t source)
+{
+	struct timespec	ts;
+	fr_time_t	now;
+	int64_t		epoch;
+
+	if (source == fr_time_source) return 0;
+
+	switch (source) {
+	case FR_TIME_SOURCE_MONOTONIC_RAW:
+	case FR_TIME_SOURCE_MONOTONIC:
+		break;
+
+	case FR_TIME_SOURCE_TSC:
+#ifdef FR_TIME_HAVE_TSC
+		if (!time_tsc_invariant()) {
+			fr_strerror_const("CPU does not have an invariant TSC");
+			return -1;
+		}
+		break;
+#else
+		fr_strerror_const("TSC time source is not supported on this platform");
+		return -1;
+#endif
+
+	default:
+		fr_strerror_printf("Invalid time source %u", source);
+		return -1;
+	}
+
+	/*
+	 *	Read the new clock after the old one, so time
+	 *	can't go backwards.
+	 */
+	now = fr_time();
+	if (clock_gettime((source == FR_TIME_SOURCE_MONOTONIC) ? CLOCK_MONOTONIC : CLOCK_MONOTONIC_RAW, &ts) < 0) {
+		fr_strerror_printf("Failed reading clock: %s", fr_syserror(errno));
+		return -1;
+	}
+	epoch = fr_time_delta_unwrap(fr_time_delta_from_timespec(&ts)) - fr_time_unwrap(now);
+
+#ifdef FR_TIME_HAVE_TSC
+	if ((source == FR_TIME_SOURCE_TSC) && (time_tsc_calibrate(epoch) < 0)) return -1;
+#endif
+
+	fr_time_epoch = epoch;
+	fr_time_source = source;
+
+	return fr_time_sync();
+}
+
 /** Return time delta from the time zone.
  *
  * Returns the delta between UTC and the timezone specified by tz
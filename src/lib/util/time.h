@@ -60,6 +60,19 @@ typedef enum {
 	FR_TIME_RES_NSEC
 } fr_time_res_t;
 
+/** Where fr_time() gets its time from
+ *
+ */
+typedef enum {
+	FR_TIME_SOURCE_MONOTONIC_RAW = 0,		//!< clock_gettime(CLOCK_MONOTONIC_RAW).  Not adjusted
+							///< by NTP, but not vDSO accelerated on many kernels
+							///< and virtualised clock sources.
+	FR_TIME_SOURCE_MONOTONIC,			//!< clock_gettime(CLOCK_MONOTONIC).  vDSO accelerated
+							///< nearly everywhere.
+	FR_TIME_SOURCE_TSC				//!< The invariant TSC, calibrated against CLOCK_MONOTONIC_RAW
+							///< and resynced by fr_time_sync().
+} fr_time_source_t;
+
 /** "server local" time.  This is the time in nanoseconds since the application started.
  *
  *  This time is our *private* view of time.  It should only be used
@@ -115,6 +128,8 @@ extern "C" {
 extern int64_t const			fr_time_multiplier_by_res[];
 extern fr_table_num_ordered_t const	fr_time_precision_table[];
 extern size_t				fr_time_precision_table_len;
+extern fr_table_num_sorted_t const	fr_time_source_table[];
+extern size_t				fr_time_source_table_len;
 
 static bool fr_time_op_ispos(bool a, bool op, bool b)
 {
@@ -395,15 +410,53 @@ typedef struct {
 
 
 /*
- *	The value of clock_gettime(CLOCK_MONOTONIC_RAW) when we started.  i.e. our epoch.
+ *	The value of the clock fr_time() reads when we started.  i.e. our epoch.
  */
 extern int64_t				fr_time_epoch;
 
 /*
- *	The offset from CLOCK_MONOTONIC_RAW to CLOCK_REALTIME.
+ *	The offset from fr_time() to CLOCK_REALTIME.
  */
 extern _Atomic int64_t			fr_time_monotonic_to_realtime;
 
+/*
+ *	Which clock fr_time() reads.
+ */
+extern fr_time_source_t			fr_time_source;
+
+#ifndef NDEBUG
+/*
+ *	How many times this thread has called fr_time().  Used by
+ *	the tests to check how often the clock is read per request.
+ */
+extern _Thread_local uint64_t		fr_time_reads;
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  include <x86intrin.h>
+#  define FR_TIME_HAVE_TSC 1
+
+/** Fixed point shift for #fr_time_tsc_t mult
+ */
+#  define FR_TIME_TSC_SHIFT	(32)
+
+/** Conversion from TSC ticks to fr_time_t
+ *
+ * fr_time_sync() makes seq odd while it updates the other fields,
+ * and even again once they're consistent.  Readers retry if seq was
+ * odd, or changed while they were reading.
+ */
+typedef struct {
+	_Atomic uint64_t	seq;				//!< Sequence counter.
+	_Atomic uint64_t	tsc;				//!< TSC value at the last resync.
+	_Atomic int64_t		ns;				//!< fr_time() value at the last resync.
+	_Atomic uint64_t	mult;				//!< Nanoseconds per tick, shifted left by
+								///< #FR_TIME_TSC_SHIFT.
+} fr_time_tsc_t;
+
+extern fr_time_tsc_t			fr_time_tsc;
+#endif
+
 /** @name fr_unix_time_t scale conversion macros/functions
  *
  * @{
@@ -962,12 +1015,53 @@ static inline int8_t fr_unix_time_cmp(fr_unix_time_t a, fr_unix_time_t b)
 static inline fr_time_t fr_time(void)
 {
 	struct timespec ts;
-	(void) clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+#ifndef NDEBUG
+	fr_time_reads++;
+#endif
+
+	switch (fr_time_source) {
+#ifdef FR_TIME_HAVE_TSC
+	case FR_TIME_SOURCE_TSC:
+	{
+		uint64_t	seq, tsc, mult;
+		int64_t		ns, ticks;
+
+		do {
+			seq = atomic_load_explicit(&fr_time_tsc.seq, memory_order_acquire);
+			tsc = atomic_load_explicit(&fr_time_tsc.tsc, memory_order_relaxed);
+			ns = atomic_load_explicit(&fr_time_tsc.ns, memory_order_relaxed);
+			mult = atomic_load_explicit(&fr_time_tsc.mult, memory_order_relaxed);
+			atomic_thread_fence(memory_order_acquire);
+		} while (unlikely((seq & 1) || (seq != atomic_load_explicit(&fr_time_tsc.seq, memory_order_relaxed))));
+
+		ticks = (int64_t)(__rdtsc() - tsc);
+
+		/*
+		 *	Another core can be a few ticks behind the
+		 *	one which did the last resync.
+		 */
+		if (unlikely(ticks < 0)) ticks = 0;
+
+		return fr_time_wrap(ns + (int64_t)(((unsigned __int128)ticks * mult) >> FR_TIME_TSC_SHIFT));
+	}
+#endif
+
+	case FR_TIME_SOURCE_MONOTONIC:
+		(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+		break;
+
+	default:
+		(void) clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+		break;
+	}
+
 	return fr_time_wrap(fr_time_delta_unwrap(fr_time_delta_from_timespec(&ts)) - fr_time_epoch);
 }
 
 int		fr_time_start(void);
 int		fr_time_sync(void);
+int		fr_time_source_set(fr_time_source_t source);
 
 int64_t		fr_time_scale(int64_t t, fr_time_res_t hint);
 
@@ -24,6 +24,15 @@
 #include <freeradius-devel/util/acutest_helpers.h>
 #include <freeradius-devel/util/time.h>
 
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #define ROUNDS (100000)
 
 DIAG_OFF(unused-but-set-variable)
@@ -47,10 +56,151 @@ static void time_benchmark(void)
 	/* shared runners are terrible for performance tests */
 	if (!getenv("NO_PERFORMANCE_TESTS")) TEST_CHECK(rate > (ROUNDS * 10));
 }
+
+/** Cost of a single fr_time() call with each of the time sources
+ *
+ */
+static void time_source_benchmark(void)
+{
+	size_t i;
+
+	for (i = 0; i < fr_time_source_table_len; i++) {
+		fr_time_source_t	source = fr_time_source_table[i].value;
+		char const		*name = fr_time_source_table[i].name.str;
+		fr_time_t		start, stop;
+		int			j;
+
+		TEST_CASE(name);
+		if (fr_time_source_set(source) < 0) {
+			TEST_MSG("Skipping %s - %s", name, fr_strerror());
+			continue;
+		}
+
+		start = fr_time();
+		for (j = 0; j < ROUNDS; j++) {
+			volatile fr_time_t now;
+
+			now = fr_time();
+		}
+		stop = fr_time();
+
+		printf("%-14s %5.1f ns per read\n", name,
+		       (double)fr_time_delta_unwrap(fr_time_sub(stop, start)) / ROUNDS);
+	}
+
+	TEST_CHECK(fr_time_source_set(FR_TIME_SOURCE_MONOTONIC_RAW) == 0);
+}
 DIAG_ON(unused-but-set-variable)
 
+/** Switching sources must not step time, and every source must keep time
+ *
+ */
+static void time_source_switch(void)
+{
+	size_t i;
+
+	for (i = 0; i < fr_time_source_table_len; i++) {
+		fr_time_source_t	source = fr_time_source_table[i].value;
+		char const		*name = fr_time_source_table[i].name.str;
+		struct timespec		ts;
+		int64_t			raw_start, raw_elapsed;
+		fr_time_t		before, start, stop;
+
+		TEST_CASE(name);
+		before = fr_time();
+		if (fr_time_source_set(source) < 0) {
+			TEST_MSG("Skipping %s - %s", name, fr_strerror());
+			continue;
+		}
+		start = fr_time();
+		TEST_CHECK(fr_time_gteq(start, before));
+		TEST_MSG("Time went backwards by %" PRId64 "ns", fr_time_delta_unwrap(fr_time_sub(before, start)));
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+		raw_start = fr_time_delta_unwrap(fr_time_delta_from_timespec(&ts));
+
+		usleep(50000);
+		TEST_CHECK(fr_time_sync() == 0);
+		usleep(50000);
+
+		stop = fr_time();
+		clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+		raw_elapsed = fr_time_delta_unwrap(fr_time_delta_from_timespec(&ts)) - raw_start;
+
+		/*
+		 *	Generous, as NTP may be slewing CLOCK_MONOTONIC.
+		 */
+		TEST_CHECK(llabs(fr_time_delta_unwrap(fr_time_sub(stop, start)) - raw_elapsed) < (raw_elapsed / 100));
+		TEST_MSG("%s measured %" PRId64 "ns, CLOCK_MONOTONIC_RAW measured %" PRId64 "ns",
+			 name, fr_time_delta_unwrap(fr_time_sub(stop, start)), raw_elapsed);
+	}
+
+	TEST_CHECK(fr_time_source_set(FR_TIME_SOURCE_MONOTONIC_RAW) == 0);
+}
+
+typedef struct {
+	atomic_bool	stop;
+	atomic_bool	backwards;
+	_Atomic int	reads;
+} time_sync_ctx_t;
+
+static void *time_sync_reader(void *uctx)
+{
+	time_sync_ctx_t	*ctx = uctx;
+	fr_time_t	last = fr_time(), now;
+
+	while (!atomic_load(&ctx->stop)) {
+		now = fr_time();
+		if (fr_time_lt(now, last)) atomic_store(&ctx->backwards, true);
+		last = now;
+
+		atomic_fetch_add(&ctx->reads, 1);
+	}
+
+	return NULL;
+}
+
+/** Readers must never see a partially updated conversion while fr_time_sync() runs
+ *
+ */
+static void time_source_sync_concurrent(void)
+{
+	size_t i;
+
+	for (i = 0; i < fr_time_source_table_len; i++) {
+		fr_time_source_t	source = fr_time_source_table[i].value;
+		char const		*name = fr_time_source_table[i].name.str;
+		time_sync_ctx_t		ctx = { .stop = false };
+		pthread_t		readers[4];
+		size_t			j;
+		int			k;
+
+		TEST_CASE(name);
+		if (fr_time_source_set(source) < 0) {
+			TEST_MSG("Skipping %s - %s", name, fr_strerror());
+			continue;
+		}
+
+		for (j = 0; j < NUM_ELEMENTS(readers); j++) pthread_create(&readers[j], NULL, time_sync_reader, &ctx);
+		while (atomic_load(&ctx.reads) == 0) sched_yield();
+
+		for (k = 0; k < 1000; k++) TEST_CHECK(fr_time_sync() == 0);
+
+		atomic_store(&ctx.stop, true);
+		for (j = 0; j < NUM_ELEMENTS(readers); j++) pthread_join(readers[j], NULL);
+
+		TEST_CHECK(!atomic_load(&ctx.backwards));
+		TEST_MSG("%s went backwards", name);
+	}
+
+	TEST_CHECK(fr_time_source_set(FR_TIME_SOURCE_MONOTONIC_RAW) == 0);
+}
+
 TEST_LIST = {
 	{ "time_const_benchmark",		time_benchmark },
+	{ "time_source_benchmark",		time_source_benchmark },
+	{ "time_source_switch",			time_source_switch },
+	{ "time_source_sync_concurrent",	time_source_sync_concurrent },
 
 	{ 0 }
 };
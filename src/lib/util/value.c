@@ -3632,6 +3632,14 @@ void fr_value_box_clear_value(fr_value_box_t *data)
 	switch (data->type) {
 	case FR_TYPE_OCTETS:
 	case FR_TYPE_STRING:
+		/*
+		 *	Borrowed buffers aren't ours to free, and shared
+		 *	buffers are still in use by other boxes.  Our link
+		 *	to a shared buffer is released when whatever ctx
+		 *	holds it is freed.
+		 */
+		if (data->borrowed || fr_value_box_is_shared(data)) break;
+
 		if (data->secret) memset_explicit(data->datum.ptr, 0, data->vb_length);
 		talloc_free(data->datum.ptr);
 		break;
@@ -3661,6 +3669,7 @@ void fr_value_box_clear_value(fr_value_box_t *data)
 	}
 
 	memset(&data->datum, 0, sizeof(data->datum));
+	data->borrowed = false;
 }
 
 /** Clear/free any existing value and metadata
@@ -3675,6 +3684,46 @@ void fr_value_box_clear(fr_value_box_t *data)
 	fr_value_box_init(data, FR_TYPE_NULL, NULL, false);
 }
 
+/** Give a box its own copy of a buffer it shares with other boxes
+ *
+ * Called before any operation which modifies a string or octets buffer
+ * in place, so that writes are never visible to the other boxes sharing
+ * the buffer.
+ *
+ * @param[in] ctx	to allocate the new buffer in.  If ctx holds a link
+ *			to the shared buffer, the link is released.
+ * @param[in] vb	to unshare.
+ * @return
+ *	- 0 on success (or if the buffer wasn't shared).
+ *	- -1 on failure.
+ */
+static int value_box_unshare(TALLOC_CTX *ctx, fr_value_box_t *vb)
+{
+	void *old = vb->datum.ptr, *new;
+
+	if (!fr_value_box_is_shared(vb)) return 0;
+
+	new = talloc_memdup(ctx, old, talloc_get_size(old));
+	if (!new) {
+		fr_strerror_const("Failed copying shared buffer");
+		return -1;
+	}
+	talloc_set_name_const(new, talloc_get_name(old));
+
+	/*
+	 *	If ctx doesn't hold a link to the old buffer, the
+	 *	link belongs to some other ctx, and won't be released
+	 *	until that ctx is freed.  That's a caller bug, but
+	 *	the box is still safe to write to.
+	 */
+	if (ctx) (void) fr_cond_assert_msg(talloc_unlink(ctx, old) == 0,
+					   "Shared %s buffer %p isn't linked to ctx %p (%s)",
+					   talloc_get_name(old), old, ctx, talloc_get_name(ctx));
+	vb->datum.ptr = new;
+
+	return 0;
+}
+
 /** Copy value data verbatim duplicating any buffers
  *
  * @note Will free any exiting buffers associated with the dst #fr_value_box_t.
@@ -3774,7 +3823,9 @@ int fr_value_box_copy(TALLOC_CTX *ctx, fr_value_box_t *dst, const fr_value_box_t
  * Like #fr_value_box_copy, but does not duplicate the buffers of the src value_box.
  *
  * For #FR_TYPE_STRING and #FR_TYPE_OCTETS adds a reference from ctx so that the
- * buffer cannot be freed until the ctx is freed.
+ * buffer cannot be freed until the ctx is freed.  While the buffer is referenced
+ * it's treated as shared, and any box sharing it makes a private copy before
+ * modifying it.
  *
  * @param[in] ctx	to add reference from.  If NULL no reference will be added.
  * @param[in] dst	to copy value to.
@@ -3789,8 +3840,9 @@ void fr_value_box_copy_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_bo
 
 	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
-		dst->datum.ptr = ctx ? talloc_reference(ctx, src->datum.ptr) : src->datum.ptr;
+		dst->datum.ptr = (ctx && !src->borrowed) ? talloc_reference(ctx, src->datum.ptr) : src->datum.ptr;
 		fr_value_box_copy_meta(dst, src);
+		dst->borrowed = src->borrowed;
 		break;
 	}
 }
@@ -3816,6 +3868,12 @@ int fr_value_box_steal(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_t *src
 	{
 		char const *str;
 
+		/*
+		 *	Shared buffers have other owners, so
+		 *	can't be moved.
+		 */
+		if (fr_value_box_is_shared(src)) return fr_value_box_copy(ctx, dst, src);
+
 		str = talloc_steal(ctx, src->vb_strvalue);
 		if (!str) {
 			fr_strerror_const("Failed stealing string buffer");
@@ -3832,6 +3890,8 @@ int fr_value_box_steal(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_t *src
 	{
 		uint8_t const *bin;
 
+		if (fr_value_box_is_shared(src)) return fr_value_box_copy(ctx, dst, src);
+
  		bin = talloc_steal(ctx, src->vb_octets);
 		if (!bin) {
 			fr_strerror_const("Failed stealing octets buffer");
@@ -3906,6 +3966,8 @@ int fr_value_box_strtrim(TALLOC_CTX *ctx, fr_value_box_t *vb)
 
 	if (!fr_cond_assert(vb->type == FR_TYPE_STRING)) return -1;
 
+	if (unlikely(value_box_unshare(ctx, vb) < 0)) return -1;
+
 	len = strlen(vb->vb_strvalue);
 	str = talloc_realloc(ctx, UNCONST(char *, vb->vb_strvalue), char, len + 1);
 	if (!str) {
@@ -3988,6 +4050,7 @@ void fr_value_box_strdup_shallow(fr_value_box_t *dst, fr_dict_attr_t const *enum
 	fr_value_box_init(dst, FR_TYPE_STRING, enumv, tainted);
 	dst->vb_strvalue = src;
 	dst->vb_length = strlen(src);
+	dst->borrowed = true;
 }
 
 /** Free the existing buffer (if talloced) associated with the valuebox, and replace it with a new one
@@ -4003,6 +4066,7 @@ void fr_value_box_strdup_shallow_replace(fr_value_box_t *vb, char const *src, ss
 	fr_value_box_clear_value(vb);
 	vb->vb_strvalue = src;
 	vb->vb_length = len < 0 ? strlen(src) : (size_t)len;
+	vb->borrowed = true;
 }
 
 /** Alloc and assign an empty \0 terminated string to a #fr_value_box_t
@@ -4058,10 +4122,15 @@ int fr_value_box_bstr_realloc(TALLOC_CTX *ctx, char **out, fr_value_box_t *dst,
 
 	fr_assert(dst->type == FR_TYPE_STRING);
 
+	if (unlikely(value_box_unshare(ctx, dst) < 0)) return -1;
+
 	memcpy(&cstr, &dst->vb_strvalue, sizeof(cstr));
 
 	clen = talloc_array_length(dst->vb_strvalue) - 1;
-	if (clen == len) return 0;	/* No change */
+	if (clen == len) {		/* No change */
+		if (out) *out = cstr;
+		return 0;
+	}
 
 	str = talloc_realloc(ctx, cstr, char, len + 1);
 	if (!str) {
@@ -4184,6 +4253,7 @@ void fr_value_box_bstrndup_shallow(fr_value_box_t *dst, fr_dict_attr_t const *en
 	fr_value_box_init(dst, FR_TYPE_STRING, enumv, tainted);
 	dst->vb_strvalue = src;
 	dst->vb_length = len;
+	dst->borrowed = true;
 }
 
 /** Assign a talloced buffer containing a nul terminated string to a box, but don't copy it
@@ -4244,13 +4314,10 @@ int fr_value_box_bstrn_append(TALLOC_CTX *ctx, fr_value_box_t *dst, char const *
 		return -1;
 	}
 
-	ptr = dst->datum.ptr;
-	if (!fr_cond_assert(ptr)) return -1;
+	if (!fr_cond_assert(dst->datum.ptr)) return -1;
 
-	if (talloc_reference_count(ptr) > 0) {
-		fr_strerror_printf("%s: Boxed value has too many references", __FUNCTION__);
-		return -1;
-	}
+	if (unlikely(value_box_unshare(ctx, dst) < 0)) return -1;
+	ptr = dst->datum.ptr;
 
 	nlen = dst->vb_length + len + 1;
 	nptr = talloc_realloc(ctx, ptr, char, dst->vb_length + len + 1);
@@ -4358,10 +4425,15 @@ int fr_value_box_mem_realloc(TALLOC_CTX *ctx, uint8_t **out, fr_value_box_t *dst
 
 	fr_assert(dst->type == FR_TYPE_OCTETS);
 
+	if (unlikely(value_box_unshare(ctx, dst) < 0)) return -1;
+
 	memcpy(&cbin, &dst->vb_octets, sizeof(cbin));
 
 	clen = talloc_array_length(dst->vb_octets);
-	if (clen == len) return 0;	/* No change */
+	if (clen == len) {		/* No change */
+		if (out) *out = cbin;
+		return 0;
+	}
 
 	/*
 	 *	Realloc the buffer.  If the new length is 0, we
@@ -4500,6 +4572,7 @@ void fr_value_box_memdup_shallow(fr_value_box_t *dst, fr_dict_attr_t const *enum
 	fr_value_box_init(dst, FR_TYPE_OCTETS, enumv, tainted);
 	dst->vb_octets = src;
 	dst->vb_length = len;
+	dst->borrowed = true;
 }
 
 /** Assign a talloced buffer to a box, but don't copy it
@@ -4549,10 +4622,7 @@ int fr_value_box_mem_append(TALLOC_CTX *ctx, fr_value_box_t *dst, uint8_t const
 
 	if (!fr_cond_assert(dst->datum.ptr)) return -1;
 
-	if (talloc_reference_count(dst->datum.ptr) > 0) {
-		fr_strerror_printf("%s: Boxed value has too many references", __FUNCTION__);
-		return -1;
-	}
+	if (unlikely(value_box_unshare(ctx, dst) < 0)) return -1;
 
 	nlen = dst->vb_length + len;
 	nptr = talloc_realloc(ctx, dst->datum.ptr, uint8_t, dst->vb_length + len);
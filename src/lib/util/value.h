@@ -172,6 +172,8 @@ struct value_box_s {
 	unsigned int   				secret : 1;		//!< Same as #fr_dict_attr_flags_t secret
 	unsigned int				immutable : 1;		//!< once set, the value cannot be changed
 	unsigned int				talloced : 1;		//!< Talloced, not stack or text allocated.
+	unsigned int				borrowed : 1;		//!< Buffer isn't a talloc chunk, so it must be
+									///< copied, and can't be shared by reference.
 	fr_value_box_safe_for_t	_CONST		safe_for;		//!< A unique value to indicate if that value box is safe
 									///< for consumption by a particular module for a particular
 									///< purpose.  e.g. LDAP, SQL, etc.
@@ -1063,6 +1065,24 @@ bool fr_value_box_contains_secret(fr_value_box_t const *box)
 	return false;
 }
 
+/** Whether the buffer of a string or octets box is shared with other boxes
+ *
+ * Shared buffers are created by #fr_value_box_copy_shallow, and are copied
+ * on the first write by any of the boxes sharing them.
+ */
+static inline CC_HINT(nonnull, always_inline)
+bool fr_value_box_is_shared(fr_value_box_t const *box)
+{
+	switch (box->type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		return box->datum.ptr && !box->borrowed && (talloc_reference_count(box->datum.ptr) > 0);
+
+	default:
+		return false;
+	}
+}
+
 static inline CC_HINT(nonnull, always_inline)
 void fr_value_box_set_secret(fr_value_box_t *box, bool secret)
 {
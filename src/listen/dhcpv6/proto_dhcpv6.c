@@ -61,6 +61,11 @@ static conf_parser_t const limit_config[] = {
 	{ FR_CONF_OFFSET("max_clients", proto_dhcpv6_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", proto_dhcpv6_t, io.max_pending_packets), .dflt = "256" } ,
 
+	{ FR_CONF_OFFSET("new_client_rate", proto_dhcpv6_t, io.new_client_rate), .dflt = "0" } ,
+	{ FR_CONF_OFFSET("new_client_burst", proto_dhcpv6_t, io.new_client_burst), .dflt = "20" } ,
+	{ FR_CONF_OFFSET("new_client_ipv4_prefix", proto_dhcpv6_t, io.new_client_ipv4_prefix), .dflt = "24" } ,
+	{ FR_CONF_OFFSET("new_client_ipv6_prefix", proto_dhcpv6_t, io.new_client_ipv6_prefix), .dflt = "64" } ,
+
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
 	 */
@@ -386,6 +391,11 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_TIME_DELTA_BOUND_CHECK("nak_lifetime", inst->io.nak_lifetime, >=, fr_time_delta_from_sec(1));
 	FR_TIME_DELTA_BOUND_CHECK("nak_lifetime", inst->io.nak_lifetime, <=, fr_time_delta_from_sec(600));
 
+	FR_INTEGER_BOUND_CHECK("new_client_rate", inst->io.new_client_rate, <=, 100000);
+	FR_INTEGER_BOUND_CHECK("new_client_burst", inst->io.new_client_burst, >=, 1);
+	FR_INTEGER_BOUND_CHECK("new_client_ipv4_prefix", inst->io.new_client_ipv4_prefix, <=, 32);
+	FR_INTEGER_BOUND_CHECK("new_client_ipv6_prefix", inst->io.new_client_ipv6_prefix, <=, 128);
+
 	FR_TIME_DELTA_BOUND_CHECK("cleanup_delay", inst->io.cleanup_delay, <=, fr_time_delta_from_sec(30));
 	FR_TIME_DELTA_BOUND_CHECK("cleanup_delay", inst->io.cleanup_delay, >, fr_time_delta_from_sec(0));
 
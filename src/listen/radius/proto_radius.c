@@ -23,6 +23,7 @@
  * @copyright 2016 Alan DeKok (aland@freeradius.org)
  */
 #include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/internal/internal.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/unlang/xlat_func.h>
 #include <freeradius-devel/server/module_rlm.h>
@@ -43,6 +44,11 @@ static conf_parser_t const limit_config[] = {
 	{ FR_CONF_OFFSET("max_clients", proto_radius_t, io.max_clients), .dflt = "256" } ,
 	{ FR_CONF_OFFSET("max_pending_packets", proto_radius_t, io.max_pending_packets), .dflt = "256" } ,
 
+	{ FR_CONF_OFFSET("new_client_rate", proto_radius_t, io.new_client_rate), .dflt = "0" } ,
+	{ FR_CONF_OFFSET("new_client_burst", proto_radius_t, io.new_client_burst), .dflt = "20" } ,
+	{ FR_CONF_OFFSET("new_client_ipv4_prefix", proto_radius_t, io.new_client_ipv4_prefix), .dflt = "24" } ,
+	{ FR_CONF_OFFSET("new_client_ipv6_prefix", proto_radius_t, io.new_client_ipv6_prefix), .dflt = "64" } ,
+
 	/*
 	 *	For performance tweaking.  NOT for normal humans.
 	 */
@@ -94,6 +100,9 @@ static conf_parser_t const proto_radius_config[] = {
 	  .uctx = &(cf_table_parse_ctx_t){ .table = fr_radius_limit_proxy_state_table, .len = &fr_radius_limit_proxy_state_table_len },
 	  .dflt = "auto" },
 
+	{ FR_CONF_OFFSET("fast_status_server", proto_radius_t, fast_status_server) } ,
+	{ FR_CONF_OFFSET("decode_in_network", proto_radius_t, decode_in_network) } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -110,6 +119,8 @@ static fr_dict_attr_t const *attr_user_name;
 static fr_dict_attr_t const *attr_state;
 static fr_dict_attr_t const *attr_proxy_state;
 static fr_dict_attr_t const *attr_message_authenticator;
+static fr_dict_attr_t const *attr_freeradius_outstanding_requests;
+static fr_dict_attr_t const *attr_freeradius_queue_use_percentage;
 
 extern fr_dict_attr_autoload_t proto_radius_dict_attr[];
 fr_dict_attr_autoload_t proto_radius_dict_attr[] = {
@@ -118,6 +129,8 @@ fr_dict_attr_autoload_t proto_radius_dict_attr[] = {
 	{ .out = &attr_state, .name = "State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_proxy_state, .name = "Proxy-State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_message_authenticator, .name = "Message-Authenticator", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
+	{ .out = &attr_freeradius_outstanding_requests, .name = "Vendor-Specific.FreeRADIUS.Stats-Server-Outstanding-Requests", .type = FR_TYPE_UINT32, .dict = &dict_radius},
+	{ .out = &attr_freeradius_queue_use_percentage, .name = "Vendor-Specific.FreeRADIUS.Queue-Use-Percentage", .type = FR_TYPE_UINT32, .dict = &dict_radius},
 	{ NULL }
 };
 
@@ -174,17 +187,20 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *
 	return 0;
 }
 
-/** Decode the packet
+/** Set up the context for decoding a packet from a client
  *
+ * @param[in] inst		of proto_radius.
+ * @param[in] client		the packet came from.
+ * @param[out] common_ctx	to fill in with the client's secret.
+ * @param[out] decode_ctx	to fill in.
+ * @param[in] tmp_ctx		for the decoder's temporary allocations.
+ * @param[in] data		the raw packet.
+ * @param[in] data_len		length of the packet.
  */
-static int mod_decode(void const *instance, request_t *request, uint8_t *const data, size_t data_len)
+static void decode_ctx_init(proto_radius_t const *inst, fr_client_t const *client,
+			    fr_radius_ctx_t *common_ctx, fr_radius_decode_ctx_t *decode_ctx,
+			    TALLOC_CTX *tmp_ctx, uint8_t const *data, size_t data_len)
 {
-	proto_radius_t const		*inst = talloc_get_type_abort_const(instance, proto_radius_t);
-	fr_io_track_t const		*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
-	fr_io_address_t const  		*address = track->address;
-	fr_client_t			*client = UNCONST(fr_client_t *, address->radclient);
-	fr_radius_ctx_t			common_ctx;
-	fr_radius_decode_ctx_t		decode_ctx;
 	fr_radius_require_ma_t		require_message_authenticator = client->require_message_authenticator_is_set ?
 									client->require_message_authenticator:
 									inst->require_message_authenticator;
@@ -192,45 +208,116 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 							    client->limit_proxy_state:
 							    inst->limit_proxy_state;
 
-	fr_assert(data[0] < FR_RADIUS_CODE_MAX);
-
-	/*
-	 *	Set the request dictionary so that we can do
-	 *	generic->protocol attribute conversions as
-	 *	the request runs through the server.
-	 */
-	request->dict = dict_radius;
-
-	common_ctx = (fr_radius_ctx_t) {
+	*common_ctx = (fr_radius_ctx_t) {
 		.secret = client->secret,
 		.secret_length = talloc_array_length(client->secret) - 1,
 	};
 
-	request->packet->code = data[0];
-
-	decode_ctx = (fr_radius_decode_ctx_t) {
-		.common = &common_ctx,
-		.tmp_ctx = talloc(request, uint8_t),
+	*decode_ctx = (fr_radius_decode_ctx_t) {
+		.common = common_ctx,
+		.tmp_ctx = tmp_ctx,
 		/* decode figures out request_authenticator */
 		.end = data + data_len,
 		.verify = client->active,
 	};
 
-	if (request->packet->code == FR_RADIUS_CODE_ACCESS_REQUEST) {
+	if (data[0] == FR_RADIUS_CODE_ACCESS_REQUEST) {
 		/*
 		 *	bit1 is set if we've seen a packet, and the auto bit in require_message_authenticator is set/
 		 *	bit2 is set if we always require a message_authenticator.
 		 *	If either bit is high we require a message authenticator in the packet.
 		 */
-		decode_ctx.require_message_authenticator = (
+		decode_ctx->require_message_authenticator = (
 				(client->received_message_authenticator & require_message_authenticator) |
 				(require_message_authenticator & FR_RADIUS_REQUIRE_MA_YES)
 			) > 0;
-		decode_ctx.limit_proxy_state = (
+		decode_ctx->limit_proxy_state = (
 				(client->first_packet_no_proxy_state & limit_proxy_state) |
 				(limit_proxy_state & FR_RADIUS_LIMIT_PROXY_STATE_YES)
 			) > 0;
 	}
+}
+
+#ifndef NDEBUG
+/** Compare pairs decoded by the network thread with a worker decode of the same packet
+ *
+ * Unknown attributes are allocated separately by each decode, so they're
+ * compared by number.  Only leaves carry the tainted flag in the internal
+ * format, so it's only compared for them.
+ *
+ * @param[in] a		pairs decoded by the network thread.
+ * @param[in] b		pairs decoded by the worker.
+ * @return
+ *	- 0 if the lists match.
+ *	- -1 if they don't.  The error is in fr_strerror().
+ */
+static int predecode_cmp(fr_pair_list_t const *a, fr_pair_list_t const *b)
+{
+	fr_pair_t *a_p, *b_p;
+
+	for (a_p = fr_pair_list_head(a), b_p = fr_pair_list_head(b);
+	     a_p && b_p;
+	     a_p = fr_pair_list_next(a, a_p), b_p = fr_pair_list_next(b, b_p)) {
+		if ((a_p->da != b_p->da) &&
+		    (!a_p->da->flags.is_unknown || !b_p->da->flags.is_unknown ||
+		     (a_p->da->attr != b_p->da->attr) || (a_p->vp_type != b_p->vp_type))) {
+			fr_strerror_printf("Expected %s, got %s", b_p->da->name, a_p->da->name);
+			return -1;
+		}
+
+		switch (a_p->vp_type) {
+		case FR_TYPE_STRUCTURAL:
+			if (predecode_cmp(&a_p->vp_group, &b_p->vp_group) < 0) return -1;
+			break;
+
+		default:
+			if (fr_value_box_cmp(&a_p->data, &b_p->data) != 0) {
+				fr_strerror_printf("Value of %s differs", a_p->da->name);
+				return -1;
+			}
+			if (a_p->vp_tainted != b_p->vp_tainted) {
+				fr_strerror_printf("Tainted flag of %s differs", a_p->da->name);
+				return -1;
+			}
+			break;
+		}
+	}
+
+	if (a_p || b_p) {
+		fr_strerror_printf("%s has extra attributes", a_p ? "Network thread" : "Worker");
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+/** Decode the packet
+ *
+ */
+static int mod_decode(void const *instance, request_t *request, uint8_t *const data, size_t data_len)
+{
+	proto_radius_t const		*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	fr_io_track_t const		*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
+	fr_io_address_t const  		*address = track->address;
+	fr_client_t			*client = UNCONST(fr_client_t *, address->radclient);
+	fr_radius_require_ma_t		require_message_authenticator = client->require_message_authenticator_is_set ?
+									client->require_message_authenticator:
+									inst->require_message_authenticator;
+	fr_radius_limit_proxy_state_t	limit_proxy_state = client->limit_proxy_state_is_set ?
+							    client->limit_proxy_state:
+							    inst->limit_proxy_state;
+
+	fr_assert(data[0] < FR_RADIUS_CODE_MAX);
+
+	/*
+	 *	Set the request dictionary so that we can do
+	 *	generic->protocol attribute conversions as
+	 *	the request runs through the server.
+	 */
+	request->dict = dict_radius;
+
+	request->packet->code = data[0];
 
 	/*
 	 *	The verify() routine over-writes the request packet vector.
@@ -245,16 +332,70 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	request->packet->data_len = data_len;
 
 	/*
-	 *	!client->active means a fake packet defining a dynamic client - so there will
-	 *	be no secret defined yet - so can't verify.
+	 *	The network thread has already decoded and verified
+	 *	the packet.  We just need to unpack the pairs.
 	 */
-	if (fr_radius_decode(request->request_ctx, &request->request_pairs,
-			     data, data_len, &decode_ctx) < 0) {
+	if (request->async->decoded) {
+		fr_dbuff_t dbuff = FR_DBUFF_TMP(request->async->decoded, request->async->decoded_len);
+
+		if (fr_internal_decode_list_dbuff(request->request_ctx, &request->request_pairs,
+						  fr_dict_root(dict_radius), &dbuff, NULL) < 0) {
+			RPEDEBUG("Failed reading pairs decoded by the network thread");
+			return -1;
+		}
+		RDEBUG3("Using pairs decoded by the network thread");
+
+#ifndef NDEBUG
+		/*
+		 *	Check that the worker would have decoded the
+		 *	same pairs.  This also checks that the packet
+		 *	we were given ends where the pairs start.
+		 *
+		 *	The packet has already been verified, and the
+		 *	checks which reject packets don't change the
+		 *	pairs, so they're skipped here.  The client's
+		 *	state may have changed since the network thread
+		 *	looked at it.
+		 */
+		{
+			TALLOC_CTX		*check_ctx = talloc_new(request);
+			fr_pair_list_t		check;
+			fr_radius_ctx_t		common_ctx;
+			fr_radius_decode_ctx_t	decode_ctx;
+
+			fr_pair_list_init(&check);
+			decode_ctx_init(inst, client, &common_ctx, &decode_ctx, talloc(check_ctx, uint8_t), data, data_len);
+			decode_ctx.require_message_authenticator = false;
+			decode_ctx.limit_proxy_state = false;
+
+			if ((fr_radius_decode(check_ctx, &check, data, data_len, &decode_ctx) < 0) ||
+			    (predecode_cmp(&request->request_pairs, &check) < 0)) {
+				talloc_free(check_ctx);
+				RPEDEBUG("Pairs decoded by the network thread don't match the packet");
+				return -1;
+			}
+			talloc_free(check_ctx);
+		}
+#endif
+
+	} else {
+		fr_radius_ctx_t		common_ctx;
+		fr_radius_decode_ctx_t	decode_ctx;
+
+		decode_ctx_init(inst, client, &common_ctx, &decode_ctx, talloc(request, uint8_t), data, data_len);
+
+		/*
+		 *	!client->active means a fake packet defining a dynamic client - so there will
+		 *	be no secret defined yet - so can't verify.
+		 */
+		if (fr_radius_decode(request->request_ctx, &request->request_pairs,
+				     data, data_len, &decode_ctx) < 0) {
+			talloc_free(decode_ctx.tmp_ctx);
+			RPEDEBUG("Failed reading packet");
+			return -1;
+		}
 		talloc_free(decode_ctx.tmp_ctx);
-		RPEDEBUG("Failed reading packet");
-		return -1;
 	}
-	talloc_free(decode_ctx.tmp_ctx);
 
 	/*
 	 *	Set the rest of the fields.
@@ -389,6 +530,46 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	return 0;
 }
 
+/** Decode a packet in the network thread
+ *
+ * Only packets from known clients are decoded here.  Packets which
+ * define a dynamic client, and packets which fail to decode, are left
+ * for the worker.
+ */
+static size_t mod_predecode(void const *instance, void *packet_ctx, uint8_t *out, size_t outlen,
+			    uint8_t *buffer, size_t buflen)
+{
+	proto_radius_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	fr_io_track_t const	*track;
+	fr_client_t const	*client;
+	fr_radius_ctx_t		common_ctx;
+	fr_radius_decode_ctx_t	decode_ctx;
+	TALLOC_CTX		*tmp_ctx;
+	fr_pair_list_t		list;
+	ssize_t			slen = 0;
+
+	if (!inst->decode_in_network) return 0;
+
+	track = talloc_get_type_abort_const(packet_ctx, fr_io_track_t);
+	client = track->address->radclient;
+	if (!client->active) return 0;
+
+	tmp_ctx = talloc_new(NULL);
+	if (!tmp_ctx) return 0;
+
+	fr_pair_list_init(&list);
+	decode_ctx_init(inst, client, &common_ctx, &decode_ctx, talloc(tmp_ctx, uint8_t), buffer, buflen);
+
+	if (fr_radius_decode(tmp_ctx, &list, buffer, buflen, &decode_ctx) < 0) goto done;
+
+	slen = fr_internal_encode_list(&FR_DBUFF_TMP(out, outlen), &list, NULL);
+	if (slen < 0) slen = 0;
+
+done:
+	talloc_free(tmp_ctx);
+	return slen;
+}
+
 static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8_t *buffer, size_t buffer_len)
 {
 	fr_io_track_t		*track = talloc_get_type_abort(request->async->packet_ctx, fr_io_track_t);
@@ -517,6 +698,101 @@ static int mod_priority_set(void const *instance, uint8_t const *buffer, UNUSED
 	return inst->priorities[buffer[0]];
 }
 
+/*
+ *	Offsets into the pre-encoded reply to Status-Server.
+ *
+ *	Header, Message-Authenticator, then one Vendor-Specific
+ *	containing the two load indicators.
+ */
+#define STATUS_REPLY_MA		(RADIUS_HEADER_LENGTH)
+#define STATUS_REPLY_VSA	(STATUS_REPLY_MA + 2 + RADIUS_AUTH_VECTOR_LENGTH)
+#define STATUS_REPLY_OUTSTANDING (STATUS_REPLY_VSA + 6 + 2)
+#define STATUS_REPLY_PERCENTAGE	(STATUS_REPLY_OUTSTANDING + 4 + 2)
+#define STATUS_REPLY_LEN	(STATUS_REPLY_PERCENTAGE + 4)
+
+/** Encode the parts of the reply to Status-Server which never change
+ *
+ */
+static uint8_t *status_server_reply_alloc(proto_radius_t const *inst)
+{
+	uint8_t			*reply;
+	fr_dict_attr_t const	*vendor = attr_freeradius_outstanding_requests->parent;
+
+	reply = talloc_zero_array(inst, uint8_t, STATUS_REPLY_LEN);
+	if (!reply) return NULL;
+
+	/*
+	 *	RFC 5997 Section 3.2.  Status-Server sent to an
+	 *	accounting port is answered with Accounting-Response.
+	 */
+	if (!inst->allowed[FR_RADIUS_CODE_ACCESS_REQUEST] && inst->allowed[FR_RADIUS_CODE_ACCOUNTING_REQUEST]) {
+		reply[0] = FR_RADIUS_CODE_ACCOUNTING_RESPONSE;
+	} else {
+		reply[0] = FR_RADIUS_CODE_ACCESS_ACCEPT;
+	}
+	fr_nbo_from_uint16(reply + 2, STATUS_REPLY_LEN);
+
+	reply[STATUS_REPLY_MA] = attr_message_authenticator->attr;
+	reply[STATUS_REPLY_MA + 1] = 2 + RADIUS_AUTH_VECTOR_LENGTH;
+
+	reply[STATUS_REPLY_VSA] = vendor->parent->attr;
+	reply[STATUS_REPLY_VSA + 1] = STATUS_REPLY_LEN - STATUS_REPLY_VSA;
+	fr_nbo_from_uint32(reply + STATUS_REPLY_VSA + 2, vendor->attr);
+
+	reply[STATUS_REPLY_OUTSTANDING - 2] = attr_freeradius_outstanding_requests->attr;
+	reply[STATUS_REPLY_OUTSTANDING - 1] = 6;
+
+	reply[STATUS_REPLY_PERCENTAGE - 2] = attr_freeradius_queue_use_percentage->attr;
+	reply[STATUS_REPLY_PERCENTAGE - 1] = 6;
+
+	return reply;
+}
+
+/** Answer Status-Server in the network thread
+ *
+ * The reply contains the number of packets which the network
+ * thread's workers have yet to reply to, and the percentage of
+ * workers which are too busy to accept new packets.
+ *
+ * The master I/O handler only calls this for Status-Server, and only
+ * when fast_status_server is set.
+ */
+static ssize_t mod_reply(void const *instance, TALLOC_CTX *ctx, uint8_t **reply,
+			 fr_client_t const *client, fr_io_load_t const *load,
+			 uint8_t *buffer, UNUSED size_t buflen)
+{
+	proto_radius_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	uint8_t const		*secret = (uint8_t const *) client->secret;
+	size_t			secret_len = talloc_array_length(client->secret) - 1;
+	uint8_t			*packet;
+
+	/*
+	 *	The transport has already checked that the packet
+	 *	contains a Message-Authenticator, so this checks the
+	 *	shared secret.
+	 */
+	if (fr_radius_verify(buffer, NULL, secret, secret_len, true, false) < 0) return -1;
+
+	packet = talloc_memdup(ctx, inst->status_server_reply, STATUS_REPLY_LEN);
+	if (!packet) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	packet[1] = buffer[1];
+	fr_nbo_from_uint32(packet + STATUS_REPLY_OUTSTANDING, (load->outstanding > UINT32_MAX) ? UINT32_MAX : load->outstanding);
+	fr_nbo_from_uint32(packet + STATUS_REPLY_PERCENTAGE,
+			   load->num_workers ? (load->num_blocked * 100) / load->num_workers : 100);
+
+	if (fr_radius_sign(packet, buffer + 4, secret, secret_len) < 0) {
+		talloc_free(packet);
+		return -1;
+	}
+
+	*reply = packet;
+	return STATUS_REPLY_LEN;
+}
+
 /** Open listen sockets/connect to external event source
  *
  * @param[in] instance	Ctx data for this application.
@@ -537,6 +813,28 @@ static int mod_open(void *instance, fr_schedule_t *sc, UNUSED CONF_SECTION *conf
 				   inst->max_packet_size, inst->num_messages);
 }
 
+/** Reject an Access-Request which the worker is shedding
+ *
+ * Nothing else can be usefully rejected.  The NAS will retry other
+ * packets, or fail over to another server.
+ */
+static int mod_shed(UNUSED void const *instance, request_t *request)
+{
+	fr_io_track_t const	*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
+
+	if (request->packet->code != FR_RADIUS_CODE_ACCESS_REQUEST) return -1;
+
+	/*
+	 *	Dynamic clients are defined by the virtual server,
+	 *	which we're not going to run.
+	 */
+	if (track->address->radclient->dynamic && !track->address->radclient->active) return -1;
+
+	request->reply->code = FR_RADIUS_CODE_ACCESS_REJECT;
+
+	return 0;
+}
+
 /** Instantiate the application
  *
  * Instantiate I/O and type submodules.
@@ -563,6 +861,11 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_TIME_DELTA_BOUND_CHECK("nak_lifetime", inst->io.nak_lifetime, >=, fr_time_delta_from_sec(1));
 	FR_TIME_DELTA_BOUND_CHECK("nak_lifetime", inst->io.nak_lifetime, <=, fr_time_delta_from_sec(600));
 
+	FR_INTEGER_BOUND_CHECK("new_client_rate", inst->io.new_client_rate, <=, 100000);
+	FR_INTEGER_BOUND_CHECK("new_client_burst", inst->io.new_client_burst, >=, 1);
+	FR_INTEGER_BOUND_CHECK("new_client_ipv4_prefix", inst->io.new_client_ipv4_prefix, <=, 32);
+	FR_INTEGER_BOUND_CHECK("new_client_ipv6_prefix", inst->io.new_client_ipv6_prefix, <=, 128);
+
 	FR_TIME_DELTA_BOUND_CHECK("cleanup_delay", inst->io.cleanup_delay, <=, fr_time_delta_from_sec(30));
 	FR_TIME_DELTA_BOUND_CHECK("cleanup_delay", inst->io.cleanup_delay, >, fr_time_delta_from_sec(0));
 
@@ -594,11 +897,23 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 1024);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
 
+	if (inst->fast_status_server) {
+		if (!inst->allowed[FR_RADIUS_CODE_STATUS_SERVER]) {
+			cf_log_err(mctx->mi->conf, "'fast_status_server' requires 'type = Status-Server'");
+			return -1;
+		}
+
+		inst->status_server_reply = status_server_reply_alloc(inst);
+		if (!inst->status_server_reply) return -1;
+	}
+
 	/*
 	 *	Tell the master handler about the main protocol instance.
 	 */
 	inst->io.app = &proto_radius;
 	inst->io.app_instance = inst;
+	inst->io.app_reply = inst->fast_status_server;
+	inst->io.app_reply_code = FR_RADIUS_CODE_STATUS_SERVER;
 
 	/*
 	 *	We will need this for dynamic clients and connected sockets.
@@ -677,5 +992,8 @@ fr_app_t proto_radius = {
 	.open			= mod_open,
 	.decode			= mod_decode,
 	.encode			= mod_encode,
-	.priority		= mod_priority_set
+	.priority		= mod_priority_set,
+	.reply			= mod_reply,
+	.shed			= mod_shed,
+	.predecode		= mod_predecode
 };
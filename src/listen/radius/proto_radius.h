@@ -45,4 +45,9 @@ typedef struct {
 	fr_radius_require_ma_t		require_message_authenticator;			//!< Require Message-Authenticator in all requests.
 	fr_radius_limit_proxy_state_t	limit_proxy_state;		//!< Limit Proxy-State to packets containing
 									///< Message-Authenticator.
+
+	bool				fast_status_server;		//!< Answer Status-Server in the network thread.
+	uint8_t				*status_server_reply;		//!< Pre-encoded reply to Status-Server.
+
+	bool				decode_in_network;		//!< Decode packets in the network thread.
 } proto_radius_t;
@@ -6,4 +6,4 @@ endif
 
 SOURCES		:= proto_radius.c
 
-TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-radius$(L) libfreeradius-io$(L)
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-radius$(L) libfreeradius-internal$(L) libfreeradius-io$(L)
@@ -26,6 +26,7 @@
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/util/udp.h>
 #include <freeradius-devel/util/trie.h>
+#include <freeradius-devel/util/socket_filter.h>
 #include <freeradius-devel/radius/radius.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
@@ -43,6 +44,10 @@ typedef struct {
 
 	fr_stats_t			stats;			//!< statistics for this socket
 
+	fr_event_list_t			*el;			//!< for refreshing the kernel filter.
+	fr_event_timer_t const		*filter_ev;		//!< timer for refreshing the kernel filter.
+	uint64_t			filter_generation;	//!< of the client lists the kernel filter was built from.
+	bool				filtered;		//!< whether a kernel filter is attached.
 } proto_radius_udp_thread_t;
 
 typedef struct {
@@ -69,6 +74,7 @@ typedef struct {
 	bool				send_buff_is_set;	//!< Whether we were provided with a send_buff
 	bool				dynamic_clients;	//!< whether we have dynamic clients
 	bool				dedup_authenticator;	//!< dedup using the request authenticator
+	bool				kernel_filter;		//!< discard packets from unknown clients in the kernel
 
 	fr_client_list_t		*clients;		//!< local clients
 
@@ -104,6 +110,7 @@ static const conf_parser_t udp_listen_config[] = {
 	{ FR_CONF_OFFSET("accept_conflicting_packets", proto_radius_udp_t, dedup_authenticator) } ,
 	{ FR_CONF_OFFSET("dynamic_clients", proto_radius_udp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) networks_config },
+	{ FR_CONF_OFFSET("kernel_filter", proto_radius_udp_t, kernel_filter), .dflt = "yes" } ,
 
 	{ FR_CONF_OFFSET("max_packet_size", proto_radius_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", proto_radius_udp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
@@ -297,6 +304,152 @@ static void mod_network_get(int *ipproto, bool *dynamic_clients, fr_trie_t const
 	*trie = inst->trie;
 }
 
+/** Return a value which changes whenever the clients for this listener change
+ *
+ */
+static uint64_t mod_filter_generation(proto_radius_udp_t const *inst)
+{
+	uint64_t generation = client_list_generation(NULL);
+
+	if (inst->clients) generation += client_list_generation(inst->clients);
+
+	return generation;
+}
+
+/** Whether a denied network for dynamic clients also contains a known client
+ *
+ */
+static bool mod_filter_deny_overlaps(fr_ipaddr_t const *deny, fr_ipaddr_t const *networks)
+{
+	size_t i, num = talloc_array_length(networks);
+
+	for (i = 0; i < num; i++) {
+		fr_ipaddr_t masked;
+
+		if (networks[i].af != deny->af) continue;
+		if (networks[i].prefix > deny->prefix) continue;
+
+		masked = *deny;
+		fr_ipaddr_mask(&masked, networks[i].prefix);
+		if (fr_ipaddr_cmp(&masked, &networks[i]) == 0) return true;
+	}
+
+	return false;
+}
+
+/** Build a kernel filter from the known clients, and attach it to the socket
+ *
+ * Packets from sources which can't be a known client, or define a
+ * dynamic client, are then discarded by the kernel, and never wake up
+ * the network thread.
+ *
+ * @param[in] li	the listener to filter.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The socket is then unfiltered.
+ */
+static int mod_filter_attach(fr_listen_t *li)
+{
+	proto_radius_udp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_udp_t);
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+	fr_ipaddr_t			*networks, *local;
+	fr_socket_filter_rule_t		*rules;
+	size_t				i, num_rules = 0;
+	int				ret;
+
+	/*
+	 *	Read the generation first, so that a client added
+	 *	while we're building the filter triggers another
+	 *	refresh.
+	 */
+	thread->filter_generation = mod_filter_generation(inst);
+
+	networks = client_list_networks(thread, NULL, IPPROTO_UDP);
+	if (!networks) goto error;
+
+	if (inst->clients) {
+		size_t num = talloc_array_length(networks);
+
+		local = client_list_networks(thread, inst->clients, IPPROTO_UDP);
+		if (!local) {
+			talloc_free(networks);
+			goto error;
+		}
+
+		if (talloc_array_length(local) > 0) {
+			networks = talloc_realloc(thread, networks, fr_ipaddr_t, num + talloc_array_length(local));
+			if (!networks) {
+				talloc_free(local);
+				goto error;
+			}
+			memcpy(networks + num, local, talloc_array_length(local) * sizeof(*local));
+		}
+		talloc_free(local);
+	}
+
+	rules = talloc_array(thread, fr_socket_filter_rule_t,
+			     talloc_array_length(networks) +
+			     (inst->dynamic_clients ? talloc_array_length(inst->allow) + talloc_array_length(inst->deny) : 0));
+	if (!rules) {
+		talloc_free(networks);
+		goto error;
+	}
+
+	for (i = 0; i < talloc_array_length(networks); i++) {
+		rules[num_rules++] = (fr_socket_filter_rule_t) { .network = networks[i], .allow = true };
+	}
+
+	if (inst->dynamic_clients) {
+		for (i = 0; i < talloc_array_length(inst->allow); i++) {
+			rules[num_rules++] = (fr_socket_filter_rule_t) { .network = inst->allow[i], .allow = true };
+		}
+
+		/*
+		 *	A known client inside of a denied network
+		 *	must still be able to send us packets.
+		 */
+		for (i = 0; i < talloc_array_length(inst->deny); i++) {
+			if (mod_filter_deny_overlaps(&inst->deny[i], networks)) continue;
+
+			rules[num_rules++] = (fr_socket_filter_rule_t) { .network = inst->deny[i], .allow = false };
+		}
+	}
+
+	ret = fr_socket_filter_attach(thread->sockfd, rules, num_rules);
+	talloc_free(rules);
+	talloc_free(networks);
+
+	if (ret < 0) {
+	error:
+		if (thread->filtered) (void) fr_socket_filter_detach(thread->sockfd);
+		thread->filtered = false;
+		return -1;
+	}
+
+	thread->filtered = true;
+	return 0;
+}
+
+/** Rebuild the kernel filter if the clients have changed
+ *
+ */
+static void mod_filter_refresh(fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_listen_t			*li = talloc_get_type_abort(uctx, fr_listen_t);
+	proto_radius_udp_t const       	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_radius_udp_t);
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	if ((mod_filter_generation(inst) != thread->filter_generation) && (mod_filter_attach(li) < 0)) {
+		PWARN("Failed updating kernel filter for %s, all packets will be read",
+		      thread->name);
+	}
+
+	if (fr_event_timer_in(thread, el, &thread->filter_ev, fr_time_delta_from_sec(1),
+			      mod_filter_refresh, li) < 0) {
+		PERROR("Failed adding timer for kernel filter of %s", thread->name);
+	}
+}
+
 /** Open a UDP listener for RADIUS
  *
  */
@@ -368,9 +521,48 @@ static int mod_open(fr_listen_t *li)
 					     &inst->ipaddr, inst->port,
 					     inst->interface);
 
+	/*
+	 *	Connected sockets only receive packets from one
+	 *	client, so there's nothing to filter.
+	 */
+#ifdef SO_ATTACH_FILTER
+	if (inst->kernel_filter && !thread->connection && (mod_filter_attach(li) < 0)) {
+		PWARN("Failed adding kernel filter for %s, all packets will be read", thread->name);
+	}
+#endif
+
 	return 0;
 }
 
+/** Start refreshing the kernel filter in the network thread which owns the socket
+ *
+ */
+static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, UNUSED void *nr)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	thread->el = el;
+
+	if (!thread->filtered) return;
+
+	if (fr_event_timer_in(thread, el, &thread->filter_ev, fr_time_delta_from_sec(1),
+			      mod_filter_refresh, li) < 0) {
+		PERROR("Failed adding timer for kernel filter of %s", thread->name);
+	}
+}
+
+static void mod_stats_print(fr_listen_t const *li, FILE *fp)
+{
+	proto_radius_udp_thread_t const	*thread = talloc_get_type_abort_const(li->thread_instance, proto_radius_udp_thread_t);
+	uint64_t			dropped;
+
+	if (!thread->filtered) return;
+
+	if (fr_socket_filter_dropped(&dropped, thread->sockfd) < 0) return;
+
+	fprintf(fp, "count.kernel_dropped\t%" PRIu64 "\n", dropped);
+}
+
 /** Set the file descriptor for this socket.
  *
  */
@@ -562,4 +754,6 @@ fr_app_io_t proto_radius_udp = {
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
 	.get_name      		= mod_name,
+	.event_list_set		= mod_event_list_set,
+	.stats_print		= mod_stats_print,
 };
@@ -29,6 +29,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/rcu.h>
 #include <freeradius-devel/server/users_file.h>
 
 #include <sys/stat.h>
@@ -44,7 +45,7 @@ typedef struct {
 	char const	*filename;
 	tmpl_t		*key;
 	bool		relaxed;
-	PAIR_LIST_LIST	attrs;
+	fr_rcu_ptr_t	*attrs;		//!< Current PAIR_LIST_LIST, replaced on reload.
 } rlm_attr_filter_t;
 
 static const conf_parser_t module_config[] = {
@@ -106,6 +107,7 @@ static int attr_filter_getfile(TALLOC_CTX *ctx, module_inst_ctx_t const *mctx, c
 	PAIR_LIST *entry = NULL;
 	map_t *map;
 
+	pairlist_list_init(pair_list);
 	rcode = pairlist_read(ctx, dict_radius, filename, pair_list);
 	if (rcode < 0) {
 		return -1;
@@ -164,24 +166,66 @@ static int attr_filter_getfile(TALLOC_CTX *ctx, module_inst_ctx_t const *mctx, c
 }
 
 /*
- *	(Re-)read the "attrs" file into memory.
+ *	Read the "attrs" file into memory.
  */
-static int mod_instantiate(module_inst_ctx_t const *mctx)
+static PAIR_LIST_LIST *attr_filter_load(module_inst_ctx_t const *mctx)
 {
-	rlm_attr_filter_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_attr_filter_t);
-	int rcode;
-	pairlist_list_init(&inst->attrs);
+	rlm_attr_filter_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_attr_filter_t);
+	PAIR_LIST_LIST		*attrs;
 
-	rcode = attr_filter_getfile(inst, mctx, inst->filename, &inst->attrs);
-	if (rcode != 0) {
+	MEM(attrs = talloc_zero(NULL, PAIR_LIST_LIST));
+	if (attr_filter_getfile(attrs, mctx, inst->filename, attrs) != 0) {
 		ERROR("Errors reading %s", inst->filename);
+		talloc_free(attrs);
+		return NULL;
+	}
+
+	return attrs;
+}
+
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_attr_filter_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_attr_filter_t);
+	PAIR_LIST_LIST		*attrs;
+
+	attrs = attr_filter_load(mctx);
+	if (!attrs) return -1;
+
+	MEM(inst->attrs = fr_rcu_ptr_alloc(mctx->mi, attrs));
+
+	return 0;
+}
 
+/*
+ *	Re-read the "attrs" file, replacing the filters workers are using.
+ */
+static int mod_reload(module_inst_ctx_t const *mctx)
+{
+	rlm_attr_filter_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_attr_filter_t);
+	PAIR_LIST_LIST		*attrs;
+
+	attrs = attr_filter_load(mctx);
+	if (!attrs) {
+		fr_strerror_printf("Failed reading \"%s\"", inst->filename);
+		return -1;
+	}
+
+	if (fr_rcu_ptr_replace(inst->attrs, attrs) < 0) {
+		talloc_free(attrs);
 		return -1;
 	}
 
 	return 0;
 }
 
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_attr_filter_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_attr_filter_t);
+
+	talloc_free(inst->attrs);
+	return 0;
+}
+
 
 /*
  *	Common attr_filter checks
@@ -191,6 +235,7 @@ static unlang_action_t CC_HINT(nonnull) attr_filter_common(TALLOC_CTX *ctx, rlm_
 							   fr_pair_list_t *list)
 {
 	rlm_attr_filter_t const *inst = talloc_get_type_abort_const(mctx->mi->data, rlm_attr_filter_t);
+	PAIR_LIST_LIST	*attrs = fr_rcu_ptr_read(inst->attrs);
 	fr_pair_list_t	output;
 	PAIR_LIST	*pl = NULL;
 	int		found = 0;
@@ -216,7 +261,7 @@ static unlang_action_t CC_HINT(nonnull) attr_filter_common(TALLOC_CTX *ctx, rlm_
 	/*
 	 *      Find the attr_filter profile entry for the entry.
 	 */
-	while ((pl = fr_dlist_next(&inst->attrs.head, pl))) {
+	while ((pl = fr_dlist_next(&attrs->head, pl))) {
 		int fall_through = 0;
 		int relax_filter = inst->relaxed;
 		map_t *map = NULL;
@@ -371,9 +416,12 @@ module_rlm_t rlm_attr_filter = {
 	.common = {
 		.magic		= MODULE_MAGIC_INIT,
 		.name		= "attr_filter",
+		.flags		= MODULE_TYPE_INSTANTIATE_PARALLEL,
 		.inst_size	= sizeof(rlm_attr_filter_t),
 		.config		= module_config,
 		.instantiate	= mod_instantiate,
+		.reload		= mod_reload,
+		.detach		= mod_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/util/htrie.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/rcu.h>
 
 #include <freeradius-devel/server/map_proc.h>
 
@@ -59,7 +60,7 @@ typedef struct {
 	int		*field_offsets; /* field X from the file maps to array entry Y here */
 	fr_type_t	*field_types;
 	fr_rb_tree_t	*tree;
-	fr_htrie_t	*trie;
+	fr_rcu_ptr_t	*trie;		//!< Current fr_htrie_t of entries, replaced on reload.
 
 	tmpl_t		*key;
 	fr_type_t	key_data_type;
@@ -92,7 +93,7 @@ static const conf_parser_t module_config[] = {
 /*
  *	Allow for quotation marks.
  */
-static bool buf2entry(rlm_csv_t *inst, char *buf, char **out)
+static bool buf2entry(rlm_csv_t const *inst, char *buf, char **out)
 {
 	char *p, *q;
 
@@ -185,13 +186,13 @@ static int csv_to_key(uint8_t **out, size_t *outlen, void const *data)
 }
 
 
-static bool insert_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *e, int lineno)
+static bool insert_entry(CONF_SECTION *conf, rlm_csv_t const *inst, fr_htrie_t *trie, rlm_csv_entry_t *e, int lineno)
 {
 	rlm_csv_entry_t *old;
 
 	fr_assert(e != NULL);
 
-	old = fr_htrie_find(inst->trie, e);
+	old = fr_htrie_find(trie, e);
 	if (old) {
 		if (!inst->allow_multiple_keys && !inst->multiple_index_fields) {
 			cf_log_err(conf, "%s[%d]: Multiple entries are disallowed", inst->filename, lineno);
@@ -207,7 +208,7 @@ static bool insert_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *e
 		return true;
 	}
 
-	if (!fr_htrie_insert(inst->trie, e)) {
+	if (!fr_htrie_insert(trie, e)) {
 		cf_log_err(conf, "Failed inserting entry for file %s line %d: %s",
 			   inst->filename, lineno, fr_strerror());
 fail:
@@ -219,13 +220,14 @@ fail:
 }
 
 
-static bool duplicate_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t *old, char *p, int lineno)
+static bool duplicate_entry(CONF_SECTION *conf, rlm_csv_t const *inst, fr_htrie_t *trie,
+			    rlm_csv_entry_t *old, char *p, int lineno)
 {
 	int i;
 	fr_type_t type = inst->key_data_type;
 	rlm_csv_entry_t *e;
 
-	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst, uint8_t,
+	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(trie, uint8_t,
 						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
 	talloc_set_type(e, rlm_csv_entry_t);
 
@@ -247,19 +249,19 @@ static bool duplicate_entry(CONF_SECTION *conf, rlm_csv_t *inst, rlm_csv_entry_t
 		if (old->data[i]) e->data[i] = old->data[i]; /* no need to dup it, it's never freed... */
 	}
 
-	return insert_entry(conf, inst, e, lineno);
+	return insert_entry(conf, inst, trie, e, lineno);
 }
 
 /*
  *	Convert a buffer to a CSV entry
  */
-static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buffer)
+static bool file2csv(CONF_SECTION *conf, rlm_csv_t const *inst, fr_htrie_t *trie, int lineno, char *buffer)
 {
 	rlm_csv_entry_t *e;
 	int i;
 	char *p, *q;
 
-	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(inst, uint8_t,
+	MEM(e = (rlm_csv_entry_t *)talloc_zero_array(trie, uint8_t,
 						     sizeof(*e) + (inst->used_fields * sizeof(e->data[0]))));
 	talloc_set_type(e, rlm_csv_entry_t);
 
@@ -305,7 +307,7 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 				while (l) {
 					*l = '\0';
 
-					if (!duplicate_entry(conf, inst, e, p, lineno)) goto fail;
+					if (!duplicate_entry(conf, inst, trie, e, p, lineno)) goto fail;
 
 					p = l + 1;
 					l = strchr(p, ',');
@@ -359,7 +361,89 @@ static bool file2csv(CONF_SECTION *conf, rlm_csv_t *inst, int lineno, char *buff
 		goto fail;
 	}
 
-	return insert_entry(conf, inst, e, lineno);
+	return insert_entry(conf, inst, trie, e, lineno);
+}
+
+/** Read the CSV file into a new trie
+ *
+ * Entries are allocated in the trie, so freeing the trie frees everything
+ * read from the file.
+ *
+ * @param[in] conf	to log errors against.
+ * @param[in] inst	of rlm_csv.
+ * @return
+ *	- A new trie on success.
+ *	- NULL on failure.
+ */
+static fr_htrie_t *csv_file_load(CONF_SECTION *conf, rlm_csv_t const *inst)
+{
+	fr_htrie_t	*trie;
+	FILE		*fp;
+	int		lineno;
+	char		buffer[8192];
+
+	/*
+	 *	The key type was checked during bootstrap.
+	 */
+	trie = fr_htrie_alloc(NULL, fr_htrie_hint(inst->key_data_type),
+			      (fr_hash_t) csv_hash,
+			      (fr_cmp_t) csv_cmp,
+			      (fr_trie_key_t) csv_to_key,
+			      NULL);
+	if (!trie) {
+		cf_log_err(conf, "Failed creating internal trie: %s", fr_strerror());
+		return NULL;
+	}
+
+	fp = fopen(inst->filename, "r");
+	if (!fp) {
+		cf_log_err(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+	error:
+		talloc_free(trie);
+		return NULL;
+	}
+	lineno = 1;
+
+	/*
+	 *	If there is a header in the file, then read that first.
+	 *	The field names were taken from it during bootstrap,
+	 *	and the maps refer to them, so it can't change.
+	 */
+	if (inst->header) {
+		char *p = fgets(buffer, sizeof(buffer), fp);
+		if (!p) {
+			cf_log_err(conf, "Error reading filename %s: Unexpected EOF", inst->filename);
+			fclose(fp);
+			goto error;
+		}
+
+		p = strchr(buffer, '\n');
+		if (p) *p = '\0';
+
+		if (strcmp(buffer, inst->fields) != 0) {
+			cf_log_err(conf, "Header of %s has changed from \"%s\" to \"%s\" - "
+				   "the server must be restarted to change the fields",
+				   inst->filename, inst->fields, buffer);
+			fclose(fp);
+			goto error;
+		}
+		lineno++;
+	}
+
+	/*
+	 *	Read the rest of the file.
+	 */
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		if (!file2csv(conf, inst, trie, lineno, buffer)) {
+			fclose(fp);
+			goto error;
+		}
+
+		lineno++;
+	}
+	fclose(fp);
+
+	return trie;
 }
 
 
@@ -557,16 +641,6 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
-	inst->trie = fr_htrie_alloc(inst, htype,
-				    (fr_hash_t) csv_hash,
-				    (fr_cmp_t) csv_cmp,
-				    (fr_trie_key_t) csv_to_key,
-				    NULL);
-	if (!inst->trie) {
-		cf_log_err(conf, "Failed creating internal trie: %s", fr_strerror());
-		return -1;
-	}
-
 	if ((*inst->index_field_name == ',') || (*inst->index_field_name == *inst->delimiter)) {
 		cf_log_err(conf, "Field names cannot begin with the '%c' character", *inst->index_field_name);
 		return -1;
@@ -756,14 +830,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	rlm_csv_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_csv_t);
 	CONF_SECTION	*conf = mctx->mi->conf;
 	CONF_SECTION	*cs;
-	int		lineno;
-	FILE		*fp;
+	fr_htrie_t	*trie;
 	tmpl_rules_t	parse_rules = {
 		.attr = {
 			.allow_foreign = true	/* Because we don't know where we'll be called */
 		}
 	};
-	char buffer[8192];
 
 	map_list_init(&inst->map);
 	/*
@@ -796,40 +868,43 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	/*
 	 *	Re-open the file and read it all.
 	 */
-	fp = fopen(inst->filename, "r");
-	if (!fp) {
-		cf_log_err(conf, "Error opening filename %s: %s", inst->filename, fr_syserror(errno));
+	trie = csv_file_load(conf, inst);
+	if (!trie) return -1;
+
+	MEM(inst->trie = fr_rcu_ptr_alloc(mctx->mi, trie));
+
+	return 0;
+}
+
+/** Re-read the CSV file, replacing the entries workers are using
+ *
+ * The field names are fixed at bootstrap, so a file whose header has
+ * changed is rejected, and the old entries are kept.
+ */
+static int mod_reload(module_inst_ctx_t const *mctx)
+{
+	rlm_csv_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_csv_t);
+	fr_htrie_t	*trie;
+
+	trie = csv_file_load(mctx->mi->conf, inst);
+	if (!trie) {
+		fr_strerror_printf("Failed reading \"%s\"", inst->filename);
 		return -1;
 	}
-	lineno = 1;
 
-	/*
-	 *	If there is a header in the file, then read that first.
-	 *	This time we just ignore it.
-	 */
-	if (inst->header) {
-		char *p = fgets(buffer, sizeof(buffer), fp);
-		if (!p) {
-			cf_log_err(conf, "Error reading filename %s: Unexpected EOF", inst->filename);
-			fclose(fp);
-			return -1;
-		}
-		lineno++;
+	if (fr_rcu_ptr_replace(inst->trie, trie) < 0) {
+		talloc_free(trie);
+		return -1;
 	}
 
-	/*
-	 *	Read the rest of the file.
-	 */
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-		if (!file2csv(conf, inst, lineno, buffer)) {
-			fclose(fp);
-			return -1;
-		}
+	return 0;
+}
 
-		lineno++;
-	}
-	fclose(fp);
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_csv_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_csv_t);
 
+	talloc_free(inst->trie);
 	return 0;
 }
 
@@ -902,7 +977,7 @@ static rlm_rcode_t mod_map_apply(rlm_csv_t const *inst, request_t *request,
 	rlm_csv_entry_t		*e;
 	map_t const		*map = NULL;
 
-	e = fr_htrie_find(inst->trie, &(rlm_csv_entry_t) { .key = UNCONST(fr_value_box_t *, key) } );
+	e = fr_htrie_find(fr_rcu_ptr_read(inst->trie), &(rlm_csv_entry_t) { .key = UNCONST(fr_value_box_t *, key) } );
 	if (!e) {
 		rcode = RLM_MODULE_NOOP;
 		goto finish;
@@ -1052,11 +1127,13 @@ module_rlm_t rlm_csv = {
 	.common = {
 		.magic		= MODULE_MAGIC_INIT,
 		.name		= "csv",
-		.flags		= MODULE_TYPE_DYNAMIC_UNSAFE,
+		.flags		= MODULE_TYPE_DYNAMIC_UNSAFE | MODULE_TYPE_INSTANTIATE_PARALLEL,
 		.inst_size	= sizeof(rlm_csv_t),
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
 		.instantiate	= mod_instantiate,
+		.reload		= mod_reload,
+		.detach		= mod_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
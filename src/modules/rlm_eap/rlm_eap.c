@@ -783,8 +783,8 @@ static unlang_action_t eap_method_select(rlm_rcode_t *p_result, module_ctx_t con
 							      request->dict));
 
 	if (method->submodule->clone_parent_lists) {
-		if (fr_pair_list_copy(eap_session->subrequest->control_ctx,
-				      &eap_session->subrequest->control_pairs, &request->control_pairs) < 0) {
+		if (fr_pair_list_copy_shared(eap_session->subrequest->control_ctx,
+					     &eap_session->subrequest->control_pairs, &request->control_pairs) < 0) {
 		list_copy_fail:
 			RERROR("Failed copying parent's attribute list");
 		fail:
@@ -792,9 +792,9 @@ static unlang_action_t eap_method_select(rlm_rcode_t *p_result, module_ctx_t con
 			RETURN_MODULE_FAIL;
 		}
 
-		if (fr_pair_list_copy(eap_session->subrequest->request_ctx,
-				      &eap_session->subrequest->request_pairs,
-				      &request->request_pairs) < 0) goto list_copy_fail;
+		if (fr_pair_list_copy_shared(eap_session->subrequest->request_ctx,
+					     &eap_session->subrequest->request_pairs,
+					     &request->request_pairs) < 0) goto list_copy_fail;
 	}
 
 	/*
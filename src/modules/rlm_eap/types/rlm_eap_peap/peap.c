@@ -321,7 +321,18 @@ static rlm_rcode_t CC_HINT(nonnull) process_reply(eap_session_t *eap_session, fr
 		 *	Access-Challenge is ignored.
 		 */
 		fr_pair_list_init(&vps);
-		MEM(fr_pair_list_copy_by_da(t, &vps, reply_list, attr_eap_message, 0) >= 0);
+		fr_pair_list_foreach(reply_list, vp) {
+			fr_pair_t *copy;
+
+			if (vp->da != attr_eap_message) continue;
+
+			/*
+			 *	The copies are only encoded into the tunnel,
+			 *	so they can share the inner reply's buffers.
+			 */
+			MEM(copy = fr_pair_copy_shared(t, vp));
+			fr_pair_append(&vps, copy);
+		}
 
 		/*
 		 *	Handle the ACK, by tunneling any necessary reply
@@ -611,7 +622,7 @@ static int CC_HINT(nonnull) setup_fake_request(request_t *request, request_t *fa
 	(void) fr_pair_value_from_str(vp, "127.0.0.1", sizeof("127.0.0.1") - 1, NULL, false);
 
 	if (t->username) {
-		vp = fr_pair_copy(fake->request_ctx, t->username);
+		vp = fr_pair_copy_shared(fake->request_ctx, t->username);
 		fr_pair_append(&fake->request_pairs, vp);
 		RDEBUG2("Setting &request.User-Name from tunneled (inner) identity \"%s\"",
 			vp->vp_strvalue);
@@ -548,11 +548,11 @@ static rlm_rcode_t CC_HINT(nonnull) process_reply(NDEBUG_UNUSED eap_session_t *e
 
 				rcode = RLM_MODULE_HANDLED;
 				t->authenticated = true;
-				fr_pair_prepend(&tunnel_vps, fr_pair_copy(tls_session, vp));
+				fr_pair_prepend(&tunnel_vps, fr_pair_copy_shared(tls_session, vp));
 			} else if (vp->da == attr_eap_channel_binding_message) {
 				rcode = RLM_MODULE_HANDLED;
 				t->authenticated = true;
-				fr_pair_prepend(&tunnel_vps, fr_pair_copy(tls_session, vp));
+				fr_pair_prepend(&tunnel_vps, fr_pair_copy_shared(tls_session, vp));
 			}
 		}
 	}
@@ -580,9 +580,9 @@ static rlm_rcode_t CC_HINT(nonnull) process_reply(NDEBUG_UNUSED eap_session_t *e
 		     vp;
 		     vp = fr_pair_list_next(reply_list, vp)) {
 		     	if ((vp->da == attr_eap_message) || (vp->da == attr_reply_message)) {
-				fr_pair_prepend(&tunnel_vps, fr_pair_copy(tls_session, vp));
+				fr_pair_prepend(&tunnel_vps, fr_pair_copy_shared(tls_session, vp));
 		     	} else if (vp->da == attr_eap_channel_binding_message) {
-				fr_pair_prepend(&tunnel_vps, fr_pair_copy(tls_session, vp));
+				fr_pair_prepend(&tunnel_vps, fr_pair_copy_shared(tls_session, vp));
 		     	}
 		}
 		rcode = RLM_MODULE_HANDLED;
@@ -713,7 +713,7 @@ fr_radius_packet_code_t eap_ttls_process(request_t *request, eap_session_t *eap_
 		} /* else there WAS a t->username */
 
 		if (t->username) {
-			vp = fr_pair_copy(request->request_ctx, t->username);
+			vp = fr_pair_copy_shared(request->request_ctx, t->username);
 			fr_pair_append(&request->request_pairs, vp);
 		}
 	} /* else the request ALREADY had a User-Name */
@@ -29,6 +29,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/pairmove.h>
 #include <freeradius-devel/server/users_file.h>
 #include <freeradius-devel/util/htrie.h>
+#include <freeradius-devel/util/rcu.h>
 #include <freeradius-devel/unlang/call_env.h>
 #include <freeradius-devel/unlang/function.h>
 #include <freeradius-devel/unlang/transaction.h>
@@ -40,14 +41,31 @@ typedef struct {
 	char const	*filename;
 } rlm_files_t;
 
-/**  Structure produced by custom call_env parser
+/**  Parsed contents of the "users" file
  */
 typedef struct {
-	tmpl_t		*key_tmpl;	//!< tmpl used to evaluate lookup key.
 	fr_htrie_t	*htrie;		//!< parsed files "user" data.
 	PAIR_LIST_LIST	*def;		//!< parsed files DEFAULT data.
+} rlm_files_users_t;
+
+/**  Structure produced by custom call_env parser
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the list of call sites to reload.
+	module_instance_t const	*mi;		//!< Module instance the call site uses.
+	tmpl_t			*key_tmpl;	//!< tmpl used to evaluate lookup key.
+	fr_type_t		keytype;	//!< Data type of the lookup key.
+	fr_dict_t const		*dict;		//!< To resolve attributes in the file.
+	fr_rcu_ptr_t		*users;		//!< Current rlm_files_users_t, replaced on reload.
 } rlm_files_data_t;
 
+/** Every call site, as each parses the file for its own key type
+ *
+ * Call sites remove themselves when they're freed, and the list is emptied
+ * when the module is unloaded.  Only modified by the main thread.
+ */
+static fr_dlist_head_t	files_data_list;
+
 /**  Call_env structure
  */
 typedef struct {
@@ -405,8 +423,9 @@ static unlang_action_t CC_HINT(nonnull) mod_files_resume(rlm_rcode_t *p_result,
 	uint8_t			key_buffer[16], *key;
 	size_t			keylen = 0;
 	fr_edit_list_t		*el, *child;
-	fr_htrie_t		*tree = env->data->htrie;
-	PAIR_LIST_LIST		*default_list = env->data->def;
+	rlm_files_users_t const	*users = fr_rcu_ptr_read(env->data->users);
+	fr_htrie_t		*tree = users->htrie;
+	PAIR_LIST_LIST		*default_list = users->def;
 	fr_value_box_t		*key_vb = fr_value_box_list_head(&env->values);
 
 	if (!key_vb) {
@@ -623,6 +642,29 @@ static unlang_action_t CC_HINT(nonnull) mod_files(rlm_rcode_t *p_result, module_
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+/** Read the "users" file, indexing it by a particular key type
+ *
+ */
+static rlm_files_users_t *files_users_load(char const *filename, fr_type_t keytype, fr_dict_t const *dict)
+{
+	rlm_files_users_t	*users;
+
+	MEM(users = talloc_zero(NULL, rlm_files_users_t));
+	if (getrecv_filename(users, filename, &users->htrie, &users->def, keytype, dict) < 0) {
+		talloc_free(users);
+		return NULL;
+	}
+
+	return users;
+}
+
+static int _files_data_free(rlm_files_data_t *files_data)
+{
+	fr_dlist_remove(&files_data_list, files_data);
+
+	return 0;
+}
+
 /** Custom call_env parser for loading files data
  *
  */
@@ -632,7 +674,7 @@ static int call_env_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rule
 	rlm_files_t const		*inst = talloc_get_type_abort_const(cec->mi->data, rlm_files_t);
 	CONF_PAIR const			*to_parse = cf_item_to_pair(ci);
 	rlm_files_data_t		*files_data;
-	fr_type_t			keytype;
+	rlm_files_users_t		*users;
 
 	MEM(files_data = talloc_zero(ctx, rlm_files_data_t));
 
@@ -640,21 +682,86 @@ static int call_env_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rule
 			      &FR_SBUFF_IN(cf_pair_value(to_parse), talloc_array_length(cf_pair_value(to_parse)) - 1),
 			      cf_pair_value_quote(to_parse), NULL, t_rules) < 0) return -1;
 
-	keytype = tmpl_expanded_type(files_data->key_tmpl);
-	if (fr_htrie_hint(keytype) == FR_HTRIE_INVALID) {
-		cf_log_err(ci, "Invalid data type '%s' for 'files' module", fr_type_to_str(keytype));
+	files_data->keytype = tmpl_expanded_type(files_data->key_tmpl);
+	if (fr_htrie_hint(files_data->keytype) == FR_HTRIE_INVALID) {
+		cf_log_err(ci, "Invalid data type '%s' for 'files' module", fr_type_to_str(files_data->keytype));
 	error:
 		talloc_free(files_data);
 		return -1;
 	}
 
-	if (getrecv_filename(files_data, inst->filename, &files_data->htrie, &files_data->def,
-			     keytype, t_rules->attr.dict_def) < 0) goto error;
+	files_data->mi = cec->mi;
+	files_data->dict = t_rules->attr.dict_def;
+
+	users = files_users_load(inst->filename, files_data->keytype, files_data->dict);
+	if (!users) goto error;
+
+	MEM(files_data->users = fr_rcu_ptr_alloc(files_data, users));
+
+	fr_dlist_insert_tail(&files_data_list, files_data);
+	talloc_set_destructor(files_data, _files_data_free);
 
 	*(void **)out = files_data;
 	return 0;
 }
 
+/** Re-read the "users" file, for every call site using this module instance
+ *
+ * All call sites are re-read before any are replaced, so a bad file
+ * leaves every call site using the old data.
+ */
+static int mod_reload(module_inst_ctx_t const *mctx)
+{
+	rlm_files_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_files_t);
+	rlm_files_users_t	**users;
+	unsigned int		i = 0;
+
+	MEM(users = talloc_zero_array(NULL, rlm_files_users_t *, fr_dlist_num_elements(&files_data_list)));
+
+	fr_dlist_foreach(&files_data_list, rlm_files_data_t, files_data) {
+		if (files_data->mi != mctx->mi) continue;
+
+		users[i] = files_users_load(inst->filename, files_data->keytype, files_data->dict);
+		if (!users[i]) {
+			fr_strerror_printf("Failed reading \"%s\"", inst->filename);
+			while (i > 0) talloc_free(users[--i]);
+			talloc_free(users);
+			return -1;
+		}
+		i++;
+	}
+
+	i = 0;
+	fr_dlist_foreach(&files_data_list, rlm_files_data_t, files_data) {
+		if (files_data->mi != mctx->mi) continue;
+
+		if (fr_rcu_ptr_replace(files_data->users, users[i]) < 0) talloc_free(users[i]);
+		i++;
+	}
+	talloc_free(users);
+
+	return 0;
+}
+
+static int mod_load(void)
+{
+	fr_dlist_init(&files_data_list, rlm_files_data_t, entry);
+
+	return 0;
+}
+
+/** Forget any call sites which are still around
+ *
+ * They're freed along with their call_env, which may be after the
+ * module is unloaded, so their destructors can't be in this module.
+ */
+static void mod_unload(void)
+{
+	rlm_files_data_t *files_data;
+
+	while ((files_data = fr_dlist_pop_head(&files_data_list))) talloc_set_destructor(files_data, NULL);
+}
+
 static const call_env_method_t method_env = {
 	FR_CALL_ENV_METHOD_OUT(rlm_files_env_t),
 	.env = (call_env_parser_t[]){
@@ -673,6 +780,9 @@ module_rlm_t rlm_files = {
 		.name		= "files",
 		.inst_size	= sizeof(rlm_files_t),
 		.config		= module_config,
+		.onload		= mod_load,
+		.unload		= mod_unload,
+		.reload		= mod_reload,
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
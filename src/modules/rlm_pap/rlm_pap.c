@@ -31,6 +31,7 @@ USES_APPLE_DEPRECATED_API
 #include <freeradius-devel/server/password.h>
 #include <freeradius-devel/tls/base.h>
 #include <freeradius-devel/tls/log.h>
+#include <freeradius-devel/unlang/module.h>
 
 #include <freeradius-devel/util/base64.h>
 #include <freeradius-devel/util/debug.h>
@@ -192,9 +193,17 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_clear(rlm_rcode_t *p_result,
 }
 
 #ifdef HAVE_CRYPT
-static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
-						       UNUSED rlm_pap_t const *inst, request_t *request,
-						       fr_pair_t const *known_good, fr_value_box_t const *password)
+/** Check a cleartext password against a crypt() digest
+ *
+ * Doesn't use the request, so it can be called from an offload thread.
+ *
+ * @param[in] password		the user supplied.
+ * @param[in] known_good	crypt() digest to compare against.
+ * @return
+ *	- true if the password matches the digest.
+ *	- false if it doesn't, or crypt() failed.
+ */
+static bool pap_crypt_match(char const *password, char const *known_good)
 {
 	char	*crypt_out;
 	int	cmp = 0;
@@ -202,32 +211,70 @@ static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
 #ifdef HAVE_CRYPT_R
 	struct crypt_data crypt_data = { .initialized = 0 };
 
-	crypt_out = crypt_r(password->vb_strvalue, known_good->vp_strvalue, &crypt_data);
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	crypt_out = crypt_r(password, known_good, &crypt_data);
+	if (crypt_out) cmp = strcmp(known_good, crypt_out);
 #else
 	/*
 	 *	Ensure we're thread-safe, as crypt() isn't.
 	 */
 	pthread_mutex_lock(&fr_crypt_mutex);
-	crypt_out = crypt(password->vb_strvalue, known_good->vp_strvalue);
+	crypt_out = crypt(password, known_good);
 
 	/*
 	 *	Got something, check it within the lock.  This is
 	 *	faster than copying it to a local buffer, and the
 	 *	time spent within the lock is critical.
 	 */
-	if (crypt_out) cmp = strcmp(known_good->vp_strvalue, crypt_out);
+	if (crypt_out) cmp = strcmp(known_good, crypt_out);
 	pthread_mutex_unlock(&fr_crypt_mutex);
 #endif
 
-	/*
-	 *	Error.
-	 */
-	if (!crypt_out || (cmp != 0)) {
+	return crypt_out && (cmp == 0);
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_auth_crypt(rlm_rcode_t *p_result,
+						       UNUSED rlm_pap_t const *inst, request_t *request,
+						       fr_pair_t const *known_good, fr_value_box_t const *password)
+{
+	if (!pap_crypt_match(password->vb_strvalue, known_good->vp_strvalue)) {
+		REDEBUG("Crypt digest does not match \"known good\" digest");
+		RETURN_MODULE_REJECT;
+	}
+
+	RETURN_MODULE_OK;
+}
+
+/** Copies of the passwords, so crypt() can run on an offload thread
+ *
+ */
+typedef struct {
+	char		*password;		//!< the user supplied.
+	char		*known_good;		//!< crypt() digest.
+	bool		match;			//!< Result of the comparison.
+} pap_crypt_rctx_t;
+
+static void pap_crypt_offload(void *uctx)
+{
+	pap_crypt_rctx_t *rctx = talloc_get_type_abort(uctx, pap_crypt_rctx_t);
+
+	rctx->match = pap_crypt_match(rctx->password, rctx->known_good);
+}
+
+static unlang_action_t CC_HINT(nonnull) pap_crypt_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+							 request_t *request)
+{
+	pap_crypt_rctx_t *rctx = talloc_get_type_abort(mctx->rctx, pap_crypt_rctx_t);
+	bool		 match = rctx->match;
+
+	talloc_free(rctx);
+
+	if (!match) {
 		REDEBUG("Crypt digest does not match \"known good\" digest");
+		REDEBUG("Password incorrect");
 		RETURN_MODULE_REJECT;
 	}
 
+	RDEBUG2("User authenticated successfully");
 	RETURN_MODULE_OK;
 }
 #endif
@@ -962,6 +1009,24 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		RDEBUG2("Comparing with \"known-good\" %s (%zu)", known_good->da->name, known_good->vp_length);
 	}
 
+#ifdef HAVE_CRYPT
+	/*
+	 *	crypt() is slow on purpose.  If there are offload
+	 *	threads, run it there instead of blocking the worker.
+	 */
+	if ((known_good->da->attr == FR_CRYPT) && unlang_offload_available(NULL)) {
+		pap_crypt_rctx_t *rctx;
+
+		MEM(rctx = talloc_zero(request, pap_crypt_rctx_t));
+		MEM(rctx->password = talloc_bstrndup(rctx, env_data->password.vb_strvalue,
+						     env_data->password.vb_length));
+		MEM(rctx->known_good = talloc_bstrndup(rctx, known_good->vp_strvalue, known_good->vp_length));
+		if (ephemeral) TALLOC_FREE(known_good);
+
+		return unlang_module_yield_to_offload(request, pap_crypt_offload, pap_crypt_resume, NULL, 0, rctx);
+	}
+#endif
+
 	/*
 	 *	Authenticate, and return.
 	 */
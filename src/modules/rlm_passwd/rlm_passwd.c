@@ -28,6 +28,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/rcu.h>
 
 struct mypasswd {
 	struct mypasswd *next;
@@ -150,9 +151,13 @@ static void release_hash_table(struct hashtable * ht){
 	ht->tablesize = 0;
 }
 
-static void release_ht(struct hashtable * ht){
-	if (!ht) return;
+static int _hashtable_free(struct hashtable *ht)
+{
 	release_hash_table(ht);
+	return 0;
+}
+
+static void release_ht(struct hashtable * ht){
 	talloc_free(ht);
 }
 
@@ -169,6 +174,7 @@ static struct hashtable * build_hash_table (char const * file, int num_fields,
 	char buffer[1024];
 
 	MEM(ht = talloc_zero(NULL, struct hashtable));
+	talloc_set_destructor(ht, _hashtable_free);
 	MEM(ht->filename = talloc_typed_strdup(ht, file));
 
 	ht->tablesize = tablesize;
@@ -355,7 +361,7 @@ int main(void){
 
 #else  /* TEST */
 typedef struct {
-	struct hashtable	*ht;
+	fr_rcu_ptr_t		*ht;		//!< Current struct hashtable, replaced on reload.
 	struct mypasswd		*pwd_fmt;
 	char const		*filename;
 	char const		*format;
@@ -395,6 +401,7 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	fr_dict_attr_t const	*da;
 	rlm_passwd_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_passwd_t);
 	CONF_SECTION		*conf = mctx->mi->conf;
+	struct hashtable	*ht;
 
 	fr_assert(inst->filename && *inst->filename);
 	fr_assert(inst->format && *inst->format);
@@ -441,9 +448,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
-	inst->ht = build_hash_table(inst->filename, num_fields, key_field, listable,
-				    inst->hash_size, inst->ignore_nislike, *inst->delimiter);
-	if (!inst->ht){
+	ht = build_hash_table(inst->filename, num_fields, key_field, listable,
+			      inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+	if (!ht){
 		ERROR("Can't build hashtable from passwd file");
 		return -1;
 	}
@@ -451,14 +458,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	inst->pwd_fmt = mypasswd_alloc(inst->format, num_fields, &len);
 	if (!inst->pwd_fmt){
 		ERROR("Memory allocation failed");
-		release_ht(inst->ht);
-		inst->ht = NULL;
+		release_ht(ht);
 		return -1;
 	}
 	if (!string_to_entry(inst->format, num_fields, ':', inst->pwd_fmt , len)) {
 		ERROR("Unable to convert format entry");
-		release_ht(inst->ht);
-		inst->ht = NULL;
+		release_ht(ht);
 		return -1;
 	}
 
@@ -473,8 +478,7 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	}
 	if (!*inst->pwd_fmt->field[key_field]) {
 		cf_log_err(conf, "key field is empty");
-		release_ht(inst->ht);
-		inst->ht = NULL;
+		release_ht(ht);
 		return -1;
 	}
 
@@ -482,11 +486,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 						  inst->pwd_fmt->field[key_field], true, true);
 	if (!da) {
 		PERROR("Unable to resolve attribute");
-		release_ht(inst->ht);
-		inst->ht = NULL;
+		release_ht(ht);
 		return -1;
 	}
 
+	MEM(inst->ht = fr_rcu_ptr_alloc(mctx->mi, ht));
+
 	inst->keyattr = da;
 	inst->num_fields = num_fields;
 	inst->key_field = key_field;
@@ -500,13 +505,34 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 #undef inst
 }
 
+/** Re-read the passwd file, replacing the hash table workers are using
+ *
+ */
+static int mod_reload(module_inst_ctx_t const *mctx)
+{
+	rlm_passwd_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_passwd_t);
+	struct hashtable	*ht;
+
+	ht = build_hash_table(inst->filename, inst->num_fields, inst->key_field, inst->listable,
+			      inst->hash_size, inst->ignore_nislike, *inst->delimiter);
+	if (!ht) {
+		fr_strerror_printf("Can't build hashtable from passwd file \"%s\"", inst->filename);
+		return -1;
+	}
+
+	if (fr_rcu_ptr_replace(inst->ht, ht) < 0) {
+		release_ht(ht);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int mod_detach(module_detach_ctx_t const *mctx)
 {
 	rlm_passwd_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_passwd_t);
-	if (inst->ht) {
-		release_ht(inst->ht);
-		inst->ht = NULL;
-	}
+
+	talloc_free(inst->ht);
 	talloc_free(inst->pwd_fmt);
 	return 0;
 }
@@ -563,6 +589,7 @@ static void result_add(TALLOC_CTX *ctx, rlm_passwd_t const *inst, request_t *req
 static unlang_action_t CC_HINT(nonnull) mod_passwd_map(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_passwd_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_passwd_t);
+	struct hashtable	*ht = fr_rcu_ptr_read(inst->ht);
 
 	char			buffer[1024];
 	fr_pair_t		*key, *i;
@@ -587,14 +614,14 @@ static unlang_action_t CC_HINT(nonnull) mod_passwd_map(rlm_rcode_t *p_result, mo
 		buffer[0] = '\0';
 #endif
 		fr_pair_print_value_quoted(&FR_SBUFF_OUT(buffer, sizeof(buffer)), i, T_BARE_WORD);
-		pw = get_pw_nam(buffer, inst->ht, &last_found);
+		pw = get_pw_nam(buffer, ht, &last_found);
 		if (!pw) continue;
 
 		do {
 			result_add(request->control_ctx, inst, request, &request->control_pairs, pw, 0, "config");
 			result_add(request->reply_ctx, inst, request, &request->reply_pairs, pw, 1, "reply_items");
 			result_add(request->request_ctx, inst, request, &request->request_pairs, pw, 2, "request_items");
-		} while ((pw = get_next(buffer, inst->ht, &last_found)));
+		} while ((pw = get_next(buffer, ht, &last_found)));
 
 		found++;
 
@@ -611,9 +638,11 @@ module_rlm_t rlm_passwd = {
 	.common = {
 		.magic		= MODULE_MAGIC_INIT,
 		.name		= "passwd",
+		.flags		= MODULE_TYPE_INSTANTIATE_PARALLEL,
 		.inst_size	= sizeof(rlm_passwd_t),
 		.config		= module_config,
 		.instantiate	= mod_instantiate,
+		.reload		= mod_reload,
 		.detach		= mod_detach
 	},
 	.method_group = {
@@ -29,16 +29,26 @@ RCSID("$Id$")
 
 #define LOG_PREFIX mctx->mi->name
 
+#include <freeradius-devel/internal/internal.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/server/pairmove.h>
+#include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/lsan.h>
+#include <freeradius-devel/util/syserror.h>
 
 #include <Python.h>
 #include <frameobject.h> /* Python header not pulled in by default. */
 #include <libgen.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 /** Specifies the module.function to load for processing a section
  *
@@ -70,8 +80,23 @@ typedef struct {
 
 	PyObject	*pythonconf_dict;	//!< Configuration parameters defined in the module
 						//!< made available to the python script.
+
+	uint32_t	processes;		//!< Child processes to start for each worker thread.
+						///< 0 means python is called from the worker threads.
+	size_t		process_max_memory;	//!< Restart a child process once it uses this much memory.
+
+	bool		per_thread_interpreter;	//!< Give each worker thread its own interpreter and GIL.
 } rlm_python_t;
 
+/** Created when the module is bootstrapped
+ *
+ */
+typedef struct {
+	pid_t		supervisor_pid;		//!< Process which starts and restarts the child processes.
+						///< 0 if there isn't one.
+	int		supervisor_fd;		//!< Used to pass sockets to the supervisor.
+} rlm_python_boot_t;
+
 /** Global config for python library
  *
  */
@@ -85,16 +110,41 @@ typedef struct {
  * Multiple instances of python create multiple interpreters and each
  * thread must have a PyThreadState per interpreter, to track execution.
  */
+typedef struct rlm_python_thread_s rlm_python_thread_t;
+
+/** A worker thread's connection to one of the child processes
+ *
+ */
 typedef struct {
-	PyThreadState	*state;			//!< Module instance/thread specific state.
-} rlm_python_thread_t;
+	rlm_python_thread_t	*t;		//!< Thread which owns the connection.
+	int			fd;		//!< Our end of the socket.  -1 if the supervisor has gone.
+	fr_dlist_head_t		pending;	//!< Requests sent to the child, oldest first.
+} python_child_conn_t;
+
+struct rlm_python_thread_s {
+	PyThreadState		*state;		//!< Module instance/thread specific state.
+	PyThreadState		*interpreter;	//!< This thread's own interpreter, if per_thread_interpreter
+						///< is set.
+	PyObject		*module;	//!< The freeradius module in this thread's interpreter.
+	PyObject		*pythonconf_dict;	//!< Configuration parameters, in this thread's interpreter.
+
+	python_func_def_t
+	authorize,
+	authenticate,
+	preacct,
+	accounting,
+	post_auth;				//!< Functions loaded into this thread's interpreter.
+
+	module_instance_t const	*mi;		//!< Instance the thread belongs to.
+	fr_event_list_t		*el;		//!< To insert the child connections into.
+	python_child_conn_t	**conns;	//!< Connections to child processes.
+	uint8_t			*buffer;	//!< For encoding requests and reading replies.
+	uint32_t		next_id;	//!< To identify requests sent to the children.
+};
 
 static void			*python_dlhandle;
 static PyThreadState		*global_interpreter;	//!< Our first interpreter.
 
-static module_ctx_t const	*current_mctx;		//!< Used for communication with inittab functions.
-static CONF_SECTION		*current_conf;		//!< Used for communication with inittab functions.
-
 static libpython_global_config_t libpython_global_config = {
 	.path = NULL,
 	.path_include_default = true
@@ -108,6 +158,8 @@ static conf_parser_t const python_global_config[] = {
 
 static int libpython_init(void);
 static void libpython_free(void);
+static int python_function_load(module_inst_ctx_t const *mctx, python_func_def_t *def);
+static int python_interpreter_init(module_inst_ctx_t const *mctx);
 
 global_lib_autoinst_t rlm_python_autoinst = {
 	.name = "python",
@@ -124,13 +176,16 @@ global_lib_autoinst_t const * const rlm_python_lib[] = {
 };
 
 /*
- *	As of Python 3.8 the GIL will be per-interpreter
- *	If there are still issues with CEXTs,
- *	multiple interpreters and the GIL at that point
- *	users can build rlm_python against Python 3.8
- *	and the horrible hack of using a single interpreter
- *	for all instances of rlm_python will no longer be
- *	required.
+ *	Each instance of rlm_python gets its own interpreter,
+ *	but they all share the main interpreter's GIL, so only
+ *	one worker thread can be running python at a time.
+ *
+ *	As of Python 3.12 an interpreter can have its own GIL.
+ *	If per_thread_interpreter is set, each worker thread
+ *	creates one, and loads the module functions into it.
+ *	Objects can't be shared between these interpreters,
+ *	and C extensions which don't support them will fail
+ *	to import, so this isn't the default.
  *
  *	As Python 3.x module initialisation is significantly
  *	different than Python 2.x initialisation,
@@ -145,6 +200,9 @@ global_lib_autoinst_t const * const rlm_python_lib[] = {
  *	A mapping of configuration file names to internal variables.
  */
 static conf_parser_t module_config[] = {
+	{ FR_CONF_OFFSET("processes", rlm_python_t, processes), .dflt = "0" },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("process_max_memory", FR_TYPE_SIZE, 0, rlm_python_t, process_max_memory), .dflt = "0" },
+	{ FR_CONF_OFFSET("per_thread_interpreter", rlm_python_t, per_thread_interpreter), .dflt = "no" },
 
 #define A(x) { FR_CONF_OFFSET("mod_" #x, rlm_python_t, x.module_name), .dflt = "${.module}" }, \
 	{ FR_CONF_OFFSET("func_" #x, rlm_python_t, x.function_name) },
@@ -279,16 +337,14 @@ failed:
 }
 
 static void mod_vptuple(TALLOC_CTX *ctx, module_ctx_t const *mctx, request_t *request,
-			fr_pair_list_t *vps, PyObject *p_value, char const *funcname, char const *list_name)
+			fr_pair_list_t *out, PyObject *p_value, char const *funcname, char const *list_name)
 {
 	int		i;
 	Py_ssize_t	tuple_len;
 	tmpl_t		*dst;
 	fr_pair_t	*vp;
 	request_t	*current = request;
-	fr_pair_list_t	tmp_list;
 
-	fr_pair_list_init(&tmp_list);
 	/*
 	 *	If the Python function gave us None for the tuple,
 	 *	then just return.
@@ -360,9 +416,8 @@ static void mod_vptuple(TALLOC_CTX *ctx, module_ctx_t const *mctx, request_t *re
 			DEBUG("%s - '%s.%s' = '%s'", funcname, list_name, s1, s2);
 		}
 
-		fr_pair_append(&tmp_list, vp);
+		fr_pair_append(out, vp);
 	}
-	radius_pairmove(request, vps, &tmp_list);
 }
 
 
@@ -473,8 +528,22 @@ static int mod_populate_vptuple(module_ctx_t const *mctx, request_t *request, Py
 	return 0;
 }
 
+/** Call a python function
+ *
+ * Must be called with the GIL held.
+ *
+ * @param[out] p_result		returned by the function.
+ * @param[in] mctx		module calling the function.
+ * @param[in] request		whose request pairs are passed to the function.
+ *				NULL if there's no request.
+ * @param[in] p_func		to call.
+ * @param[in] funcname		for log messages.
+ * @param[out] reply		pairs the function wants to add to the reply list.
+ * @param[out] control		pairs the function wants to add to the control list.
+ */
 static unlang_action_t do_python_single(rlm_rcode_t *p_result, module_ctx_t const *mctx,
-					request_t *request, PyObject *p_func, char const *funcname)
+					request_t *request, PyObject *p_func, char const *funcname,
+					fr_pair_list_t *reply, fr_pair_list_t *control)
 {
 	fr_pair_t	*vp;
 	PyObject	*p_ret = NULL;
@@ -572,10 +641,10 @@ static unlang_action_t do_python_single(rlm_rcode_t *p_result, module_ctx_t cons
 		/* Now have the return value */
 		rcode = PyLong_AsLong(p_tuple_int);
 		/* Reply item tuple */
-		mod_vptuple(request->reply_ctx, mctx, request, &request->reply_pairs,
+		mod_vptuple(request->reply_ctx, mctx, request, reply,
 			    PyTuple_GET_ITEM(p_ret, 1), funcname, "reply");
 		/* Config item tuple */
-		mod_vptuple(request->control_ctx, mctx, request, &request->control_pairs,
+		mod_vptuple(request->control_ctx, mctx, request, control,
 			    PyTuple_GET_ITEM(p_ret, 2), funcname, "config");
 
 	} else if (PyNumber_Check(p_ret)) {
@@ -600,26 +669,865 @@ finish:
 	RETURN_MODULE_RCODE(rcode);
 }
 
+/*
+ *	Child processes
+ *
+ *	Python code is serialised by the GIL, so calling it from many
+ *	worker threads doesn't use more than one core.  With `processes`
+ *	set, each worker thread instead hands the request pairs to child
+ *	processes, which run the python functions and send back the
+ *	pairs to add to the reply and control lists.
+ *
+ *	The children are forked from a supervisor, which is itself forked
+ *	when the module is bootstrapped, before there are any worker
+ *	threads.  PyOS_AfterFork_Child() hangs if the process has any
+ *	interpreters other than the main one, so this has to happen
+ *	before they're created.  Each child creates the instance's
+ *	interpreter, and imports the module, itself.  The supervisor is
+ *	single threaded, so it can fork new children whenever it needs
+ *	to.  Each worker thread creates a socket pair per child, and
+ *	passes one end to the supervisor.
+ *	The supervisor keeps its copy of that end, so if the child
+ *	crashes, or is recycled because it has grown too large, a new
+ *	child is started on the same socket.
+ */
+#define PYTHON_CHILD_MSG_MAX		(64 * 1024)	//!< Largest request or reply.
+#define PYTHON_CHILD_EXIT_RECYCLE	3		//!< Child exited because it used too much memory.
+
+/** Header of a message sent to a child process
+ *
+ * Followed by the protocol name of the request's dictionary, including the
+ * trailing '\0', then the request pairs, encoded with the internal encoder.
+ */
+typedef struct {
+	uint32_t		id;		//!< Copied into the reply.
+	uint32_t		func;		//!< Offset of the #python_func_def_t to call.
+} python_child_request_hdr_t;
+
+/** Header of a reply from a child process
+ *
+ * Followed by the reply pairs, then the control pairs, both encoded with
+ * the internal encoder.
+ */
+typedef struct {
+	uint32_t		id;		//!< From the request.
+	uint32_t		rcode;		//!< Returned by the python function.
+	uint32_t		reply_len;	//!< Length of the encoded reply pairs.
+} python_child_reply_hdr_t;
+
+/** A request waiting for a child process
+ *
+ */
+typedef struct {
+	uint32_t		id;		//!< Identifies the reply.
+	request_t		*request;	//!< Waiting for the reply.
+	python_child_conn_t	*conn;		//!< The request was sent on.
+	fr_dlist_t		entry;		//!< In the connection's list of pending requests.
+
+	rlm_rcode_t		rcode;		//!< Returned by the python function.
+	fr_pair_list_t		reply;		//!< Pairs to move into the reply list.
+	fr_pair_list_t		control;	//!< Pairs to move into the control list.
+} python_child_rctx_t;
+
+/** A child process, as seen by the supervisor
+ *
+ */
+typedef struct {
+	int			fd;		//!< Child's end of the socket pair.
+	pid_t			pid;		//!< Of the child currently serving fd.
+	uint32_t		*busy;		//!< ID of the request the child is running.
+						///< Shared with the child, so that request can
+						///< be failed if the child crashes.
+	time_t			started;	//!< When the child was started.
+	fr_dlist_t		entry;		//!< In the supervisor's list of children.
+} python_supervised_t;
+
+static int python_sigchld_pipe[2] = { -1, -1 };
+
+/** Pass a file descriptor over a unix socket
+ *
+ */
+static int python_fd_send(int sock, int fd)
+{
+	struct msghdr	msg = {};
+	struct cmsghdr	*cmsg;
+	struct iovec	iov;
+	uint8_t		dummy = 0;
+	union {
+		struct cmsghdr	align;
+		uint8_t		buf[CMSG_SPACE(sizeof(int))];
+	} control = {};
+
+	iov.iov_base = &dummy;
+	iov.iov_len = sizeof(dummy);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	return (sendmsg(sock, &msg, 0) < 0) ? -1 : 0;
+}
+
+/** Receive a file descriptor sent with #python_fd_send
+ *
+ * @return
+ *	- 1 if a file descriptor was received.
+ *	- 0 if the other end has closed the socket.
+ *	- -1 on error.
+ */
+static int python_fd_recv(int sock, int *fd)
+{
+	struct msghdr	msg = {};
+	struct cmsghdr	*cmsg;
+	struct iovec	iov;
+	uint8_t		dummy;
+	ssize_t		len;
+	union {
+		struct cmsghdr	align;
+		uint8_t		buf[CMSG_SPACE(sizeof(int))];
+	} control = {};
+
+	iov.iov_base = &dummy;
+	iov.iov_len = sizeof(dummy);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	len = recvmsg(sock, &msg, 0);
+	if (len == 0) return 0;
+	if (len < 0) return -1;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) return -1;
+
+	memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+
+	return 1;
+}
+
+/** How much memory this process is using, in bytes
+ *
+ */
+static size_t python_child_rss(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0) return 0;
+
+#ifdef __APPLE__
+	return ru.ru_maxrss;
+#else
+	return ru.ru_maxrss * 1024;
+#endif
+}
+
+/** Run one request in a child process, and send back the result
+ *
+ */
+static void python_child_request(module_ctx_t const *mctx, int fd, uint32_t *busy,
+				 uint8_t const *data, size_t data_len, uint8_t *out)
+{
+	rlm_python_t const		*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t);
+	python_child_request_hdr_t	hdr;
+	python_child_reply_hdr_t	reply_hdr = { .rcode = RLM_MODULE_FAIL };
+	python_func_def_t const		*def;
+	uint8_t const			*p, *end = data + data_len;
+	fr_dict_t const			*dict;
+	request_t			*request = NULL;
+	fr_dbuff_t			dbuff = FR_DBUFF_TMP(out + sizeof(reply_hdr),
+							     PYTHON_CHILD_MSG_MAX - sizeof(reply_hdr));
+	fr_pair_list_t			reply, control;
+	rlm_rcode_t			rcode;
+	ssize_t				slen;
+
+	fr_pair_list_init(&reply);
+	fr_pair_list_init(&control);
+
+	if (data_len < sizeof(hdr)) return;
+	memcpy(&hdr, data, sizeof(hdr));
+
+	*busy = reply_hdr.id = hdr.id;
+
+	if (hdr.func > (sizeof(rlm_python_t) - sizeof(python_func_def_t))) {
+		ERROR("Invalid function requested");
+		goto send;
+	}
+	def = (python_func_def_t const *)((uint8_t const *)inst + hdr.func);
+
+	p = data + sizeof(hdr);
+	dict = fr_dict_by_protocol_name((char const *)p);
+	p = memchr(p, '\0', end - p);
+	if (!p || !dict) {
+		ERROR("Request has an unknown protocol");
+		goto send;
+	}
+	p++;
+
+	request = request_local_alloc_external(NULL, (&(request_init_args_t){ .namespace = dict }));
+	if (fr_internal_decode_list_dbuff(request->request_ctx, &request->request_pairs, fr_dict_root(dict),
+					  &FR_DBUFF_TMP(p, end - p), NULL) < 0) {
+		PERROR("Failed decoding request");
+		goto send;
+	}
+
+	if (!def->function) {
+		reply_hdr.rcode = RLM_MODULE_NOOP;
+		goto send;
+	}
+
+	do_python_single(&rcode, mctx, request, def->function, def->function_name, &reply, &control);
+
+	slen = fr_internal_encode_list(&dbuff, &reply, NULL);
+	if (slen < 0) {
+	too_big:
+		ERROR("Reply pairs from %s are too large", def->function_name);
+		fr_dbuff_set_to_start(&dbuff);
+		goto send;
+	}
+	reply_hdr.reply_len = slen;
+
+	if (fr_internal_encode_list(&dbuff, &control, NULL) < 0) goto too_big;
+	reply_hdr.rcode = rcode;
+
+send:
+	memcpy(out, &reply_hdr, sizeof(reply_hdr));
+	if (send(fd, out, sizeof(reply_hdr) + fr_dbuff_used(&dbuff), 0) < 0) {
+		ERROR("Failed sending reply: %s", fr_syserror(errno));
+	}
+
+	*busy = 0;
+	talloc_free(request);
+}
+
+/** Exit from a child process
+ *
+ * Output written by python's print() is buffered by python, and would be
+ * lost otherwise.
+ */
+static NEVER_RETURNS void python_child_exit(int status)
+{
+	PyObject *p_file;
+
+	p_file = PySys_GetObject("stdout");
+	if (p_file) Py_XDECREF(PyObject_CallMethod(p_file, "flush", NULL));
+
+	p_file = PySys_GetObject("stderr");
+	if (p_file) Py_XDECREF(PyObject_CallMethod(p_file, "flush", NULL));
+
+	_exit(status);
+}
+
+/** Main loop of a child process
+ *
+ * Runs requests from one worker thread, until it closes its end of the socket.
+ */
+static NEVER_RETURNS void python_child_run(module_ctx_t const *mctx, int fd, uint32_t *busy)
+{
+	rlm_python_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t);
+	uint8_t			*buffer, *out;
+	ssize_t			len;
+
+	MEM(buffer = talloc_array(NULL, uint8_t, PYTHON_CHILD_MSG_MAX));
+	MEM(out = talloc_array(buffer, uint8_t, PYTHON_CHILD_MSG_MAX));
+
+	for (;;) {
+		len = recv(fd, buffer, PYTHON_CHILD_MSG_MAX, 0);
+		if (len == 0) python_child_exit(EXIT_SUCCESS);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			python_child_exit(EXIT_FAILURE);
+		}
+
+		python_child_request(mctx, fd, busy, buffer, len, out);
+
+		if (inst->process_max_memory && (python_child_rss() > inst->process_max_memory)) {
+			python_child_exit(PYTHON_CHILD_EXIT_RECYCLE);
+		}
+	}
+}
+
+/** Create the instance's interpreter in a child process
+ *
+ * The supervisor was forked before the module was instantiated, so the
+ * child has to create the interpreter, and load the functions, itself.
+ * func_instantiate isn't called, as the server has already called it.
+ */
+static int python_child_init(module_ctx_t const *mctx)
+{
+	rlm_python_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
+	module_inst_ctx_t const	*inst_mctx = MODULE_INST_CTX(UNCONST(module_instance_t *, mctx->mi));
+
+	/*
+	 *	The instance data was read only when the supervisor
+	 *	was forked.  Our copy of it is ours to change.
+	 */
+	if (module_instance_data_unprotect(mctx->mi) < 0) {
+		PERROR("Failed unprotecting instance data");
+		return -1;
+	}
+
+	PyEval_SaveThread();
+	if (python_interpreter_init(inst_mctx) < 0) return -1;
+
+	PyEval_RestoreThread(inst->interpreter);
+
+#define PYTHON_CHILD_FUNC_LOAD(_x) if (python_function_load(inst_mctx, &inst->_x) < 0) return -1
+	PYTHON_CHILD_FUNC_LOAD(authenticate);
+	PYTHON_CHILD_FUNC_LOAD(authorize);
+	PYTHON_CHILD_FUNC_LOAD(preacct);
+	PYTHON_CHILD_FUNC_LOAD(accounting);
+	PYTHON_CHILD_FUNC_LOAD(post_auth);
+#undef PYTHON_CHILD_FUNC_LOAD
+
+	return 0;
+}
+
+/** Fork a child process to serve a socket
+ *
+ * Called in the supervisor, with the main interpreter active.
+ */
+static void python_child_start(module_ctx_t const *mctx, int ctl, python_supervised_t *child)
+{
+	pid_t	pid;
+	int	fork_errno;
+
+	PyOS_BeforeFork();
+	pid = fork();
+	fork_errno = errno;
+
+	if (pid == 0) {
+		PyOS_AfterFork_Child();
+
+		close(ctl);
+		close(python_sigchld_pipe[0]);
+		close(python_sigchld_pipe[1]);
+		signal(SIGCHLD, SIG_DFL);
+
+		if (python_child_init(mctx) < 0) python_child_exit(EXIT_FAILURE);
+
+		python_child_run(mctx, child->fd, child->busy);
+	}
+
+	PyOS_AfterFork_Parent();
+
+	if (pid < 0) {
+		ERROR("Failed starting child process: %s", fr_syserror(fork_errno));
+		child->pid = -1;
+		return;
+	}
+
+	DEBUG2("Started child process %u", (unsigned int)pid);
+	child->pid = pid;
+	child->started = time(NULL);
+}
+
+static void _python_sigchld(UNUSED int sig)
+{
+	int saved_errno = errno;
+
+	IGNORE(write(python_sigchld_pipe[1], "", 1), ssize_t);
+	errno = saved_errno;
+}
+
+/** Restart children which have exited, and forget those which are no longer needed
+ *
+ */
+static void python_supervisor_reap(module_ctx_t const *mctx, int ctl, fr_dlist_head_t *children)
+{
+	pid_t	pid;
+	int	status;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		python_supervised_t *child = NULL;
+
+		while ((child = fr_dlist_next(children, child))) if (child->pid == pid) break;
+		if (!child) continue;
+
+		/*
+		 *	The worker thread closed its end of the socket.
+		 */
+		if (WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS)) {
+			fr_dlist_remove(children, child);
+			close(child->fd);
+			munmap(child->busy, sizeof(*child->busy));
+			talloc_free(child);
+			continue;
+		}
+
+		if (WIFEXITED(status) && (WEXITSTATUS(status) == PYTHON_CHILD_EXIT_RECYCLE)) {
+			INFO("Child process %u exceeded process_max_memory, restarting it", (unsigned int)pid);
+		} else {
+			if (WIFSIGNALED(status)) {
+				ERROR("Child process %u was killed by signal %d, restarting it",
+				      (unsigned int)pid, WTERMSIG(status));
+			} else {
+				ERROR("Child process %u exited with status %d, restarting it",
+				      (unsigned int)pid, WEXITSTATUS(status));
+			}
+
+			/*
+			 *	Fail the request it was running, so
+			 *	that it doesn't wait forever.
+			 */
+			if (*child->busy) {
+				python_child_reply_hdr_t reply_hdr = { .id = *child->busy, .rcode = RLM_MODULE_FAIL };
+
+				(void) send(child->fd, &reply_hdr, sizeof(reply_hdr), MSG_DONTWAIT);
+				*child->busy = 0;
+			}
+
+			/*
+			 *	Don't spin if the child can't start.
+			 */
+			if ((time(NULL) - child->started) < 1) sleep(1);
+		}
+
+		python_child_start(mctx, ctl, child);
+	}
+}
+
+/** Main loop of the supervisor process
+ *
+ * Starts a child for each socket it's sent, until the server closes the
+ * control socket.
+ */
+static NEVER_RETURNS void python_supervisor_run(module_ctx_t const *mctx, int ctl)
+{
+	fr_dlist_head_t		children;
+	python_supervised_t	*child = NULL;
+	struct sigaction	act = {};
+	struct pollfd		fds[2];
+
+	/*
+	 *	Signals are for the main server process.  Our children
+	 *	are stopped by closing their sockets.
+	 */
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGINT, SIG_IGN);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+
+	if ((pipe(python_sigchld_pipe) < 0) ||
+	    (fr_nonblock(python_sigchld_pipe[0]) < 0) || (fr_nonblock(python_sigchld_pipe[1]) < 0)) {
+		ERROR("Failed creating pipe for child process supervisor: %s", fr_syserror(errno));
+		_exit(EXIT_FAILURE);
+	}
+
+	act.sa_handler = _python_sigchld;
+	act.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&act.sa_mask);
+	sigaction(SIGCHLD, &act, NULL);
+
+	fr_dlist_talloc_init(&children, python_supervised_t, entry);
+
+	for (;;) {
+		int fd;
+
+		fds[0] = (struct pollfd){ .fd = ctl, .events = POLLIN };
+		fds[1] = (struct pollfd){ .fd = python_sigchld_pipe[0], .events = POLLIN };
+
+		if (poll(fds, NUM_ELEMENTS(fds), -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		if (fds[1].revents) {
+			uint8_t buffer[64];
+
+			while (read(python_sigchld_pipe[0], buffer, sizeof(buffer)) > 0);
+			python_supervisor_reap(mctx, ctl, &children);
+		}
+
+		if (!fds[0].revents) continue;
+
+		switch (python_fd_recv(ctl, &fd)) {
+		case 1:
+			break;
+
+		case 0:
+			goto done;
+
+		default:
+			if (errno == EINTR) continue;
+			ERROR("Failed reading from control socket: %s", fr_syserror(errno));
+			goto done;
+		}
+
+		MEM(child = talloc_zero(NULL, python_supervised_t));
+		child->fd = fd;
+		child->busy = mmap(NULL, sizeof(*child->busy), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+		if (child->busy == MAP_FAILED) {
+			ERROR("Failed allocating shared memory for child process: %s", fr_syserror(errno));
+			close(fd);
+			talloc_free(child);
+			continue;
+		}
+		fr_dlist_insert_tail(&children, child);
+
+		python_child_start(mctx, ctl, child);
+	}
+
+done:
+	/*
+	 *	The server has gone away.  Stop the children which
+	 *	are still running.
+	 */
+	signal(SIGCHLD, SIG_DFL);
+	child = NULL;
+	while ((child = fr_dlist_next(&children, child))) if (child->pid > 0) kill(child->pid, SIGTERM);
+	while ((wait(NULL) > 0) || (errno == EINTR));
+
+	_exit(EXIT_SUCCESS);
+}
+
+/** Start the supervisor for an instance's child processes
+ *
+ * Must be called before any worker threads are started, and before
+ * any interpreters other than the main one are created.
+ */
+static int python_supervisor_start(module_inst_ctx_t const *mctx)
+{
+	rlm_python_boot_t	*boot = talloc_get_type_abort(mctx->mi->boot, rlm_python_boot_t);
+	int			sockets[2];
+	pid_t			pid;
+	int			fork_errno;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) < 0) {
+		ERROR("Failed creating control socket for child processes: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	PyEval_RestoreThread(global_interpreter);
+	PyOS_BeforeFork();
+	pid = fork();
+	fork_errno = errno;
+
+	if (pid == 0) {
+		PyOS_AfterFork_Child();
+
+		close(sockets[0]);
+		python_supervisor_run(MODULE_CTX_FROM_INST(mctx), sockets[1]);
+	}
+
+	PyOS_AfterFork_Parent();
+	PyEval_SaveThread();
+
+	if (pid < 0) {
+		ERROR("Failed starting child process supervisor: %s", fr_syserror(fork_errno));
+		close(sockets[0]);
+		close(sockets[1]);
+		return -1;
+	}
+
+	close(sockets[1]);
+	(void) fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+
+	DEBUG("Started child process supervisor %u", (unsigned int)pid);
+	boot->supervisor_pid = pid;
+	boot->supervisor_fd = sockets[0];
+
+	return 0;
+}
+
+/** Stop the supervisor, and with it, all the child processes
+ *
+ */
+static void python_supervisor_stop(rlm_python_boot_t *boot)
+{
+	if (!boot->supervisor_pid) return;
+
+	close(boot->supervisor_fd);
+	while ((waitpid(boot->supervisor_pid, NULL, 0) < 0) && (errno == EINTR));
+
+	boot->supervisor_pid = 0;
+}
+
+static int _python_child_rctx_free(python_child_rctx_t *rctx)
+{
+	if (fr_dlist_entry_in_list(&rctx->entry)) fr_dlist_remove(&rctx->conn->pending, rctx);
+
+	return 0;
+}
+
+/** The supervisor has gone away, fail all the requests waiting for it
+ *
+ */
+static void python_child_conn_fail(python_child_conn_t *conn)
+{
+	module_ctx_t const	*mctx = MODULE_CTX(conn->t->mi, conn->t, NULL, NULL);
+	python_child_rctx_t	*rctx;
+
+	if (conn->fd < 0) return;
+
+	ERROR("Lost connection to child process supervisor");
+
+	(void) fr_event_fd_delete(conn->t->el, conn->fd, FR_EVENT_FILTER_IO);
+	close(conn->fd);
+	conn->fd = -1;
+
+	while ((rctx = fr_dlist_pop_head(&conn->pending))) {
+		rctx->rcode = RLM_MODULE_FAIL;
+		unlang_interpret_mark_runnable(rctx->request);
+	}
+}
+
+static void python_child_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+			       UNUSED int fd_errno, void *uctx)
+{
+	python_child_conn_fail(talloc_get_type_abort(uctx, python_child_conn_t));
+}
+
+/** Read replies from a child process, and resume the requests they're for
+ *
+ */
+static void python_child_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	python_child_conn_t	*conn = talloc_get_type_abort(uctx, python_child_conn_t);
+	uint8_t			*buffer = conn->t->buffer;
+
+	for (;;) {
+		python_child_reply_hdr_t	hdr;
+		python_child_rctx_t		*rctx = NULL;
+		request_t			*request;
+		fr_dict_attr_t const		*root;
+		uint8_t const			*p;
+		ssize_t				len;
+
+		len = recv(fd, buffer, talloc_array_length(buffer), 0);
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+		}
+		if (len <= 0) {
+			python_child_conn_fail(conn);
+			return;
+		}
+
+		if ((size_t)len < sizeof(hdr)) continue;
+		memcpy(&hdr, buffer, sizeof(hdr));
+
+		/*
+		 *	Replies arrive in the order the requests
+		 *	were sent, so this is normally the first
+		 *	one.  If it's not found, the request was
+		 *	cancelled.
+		 */
+		while ((rctx = fr_dlist_next(&conn->pending, rctx))) if (rctx->id == hdr.id) break;
+		if (!rctx) continue;
+
+		fr_dlist_remove(&conn->pending, rctx);
+		request = rctx->request;
+		root = fr_dict_root(request->dict);
+		rctx->rcode = hdr.rcode;
+
+		p = buffer + sizeof(hdr);
+		if ((hdr.reply_len > (len - sizeof(hdr))) ||
+		    (fr_internal_decode_list_dbuff(request->reply_ctx, &rctx->reply, root,
+						   &FR_DBUFF_TMP(p, (size_t)hdr.reply_len), NULL) < 0) ||
+		    (fr_internal_decode_list_dbuff(request->control_ctx, &rctx->control, root,
+						   &FR_DBUFF_TMP(p + hdr.reply_len, buffer + len), NULL) < 0)) {
+			RPERROR("Failed decoding reply from child process");
+			rctx->rcode = RLM_MODULE_FAIL;
+		}
+
+		unlang_interpret_mark_runnable(request);
+	}
+}
+
+static unlang_action_t python_child_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	python_child_rctx_t	*rctx = talloc_get_type_abort(mctx->rctx, python_child_rctx_t);
+	rlm_rcode_t		rcode = rctx->rcode;
+
+	radius_pairmove(request, &request->reply_pairs, &rctx->reply);
+	radius_pairmove(request, &request->control_pairs, &rctx->control);
+	fr_pair_list_free(&rctx->reply);
+	fr_pair_list_free(&rctx->control);
+	talloc_free(rctx);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+static void python_child_signal(module_ctx_t const *mctx, request_t *request, UNUSED fr_signal_t action)
+{
+	python_child_rctx_t *rctx = talloc_get_type_abort(mctx->rctx, python_child_rctx_t);
+
+	RDEBUG2("Request cancelled, ignoring the reply from the child process");
+
+	/*
+	 *	The reply is discarded when it arrives.
+	 */
+	talloc_free(rctx);
+}
+
+/** Send a request to the least busy child process, and wait for the reply
+ *
+ */
+static unlang_action_t python_child_call(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					 request_t *request, size_t func)
+{
+	rlm_python_thread_t		*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
+	python_child_conn_t		*conn = NULL;
+	python_child_rctx_t		*rctx;
+	python_child_request_hdr_t	hdr = { .func = func };
+	char const			*proto = fr_dict_root(request->dict)->name;
+	fr_dbuff_t			dbuff = FR_DBUFF_TMP(t->buffer, talloc_array_length(t->buffer));
+	size_t				i;
+
+	for (i = 0; i < talloc_array_length(t->conns); i++) {
+		if (t->conns[i]->fd < 0) continue;
+
+		if (!conn ||
+		    (fr_dlist_num_elements(&t->conns[i]->pending) < fr_dlist_num_elements(&conn->pending))) {
+			conn = t->conns[i];
+		}
+	}
+	if (!conn) {
+		REDEBUG("No child processes available");
+		RETURN_MODULE_FAIL;
+	}
+
+	if (++t->next_id == 0) t->next_id = 1;
+	hdr.id = t->next_id;
+
+	if ((fr_dbuff_in_memcpy(&dbuff, (uint8_t const *)&hdr, sizeof(hdr)) < 0) ||
+	    (fr_dbuff_in_memcpy(&dbuff, (uint8_t const *)proto, strlen(proto) + 1) < 0) ||
+	    (fr_internal_encode_list(&dbuff, &request->request_pairs, NULL) < 0)) {
+		REDEBUG("Request pairs are too large to send to a child process");
+		RETURN_MODULE_FAIL;
+	}
+
+	if (send(conn->fd, t->buffer, fr_dbuff_used(&dbuff), 0) < 0) {
+		REDEBUG("Failed sending request to child process: %s", fr_syserror(errno));
+		RETURN_MODULE_FAIL;
+	}
+
+	MEM(rctx = talloc_zero(request, python_child_rctx_t));
+	rctx->id = hdr.id;
+	rctx->request = request;
+	rctx->conn = conn;
+	fr_pair_list_init(&rctx->reply);
+	fr_pair_list_init(&rctx->control);
+	fr_dlist_insert_tail(&conn->pending, rctx);
+	talloc_set_destructor(rctx, _python_child_rctx_free);
+
+	return unlang_module_yield(request, python_child_resume, python_child_signal, ~FR_SIGNAL_CANCEL, rctx);
+}
+
+/** Connect a worker thread to its child processes
+ *
+ */
+static int python_child_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_python_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t);
+	rlm_python_boot_t const	*boot = talloc_get_type_abort_const(mctx->mi->boot, rlm_python_boot_t);
+	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
+	uint32_t		i;
+
+	t->mi = mctx->mi;
+	t->el = mctx->el;
+	MEM(t->buffer = talloc_array(t, uint8_t, PYTHON_CHILD_MSG_MAX));
+	MEM(t->conns = talloc_zero_array(t, python_child_conn_t *, inst->processes));
+
+	for (i = 0; i < inst->processes; i++) {
+		python_child_conn_t	*conn;
+		int			sockets[2];
+
+		MEM(conn = talloc_zero(t->conns, python_child_conn_t));
+		conn->t = t;
+		conn->fd = -1;
+		fr_dlist_talloc_init(&conn->pending, python_child_rctx_t, entry);
+		t->conns[i] = conn;
+
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) < 0) {
+			ERROR("Failed creating socket for child process: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		if (python_fd_send(boot->supervisor_fd, sockets[1]) < 0) {
+			ERROR("Failed passing socket to child process supervisor: %s", fr_syserror(errno));
+			close(sockets[0]);
+			close(sockets[1]);
+			return -1;
+		}
+		close(sockets[1]);
+
+		conn->fd = sockets[0];
+		(void) fcntl(conn->fd, F_SETFD, FD_CLOEXEC);
+		if (fr_nonblock(conn->fd) < 0) {
+			PERROR("Failed making child process socket non-blocking");
+			return -1;
+		}
+
+		if (fr_event_fd_insert(conn, NULL, t->el, conn->fd,
+				       python_child_read, NULL, python_child_error, conn) < 0) {
+			PERROR("Failed inserting child process socket into event loop");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Disconnect a worker thread from its child processes
+ *
+ * The children exit when they see their socket has been closed.
+ */
+static void python_child_thread_detach(rlm_python_thread_t *t)
+{
+	size_t i;
+
+	for (i = 0; i < talloc_array_length(t->conns); i++) {
+		python_child_conn_t *conn = t->conns[i];
+
+		if (!conn || (conn->fd < 0)) continue;
+
+		(void) fr_event_fd_delete(t->el, conn->fd, FR_EVENT_FILTER_IO);
+		close(conn->fd);
+		conn->fd = -1;
+	}
+}
+
 /** Thread safe call to a python function
  *
  * Will swap in thread state specific to module/thread.
  */
 static unlang_action_t do_python(rlm_rcode_t *p_result, module_ctx_t const *mctx,
-				 request_t *request, PyObject *p_func, char const *funcname)
+				 request_t *request, python_func_def_t const *def, char const *funcname)
 {
+	rlm_python_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t);
 	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
+	PyThreadState		*state = t->interpreter ? t->interpreter : t->state;
 	rlm_rcode_t		rcode;
+	fr_pair_list_t		reply, control;
 
 	/*
 	 *	It's a NOOP if the function wasn't defined
 	 */
-	if (!p_func) RETURN_MODULE_NOOP;
+	if (!def->function) RETURN_MODULE_NOOP;
+
+	if (inst->processes) {
+		return python_child_call(p_result, mctx, request, (uint8_t const *)def - (uint8_t const *)inst);
+	}
 
-	RDEBUG3("Using thread state %p/%p", mctx->mi->data, t->state);
+	RDEBUG3("Using thread state %p/%p", mctx->mi->data, state);
 
-	PyEval_RestoreThread(t->state);	/* Swap in our local thread state */
-	do_python_single(&rcode, mctx, request, p_func, funcname);
-	(void)fr_cond_assert(PyEval_SaveThread() == t->state);
+	fr_pair_list_init(&reply);
+	fr_pair_list_init(&control);
+
+	PyEval_RestoreThread(state);	/* Swap in our local thread state */
+	do_python_single(&rcode, mctx, request, def->function, funcname, &reply, &control);
+	(void)fr_cond_assert(PyEval_SaveThread() == state);
+
+	radius_pairmove(request, &request->reply_pairs, &reply);
+	radius_pairmove(request, &request->control_pairs, &control);
 
 	RETURN_MODULE_RCODE(rcode);
 }
@@ -628,7 +1536,8 @@ static unlang_action_t do_python(rlm_rcode_t *p_result, module_ctx_t const *mctx
 static unlang_action_t CC_HINT(nonnull) mod_##x(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request) \
 { \
 	rlm_python_t const *inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t); \
-	return do_python(p_result, mctx, request, inst->x.function, #x);\
+	rlm_python_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t); \
+	return do_python(p_result, mctx, request, t->interpreter ? &t->x : &inst->x, #x);\
 }
 
 MOD_FUNC(authenticate)
@@ -774,21 +1683,21 @@ static int python_parse_config(module_inst_ctx_t const *mctx, CONF_SECTION *cs,
 /** Make the current instance's config available within the module we're initialising
  *
  */
-static int python_module_import_config(module_inst_ctx_t const *mctx, CONF_SECTION *conf, PyObject *module)
+static int python_module_import_config(module_inst_ctx_t const *mctx, CONF_SECTION *conf, PyObject *module,
+				       PyObject **pythonconf_dict)
 {
-	rlm_python_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
 	CONF_SECTION *cs;
 
 	/*
 	 *	Convert a FreeRADIUS config structure into a python
 	 *	dictionary.
 	 */
-	inst->pythonconf_dict = PyDict_New();
-	if (!inst->pythonconf_dict) {
+	*pythonconf_dict = PyDict_New();
+	if (!*pythonconf_dict) {
 		ERROR("Unable to create python dict for config");
 	error:
-		Py_XDECREF(inst->pythonconf_dict);
-		inst->pythonconf_dict = NULL;
+		Py_XDECREF(*pythonconf_dict);
+		*pythonconf_dict = NULL;
 		python_error_log(MODULE_CTX_FROM_INST(mctx), NULL);
 		return -1;
 	}
@@ -796,13 +1705,13 @@ static int python_module_import_config(module_inst_ctx_t const *mctx, CONF_SECTI
 	cs = cf_section_find(conf, "config", NULL);
 	if (cs) {
 		DEBUG("Inserting \"config\" section into python environment as radiusd.config");
-		if (python_parse_config(mctx, cs, 0, inst->pythonconf_dict) < 0) goto error;
+		if (python_parse_config(mctx, cs, 0, *pythonconf_dict) < 0) goto error;
 	}
 
 	/*
 	 *	Add module configuration as a dict
 	 */
-	if (PyModule_AddObject(module, "config", inst->pythonconf_dict) < 0) goto error;
+	if (PyModule_AddObject(module, "config", *pythonconf_dict) < 0) goto error;
 
 	return 0;
 }
@@ -828,24 +1737,61 @@ static int python_module_import_constants(module_inst_ctx_t const *mctx, PyObjec
 /*
  *	Python 3 interpreter initialisation and destruction
  */
+
+/** Return the definition of the freeradius module
+ *
+ * Uses multi-phase initialisation, so that every interpreter which
+ * imports the module gets a separate copy, and so the module can be
+ * imported by interpreters with their own GIL.
+ */
 static PyObject *python_module_init(void)
 {
-	PyObject		*module;
+	static PyModuleDef_Slot py_module_slots[] = {
+#if PY_VERSION_HEX >= 0x030C0000
+		{ Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+		{ 0, NULL }
+	};
 
 	static struct PyModuleDef py_module_def = {
 		PyModuleDef_HEAD_INIT,
 		.m_name = "freeradius",
 		.m_doc = "freeRADIUS python module",
-		.m_size = -1,
-		.m_methods = module_methods
+		.m_size = 0,
+		.m_methods = module_methods,
+		.m_slots = py_module_slots
 	};
 
-	fr_assert(current_mctx);
+	return PyModuleDef_Init(&py_module_def);
+}
+
+/** Import the freeradius module into the current interpreter
+ *
+ * Each interpreter gets its own copy which it can mutate as much as
+ * it wants.  The instance's config section, and our constants are
+ * added to it.
+ *
+ * @param[in] mctx		of the module instance.
+ * @param[out] pythonconf_dict	the config section, as a python dict.
+ * @return
+ *	- The module on success.
+ *	- NULL on failure.
+ */
+static PyObject *python_module_import(module_inst_ctx_t const *mctx, PyObject **pythonconf_dict)
+{
+	PyObject	*module;
 
-	module = PyModule_Create(&py_module_def);
+	module = PyImport_ImportModule("freeradius");
 	if (!module) {
-		python_error_log(current_mctx, NULL);
-		Py_RETURN_NONE;
+		ERROR("Failed importing \"freeradius\" module into interpreter %p", PyThreadState_Get());
+		python_error_log(MODULE_CTX_FROM_INST(mctx), NULL);
+		return NULL;
+	}
+
+	if ((python_module_import_config(mctx, mctx->mi->conf, module, pythonconf_dict) < 0) ||
+	    (python_module_import_constants(mctx, module) < 0)) {
+		Py_DECREF(module);
+		return NULL;
 	}
 
 	return module;
@@ -854,17 +1800,6 @@ static PyObject *python_module_init(void)
 static int python_interpreter_init(module_inst_ctx_t const *mctx)
 {
 	rlm_python_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
-	CONF_SECTION	*conf = mctx->mi->conf;
-	PyObject	*module;
-
-	/*
-	 *	python_module_init takes no args, so we need
-	 *	to set these globals so that when it's
-	 *	called during interpreter initialisation
-	 *	it can get at the current instance config.
-	 */
-	current_mctx = MODULE_CTX_FROM_INST(mctx);
-	current_conf = conf;
 
 	PyEval_RestoreThread(global_interpreter);
 	LSAN_DISABLE(inst->interpreter = Py_NewInterpreter());
@@ -879,21 +1814,10 @@ static int python_interpreter_init(module_inst_ctx_t const *mctx)
 
 	/*
 	 *	Import the radiusd module into this python
-	 *	environment.  Each interpreter gets its
-	 *	own copy which it can mutate as much as
-	 *      it wants.
+	 *	environment.
 	 */
- 	module = PyImport_ImportModule("freeradius");
- 	if (!module) {
- 		ERROR("Failed importing \"freeradius\" module into interpreter %p", inst->interpreter);
- 		return -1;
- 	}
-	if ((python_module_import_config(mctx, conf, module) < 0) ||
-	    (python_module_import_constants(mctx, module) < 0)) {
-		Py_DECREF(module);
-		return -1;
-	}
-	inst->module = module;
+	inst->module = python_module_import(mctx, &inst->pythonconf_dict);
+	if (!inst->module) return -1;
 	PyEval_SaveThread();
 
 	return 0;
@@ -926,7 +1850,30 @@ static void python_interpreter_free(rlm_python_t *inst, PyThreadState *interp)
  */
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
-	rlm_python_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
+	rlm_python_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_python_t);
+	rlm_python_boot_t const	*boot = talloc_get_type_abort_const(mctx->mi->boot, rlm_python_boot_t);
+
+	if (inst->per_thread_interpreter) {
+#if PY_VERSION_HEX < 0x030C0000
+		cf_log_err(mctx->mi->conf, "per_thread_interpreter requires Python >= 3.12, "
+			   "but the server was built with Python %s", PY_VERSION);
+		return -1;
+#else
+		if (inst->processes) {
+			cf_log_err(mctx->mi->conf, "per_thread_interpreter and processes can't both be set");
+			return -1;
+		}
+#endif
+	}
+
+	/*
+	 *	Modules created at runtime aren't bootstrapped, so
+	 *	they have no supervisor.
+	 */
+	if (inst->processes && !boot->supervisor_pid) {
+		cf_log_err(mctx->mi->conf, "processes can't be used by modules which are created at runtime");
+		return -1;
+	}
 
 	if (python_interpreter_init(mctx) < 0) return -1;
 
@@ -953,7 +1900,8 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	if (inst->instantiate.function) {
 		rlm_rcode_t rcode;
 
-		do_python_single(&rcode, MODULE_CTX_FROM_INST(mctx), NULL, inst->instantiate.function, "instantiate");
+		do_python_single(&rcode, MODULE_CTX_FROM_INST(mctx), NULL, inst->instantiate.function, "instantiate",
+				 NULL, NULL);
 		switch (rcode) {
 		case RLM_MODULE_FAIL:
 		case RLM_MODULE_REJECT:
@@ -997,7 +1945,8 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	if (inst->detach.function) {
 		rlm_rcode_t rcode;
 
-		(void)do_python_single(&rcode, MODULE_CTX_FROM_INST(mctx), NULL, inst->detach.function, "detach");
+		(void)do_python_single(&rcode, MODULE_CTX_FROM_INST(mctx), NULL, inst->detach.function, "detach",
+					NULL, NULL);
 	}
 
 #define PYTHON_FUNC_DESTROY(_x) python_function_destroy(&inst->_x)
@@ -1020,6 +1969,112 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	return 0;
 }
 
+/** Fork the supervisor for the child processes
+ *
+ * This is done here, rather than in mod_instantiate, so that the
+ * supervisor only has the main interpreter.
+ */
+static int mod_bootstrap(module_inst_ctx_t const *mctx)
+{
+	rlm_python_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t);
+
+	if (!inst->processes) return 0;
+
+	return python_supervisor_start(mctx);
+}
+
+static int mod_unstrap(module_detach_ctx_t const *mctx)
+{
+	rlm_python_boot_t	*boot = talloc_get_type_abort(mctx->mi->boot, rlm_python_boot_t);
+
+	python_supervisor_stop(boot);
+
+	return 0;
+}
+
+/** Free a worker thread's own interpreter
+ *
+ */
+static void python_thread_interpreter_free(rlm_python_thread_t *t)
+{
+	if (!t->interpreter) return;
+
+	PyEval_RestoreThread(t->interpreter);
+
+	python_function_destroy(&t->authenticate);
+	python_function_destroy(&t->authorize);
+	python_function_destroy(&t->preacct);
+	python_function_destroy(&t->accounting);
+	python_function_destroy(&t->post_auth);
+	python_obj_destroy(&t->module);
+	Py_XDECREF(t->pythonconf_dict);
+	t->pythonconf_dict = NULL;
+
+	Py_EndInterpreter(t->interpreter);	/* Destroys interpreter and its GIL - sets thread state to NULL */
+	t->interpreter = NULL;
+}
+
+#if PY_VERSION_HEX >= 0x030C0000
+/** Create an interpreter with its own GIL for a worker thread
+ *
+ * The freeradius module, and the module functions are imported again,
+ * as objects can't be shared with the instance's interpreter.
+ */
+static int python_thread_interpreter_init(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_python_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_python_t);
+	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
+	module_inst_ctx_t const	*inst_mctx = MODULE_INST_CTX(UNCONST(module_instance_t *, mctx->mi));
+	PyInterpreterConfig	config = {
+					.use_main_obmalloc = 0,
+					.allow_fork = 0,
+					.allow_exec = 0,
+					.allow_threads = 1,
+					.allow_daemon_threads = 0,
+					.check_multi_interp_extensions = 1,
+					.gil = PyInterpreterConfig_OWN_GIL
+				};
+	PyStatus		status;
+
+	/*
+	 *	Creating an interpreter needs a current thread
+	 *	state.  On success, the instance interpreter's
+	 *	GIL is released, and the new one's is held.
+	 */
+	PyEval_RestoreThread(t->state);
+	LSAN_DISABLE(status = Py_NewInterpreterFromConfig(&t->interpreter, &config));
+	if (PyStatus_Exception(status)) {
+		ERROR("Failed creating interpreter for thread: %s", status.err_msg ? status.err_msg : "unknown error");
+		t->interpreter = NULL;
+		PyEval_SaveThread();
+		return -1;
+	}
+	DEBUG3("Created new interpreter %p for thread", t->interpreter);
+
+	t->module = python_module_import(inst_mctx, &t->pythonconf_dict);
+	if (!t->module) goto error;
+
+#define PYTHON_THREAD_FUNC_LOAD(_x) \
+	t->_x = (python_func_def_t){ .module_name = inst->_x.module_name, .function_name = inst->_x.function_name }; \
+	if (python_function_load(inst_mctx, &t->_x) < 0) goto error
+	PYTHON_THREAD_FUNC_LOAD(authenticate);
+	PYTHON_THREAD_FUNC_LOAD(authorize);
+	PYTHON_THREAD_FUNC_LOAD(preacct);
+	PYTHON_THREAD_FUNC_LOAD(accounting);
+	PYTHON_THREAD_FUNC_LOAD(post_auth);
+#undef PYTHON_THREAD_FUNC_LOAD
+
+	fr_cond_assert(PyEval_SaveThread() == t->interpreter);
+
+	return 0;
+
+error:
+	PyEval_SaveThread();
+	python_thread_interpreter_free(t);
+	return -1;
+}
+#endif
+
 static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 {
 	PyThreadState		*state;
@@ -1035,6 +2090,12 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 	DEBUG3("Initialised new thread state %p", state);
 	t->state = state;
 
+	if (inst->processes) return python_child_thread_instantiate(mctx);
+
+#if PY_VERSION_HEX >= 0x030C0000
+	if (inst->per_thread_interpreter) return python_thread_interpreter_init(mctx);
+#endif
+
 	return 0;
 }
 
@@ -1042,6 +2103,9 @@ static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
 
+	python_child_thread_detach(t);
+	python_thread_interpreter_free(t);
+
 	PyEval_RestoreThread(t->state);	/* Swap in our local thread state */
 	PyThreadState_Clear(t->state);
 	PyEval_SaveThread();
@@ -1171,13 +2235,18 @@ module_rlm_t rlm_python = {
 		.magic			= MODULE_MAGIC_INIT,
 		.name			= "python",
 
+		.boot_size		= sizeof(rlm_python_boot_t),
+		.boot_type		= "rlm_python_boot_t",
+
 		.inst_size		= sizeof(rlm_python_t),
 		.thread_inst_size	= sizeof(rlm_python_thread_t),
 
 		.config			= module_config,
 
+		.bootstrap		= mod_bootstrap,
 		.instantiate		= mod_instantiate,
 		.detach			= mod_detach,
+		.unstrap		= mod_unstrap,
 
 		.thread_instantiate	= mod_thread_instantiate,
 		.thread_detach		= mod_thread_detach
@@ -1409,6 +1409,7 @@ module_rlm_t rlm_rest = {
 	.common = {
 		.magic			= MODULE_MAGIC_INIT,
 		.name			= "rest",
+		.flags			= MODULE_TYPE_INSTANTIATE_PARALLEL,
 		.inst_size		= sizeof(rlm_rest_t),
 		.thread_inst_size	= sizeof(rlm_rest_thread_t),
 		.config			= module_config,
@@ -55,6 +55,8 @@ test: \
 		test.modules	\
 		test.radiusd-c	\
 		test.radclient	\
+		test.decode_in_network	\
+		test.fast_status_server	\
 		test.detail	\
 		test.radsniff	\
 		test.auth	\
@@ -26,6 +26,13 @@ FILES	:= \
 #	unit_test_map 		\
 #	unit_test_module
 
+#
+#  Built by src/tests/util/all.mk, which only does so with pthreads.
+#
+ifneq "$(findstring thread,${CFLAGS})" ""
+FILES += channel_test
+endif
+
 #
 #  Add in all of the binary tests
 #
@@ -36,6 +43,7 @@ $(eval $(call TEST_BOOTSTRAP))
 #
 #  Some tests take arguments, others do not.
 #
+channel_test.ARGS = -m 10000 -o 16
 radclient.ARGS = -h
 radict.ARGS = -D $(top_srcdir)/share/dictionary User-Name
 radmin.ARGS = -h
@@ -0,0 +1,89 @@
+#
+#	Run the radclient auth tests against a listener with
+#	"decode_in_network = yes".
+#
+
+#
+#	Test name
+#
+TEST  := test.decode_in_network
+
+#
+#	The inputs are the radclient tests, so there are no
+#	files here.
+#
+FILES :=
+
+$(eval $(call TEST_BOOTSTRAP))
+
+#
+#	Config settings
+#
+DECODE_IN_NETWORK_INPUT_DIR  := src/tests/radclient
+DECODE_IN_NETWORK_BUILD_DIR  := $(BUILD_DIR)/tests/decode_in_network
+DECODE_IN_NETWORK_RADIUS_LOG := $(DECODE_IN_NETWORK_BUILD_DIR)/radiusd.log
+
+#
+#	The radclient auth tests which have expected output.
+#
+DECODE_IN_NETWORK_FILES := $(addprefix $(DECODE_IN_NETWORK_BUILD_DIR)/,auth_1 auth_2 auth_4)
+
+$(BUILD_DIR)/tests/$(TEST): $(DECODE_IN_NETWORK_FILES)
+
+#
+#	Client port
+#
+DECODE_IN_NETWORK_CLIENT_PORT = 1334
+
+#
+#  Generic rules to start / stop the radius service.
+#
+include src/tests/radiusd.mk
+$(eval $(call RADIUSD_SERVICE,radiusd,$(OUTPUT)))
+
+#
+#	Run the radclient commands against the radiusd, and check that
+#	the output is the same as when the worker decodes the packets.
+#
+#	The Sent and Received lines contain the port, so they're ignored.
+#
+$(DECODE_IN_NETWORK_FILES): $(DECODE_IN_NETWORK_BUILD_DIR)/%: $(DECODE_IN_NETWORK_INPUT_DIR)/%.txt $(DECODE_IN_NETWORK_INPUT_DIR)/%.out $(BUILD_DIR)/bin/local/radclient $(BUILD_DIR)/lib/local/proto_radius.la $(BUILD_DIR)/lib/local/libfreeradius-radius.la | test.decode_in_network.radiusd_kill test.decode_in_network.radiusd_start
+	$(eval ARGV     := $(shell grep "#.*ARGV:" $< | cut -f2 -d ':'))
+	$(eval DECODE_IN_NETWORK_CLIENT_PORT := $(shell echo $$(($(DECODE_IN_NETWORK_CLIENT_PORT)+1))))
+
+	${Q}echo "DECODE-IN-NETWORK-TEST INPUT=$(notdir $<) ARGV=\"$(ARGV)\""
+	${Q}[ -f $(dir $@)/radiusd.pid ] || exit 1
+	${Q}if ! $(TEST_BIN)/radclient $(ARGV) -C $(DECODE_IN_NETWORK_CLIENT_PORT) -f $< -d src/tests/radclient/config -D share/dictionary 127.0.0.1:$(decode_in_network_port) auth $(SECRET) 1> $@.out 2>&1; then \
+		echo "FAILED";                                                      \
+		cat $@.out;                                                         \
+		rm -f $(BUILD_DIR)/tests/test.decode_in_network;                    \
+		$(MAKE) --no-print-directory test.decode_in_network.radiusd_kill;   \
+		exit 1;                                                             \
+	fi
+	${Q}if [ "$$(uname -s)" = "Darwin" ]; then sed -i.bak 's/via lo0/via lo/g' $@.out; fi
+	${Q}if [ "$$(uname -s)" = "FreeBSD" ]; then sed -i.bak 's/via (null)/via lo/g' $@.out; fi
+	${Q}sed -i.bak '/^_EXIT.*CALLED .*/d' $@.out
+	${Q}if ! diff -I 'Sent' -I 'Received' $(word 2,$^) $@.out; then            \
+		echo "DECODE-IN-NETWORK FAILED $@";                                 \
+		rm -f $(BUILD_DIR)/tests/test.decode_in_network;                    \
+		$(MAKE) --no-print-directory test.decode_in_network.radiusd_kill;   \
+		exit 1;                                                             \
+	fi
+	${Q}touch $@
+
+#
+#	Debug builds of proto_radius decode each packet again in the
+#	worker, and fail the request if the pairs from the network
+#	thread are different.  Make sure that the network thread did
+#	decode the packets, so that the check was run.
+#
+.NO_PARALLEL: $(TEST)
+$(TEST):
+	${Q}$(MAKE) --no-print-directory $@.radiusd_stop
+	${Q}if ! grep -q 'Using pairs decoded by the network thread' $(DECODE_IN_NETWORK_RADIUS_LOG); then \
+		echo "DECODE-IN-NETWORK FAILED: No packets were decoded in the network thread"; \
+		tail -n 100 $(DECODE_IN_NETWORK_RADIUS_LOG);                        \
+		rm -f $(BUILD_DIR)/tests/$@;                                        \
+		exit 1;                                                             \
+	fi
+	@touch $(BUILD_DIR)/tests/$@
@@ -0,0 +1,77 @@
+#
+#	Test that Status-Server is answered by the network thread
+#	when "fast_status_server = yes".
+#
+
+#
+#	Test name
+#
+TEST  := test.fast_status_server
+
+#
+#	The inputs are the radclient files here, so there are no
+#	other files.
+#
+FILES :=
+
+$(eval $(call TEST_BOOTSTRAP))
+
+#
+#	Config settings
+#
+FAST_STATUS_SERVER_INPUT_DIR  := src/tests/fast_status_server
+FAST_STATUS_SERVER_BUILD_DIR  := $(BUILD_DIR)/tests/fast_status_server
+
+#
+#	The name of each file is the radclient command used to send it.
+#
+FAST_STATUS_SERVER_FILES := $(addprefix $(FAST_STATUS_SERVER_BUILD_DIR)/,status auth)
+
+$(BUILD_DIR)/tests/$(TEST): $(FAST_STATUS_SERVER_FILES)
+
+#
+#	Client port
+#
+FAST_STATUS_SERVER_CLIENT_PORT = 1434
+
+#
+#  Generic rules to start / stop the radius service.
+#
+include src/tests/radiusd.mk
+$(eval $(call RADIUSD_SERVICE,radiusd,$(OUTPUT)))
+
+#
+#	Send the packets, and check the replies.  The worker adds a
+#	Reply-Message, which the reply to Status-Server must not have.
+#
+#	The Sent and Received lines contain the port, and the
+#	Message-Authenticator is different every time, so they're ignored.
+#
+$(FAST_STATUS_SERVER_FILES): $(FAST_STATUS_SERVER_BUILD_DIR)/%: $(FAST_STATUS_SERVER_INPUT_DIR)/%.txt $(FAST_STATUS_SERVER_INPUT_DIR)/%.out $(BUILD_DIR)/bin/local/radclient $(BUILD_DIR)/lib/local/proto_radius.la | test.fast_status_server.radiusd_kill test.fast_status_server.radiusd_start
+	$(eval ARGV     := $(shell grep "#.*ARGV:" $< | cut -f2 -d ':'))
+	$(eval FAST_STATUS_SERVER_CLIENT_PORT := $(shell echo $$(($(FAST_STATUS_SERVER_CLIENT_PORT)+1))))
+
+	${Q}echo "FAST-STATUS-SERVER-TEST INPUT=$(notdir $<) ARGV=\"$(ARGV)\""
+	${Q}[ -f $(dir $@)/radiusd.pid ] || exit 1
+	${Q}if ! $(TEST_BIN)/radclient $(ARGV) -C $(FAST_STATUS_SERVER_CLIENT_PORT) -f $< -d src/tests/radclient/config -D share/dictionary 127.0.0.1:$(fast_status_server_port) $(notdir $@) $(SECRET) 1> $@.out 2>&1; then \
+		echo "FAILED";                                                      \
+		cat $@.out;                                                         \
+		rm -f $(BUILD_DIR)/tests/test.fast_status_server;                   \
+		$(MAKE) --no-print-directory test.fast_status_server.radiusd_kill;  \
+		exit 1;                                                             \
+	fi
+	${Q}if [ "$$(uname -s)" = "Darwin" ]; then sed -i.bak 's/via lo0/via lo/g' $@.out; fi
+	${Q}if [ "$$(uname -s)" = "FreeBSD" ]; then sed -i.bak 's/via (null)/via lo/g' $@.out; fi
+	${Q}sed -i.bak '/^_EXIT.*CALLED .*/d' $@.out
+	${Q}if ! diff -I 'Sent' -I 'Received' -I 'Message-Authenticator = 0x[0-9a-f]\{32\}' $(word 2,$^) $@.out; then            \
+		echo "FAST-STATUS-SERVER FAILED $@";                                \
+		rm -f $(BUILD_DIR)/tests/test.fast_status_server;                   \
+		$(MAKE) --no-print-directory test.fast_status_server.radiusd_kill;  \
+		exit 1;                                                             \
+	fi
+	${Q}touch $@
+
+.NO_PARALLEL: $(TEST)
+$(TEST):
+	${Q}$(MAKE) --no-print-directory $@.radiusd_stop
+	@touch $(BUILD_DIR)/tests/$@
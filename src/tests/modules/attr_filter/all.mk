@@ -1,3 +1,10 @@
 #
 #  Test the "attr_filter" module
 #
+
+#
+#  The parallel instantiation test also uses rlm_csv and rlm_passwd.
+#
+ifneq "$(words $(filter rlm_csv.la rlm_passwd.la,$(ALL_TGTS)))" "2"
+  FILES_SKIP += $(filter attr_filter/parallel_instantiate/%,$(FILES))
+endif
@@ -7,3 +7,12 @@ export PYTHONPATH
 
 #  MODULE.test is the main target for this module.
 python.test:
+
+#
+#  per_thread_interpreter needs Python >= 3.12.  Skip its test if
+#  rlm_python was linked against an older version.
+#
+PYTHON_MINOR_VERSION := $(shell echo '$(filter -lpython3.%,$(rlm_python.la_LDLIBS))' | sed -n 's/^-lpython3\.\([0-9]*\).*/\1/p')
+ifneq "$(shell test 0$(PYTHON_MINOR_VERSION) -ge 12 && echo yes)" "yes"
+  FILES_SKIP += $(filter python/per_thread_interpreter/%,$(FILES))
+endif
@@ -0,0 +1,26 @@
+import freeradius
+
+instantiated = False
+
+
+def instantiate(p):
+    global instantiated
+    instantiated = True
+    return freeradius.RLM_MODULE_OK
+
+
+def authorize(p):
+    #
+    #  Worker threads import the module into their own
+    #  interpreter, so they don't see what instantiate set.
+    #
+    if instantiated:
+        return freeradius.RLM_MODULE_FAIL
+
+    for (name, value) in p:
+        if name == 'User-Name':
+            return (freeradius.RLM_MODULE_UPDATED,
+                    (('&Reply-Message', 'hello ' + value),),
+                    ())
+
+    return freeradius.RLM_MODULE_NOOP
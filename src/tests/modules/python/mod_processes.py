@@ -0,0 +1,11 @@
+import freeradius
+
+
+def authorize(p):
+    for (name, value) in p:
+        if name == 'User-Name':
+            return (freeradius.RLM_MODULE_UPDATED,
+                    (('&Reply-Message', 'hello ' + value),),
+                    (('&Filter-Id', 'from child'),))
+
+    return freeradius.RLM_MODULE_NOOP
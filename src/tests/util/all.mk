@@ -11,3 +11,17 @@ SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk
 #ifneq "$(findstring thread,${CFLAGS})" ""
 #SUBMAKEFILES += channel_test.mk worker_test.mk radius1_test.mk schedule_test.mk radius_schedule_test.mk
 #endif
+
+#
+#  Benchmark for signalling between threads.
+#
+ifneq "$(findstring thread,${CFLAGS})" ""
+SUBMAKEFILES += channel_test.mk
+endif
+
+#
+#  Benchmark for work stealing between workers.
+#
+ifneq "$(findstring thread,${CFLAGS})" ""
+SUBMAKEFILES += worker_steal_test.mk
+endif
@@ -29,6 +29,11 @@ RCSID("$Id$")
 #include <string.h>
 #include <sys/time.h>
 
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
 #ifdef HAVE_GETOPT_H
 #  include <getopt.h>
 #endif
@@ -51,42 +56,24 @@ void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t *
 static NEVER_RETURNS void usage(void)
 {
 	fprintf(stderr, "usage: atomic_queue_test [OPTS]\n");
+	fprintf(stderr, "  -b                     Benchmark push and pop between threads.\n");
+	fprintf(stderr, "  -B <batch>             Number of entries to push and pop at once, when benchmarking.\n");
+	fprintf(stderr, "  -n <count>             Number of entries to send, when benchmarking.\n");
+	fprintf(stderr, "  -p <producers>         Number of producers for N:1 benchmarks.\n");
 	fprintf(stderr, "  -s size                set queue size.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
 	fr_exit_now(EXIT_SUCCESS);
 }
 
-int main(int argc, char *argv[])
+/** Fill a queue, check it's full, then empty it, and check it's empty
+ *
+ */
+static void test_fill(fr_atomic_queue_t *aq, int size, size_t batch)
 {
-	int			c, i, ret = 0;
-	int			size;
+	int			i;
 	intptr_t		val;
 	void			*data;
-	fr_atomic_queue_t	*aq;
-	TALLOC_CTX		*autofree = talloc_autofree_context();
-
-	size = 4;
-
-	while ((c = getopt(argc, argv, "hs:tx")) != -1) switch (c) {
-		case 's':
-			size = atoi(optarg);
-			break;
-
-		case 'x':
-			debug_lvl++;
-			break;
-
-		case 'h':
-		default:
-			usage();
-	}
-#if 0
-	argc -= (optind - 1);
-	argv += (optind - 1);
-#endif
-
-	aq = fr_atomic_queue_alloc(autofree, size);
 
 #ifndef NDEBUG
 	if (debug_lvl) {
@@ -98,12 +85,26 @@ int main(int argc, char *argv[])
 
 #endif
 
-
 	for (i = 0; i < size; i++) {
 		val = i + OFFSET;
 		data = (void *) val;
 
-		if (!fr_atomic_queue_push(aq, data)) {
+		if (batch > 1) {
+			void	*array[batch];
+			size_t	j, num;
+
+			num = batch;
+			if (num > (size_t) (size - i)) num = size - i;
+
+			for (j = 0; j < num; j++) array[j] = (void *) (intptr_t) (i + j + OFFSET);
+
+			if (fr_atomic_queue_push_bulk(aq, array, num) != num) {
+				fprintf(stderr, "Failed pushing %zu at %d\n", num, i);
+				fr_exit_now(EXIT_FAILURE);
+			}
+			i += num - 1;
+
+		} else if (!fr_atomic_queue_push(aq, data)) {
 			fprintf(stderr, "Failed pushing at %d\n", i);
 			fr_exit_now(EXIT_FAILURE);
 		}
@@ -122,7 +123,7 @@ int main(int argc, char *argv[])
 	/*
 	 *	Queue is full.  No more pushes are allowed.
 	 */
-	if (fr_atomic_queue_push(aq, data)) {
+	if (fr_atomic_queue_push(aq, data) || fr_atomic_queue_push_bulk(aq, &data, 1)) {
 		fprintf(stderr, "Pushed an entry past the end of the queue.");
 		fr_exit_now(EXIT_FAILURE);
 	}
@@ -140,6 +141,28 @@ int main(int argc, char *argv[])
 	 *	And now pop them all.
 	 */
 	for (i = 0; i < size; i++) {
+		if (batch > 1) {
+			void	*array[batch];
+			size_t	j, num;
+
+			num = fr_atomic_queue_pop_bulk(aq, array, batch);
+			if ((num == 0) || (num > (size_t) (size - i))) {
+				fprintf(stderr, "Failed popping at %d, got %zu entries\n", i, num);
+				fr_exit_now(EXIT_FAILURE);
+			}
+
+			for (j = 0; j < num; j++) {
+				val = (intptr_t) array[j];
+				if (val != (intptr_t) (i + j + OFFSET)) {
+					fprintf(stderr, "Pop expected %d, got %d\n",
+						(int) (i + j + OFFSET), (int) val);
+					fr_exit_now(EXIT_FAILURE);
+				}
+			}
+			i += num - 1;
+			continue;
+		}
+
 		if (!fr_atomic_queue_pop(aq, &data)) {
 			fprintf(stderr, "Failed popping at %d\n", i);
 			fr_exit_now(EXIT_FAILURE);
@@ -163,7 +186,7 @@ int main(int argc, char *argv[])
 	/*
 	 *	Queue is empty.  No more pops are allowed.
 	 */
-	if (fr_atomic_queue_pop(aq, &data)) {
+	if (fr_atomic_queue_pop(aq, &data) || fr_atomic_queue_pop_bulk(aq, &data, 1)) {
 		fprintf(stderr, "Popped an entry past the end of the queue.");
 		fr_exit_now(EXIT_FAILURE);
 	}
@@ -174,7 +197,198 @@ int main(int argc, char *argv[])
 		fr_atomic_queue_debug(aq, stdout);
 	}
 #endif
+}
+
+#ifdef HAVE_PTHREAD_H
+typedef struct {
+	fr_atomic_queue_t	*aq;
+	pthread_t		thread;
+	intptr_t		first;			//!< First value this producer sends.
+	size_t			count;			//!< Number of entries to send.
+	size_t			batch;
+} test_producer_t;
+
+static void *test_producer(void *arg)
+{
+	test_producer_t	*p = arg;
+	size_t		sent = 0;
+	void		*array[p->batch];
+
+	while (sent < p->count) {
+		size_t i, num, pushed;
+
+		num = p->batch;
+		if (num > (p->count - sent)) num = p->count - sent;
+
+		for (i = 0; i < num; i++) array[i] = (void *) (p->first + sent + i);
 
-	return ret;
+		if (num == 1) {
+			pushed = fr_atomic_queue_push(p->aq, array[0]);
+		} else {
+			pushed = fr_atomic_queue_push_bulk(p->aq, array, num);
+		}
+
+		if (!pushed) {
+			sched_yield();
+			continue;
+		}
+		sent += pushed;
+	}
+
+	return NULL;
 }
 
+/** Send entries from one or more producers to one consumer, and print the rate
+ *
+ *  Each producer sends an increasing sequence of values, so the
+ *  consumer can check that nothing was lost, duplicated or reordered.
+ */
+static void test_throughput(fr_atomic_queue_t *aq, char const *name, int producers, size_t count, size_t batch)
+{
+	test_producer_t	p[producers];
+	intptr_t	last[producers];
+	void		*array[batch];
+	size_t		received = 0, total = count * producers;
+	struct timeval	start, end;
+	double		elapsed;
+	int		i;
+
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < producers; i++) {
+		p[i] = (test_producer_t) {
+			.aq = aq,
+			.first = OFFSET + ((intptr_t) i << 40),
+			.count = count,
+			.batch = batch
+		};
+		last[i] = p[i].first - 1;
+
+		if (pthread_create(&p[i].thread, NULL, test_producer, &p[i]) != 0) {
+			fprintf(stderr, "Failed creating thread\n");
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	while (received < total) {
+		size_t j, num;
+
+		if (batch == 1) {
+			num = fr_atomic_queue_pop(aq, &array[0]);
+		} else {
+			num = fr_atomic_queue_pop_bulk(aq, array, batch);
+		}
+
+		if (!num) {
+			sched_yield();
+			continue;
+		}
+
+		for (j = 0; j < num; j++) {
+			intptr_t val = (intptr_t) array[j];
+			int producer = (val - OFFSET) >> 40;
+
+			if ((producer < 0) || (producer >= producers) || (val != last[producer] + 1)) {
+				fprintf(stderr, "%s: unexpected value %" PRIdPTR " after %" PRIuPTR " entries\n",
+					name, val, received + j);
+				fr_exit_now(EXIT_FAILURE);
+			}
+			last[producer] = val;
+		}
+		received += num;
+	}
+
+	for (i = 0; i < producers; i++) pthread_join(p[i].thread, NULL);
+
+	gettimeofday(&end, NULL);
+	elapsed = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	printf("%-8s %d:1 batch %-4zu %10zu entries in %.3fs, %.2f M/s\n",
+	       name, producers, batch, total, elapsed, (total / elapsed) / 1000000.0);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	int			size;
+	int			producers = 4;
+	size_t			batch = 16, count = 1000000;
+	bool			benchmark = false;
+	fr_atomic_queue_t	*aq;
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+
+	size = 4;
+
+	while ((c = getopt(argc, argv, "bB:hn:p:s:tx")) != -1) switch (c) {
+		case 'b':
+			benchmark = true;
+			break;
+
+		case 'B':
+			batch = atoi(optarg);
+			break;
+
+		case 'n':
+			count = atoi(optarg);
+			break;
+
+		case 'p':
+			producers = atoi(optarg);
+			break;
+
+		case 's':
+			size = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+#if 0
+	argc -= (optind - 1);
+	argv += (optind - 1);
+#endif
+
+	if ((size < 1) || (batch < 1) || (producers < 1)) usage();
+
+	aq = fr_atomic_queue_alloc(autofree, size);
+	test_fill(aq, size, 1);
+	test_fill(aq, size, 3);
+	fr_atomic_queue_free(&aq);
+
+	aq = fr_atomic_queue_alloc_spsc(autofree, size);
+	test_fill(aq, size, 1);
+	test_fill(aq, size, 3);
+	fr_atomic_queue_free(&aq);
+
+	if (!benchmark) return 0;
+
+#ifdef HAVE_PTHREAD_H
+	/*
+	 *	The queue has to be larger than a batch, otherwise
+	 *	bulk operations can't make progress.
+	 */
+	if ((size_t) size < (batch * 4)) size = batch * 4;
+
+	aq = fr_atomic_queue_alloc(autofree, size);
+	test_throughput(aq, "mpmc", 1, count, 1);
+	test_throughput(aq, "mpmc", 1, count, batch);
+	test_throughput(aq, "mpmc", producers, count, 1);
+	test_throughput(aq, "mpmc", producers, count, batch);
+	fr_atomic_queue_free(&aq);
+
+	aq = fr_atomic_queue_alloc_spsc(autofree, size);
+	test_throughput(aq, "spsc", 1, count, 1);
+	test_throughput(aq, "spsc", 1, count, batch);
+	fr_atomic_queue_free(&aq);
+#else
+	fprintf(stderr, "Benchmarks need pthreads\n");
+#endif
+
+	return 0;
+}
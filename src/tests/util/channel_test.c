@@ -25,7 +25,9 @@ RCSID("$Id$")
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/talloc.h>
 
 #ifdef HAVE_GETOPT_H
@@ -33,67 +35,227 @@ RCSID("$Id$")
 #endif
 
 #include <pthread.h>
-#include <sys/event.h>
+#include <sys/resource.h>
+
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#endif
 
 #define MAX_MESSAGES		(2048)
 #define MAX_CONTROL_PLANE	(1024)
-#define MAX_KEVENTS		(10)
 
 #define MPRINT1 if (debug_lvl) printf
 #define MPRINT2 if (debug_lvl > 1) printf
 
+/** State for one end of the channel
+ *
+ */
+typedef struct {
+	char const		*name;
+	fr_control_callback_t	callback;
+	fr_event_list_t		*el;
+	fr_control_t		*control;
+	fr_channel_t		*channel;
+	fr_message_set_t	*ms;
+
+	bool			running;
+	bool			signaled_close;
+
+	int			num_messages;		//!< Requests sent, or received.
+	int			num_replies;		//!< Replies received, or sent.
+	int			num_outstanding;
+
+	fr_channel_data_t	**pending;		//!< Requests which the worker hasn't replied to.
+	int			num_pending;
+} test_thread_t;
+
 static int			debug_lvl = 0;
-static int			kq_master, kq_worker;
-static fr_atomic_queue_t	*aq_master, *aq_worker;
-static fr_control_t		*control_master, *control_worker;
 static int			max_messages = 10;
 static int			max_control_plane = 0;
 static int			max_outstanding = 1;
 static bool			touch_memory = false;
-
-/**********************************************************************/
-typedef struct request_s request_t;
-
-request_t *request_alloc(UNUSED TALLOC_CTX *ctx, UNUSED request_init_args_t const *args)
+static bool			poll_control = true;
+static pthread_barrier_t	barrier;
+
+static fr_table_num_sorted_t const huge_pages_table[] = {
+	{ L("explicit"),	FR_RING_BUFFER_HUGE_PAGES_EXPLICIT },
+	{ L("no"),		FR_RING_BUFFER_HUGE_PAGES_NO },
+	{ L("transparent"),	FR_RING_BUFFER_HUGE_PAGES_TRANSPARENT }
+};
+static size_t huge_pages_table_len = NUM_ELEMENTS(huge_pages_table);
+
+#ifdef __linux__
+/** Count dTLB load misses in this thread, and any threads it starts
+ *
+ * @return
+ *	- A perf event fd on success.
+ *	- -1 if the counter isn't available, e.g. in a VM, or because of
+ *	  perf_event_paranoid.
+ */
+static int tlb_miss_counter_open(void)
 {
-	return NULL;
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB |
+		      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
 }
+#endif
 
+/**********************************************************************/
 void request_verify(UNUSED char const *file, UNUSED int line, UNUSED request_t const *request)
 {
 }
-
 /**********************************************************************/
 
 static NEVER_RETURNS void usage(void)
 {
 	fprintf(stderr, "usage: channel_test [OPTS]\n");
 	fprintf(stderr, "  -c <control-plane>     Size of the control plane queue.\n");
+	fprintf(stderr, "  -H <huge-pages>        Back message set ring buffers with huge pages (no, transparent, explicit).\n");
 	fprintf(stderr, "  -m <messages>	  Send number of messages.\n");
 	fprintf(stderr, "  -o <outstanding>       Keep number of messages outstanding.\n");
+	fprintf(stderr, "  -p                     Don't poll the control plane before sleeping.\n");
 	fprintf(stderr, "  -t                     Touch memory for fake packets.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
 	fr_exit_now(EXIT_FAILURE);
 }
 
+static void touch(fr_channel_data_t *cd)
+{
+	size_t j, k;
+
+	if (!touch_memory) return;
+
+	for (j = k = 0; j < cd->m.data_size; j++) {
+		k += cd->m.data[j];
+	}
+
+	cd->m.data[4] = k;
+}
+
+/** Wait for, and service, events
+ *
+ */
+static void test_event_loop(test_thread_t *t)
+{
+	bool	wait_for_event = true;
+	int	num_events;
+
+	if (poll_control && fr_control_poll(t->control)) wait_for_event = false;
+
+	num_events = fr_event_corral(t->el, fr_time(), wait_for_event);
+	MPRINT2("%s corral returned %d events\n", t->name, num_events);
+	if (num_events < 0) {
+		fprintf(stderr, "%s failed waiting for events: %s\n", t->name, fr_strerror());
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	fr_event_service(t->el);
+}
+
+/** Create the event list and control plane for a thread
+ *
+ *  They're created by the thread which uses them, and then main()
+ *  creates the channel between them.
+ */
+static void test_thread_init(TALLOC_CTX *ctx, test_thread_t *t)
+{
+	fr_atomic_queue_t *aq;
+
+	t->el = fr_event_list_alloc(ctx, NULL, NULL);
+	if (!t->el) {
+		fprintf(stderr, "channel_test: Failed creating event list: %s\n", fr_strerror());
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	aq = fr_atomic_queue_alloc(ctx, max_control_plane);
+	fr_assert(aq != NULL);
+
+	t->control = fr_control_create(ctx, t->el, aq);
+	if (!t->control) {
+		fprintf(stderr, "channel_test: Failed creating control plane: %s\n", fr_strerror());
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_control_callback_add(t->control, FR_CONTROL_ID_CHANNEL, t, t->callback) < 0) {
+		fprintf(stderr, "channel_test: Failed adding channel callback: %s\n", fr_strerror());
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Wait for main() to create the channel.
+	 */
+	pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+}
+
+static void master_recv_reply(void *ctx, UNUSED fr_channel_t *ch, fr_channel_data_t *cd)
+{
+	test_thread_t *t = ctx;
+
+	t->num_replies++;
+	t->num_outstanding--;
+	MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
+		t->num_replies, t->num_outstanding, t->num_messages, max_messages);
+	fr_message_done(&cd->m);
+}
+
+static void master_channel_callback(void *ctx, void const *data, size_t data_size, fr_time_t now)
+{
+	test_thread_t		*t = ctx;
+	fr_channel_t		*ch;
+	fr_channel_event_t	ce;
+
+	ce = fr_channel_service_message(now, &ch, data, data_size);
+	MPRINT1("Master got channel event %d\n", ce);
+
+	switch (ce) {
+	case FR_CHANNEL_DATA_READY_REQUESTOR:
+		fr_assert(ch == t->channel);
+		while (fr_channel_recv_reply(ch));
+		break;
+
+	case FR_CHANNEL_CLOSE:
+		MPRINT1("Master received close signal\n");
+		fr_assert(ch == t->channel);
+		fr_assert(t->signaled_close == true);
+		t->running = false;
+		break;
+
+	case FR_CHANNEL_NOOP:
+	case FR_CHANNEL_EMPTY:
+		break;
+
+	default:
+		fprintf(stderr, "Master got unexpected CE %d\n", ce);
+		fr_assert(0 == 1);
+		break;
+	}
+}
+
 static void *channel_master(void *arg)
 {
-	bool			running, signaled_close;
-	int			rcode, i, num_events;
-	int			num_outstanding, num_messages;
-	int			num_replies;
-	fr_message_set_t	*ms;
+	test_thread_t		*t = arg;
+	int			i, num_to_send;
+	fr_channel_data_t	*cd;
 	TALLOC_CTX		*ctx;
-	fr_channel_t		*channel = arg;
-	fr_channel_t		*new_channel;
-	fr_channel_event_t	ce;
-	struct kevent		events[MAX_KEVENTS];
 
 	MEM(ctx = talloc_init_const("channel_master"));
+	test_thread_init(ctx, t);
 
-	ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
-	if (!ms) {
+	t->ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
+	if (!t->ms) {
 		fprintf(stderr, "Failed creating message set\n");
 		fr_exit_now(EXIT_FAILURE);
 	}
@@ -103,185 +265,59 @@ static void *channel_master(void *arg)
 	/*
 	 *	Signal the worker that the channel is open
 	 */
-	rcode = fr_channel_signal_open(channel);
-	if (rcode < 0) {
-		fprintf(stderr, "Failed signaling open: %s\n", fr_syserror(errno));
+	if (fr_channel_signal_open(t->channel) < 0) {
+		fprintf(stderr, "Failed signaling open: %s\n", fr_strerror());
 		fr_exit_now(EXIT_FAILURE);
 	}
 
-	/*
-	 *	Bootstrap the queue with messages.
-	 */
-	num_replies = num_outstanding = num_messages = 0;
-
-	running = true;
-	signaled_close = false;
-
-	while (running) {
-		fr_time_t now;
-		int num_to_send;
-		fr_channel_data_t *cd, *reply;
-
-#if 0
-		/*
-		 *	Drain the input queues before sleeping.
-		 */
-		while ((reply = fr_channel_recv_reply(channel)) != NULL) {
-			num_replies++;
-			num_outstanding--;
-			MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
-				num_replies, num_outstanding, num_messages, max_messages);
-			fr_message_done(&reply->m);
-		}
-#endif
-
+	t->running = true;
+	while (t->running) {
 		/*
 		 *	Ensure we have outstanding messages.
 		 */
-		if (num_messages >= max_messages) {
-			MPRINT1("Master DONE sending\n");
-			goto check_close;
-		}
+		num_to_send = max_outstanding - t->num_outstanding;
+		if ((t->num_messages + num_to_send) > max_messages) num_to_send = max_messages - t->num_messages;
 
-		num_to_send = max_outstanding - num_outstanding;
-		if ((num_messages + num_to_send) > max_messages) {
-			num_to_send = max_messages - num_messages;
-		}
-		MPRINT1("Master sending %d messages\n", num_to_send);
+		if (num_to_send > 0) MPRINT1("Master sending %d messages\n", num_to_send);
 
 		for (i = 0; i < num_to_send; i++) {
-			cd = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
+			cd = (fr_channel_data_t *) fr_message_alloc(t->ms, NULL, 100);
 			fr_assert(cd != NULL);
 
-			num_outstanding++;
-			num_messages++;
+			t->num_outstanding++;
+			t->num_messages++;
 
 			cd->m.when = fr_time();
+			cd->priority = PRIORITY_NORMAL;
+			touch(cd);
 
-			if (touch_memory) {
-				size_t j, k;
-
-				for (j = k = 0; j < cd->m.data_size; j++) {
-					k += cd->m.data[j];
-				}
+			memcpy(cd->m.data, &t->num_messages, sizeof(t->num_messages));
 
-				cd->m.data[4] = k;
-			}
-
-			memcpy(cd->m.data, &num_messages, sizeof(num_messages));
-
-			MPRINT1("Master sent message %d\n", num_messages);
-			rcode = fr_channel_send_request(channel, cd, &reply);
-			if (rcode < 0) {
-				fprintf(stderr, "Failed sending request: %s\n", fr_syserror(errno));
-			}
-			fr_assert(rcode == 0);
-			if (reply) {
-				num_replies++;
-				num_outstanding--;
-				MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
-					num_replies, num_outstanding, num_messages, max_messages);
-				fr_message_done(&reply->m);
+			MPRINT1("Master sent message %d\n", t->num_messages);
+			if (fr_channel_send_request(t->channel, cd) < 0) {
+				fprintf(stderr, "Failed sending request: %s\n", fr_strerror());
+				fr_exit_now(EXIT_FAILURE);
 			}
 		}
 
 		/*
 		 *	Signal close only when done.
 		 */
-check_close:
-
-		if (!signaled_close && (num_messages >= max_messages) && (num_outstanding == 0)) {
+		if (!t->signaled_close && (t->num_messages >= max_messages) && (t->num_outstanding == 0)) {
 			MPRINT1("Master signaling worker to exit.\n");
-			rcode = fr_channel_signal_responder_close(channel);
-			if (rcode < 0) {
-				fprintf(stderr, "Failed signaling close: %s\n", fr_syserror(errno));
+			if (fr_channel_signal_responder_close(t->channel) < 0) {
+				fprintf(stderr, "Failed signaling close: %s\n", fr_strerror());
 				fr_exit_now(EXIT_FAILURE);
 			}
 
-			signaled_close = true;
+			t->signaled_close = true;
 		}
 
 		MPRINT1("Master waiting on events.\n");
-		fr_assert(num_messages <= max_messages);
-
-		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("Master kevent returned %d\n", num_events);
-
-		if (num_events < 0) {
-			if (num_events == EINTR) continue;
-
-			fprintf(stderr, "Failed waiting for kevent: %s\n", fr_syserror(errno));
-			fr_exit_now(EXIT_FAILURE);
-		}
-
-		if (num_events == 0) continue;
-
-		/*
-		 *	Service the events.
-		 */
-		for (i = 0; i < num_events; i++) {
-			(void) fr_channel_service_kevent(channel, control_master, &events[i]);
-		}
+		fr_assert(t->num_messages <= max_messages);
 
-		now = fr_time();
-
-		MPRINT1("Master servicing control-plane aq %p\n", aq_master);
-
-		while (true) {
-			uint32_t id;
-			size_t data_size;
-			char data[256];
-
-			data_size = fr_control_message_pop(aq_master, &id, data, sizeof(data));
-			if (!data_size) break;
-
-			fr_assert(id == FR_CONTROL_ID_CHANNEL);
-
-			ce = fr_channel_service_message(now, &new_channel, data, data_size);
-			MPRINT1("Master got channel event %d\n", ce);
-
-			switch (ce) {
-			case FR_CHANNEL_DATA_READY_REQUESTOR:
-				MPRINT1("Master got data ready signal\n");
-				fr_assert(new_channel == channel);
-
-				reply = fr_channel_recv_reply(channel);
-				if (!reply) {
-					MPRINT1("Master SIGNAL WITH NO DATA!\n");
-					continue;
-				}
-
-				do {
-					num_replies++;
-					num_outstanding--;
-					MPRINT1("Master got reply %d, outstanding=%d, %d/%d sent.\n",
-						num_replies, num_outstanding, num_messages, max_messages);
-					fr_message_done(&reply->m);
-				} while ((reply = fr_channel_recv_reply(channel)) != NULL);
-				break;
-
-			case FR_CHANNEL_CLOSE:
-				MPRINT1("Master received close signal\n");
-				fr_assert(new_channel == channel);
-				fr_assert(signaled_close == true);
-				running = false;
-				break;
-
-			case FR_CHANNEL_NOOP:
-				MPRINT1("Master got NOOP\n");
-				break;
-
-			default:
-				fprintf(stderr, "Master got unexpected CE %d\n", ce);
-
-				/*
-				 *	Not written yet!
-				 */
-				fr_assert(0 == 1);
-				break;
-			} /* switch over signal returned */
-		} /* drain the control plane */
-	} /* loop until told to exit */
+		test_event_loop(t);
+	}
 
 	MPRINT1("Master exiting.\n");
 
@@ -289,173 +325,141 @@ check_close:
 	 *	Force all messages to be garbage collected
 	 */
 	MPRINT2("GC\n");
-	fr_message_set_gc(ms);
+	fr_message_set_gc(t->ms);
 
-	if (debug_lvl > 1) fr_message_set_debug(ms, stdout);
+	if (debug_lvl > 1) fr_message_set_debug(t->ms, stdout);
 
 	/*
 	 *	After the garbage collection, all messages marked "done" MUST also be marked "free".
 	 */
-	rcode = fr_message_set_messages_used(ms);
-	MPRINT2("Master messages used = %d\n", rcode);
-	fr_assert(rcode == 0);
+	i = fr_message_set_messages_used(t->ms);
+	MPRINT2("Master messages used = %d\n", i);
+	fr_assert(i == 0);
 
 	talloc_free(ctx);
 
 	return NULL;
 }
 
-static void *channel_worker(void *arg)
+/** Remember a request, so that we can reply to it from the event loop
+ *
+ *  Sending a reply looks for more requests, so replying from here
+ *  would recurse once for every outstanding request.
+ */
+static void worker_recv_request(void *ctx, UNUSED fr_channel_t *ch, fr_channel_data_t *cd)
 {
-	bool running = true;
-	int rcode, num_events;
-	int worker_messages = 0;
-	fr_message_set_t *ms;
-	TALLOC_CTX *ctx;
-	fr_channel_t *channel = arg;
-	fr_channel_event_t ce;
-	struct kevent events[MAX_KEVENTS];
-
-	MEM(ctx = talloc_init_const("channel_worker"));
+	test_thread_t *t = ctx;
 
-	ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
-	if (!ms) {
-		fprintf(stderr, "Failed creating message set\n");
-		fr_exit_now(EXIT_FAILURE);
-	}
+	t->num_messages++;
+	MPRINT1("\tWorker got message %d\n", t->num_messages);
 
-	MPRINT1("\tWorker started.\n");
+	fr_assert(t->num_pending < max_outstanding);
+	t->pending[t->num_pending++] = cd;
+}
 
-	while (running) {
-		int i;
-		fr_time_t now;
-		fr_channel_t *new_channel;
+static void worker_reply(test_thread_t *t)
+{
+	while (t->num_pending > 0) {
+		fr_channel_data_t	*cd, *reply;
+		int			message_id;
 
-		MPRINT1("\tWorker waiting on events.\n");
+		cd = t->pending[--t->num_pending];
 
-		num_events = kevent(kq_worker, NULL, 0, events, MAX_KEVENTS, NULL);
-		MPRINT1("\tWorker kevent returned %d events\n", num_events);
+		fr_assert(cd->m.data != NULL);
+		memcpy(&message_id, cd->m.data, sizeof(message_id));
+		MPRINT1("\tWorker replying to message %d\n", message_id);
 
-		if (num_events < 0) {
-			if (errno == EINTR) continue;
+		reply = (fr_channel_data_t *) fr_message_alloc(t->ms, NULL, 100);
+		fr_assert(reply != NULL);
 
-			fprintf(stderr, "Failed waiting for kevent: %s\n", fr_syserror(errno));
-			fr_exit_now(EXIT_FAILURE);
-		}
+		reply->m.when = fr_time();
+		reply->reply.cpu_time = fr_time_delta_wrap(0);
+		reply->reply.processing_time = fr_time_delta_wrap(0);
+		reply->reply.request_time = cd->m.when;
+		reply->reply.overloaded = false;
+		reply->reply.origin = NULL;
+		reply->priority = cd->priority;
+		fr_message_done(&cd->m);
 
-		if (num_events == 0) continue;
+		touch(reply);
 
-		for (i = 0; i < num_events; i++) {
-			(void) fr_channel_service_kevent(channel, control_worker, &events[i]);
+		t->num_replies++;
+		if (fr_channel_send_reply(t->channel, reply) < 0) {
+			fprintf(stderr, "Failed sending reply: %s\n", fr_strerror());
+			fr_exit_now(EXIT_FAILURE);
 		}
+	}
+}
 
-		MPRINT1("\tWorker servicing control-plane aq %p\n", aq_worker);
-
-		now = fr_time();
-
-		while (true) {
-			uint32_t id;
-			size_t data_size;
-			char data[256];
-			fr_channel_data_t *cd, *reply;
-
-			data_size = fr_control_message_pop(aq_worker, &id, data, sizeof(data));
-			if (!data_size) break;
-
-			fr_assert(id == FR_CONTROL_ID_CHANNEL);
-
-			ce = fr_channel_service_message(now, &new_channel, data, data_size);
-			MPRINT1("\tWorker got channel event %d\n", ce);
-
-			switch (ce) {
-
-			case FR_CHANNEL_OPEN:
-				MPRINT1("\tWorker received a new channel\n");
-				fr_assert(new_channel == channel);
-				break;
-
-			case FR_CHANNEL_CLOSE:
-				MPRINT1("\tWorker requested to close the channel.\n");
-				fr_assert(new_channel == channel);
-				running = false;
-
-				/*
-				 *	Drain the input before we ACK the exit.
-				 */
-				while ((cd = fr_channel_recv_request(channel)) != NULL) {
-					worker_messages++;
-					MPRINT1("\tWorker got message %d\n", worker_messages);
-					fr_message_done(&cd->m);
-				}
-
-				(void) fr_channel_responder_ack_close(channel);
-				break;
-
-			case FR_CHANNEL_DATA_READY_RESPONDER:
-				MPRINT1("\tWorker got data ready signal\n");
-				fr_assert(new_channel == channel);
-
-				cd = fr_channel_recv_request(channel);
-				if (!cd) {
-					MPRINT1("\tWorker SIGNAL WITH NO DATA!\n");
-					break;
-				}
-
-				while (cd) {
-					int message_id;
-
-					worker_messages++;
-
-					fr_assert(cd->m.data != NULL);
-					memcpy(&message_id, cd->m.data, sizeof(message_id));
-					MPRINT1("\tWorker got message %d (says %d)\n", worker_messages, message_id);
-
-					reply = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
-					fr_assert(reply != NULL);
+static void worker_channel_callback(void *ctx, void const *data, size_t data_size, fr_time_t now)
+{
+	test_thread_t		*t = ctx;
+	fr_channel_t		*ch;
+	fr_channel_event_t	ce;
 
-					reply->m.when = fr_time();
-					fr_message_done(&cd->m);
+	ce = fr_channel_service_message(now, &ch, data, data_size);
+	MPRINT1("\tWorker got channel event %d\n", ce);
 
-					if (touch_memory) {
-						size_t j, k;
+	switch (ce) {
+	case FR_CHANNEL_OPEN:
+		MPRINT1("\tWorker received a new channel\n");
+		fr_assert(ch == t->channel);
+		break;
 
-						for (j = k = 0; j < reply->m.data_size; j++) {
-							k += reply->m.data[j];
-						}
+	case FR_CHANNEL_CLOSE:
+		MPRINT1("\tWorker requested to close the channel.\n");
+		fr_assert(ch == t->channel);
 
-						reply->m.data[4] = k;
-					}
+		/*
+		 *	Drain the input before we ACK the exit.
+		 */
+		while (fr_channel_recv_request(ch));
+		worker_reply(t);
+
+		(void) fr_channel_responder_ack_close(ch);
+		t->running = false;
+		break;
+
+	case FR_CHANNEL_DATA_READY_RESPONDER:
+		fr_assert(ch == t->channel);
+		while (fr_channel_recv_request(ch));
+		break;
+
+	case FR_CHANNEL_NOOP:
+	case FR_CHANNEL_EMPTY:
+		break;
+
+	default:
+		fprintf(stderr, "\tWorker got unexpected CE %d\n", ce);
+		fr_assert(0 == 1);
+		break;
+	}
+}
 
+static void *channel_worker(void *arg)
+{
+	test_thread_t		*t = arg;
+	int			rcode;
+	TALLOC_CTX		*ctx;
 
-					MPRINT1("\tWorker sending reply to messages %d\n", worker_messages);
-					rcode = fr_channel_send_reply(channel, reply, &cd);
-					if (rcode < 0) {
-						fprintf(stderr, "Failed sending reply: %s\n", fr_syserror(errno));
-					}
-					fr_assert(rcode == 0);
-				}
-				break;
+	MEM(ctx = talloc_init_const("channel_worker"));
+	test_thread_init(ctx, t);
 
-			case FR_CHANNEL_NOOP:
-				MPRINT1("\tWorker got NOOP\n");
-				fr_assert(new_channel == channel);
-				break;
+	t->ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
+	if (!t->ms) {
+		fprintf(stderr, "Failed creating message set\n");
+		fr_exit_now(EXIT_FAILURE);
+	}
+	MEM(t->pending = talloc_array(ctx, fr_channel_data_t *, max_outstanding));
 
-			default:
-				fprintf(stderr, "\tWorker got unexpected CE %d\n", ce);
+	MPRINT1("\tWorker started.\n");
 
-				/*
-				 *	Not written yet!
-				 */
-				fr_assert(0 == 1);
-				break;
-			} /* switch over signals */
+	t->running = true;
+	while (t->running) {
+		worker_reply(t);
 
-			/*
-			 *	Get a new idea of "now".
-			 */
-			now = fr_time();
-		} /* drain the control plane */
+		MPRINT1("\tWorker waiting on events.\n");
+		test_event_loop(t);
 	}
 
 	MPRINT1("\tWorker exiting.\n");
@@ -464,14 +468,14 @@ static void *channel_worker(void *arg)
 	 *	Force all messages to be garbage collected
 	 */
 	MPRINT2("Worker GC\n");
-	fr_message_set_gc(ms);
+	fr_message_set_gc(t->ms);
 
-	if (debug_lvl > 1) fr_message_set_debug(ms, stdout);
+	if (debug_lvl > 1) fr_message_set_debug(t->ms, stdout);
 
 	/*
 	 *	After the garbage collection, all messages marked "done" MUST also be marked "free".
 	 */
-	rcode = fr_message_set_messages_used(ms);
+	rcode = fr_message_set_messages_used(t->ms);
 	fr_cond_assert(rcode == 0);
 
 	talloc_free(ctx);
@@ -479,8 +483,6 @@ static void *channel_worker(void *arg)
 	return NULL;
 }
 
-
-
 int main(int argc, char *argv[])
 {
 	int			c;
@@ -488,10 +490,16 @@ int main(int argc, char *argv[])
 	TALLOC_CTX		*autofree = talloc_autofree_context();
 	pthread_attr_t		attr;
 	pthread_t		master_id, worker_id;
+	test_thread_t		master, worker;
+	fr_time_t		start;
+	struct rusage		ru_start, ru_stop;
+	int			huge_pages = FR_RING_BUFFER_HUGE_PAGES_NO;
+	int			tlb_fd = -1;
+	uint64_t		tlb_misses;
 
 	fr_time_start();
 
-	while ((c = getopt(argc, argv, "c:hm:o:tx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "c:hH:m:o:ptx")) != -1) switch (c) {
 		case 'x':
 			debug_lvl++;
 			break;
@@ -500,6 +508,11 @@ int main(int argc, char *argv[])
 			max_control_plane = atoi(optarg);
 			break;
 
+		case 'H':
+			huge_pages = fr_table_value_by_str(huge_pages_table, optarg, -1);
+			if (huge_pages < 0) usage();
+			break;
+
 		case 'm':
 			max_messages = atoi(optarg);
 			break;
@@ -508,6 +521,10 @@ int main(int argc, char *argv[])
 			max_outstanding = atoi(optarg);
 			break;
 
+		case 'p':
+			poll_control = false;
+			break;
+
 		case 't':
 			touch_memory = true;
 			break;
@@ -518,57 +535,85 @@ int main(int argc, char *argv[])
 	}
 
 	if (max_outstanding > max_messages) max_outstanding = max_messages;
+	if (max_outstanding < 1) usage();
 
 	if (!max_control_plane) {
 		max_control_plane = MAX_CONTROL_PLANE;
 		if (max_outstanding > max_control_plane) max_control_plane = max_outstanding;
 	}
 
-#if 0
-	argc -= (optind - 1);
-	argv += (optind - 1);
-#endif
+	if (fr_ring_buffer_huge_pages_set(huge_pages) < 0) {
+		fprintf(stderr, "channel_test: %s\n", fr_strerror());
+		fr_exit_now(EXIT_FAILURE);
+	}
 
-	kq_master = kqueue();
-	fr_assert(kq_master >= 0);
+	memset(&master, 0, sizeof(master));
+	memset(&worker, 0, sizeof(worker));
 
-	kq_worker = kqueue();
-	fr_assert(kq_worker >= 0);
+	master.name = "master";
+	master.callback = master_channel_callback;
+	worker.name = "worker";
+	worker.callback = worker_channel_callback;
 
-	aq_master = fr_atomic_queue_alloc(autofree, max_control_plane);
-	fr_assert(aq_master != NULL);
+	/*
+	 *	Start the two threads, and wait for them to create
+	 *	their control planes.
+	 */
+	(void) pthread_attr_init(&attr);
+	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+	(void) pthread_barrier_init(&barrier, NULL, 3);
 
-	aq_worker = fr_atomic_queue_alloc(autofree, max_control_plane);
-	fr_assert(aq_worker != NULL);
+	/*
+	 *	Both counters include the threads, and the message
+	 *	sets they create.
+	 */
+#ifdef __linux__
+	tlb_fd = tlb_miss_counter_open();
+#endif
+	getrusage(RUSAGE_SELF, &ru_start);
 
-	control_master = fr_control_create(autofree, kq_master, aq_master, 1024);
-	fr_assert(control_master != NULL);
+	start = fr_time();
+	(void) pthread_create(&worker_id, &attr, channel_worker, &worker);
+	(void) pthread_create(&master_id, &attr, channel_master, &master);
 
-	control_worker = fr_control_create(autofree, kq_worker, aq_worker, 1025);
-	fr_assert(control_worker != NULL);
+	pthread_barrier_wait(&barrier);
 
-	channel = fr_channel_create(autofree, control_master, control_worker, false);
+	channel = fr_channel_create(autofree, master.control, worker.control, false);
 	if (!channel) {
-		fprintf(stderr, "channel_test: Failed to create channel\n");
+		fprintf(stderr, "channel_test: Failed to create channel: %s\n", fr_strerror());
 		fr_exit_now(EXIT_FAILURE);
 	}
+	master.channel = worker.channel = channel;
 
-	/*
-	 *	Start the two threads, with the channel.
-	 */
-	(void) pthread_attr_init(&attr);
-	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+	fr_channel_set_recv_reply(channel, &master, master_recv_reply);
+	fr_channel_set_recv_request(channel, &worker, worker_recv_request);
 
-	(void) pthread_create(&master_id, &attr, channel_master, channel);
-	(void) pthread_create(&worker_id, &attr, channel_worker, channel);
+	pthread_barrier_wait(&barrier);
 
 	(void) pthread_join(master_id, NULL);
 	(void) pthread_join(worker_id, NULL);
+	(void) pthread_barrier_destroy(&barrier);
+
+	printf("%d messages in %.3fs, %d outstanding, %s\n", max_messages,
+	       fr_time_delta_unwrap(fr_time_sub(fr_time(), start)) / (double) NSEC, max_outstanding,
+	       poll_control ? "polling" : "not polling");
+
+	getrusage(RUSAGE_SELF, &ru_stop);
+	printf("ring buffers on %s pages, %ld minor faults, %ld major faults, ",
+	       huge_pages ? fr_table_str_by_value(huge_pages_table, huge_pages, "?") : "normal",
+	       ru_stop.ru_minflt - ru_start.ru_minflt, ru_stop.ru_majflt - ru_start.ru_majflt);
+	if ((tlb_fd >= 0) && (read(tlb_fd, &tlb_misses, sizeof(tlb_misses)) == sizeof(tlb_misses))) {
+		printf("%" PRIu64 " dTLB load misses\n", tlb_misses);
+	} else {
+		printf("dTLB misses not available\n");
+	}
 
-	close(kq_master);
-	close(kq_worker);
-
-	fr_channel_debug(channel, stdout);
+	/*
+	 *	Includes the number of times each end had to wake
+	 *	the other one up, per packet.
+	 */
+	fflush(stdout);
+	fr_channel_stats_log(channel, &default_log, __FILE__, __LINE__);
 
 	fr_exit_now(EXIT_SUCCESS);
 }
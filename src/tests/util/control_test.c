@@ -212,7 +212,7 @@ int main(int argc, char *argv[])
 		fr_exit_now(EXIT_FAILURE);
 	}
 
-	rb = fr_ring_buffer_create(autofree, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE);
+	rb = fr_ring_buffer_create(autofree, FR_CONTROL_MAX_MESSAGES * FR_CONTROL_MAX_SIZE, false);
 	if (!rb) fr_exit_now(EXIT_FAILURE);
 
 	/*
@@ -164,7 +164,7 @@ int main(int argc, char *argv[])
 	argv += (optind - 1);
 #endif
 
-	rb = fr_ring_buffer_create(autofree, ARRAY_SIZE * 1024);
+	rb = fr_ring_buffer_create(autofree, ARRAY_SIZE * 1024, false);
 	if (!rb) {
 		fprintf(stderr, "Failed creating ring buffer\n");
 		fr_exit_now(EXIT_FAILURE);
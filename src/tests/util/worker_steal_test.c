@@ -0,0 +1,433 @@
+/*
+ * worker_steal_test.c	Benchmark for workers taking requests from each other
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2024 Network RADIUS SAS
+ */
+
+/*
+ *	Runs real workers, and sends them requests over channels, the
+ *	same way the network thread does.  Most requests are fast.  A
+ *	few are slow, and are only sent to the first few workers, which
+ *	then block in a synchronous call, as they would in a slow
+ *	module.  The fast requests are sent to all of the workers.
+ *
+ *	The program is run once with each worker on its own, and once
+ *	with all of the workers in a work stealing group.  It prints
+ *	the latency of the requests for both runs.
+ *
+ *	The requests don't run any unlang.  The work is done when the
+ *	worker decodes the request, which then fails, and the worker
+ *	NAKs it.
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/control.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/worker.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dict_test.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/talloc.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define MAX_WORKERS	(64)
+
+typedef struct {
+	char			name[32];
+	pthread_t		pthread_id;
+	fr_worker_t		*worker;
+	fr_channel_t		*ch;		//!< Channel from us to the worker.
+} test_worker_t;
+
+typedef struct {
+	fr_time_t		sent;		//!< When the request was sent.
+	fr_time_delta_t		latency;	//!< Time from sending the request to its reply.
+	bool			slow;		//!< The worker blocks while it processes this request.
+} test_request_t;
+
+static int			num_workers = 4;
+static int			num_blocked = 2;
+static int			num_requests = 20000;
+static int			burst = 8;
+static int			slow_every = 100;
+static int			slow_usec = 2000;
+static int			fast_usec = 10;
+static int			interval_usec = 100;
+
+static fr_worker_group_t	*group;
+static pthread_barrier_t	barrier;
+static test_request_t		*requests;
+static int			num_replies, num_stolen, num_closed;
+
+/** Spin, like a request which is using CPU
+ *
+ */
+static void test_spin(fr_time_delta_t delay)
+{
+	fr_time_t end = fr_time_add(fr_time(), delay);
+
+	while (fr_time_lt(fr_time(), end));
+}
+
+/** Process a request in the worker
+ *
+ * Slow requests sleep, as a module does when it makes a synchronous
+ * call to a slow database.  The worker can't do anything else until
+ * the call returns.
+ */
+static int test_decode(UNUSED void const *instance, UNUSED request_t *request, uint8_t *const data, UNUSED size_t data_len)
+{
+	uint32_t number;
+
+	memcpy(&number, data, sizeof(number));
+
+	if (requests[number].slow) {
+		struct timespec ts = {
+			.tv_sec = slow_usec / 1000000,
+			.tv_nsec = (slow_usec % 1000000) * 1000
+		};
+
+		while ((nanosleep(&ts, &ts) < 0) && (errno == EINTR));
+	} else {
+		test_spin(fr_time_delta_from_usec(fast_usec));
+	}
+
+	return -1;
+}
+
+static size_t test_nak(UNUSED fr_listen_t *li, UNUSED void *packet_ctx, uint8_t *const packet,
+		       UNUSED size_t packet_len, uint8_t *reply, UNUSED size_t reply_len)
+{
+	memcpy(reply, packet, sizeof(uint32_t));
+
+	return sizeof(uint32_t);
+}
+
+static fr_app_t test_app = {
+	.common = {
+		.name = "worker_steal_test"
+	},
+	.decode = test_decode
+};
+
+static fr_app_io_t test_app_io = {
+	.common = {
+		.name = "worker_steal_test"
+	},
+	.default_message_size = 64,
+	.nak = test_nak
+};
+
+static fr_listen_t test_listen = {
+	.name = "worker_steal_test",
+	.app = &test_app,
+	.app_io = &test_app_io
+};
+
+static void *test_worker_thread(void *arg)
+{
+	test_worker_t		*tw = arg;
+	TALLOC_CTX		*ctx;
+	fr_event_list_t		*el;
+
+	MEM(ctx = talloc_init_const(tw->name));
+	MEM(el = fr_event_list_alloc(ctx, NULL, NULL));
+
+	tw->worker = fr_worker_create(ctx, el, tw->name, &default_log, fr_debug_lvl, NULL);
+	if (!tw->worker || (group && (fr_worker_group_join(group, tw->worker) < 0))) {
+		fr_perror("worker_steal_test");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Channels can only be opened once we're in the group.
+	 */
+	pthread_barrier_wait(&barrier);
+
+	fr_worker(tw->worker);
+	fr_worker_destroy(tw->worker);
+
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+static void test_recv_reply(UNUSED void *uctx, UNUSED fr_channel_t *ch, fr_channel_data_t *cd)
+{
+	uint32_t number;
+
+	memcpy(&number, cd->m.data, sizeof(number));
+	fr_assert(number < (uint32_t) num_requests);
+
+	requests[number].latency = fr_time_sub(fr_time(), requests[number].sent);
+	if (cd->reply.origin) num_stolen++;
+
+	num_replies++;
+	fr_message_done(&cd->m);
+}
+
+static void test_channel_callback(UNUSED void *ctx, void const *data, size_t data_size, fr_time_t now)
+{
+	fr_channel_t		*ch;
+
+	switch (fr_channel_service_message(now, &ch, data, data_size)) {
+	case FR_CHANNEL_DATA_READY_REQUESTOR:
+		while (fr_channel_recv_reply(ch));
+		break;
+
+	case FR_CHANNEL_CLOSE:
+		num_closed++;
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void test_event_service(fr_event_list_t *el)
+{
+	if (fr_event_corral(el, fr_time(), false) > 0) fr_event_service(el);
+}
+
+static void test_send(fr_event_list_t *el, fr_message_set_t *ms, test_worker_t *tw, uint32_t number)
+{
+	fr_channel_data_t *cd;
+
+	/*
+	 *	The message set is full of requests which the workers
+	 *	haven't replied to yet.
+	 */
+	while (!(cd = (fr_channel_data_t *) fr_message_alloc(ms, NULL, sizeof(number)))) test_event_service(el);
+
+	cd->m.when = fr_time();
+	cd->priority = PRIORITY_NORMAL;
+	cd->listen = &test_listen;
+	cd->packet_ctx = NULL;
+	cd->request.recv_time = cd->m.when;
+	cd->request.decoded_len = 0;
+	memcpy(cd->m.data, &number, sizeof(number));
+
+	requests[number].sent = cd->m.when;
+	if (fr_channel_send_request(tw->ch, cd) < 0) {
+		fr_perror("worker_steal_test: Failed sending request");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+static int test_latency_cmp(void const *one, void const *two)
+{
+	test_request_t const *a = one, *b = two;
+
+	return fr_time_delta_cmp(a->latency, b->latency);
+}
+
+static void test_run(TALLOC_CTX *ctx, bool steal)
+{
+	TALLOC_CTX		*run_ctx;
+	fr_event_list_t		*el;
+	fr_atomic_queue_t	*aq;
+	fr_control_t		*control;
+	fr_message_set_t	*ms;
+	test_worker_t		*tw;
+	fr_time_t		start, next;
+	fr_time_delta_t		total;
+	int			i, fast = 0, slow = 0;
+
+	MEM(run_ctx = talloc_init_const("worker_steal_test"));
+	MEM(el = fr_event_list_alloc(run_ctx, NULL, NULL));
+	MEM(aq = fr_atomic_queue_alloc(run_ctx, 1024));
+	MEM(control = fr_control_create(run_ctx, el, aq));
+	if (fr_control_callback_add(control, FR_CONTROL_ID_CHANNEL, NULL, test_channel_callback) < 0) {
+		fr_perror("worker_steal_test");
+		fr_exit_now(EXIT_FAILURE);
+	}
+	MEM(ms = fr_message_set_create(run_ctx, 1024, sizeof(fr_channel_data_t), 1024 * 64));
+
+	MEM(requests = talloc_zero_array(ctx, test_request_t, num_requests));
+	MEM(tw = talloc_zero_array(run_ctx, test_worker_t, num_workers));
+
+	group = NULL;
+	if (steal) MEM(group = fr_worker_group_alloc(run_ctx, num_workers));
+
+	num_replies = num_stolen = num_closed = 0;
+
+	pthread_barrier_init(&barrier, NULL, num_workers + 1);
+	for (i = 0; i < num_workers; i++) {
+		snprintf(tw[i].name, sizeof(tw[i].name), "worker %d", i);
+		if (pthread_create(&tw[i].pthread_id, NULL, test_worker_thread, &tw[i]) != 0) {
+			fprintf(stderr, "worker_steal_test: Failed creating thread: %s\n", fr_syserror(errno));
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+	pthread_barrier_wait(&barrier);
+
+	for (i = 0; i < num_workers; i++) {
+		MEM(tw[i].ch = fr_worker_channel_create(tw[i].worker, run_ctx, control));
+		fr_channel_set_recv_reply(tw[i].ch, NULL, test_recv_reply);
+	}
+
+	/*
+	 *	Send a burst of requests every interval.  The slow
+	 *	requests go round-robin to the workers which block,
+	 *	and the fast ones go round-robin to all of them.
+	 */
+	start = next = fr_time();
+	for (i = 0; i < num_requests; i++) {
+		test_worker_t *to;
+
+		if (((i % burst) == 0) && (i > 0)) {
+			next = fr_time_add(next, fr_time_delta_from_usec(interval_usec));
+			while (fr_time_lt(fr_time(), next)) test_event_service(el);
+		}
+
+		if ((slow_every > 0) && ((i % slow_every) == 0)) {
+			requests[i].slow = true;
+			to = &tw[slow++ % num_blocked];
+		} else {
+			to = &tw[fast++ % num_workers];
+		}
+
+		test_send(el, ms, to, i);
+	}
+
+	while (num_replies < num_requests) test_event_service(el);
+	total = fr_time_sub(fr_time(), start);
+
+	for (i = 0; i < num_workers; i++) (void) fr_channel_signal_responder_close(tw[i].ch);
+	while (num_closed < num_workers) test_event_service(el);
+
+	for (i = 0; i < num_workers; i++) pthread_join(tw[i].pthread_id, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	qsort(requests, num_requests, sizeof(requests[0]), test_latency_cmp);
+
+#define PCT(_x) (fr_time_delta_unwrap(requests[(size_t) (((num_requests - 1) * (_x)) / 100)].latency) / 1000.0)
+	printf("%-12s total %8.3fs  p50 %10.1fus  p99 %10.1fus  p99.9 %10.1fus  max %10.1fus  stolen %d\n",
+	       steal ? "stealing" : "no stealing", fr_time_delta_unwrap(total) / (double) NSEC,
+	       PCT(50), PCT(99), PCT(99.9), fr_time_delta_unwrap(requests[num_requests - 1].latency) / 1000.0,
+	       num_stolen);
+
+	talloc_free(requests);
+	requests = NULL;
+	talloc_free(run_ctx);
+}
+
+static NEVER_RETURNS void usage(void)
+{
+	fprintf(stderr, "usage: worker_steal_test [OPTS]\n");
+	fprintf(stderr, "  -b <workers>           Number of workers which get slow requests.\n");
+	fprintf(stderr, "  -B <requests>          Number of requests sent at once.\n");
+	fprintf(stderr, "  -f <usec>              CPU time used by fast requests.\n");
+	fprintf(stderr, "  -i <usec>              Interval between bursts of requests.\n");
+	fprintf(stderr, "  -n <requests>          Number of requests to send.\n");
+	fprintf(stderr, "  -s <n>                 Every n'th request is slow.\n");
+	fprintf(stderr, "  -S <usec>              Time slow requests block the worker for.\n");
+	fprintf(stderr, "  -w <workers>           Number of workers.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	fr_exit_now(EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	TALLOC_CTX		*autofree = talloc_autofree_context();
+	fr_dict_t		*dict;
+
+	while ((c = getopt(argc, argv, "b:B:f:hi:n:s:S:w:x")) != -1) switch (c) {
+		case 'b':
+			num_blocked = atoi(optarg);
+			break;
+
+		case 'B':
+			burst = atoi(optarg);
+			break;
+
+		case 'f':
+			fast_usec = atoi(optarg);
+			break;
+
+		case 'i':
+			interval_usec = atoi(optarg);
+			break;
+
+		case 'n':
+			num_requests = atoi(optarg);
+			break;
+
+		case 's':
+			slow_every = atoi(optarg);
+			break;
+
+		case 'S':
+			slow_usec = atoi(optarg);
+			break;
+
+		case 'w':
+			num_workers = atoi(optarg);
+			break;
+
+		case 'x':
+			fr_debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if ((num_workers < 1) || (num_workers > MAX_WORKERS)) {
+		fprintf(stderr, "Number of workers must be between 1 and %d\n", MAX_WORKERS);
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if ((num_blocked < 1) || (num_blocked > num_workers)) {
+		fprintf(stderr, "Number of workers which get slow requests must be between 1 and %d\n", num_workers);
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if ((num_requests < 1) || (burst < 1)) usage();
+
+	fr_time_start();
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if ((fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) ||
+	    (fr_dict_test_init(autofree, &dict, NULL) < 0) ||
+	    (request_global_init() < 0) ||
+	    (unlang_global_init() < 0)) {
+		fr_perror("worker_steal_test");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	test_run(autofree, false);
+	test_run(autofree, true);
+
+	return 0;
+}
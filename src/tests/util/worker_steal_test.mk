@@ -0,0 +1,6 @@
+TARGET 		:= worker_steal_test$(E)
+
+SOURCES		:= worker_steal_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io$(L)
+TGT_LDLIBS	:= $(LIBS)